@@ -0,0 +1,168 @@
+/*******************************************************************************
+ * Class: Clock
+ * Filename: clock.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Injectable wall and monotonic clocks.  See clock.h.
+ ******************************************************************************/
+
+#include "clock.h"
+
+#include <stdlib.h>
+
+Clock * Clock::m_pClock = NULL;
+
+/******************************************************************************
+ *   CLOCK
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Instance
+ * Description: The clock everything reads time from.  The system clock is
+ * a local static so it exists even for timestamps made during static
+ * initialization.
+ ******************************************************************************/
+Clock * Clock::Instance() {
+    static SystemClock systemClock;
+    Clock *clock = __atomic_load_n(&m_pClock, __ATOMIC_ACQUIRE);
+    return clock ? clock : &systemClock;
+}
+
+/******************************************************************************
+ * Method: SetClock
+ * Description: Replace the clock, NULL for the system clock.
+ ******************************************************************************/
+void Clock::SetClock(Clock *clock) {
+    __atomic_store_n(&m_pClock, clock, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ * Method: NowUsec
+ * Description: Microseconds since the epoch.
+ ******************************************************************************/
+uint64_t Clock::NowUsec() {
+    struct timeval tv;
+    Now(tv);
+    return (uint64_t)tv.tv_sec * CLOCK_USEC_PER_SEC + tv.tv_usec;
+}
+
+/******************************************************************************
+ * Method: NowSeconds
+ * Description: Seconds since the epoch, what time(NULL) returns.
+ ******************************************************************************/
+time_t Clock::NowSeconds() {
+    struct timeval tv;
+    Now(tv);
+    return tv.tv_sec;
+}
+
+/******************************************************************************
+ * Method: MonotonicSeconds
+ * Description: Whole seconds of the monotonic clock.
+ ******************************************************************************/
+time_t Clock::MonotonicSeconds() {
+    return MonotonicUsec() / CLOCK_USEC_PER_SEC;
+}
+
+/******************************************************************************
+ *   SYSTEM CLOCK
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: now
+ * Description: gettimeofday
+ ******************************************************************************/
+void SystemClock::now(struct timeval &tv) {
+    gettimeofday(&tv, NULL);
+}
+
+/******************************************************************************
+ * Method: monotonicUsec
+ * Description: CLOCK_MONOTONIC
+ ******************************************************************************/
+uint64_t SystemClock::monotonicUsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * CLOCK_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/******************************************************************************
+ *   VIRTUAL CLOCK
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Start at the current time of day so dates in file names look
+ * normal.
+ ******************************************************************************/
+VirtualClock::VirtualClock() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    m_iNow = (uint64_t)tv.tv_sec * CLOCK_USEC_PER_SEC + tv.tv_usec;
+    m_iMonotonic = m_iNow;
+}
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Start at a fixed time.
+ ******************************************************************************/
+VirtualClock::VirtualClock(time_t seconds, uint32_t usec) {
+    m_iNow = (uint64_t)seconds * CLOCK_USEC_PER_SEC + usec;
+    m_iMonotonic = m_iNow;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Don't leave everything reading a clock that is gone.
+ ******************************************************************************/
+VirtualClock::~VirtualClock() {
+    Clock *self = this;
+    __atomic_compare_exchange_n(&m_pClock, &self, (Clock *)NULL, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/******************************************************************************
+ * Method: now
+ * Description: The simulated time.
+ ******************************************************************************/
+void VirtualClock::now(struct timeval &tv) {
+    uint64_t now = usec();
+
+    tv.tv_sec = now / CLOCK_USEC_PER_SEC;
+    tv.tv_usec = now % CLOCK_USEC_PER_SEC;
+}
+
+/******************************************************************************
+ * Method: monotonicUsec
+ * Description: The simulated monotonic time, only moved by advance.
+ ******************************************************************************/
+uint64_t VirtualClock::monotonicUsec() {
+    return __atomic_load_n(&m_iMonotonic, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+ * Method: set
+ * Description: Jump the wall clock to a time, forwards or backwards.
+ * Deadlines don't notice.
+ ******************************************************************************/
+void VirtualClock::set(uint64_t usec) {
+    __atomic_store_n(&m_iNow, usec, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+ * Method: advance
+ * Description: Move the clock forward.
+ ******************************************************************************/
+void VirtualClock::advance(uint64_t usec) {
+    __atomic_fetch_add(&m_iNow, usec, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&m_iMonotonic, usec, __ATOMIC_SEQ_CST);
+}
+
+/******************************************************************************
+ * Method: usec
+ * Description: Simulated microseconds since the epoch.
+ ******************************************************************************/
+uint64_t VirtualClock::usec() {
+    return __atomic_load_n(&m_iNow, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ * Class: Clock
+ * Filename: clock.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Source of time for the port agent.  Normally this is the system clock.
+ * Tests can install a VirtualClock and move time forward by hand, so hours
+ * of heartbeats, file rotation or reconnect backoff run in milliseconds
+ * without sleeping.
+ *
+ * There are two readings.  The wall clock is for timestamps and log
+ * rotation, things that mean a time of day.  The monotonic clock is for
+ * every deadline and interval.  It never jumps, so an NTP step or an
+ * operator setting the date can't fire or stall a timer.
+ *
+ * Only time that is read goes through the clock.  select and poll still
+ * wait in real time, so a test using a VirtualClock calls the timer and
+ * rotation code directly after advancing the clock rather than waiting for
+ * the main loop.
+ *
+ * Usage:
+ *
+ * // Read the time
+ * uint64_t now = Clock::NowUsec();
+ * time_t seconds = Clock::NowSeconds();
+ *
+ * // Time a deadline
+ * uint64_t due = Clock::MonotonicUsec() + 100000;
+ *
+ * // Simulate time in a test
+ * VirtualClock clock;
+ * Clock::SetClock(&clock);
+ *
+ * clock.advance(3600 * CLOCK_USEC_PER_SEC);
+ * ... check what should have happened in the last hour
+ *
+ * Clock::SetClock(NULL);
+ *
+ ******************************************************************************/
+
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CLOCK_USEC_PER_SEC 1000000ULL
+
+class Clock {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        virtual ~Clock() {}
+
+        // Current wall clock time
+        virtual void now(struct timeval &tv) = 0;
+
+        // Microseconds since an arbitrary start, never goes backwards
+        virtual uint64_t monotonicUsec() = 0;
+
+        // The clock in use, the system clock unless one was set
+        static Clock * Instance();
+
+        // Use another clock.  NULL goes back to the system clock.  The caller
+        // keeps ownership.
+        static void SetClock(Clock *clock);
+
+        // Shortcuts reading the clock in use
+        static void Now(struct timeval &tv) { Instance()->now(tv); }
+        static uint64_t NowUsec();
+        static time_t NowSeconds();
+        static uint64_t MonotonicUsec() { return Instance()->monotonicUsec(); }
+        static time_t MonotonicSeconds();
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    protected:
+        static Clock *m_pClock;
+};
+
+/* The real time of day and CLOCK_MONOTONIC */
+class SystemClock : public Clock {
+    public:
+        virtual void now(struct timeval &tv);
+        virtual uint64_t monotonicUsec();
+};
+
+/* Time that only moves when told to.  The monotonic reading starts at the
+ * wall time.  advance moves both, set only moves the wall clock, like the
+ * system time being stepped. */
+class VirtualClock : public Clock {
+    public:
+        // Start at the current system time
+        VirtualClock();
+
+        // Start at a given time since the epoch
+        VirtualClock(time_t seconds, uint32_t usec = 0);
+
+        // Puts the system clock back if this one is in use
+        virtual ~VirtualClock();
+
+        virtual void now(struct timeval &tv);
+        virtual uint64_t monotonicUsec();
+
+        // Jump to an absolute time in microseconds since the epoch
+        void set(uint64_t usec);
+
+        // Move forward
+        void advance(uint64_t usec);
+
+        uint64_t usec();
+
+    private:
+        // Read and written with atomics so threads started by the code under
+        // test can read the clock while the test advances it
+        uint64_t m_iNow;
+        uint64_t m_iMonotonic;
+};
+
+#endif //__CLOCK_H_
@@ -5,11 +5,18 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <spawn.h>
 #include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 
 #include <iostream>
 #include <sstream>
@@ -43,9 +50,63 @@ void DaemonProcess::init_pidfile() {
 
 void DaemonProcess::initialize() {}
 
+// Signals are read from a signalfd so the main loop can block on it instead
+// of waking up to look at trapped_signal.  The handlers are left in place in
+// case we can't get one.
 void DaemonProcess::init_signal_trap() {
+    sigset_t mask;
+    
     signal(SIGINT, DaemonProcess::signal_callback_handler);
     signal(SIGTERM, DaemonProcess::signal_callback_handler);
+    
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    
+    signal_watch_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    
+    // 0 means not in use, move it if stdin was closed
+    if(signal_watch_fd == 0) {
+        signal_watch_fd = fcntl(0, F_DUPFD_CLOEXEC, 1);
+        close(0);
+    }
+    
+    if(signal_watch_fd < 0) {
+        LOG(ERROR) << "signalfd failed, using signal handlers: " << strerror(errno);
+        signal_watch_fd = 0;
+        return;
+    }
+    
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+}
+
+// Get told when the parent dies instead of checking on it.  A pidfd works
+// for any process, PR_SET_PDEATHSIG only when it really is our parent.  If
+// neither works stop_process falls back to kill(ppid, 0).
+void DaemonProcess::init_parent_watch() {
+    if(! ppid())
+        return;
+    
+#ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, ppid(), 0);
+    if(fd > 0) {
+        LOG(INFO) << "watching parent " << ppid() << " with pidfd";
+        parent_watch_fd = fd;
+        return;
+    }
+#endif
+    
+    if(getppid() == (pid_t)ppid() && prctl(PR_SET_PDEATHSIG, SIGTERM) == 0) {
+        LOG(INFO) << "watching parent " << ppid() << " with death signal";
+        parent_deathsig = true;
+        
+        // It may have gone before we asked
+        if(getppid() != (pid_t)ppid())
+            trapped_signal = SIGTERM;
+        return;
+    }
+    
+    LOG(INFO) << "polling parent " << ppid();
 }
 
 void DaemonProcess::signal_callback_handler(int signum) {
@@ -106,6 +167,12 @@ bool DaemonProcess::daemonize() {
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
     
+    // Keep stdio pointing somewhere so the descriptors we open later don't
+    // land on 0, which we use to mean not open.
+    open("/dev/null", O_RDWR);
+    dup(STDIN_FILENO);
+    dup(STDIN_FILENO);
+    
     run();
     return true;
 }
@@ -117,6 +184,7 @@ bool DaemonProcess::run() {
         init_logfile();
         
         initialize();
+        init_parent_watch();
         execution_loop();
     }
     
@@ -160,6 +228,15 @@ void DaemonProcess::daemon_sleep() {
 
 
 bool DaemonProcess::stop_process() {
+    struct signalfd_siginfo info;
+    
+    if(signal_watch_fd) {
+        while(read(signal_watch_fd, &info, sizeof(info)) == sizeof(info)) {
+            LOG(DEBUG) << "SIGNAL: " << info.ssi_signo;
+            trapped_signal = info.ssi_signo;
+        }
+    }
+    
     // have we been interupted?  Then stop
     if(trapped_signal) {
         LOG(DEBUG) << "Signal detected.  Shutdown.";
@@ -167,7 +244,17 @@ bool DaemonProcess::stop_process() {
     }
     
     // check for a parent if needed
-    if(ppid()) {
+    if(parent_watch_fd) {
+        struct pollfd pfd;
+        pfd.fd = parent_watch_fd;
+        pfd.events = POLLIN;
+        
+        if(::poll(&pfd, 1, 0) > 0) {
+            LOG(DEBUG) << "Parent process (" << ppid() << ") terminated.  Shutdown.";
+            return true;
+        }
+    }
+    else if(ppid()) {
         int running = kill(ppid(), 0);
         if(running < 0) {
             LOG(DEBUG) << "Parent process (" << ppid() << ") terminated (code: " << running << ").  Shutdown.";
@@ -32,7 +32,8 @@ using namespace std;
 
 class DaemonProcess {
     public:
-        DaemonProcess() : server_pid(0) {}
+        DaemonProcess() : server_pid(0), signal_watch_fd(0), parent_watch_fd(0),
+                          parent_deathsig(false) {}
         unsigned int pid();
         
         bool start();
@@ -49,6 +50,7 @@ class DaemonProcess {
         void init_logfile();
         void init_pidfile();
         void init_signal_trap();
+        void init_parent_watch();
         
         virtual const string pid_file() = 0;
         
@@ -73,12 +75,23 @@ class DaemonProcess {
         virtual bool no_daemon();
         virtual uint32_t ppid();
         
+        // Descriptors that become readable when we should check
+        // stop_process, 0 if not in use.  If parent_polled() is true the
+        // parent can only be checked by waking up periodically.
+        int signal_fd() { return signal_watch_fd; }
+        int parent_fd() { return parent_watch_fd; }
+        bool parent_polled() { return ppid() && ! parent_watch_fd && ! parent_deathsig; }
+        
     private:
         int read_pidfile();
         
         unsigned server_pid;
         static unsigned int trapped_signal;
         
+        int signal_watch_fd;
+        int parent_watch_fd;
+        bool parent_deathsig;
+        
 };
 
 #endif //DAEMON_PROCESS_H
@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * Class: DeflateStream
+ * Filename: deflate_stream.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * One zlib deflate stream.  See deflate_stream.h.
+ ******************************************************************************/
+
+#include "deflate_stream.h"
+#include "logger.h"
+#include "exception.h"
+
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+using namespace logger;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Start a zlib format stream at the given level.
+ *
+ * Exceptions:
+ *   CompressionFailure
+ ******************************************************************************/
+DeflateStream::DeflateStream(int level) {
+    int result;
+
+    memset(&m_oStream, 0, sizeof(m_oStream));
+    m_bPending = false;
+    m_iBytesIn = 0;
+    m_iBytesOut = 0;
+    m_iFlushes = 0;
+    m_iCpuNsec = 0;
+
+    if((result = deflateInit(&m_oStream, level)) != Z_OK) {
+        LOG(ERROR) << "deflateInit failed: " << result;
+        throw CompressionFailure(zError(result));
+    }
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Free the zlib state.  Anything not flushed is dropped.
+ ******************************************************************************/
+DeflateStream::~DeflateStream() {
+    deflateEnd(&m_oStream);
+}
+
+/******************************************************************************
+ * Method: write
+ * Description: Compress a buffer.  zlib holds on to input until it has
+ * enough to emit a block, so out may not grow at all.
+ *
+ * Parameters:
+ *   buffer - data to compress
+ *   size - bytes in buffer
+ *   out - compressed output is appended here
+ ******************************************************************************/
+void DeflateStream::write(const char *buffer, uint32_t size, string &out) {
+    if(! size)
+        return;
+
+    m_oStream.next_in = (Bytef *)buffer;
+    m_oStream.avail_in = size;
+    m_iBytesIn += size;
+    m_bPending = true;
+
+    deflateTo(Z_NO_FLUSH, out);
+}
+
+/******************************************************************************
+ * Method: flush
+ * Description: Sync flush so the client can inflate everything written.
+ *
+ * Parameters:
+ *   out - compressed output is appended here
+ ******************************************************************************/
+void DeflateStream::flush(string &out) {
+    if(! m_bPending)
+        return;
+
+    m_oStream.next_in = NULL;
+    m_oStream.avail_in = 0;
+
+    deflateTo(Z_SYNC_FLUSH, out);
+    m_bPending = false;
+    m_iFlushes++;
+}
+
+/******************************************************************************
+ * Method: finish
+ * Description: Write the end of the stream.  Nothing more can be written.
+ *
+ * Parameters:
+ *   out - compressed output is appended here
+ ******************************************************************************/
+void DeflateStream::finish(string &out) {
+    m_oStream.next_in = NULL;
+    m_oStream.avail_in = 0;
+
+    deflateTo(Z_FINISH, out);
+    m_bPending = false;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: deflateTo
+ * Description: Run deflate until the input is used up and, for a flush,
+ * all of the output has been produced.
+ *
+ * Exceptions:
+ *   CompressionFailure
+ ******************************************************************************/
+void DeflateStream::deflateTo(int mode, string &out) {
+    struct timespec start, end;
+    char chunk[DEFLATE_CHUNK_SIZE];
+    int result;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    do {
+        m_oStream.next_out = (Bytef *)chunk;
+        m_oStream.avail_out = sizeof(chunk);
+
+        result = deflate(&m_oStream, mode);
+        if(result == Z_STREAM_ERROR) {
+            LOG(ERROR) << "deflate failed: " << result;
+            throw CompressionFailure(zError(result));
+        }
+
+        out.append(chunk, sizeof(chunk) - m_oStream.avail_out);
+        m_iBytesOut += sizeof(chunk) - m_oStream.avail_out;
+    } while(m_oStream.avail_out == 0);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    m_iCpuNsec += (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Class: DeflateStream
+ * Filename: deflate_stream.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * One zlib deflate stream, used to compress the data going to a single
+ * client.  Output isn't flushed on every write so small packets compress
+ * against each other.  The owner decides when the client needs what it has
+ * so far and asks for a sync flush, which ends on a byte boundary so the
+ * client can inflate everything written up to that point.
+ *
+ * Bytes in and out and the CPU time spent compressing are counted so the
+ * cost can be reported.
+ *
+ * Usage:
+ *
+ * DeflateStream stream(6);
+ * string out;
+ *
+ * stream.write(buffer, size, out);
+ * stream.flush(out);
+ * ... send out to the client
+ *
+ * LOG(INFO) << "ratio: " << stream.ratio();
+ *
+ ******************************************************************************/
+
+#ifndef __DEFLATE_STREAM_H_
+#define __DEFLATE_STREAM_H_
+
+#include <zlib.h>
+#include <stdint.h>
+
+#include <string>
+
+using namespace std;
+
+// Output buffer grown for each deflate call
+#define DEFLATE_CHUNK_SIZE 4096
+
+class DeflateStream {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+
+        // level is the zlib compression level, 1 (fast) to 9 (small)
+        DeflateStream(int level = Z_DEFAULT_COMPRESSION);
+        virtual ~DeflateStream();
+
+        // Compress a buffer, appending whatever output is ready to out
+        void write(const char *buffer, uint32_t size, string &out);
+
+        // Sync flush everything written so far
+        void flush(string &out);
+
+        // End the stream.  A client that sees the end of a stream starts
+        // inflating a new one, as after a live upgrade.
+        void finish(string &out);
+
+        // Has anything been written since the last flush?
+        bool pending() { return m_bPending; }
+
+        /* Statistics */
+        uint64_t bytesIn() { return m_iBytesIn; }
+        uint64_t bytesOut() { return m_iBytesOut; }
+        uint64_t flushes() { return m_iFlushes; }
+        uint64_t cpuUsec() { return m_iCpuNsec / 1000; }
+
+        // Bytes in for every byte out, 0 before any output
+        double ratio() { return m_iBytesOut ? (double)m_iBytesIn / m_iBytesOut : 0; }
+
+    private:
+        DeflateStream(const DeflateStream &rhs);
+        DeflateStream & operator=(const DeflateStream &rhs);
+
+        void deflateTo(int mode, string &out);
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        z_stream m_oStream;
+        bool m_bPending;
+
+        uint64_t m_iBytesIn;
+        uint64_t m_iBytesOut;
+        uint64_t m_iFlushes;
+        uint64_t m_iCpuNsec;
+};
+
+#endif //__DEFLATE_STREAM_H_
@@ -251,5 +251,13 @@ class DeviceOpenFailure : public OOIException {
         OOIException("Failed to open device path. ", 904, msg) {}
 };
 
+/*******************************************************************************
+ * Compression Exceptions
+ ******************************************************************************/
+class CompressionFailure : public OOIException {
+    public: CompressionFailure(const string & msg = "") :
+        OOIException("Compression failed:", 1001, msg) {}
+};
+
 
 #endif //EXCEPTION_H_
@@ -0,0 +1,875 @@
+/*******************************************************************************
+ * Class: IORing
+ * Filename: io_ring.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Optional io_uring I/O backend.  See io_ring.h.
+ ******************************************************************************/
+
+#include "io_ring.h"
+#include "thread_tuning.h"
+#include "logger.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sstream>
+
+using namespace std;
+using namespace logger;
+
+// user_data of the requests we don't track per write
+#define IO_RING_RECV_TAG   1
+#define IO_RING_WAKE_TAG   2
+#define IO_RING_CANCEL_TAG 3
+
+// user_data of a batch entry left unused once its fd's chain broke
+#define IO_RING_SKIP_TAG   ((uint64_t)-1)
+
+bool IORing::m_bEnabled = false;
+bool IORing::m_bLockMemory = false;
+
+__thread IORingBatch *IORingBatch::m_pCurrent = NULL;
+IORing *IORingBatch::m_pRing = NULL;
+vector<bool> IORingBatch::m_oSlots;
+uint32_t IORingBatch::m_iSubmitCount = 0;
+
+static bool s_bMultishotUnsupported = false;
+
+/******************************************************************************
+ * Method: ringEnter
+ * Description: io_uring_enter, retried when interrupted.
+ ******************************************************************************/
+static int ringEnter(int fd, uint32_t submit, uint32_t waitFor) {
+    int result;
+
+    do {
+        result = syscall(__NR_io_uring_enter, fd, submit, waitFor,
+                         waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while(result < 0 && errno == EINTR);
+
+    return result;
+}
+
+/******************************************************************************
+ *   IORing PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor.  The ring isn't created until setup.
+ ******************************************************************************/
+IORing::IORing() : m_oBufferCharge(MEMORY_CONNECTION) {
+    m_iRingFD = 0;
+    m_pSQRing = NULL;
+    m_pCQRing = NULL;
+    m_iSQRingSize = 0;
+    m_iCQRingSize = 0;
+    m_pSQEs = NULL;
+    m_iSQEsSize = 0;
+    m_pSQHead = m_pSQTail = m_pSQArray = NULL;
+    m_iSQMask = m_iSQEntries = m_iSQLocalTail = m_iSQSubmitted = 0;
+    m_pCQHead = m_pCQTail = NULL;
+    m_iCQMask = 0;
+    m_pCQEs = NULL;
+    m_pBufferRing = NULL;
+    m_pBuffers = NULL;
+    m_iBufferCount = m_iBufferSize = 0;
+    m_iBufferTail = 0;
+    m_bBuffersLocked = false;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ ******************************************************************************/
+IORing::~IORing() {
+    teardown();
+}
+
+/******************************************************************************
+ * Method: supported
+ * Description: Can we create a ring?  Checked once.
+ ******************************************************************************/
+bool IORing::supported() {
+    static int supported = -1;
+
+    if(supported < 0) {
+        IORing probe;
+        supported = probe.setup(2);
+
+        if(! supported)
+            LOG(INFO) << "io_uring not available, using select and read/write";
+    }
+
+    return supported;
+}
+
+/******************************************************************************
+ * Method: setup
+ * Description: Create the ring and map the queues.
+ *
+ * Parameters:
+ *   entries - submission queue size
+ *   cqEntries - completion queue size, 0 for the kernel default
+ * Return:
+ *   true if the ring is ready
+ ******************************************************************************/
+bool IORing::setup(uint32_t entries, uint32_t cqEntries) {
+    struct io_uring_params params;
+    char *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    if(cqEntries) {
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+    }
+
+    m_iRingFD = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_iRingFD < 0) {
+        LOG(DEBUG) << "io_uring_setup failed: " << strerror(errno);
+        m_iRingFD = 0;
+        return false;
+    }
+
+    m_iSQRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_iCQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(m_iCQRingSize > m_iSQRingSize)
+            m_iSQRingSize = m_iCQRingSize;
+        m_iCQRingSize = 0;
+    }
+
+    m_pSQRing = mmap(NULL, m_iSQRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_iRingFD, IORING_OFF_SQ_RING);
+    if(m_pSQRing == MAP_FAILED) {
+        m_pSQRing = NULL;
+        teardown();
+        return false;
+    }
+
+    if(m_iCQRingSize) {
+        m_pCQRing = mmap(NULL, m_iCQRingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_iRingFD, IORING_OFF_CQ_RING);
+        if(m_pCQRing == MAP_FAILED) {
+            m_pCQRing = NULL;
+            teardown();
+            return false;
+        }
+    }
+
+    m_iSQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_pSQEs = (struct io_uring_sqe *)mmap(NULL, m_iSQEsSize, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, m_iRingFD, IORING_OFF_SQES);
+    if(m_pSQEs == MAP_FAILED) {
+        m_pSQEs = NULL;
+        teardown();
+        return false;
+    }
+
+    sq = (char *)m_pSQRing;
+    cq = m_pCQRing ? (char *)m_pCQRing : sq;
+
+    m_pSQHead = (uint32_t *)(sq + params.sq_off.head);
+    m_pSQTail = (uint32_t *)(sq + params.sq_off.tail);
+    m_pSQArray = (uint32_t *)(sq + params.sq_off.array);
+    m_iSQMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    m_iSQEntries = params.sq_entries;
+    m_iSQLocalTail = m_iSQSubmitted = *m_pSQTail;
+
+    m_pCQHead = (uint32_t *)(cq + params.cq_off.head);
+    m_pCQTail = (uint32_t *)(cq + params.cq_off.tail);
+    m_iCQMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+    m_pCQEs = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    LOG(DEBUG) << "io_uring ready, fd: " << m_iRingFD << " sq: " << params.sq_entries
+               << " cq: " << params.cq_entries;
+    return true;
+}
+
+/******************************************************************************
+ * Method: getSQE
+ * Description: Claim the next submission entry.
+ ******************************************************************************/
+struct io_uring_sqe * IORing::getSQE() {
+    uint32_t head = __atomic_load_n(m_pSQHead, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    uint32_t index;
+
+    if(! m_iRingFD || m_iSQLocalTail - head >= m_iSQEntries)
+        return NULL;
+
+    index = m_iSQLocalTail & m_iSQMask;
+    sqe = &m_pSQEs[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_pSQArray[index] = index;
+    m_iSQLocalTail++;
+
+    return sqe;
+}
+
+/******************************************************************************
+ * Method: submit
+ * Description: Hand queued entries to the kernel.
+ *
+ * Return:
+ *   entries submitted, or -errno
+ ******************************************************************************/
+int IORing::submit(uint32_t waitFor) {
+    int result;
+
+    __atomic_store_n(m_pSQTail, m_iSQLocalTail, __ATOMIC_RELEASE);
+
+    result = ringEnter(m_iRingFD, m_iSQLocalTail - m_iSQSubmitted, waitFor);
+    if(result < 0) {
+        LOG(ERROR) << "io_uring_enter failed: " << strerror(errno);
+        return -errno;
+    }
+
+    m_iSQSubmitted += result;
+    return result;
+}
+
+/******************************************************************************
+ * Method: peekCQE
+ * Description: Take the next completion if there is one.
+ ******************************************************************************/
+bool IORing::peekCQE(struct io_uring_cqe &cqe) {
+    uint32_t head = *m_pCQHead;
+
+    if(! m_iRingFD || head == __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE))
+        return false;
+
+    cqe = m_pCQEs[head & m_iCQMask];
+    __atomic_store_n(m_pCQHead, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: waitCQE
+ * Description: Take the next completion, waiting for one if needed.
+ ******************************************************************************/
+bool IORing::waitCQE(struct io_uring_cqe &cqe) {
+    while(! peekCQE(cqe)) {
+        if(ringEnter(m_iRingFD, 0, 1) < 0) {
+            LOG(ERROR) << "io_uring wait failed: " << strerror(errno);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: registerBufferRing
+ * Description: Give the kernel a ring of buffers to receive into so a
+ * multishot receive doesn't need a buffer per request.
+ *
+ * Parameters:
+ *   group - buffer group id the receives select from
+ *   count - number of buffers, a power of 2
+ *   size - bytes in each buffer
+ ******************************************************************************/
+bool IORing::registerBufferRing(uint16_t group, uint32_t count, uint32_t size) {
+    struct io_uring_buf_reg reg;
+    size_t ringSize = count * sizeof(struct io_uring_buf);
+
+    m_pBufferRing = (struct io_uring_buf_ring *)mmap(NULL, ringSize, PROT_READ | PROT_WRITE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m_pBufferRing == MAP_FAILED) {
+        m_pBufferRing = NULL;
+        return false;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_pBufferRing;
+    reg.ring_entries = count;
+    reg.bgid = group;
+
+    if(syscall(__NR_io_uring_register, m_iRingFD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG(DEBUG) << "provided buffer ring not supported: " << strerror(errno);
+        munmap(m_pBufferRing, ringSize);
+        m_pBufferRing = NULL;
+        return false;
+    }
+
+    m_iBufferCount = count;
+    m_iBufferSize = size;
+    m_iBufferTail = 0;
+    m_pBuffers = new char[count * size];
+    m_oBufferCharge.set(count * size);
+
+    // The kernel writes straight into these, keep them resident
+    if(m_bLockMemory) {
+        memset(m_pBuffers, 0, count * size);
+        m_bBuffersLocked = ThreadTuning::Lock(m_pBuffers, count * size) &&
+                           ThreadTuning::Lock(m_pBufferRing, ringSize);
+    }
+
+    for(uint32_t i = 0; i < count; i++)
+        recycleBuffer(i);
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: recycleBuffer
+ * Description: Give a buffer back to the kernel once we've copied it out.
+ ******************************************************************************/
+void IORing::recycleBuffer(uint16_t id) {
+    // Index the ring as a plain array, the header's bufs member lands at the
+    // wrong offset when compiled as C++
+    struct io_uring_buf *buf = (struct io_uring_buf *)m_pBufferRing +
+                               (m_iBufferTail & (m_iBufferCount - 1));
+
+    buf->addr = (uint64_t)(uintptr_t)buffer(id);
+    buf->len = m_iBufferSize;
+    buf->bid = id;
+
+    m_iBufferTail++;
+    __atomic_store_n(&m_pBufferRing->tail, m_iBufferTail, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ * Method: registerFiles
+ * Description: Create an empty table of registered files.
+ ******************************************************************************/
+bool IORing::registerFiles(uint32_t count) {
+    vector<int> fds(count, -1);
+
+    if(syscall(__NR_io_uring_register, m_iRingFD, IORING_REGISTER_FILES, &fds[0], count) < 0) {
+        LOG(DEBUG) << "registered files not supported: " << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: updateFile
+ * Description: Put a file in a registered slot, -1 to empty it.
+ ******************************************************************************/
+bool IORing::updateFile(uint32_t slot, int fd) {
+    struct io_uring_files_update update;
+
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+
+    if(syscall(__NR_io_uring_register, m_iRingFD, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+        LOG(ERROR) << "registered file update failed: " << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ *   IORing PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: teardown
+ * Description: Unmap the queues and close the ring.  Provided buffers are
+ * freed after the ring is gone so the kernel can't write into them.
+ ******************************************************************************/
+void IORing::teardown() {
+    if(m_pSQEs)
+        munmap(m_pSQEs, m_iSQEsSize);
+    if(m_pCQRing)
+        munmap(m_pCQRing, m_iCQRingSize);
+    if(m_pSQRing)
+        munmap(m_pSQRing, m_iSQRingSize);
+    if(m_iRingFD)
+        close(m_iRingFD);
+
+    if(m_pBufferRing)
+        munmap(m_pBufferRing, m_iBufferCount * sizeof(struct io_uring_buf));
+    if(m_pBuffers && m_bBuffersLocked)
+        ThreadTuning::Unlock(m_pBuffers, m_iBufferCount * m_iBufferSize);
+    if(m_pBuffers)
+        delete [] m_pBuffers;
+    m_oBufferCharge.set(0);
+
+    m_pSQEs = NULL;
+    m_pCQRing = NULL;
+    m_pSQRing = NULL;
+    m_iRingFD = 0;
+    m_pBufferRing = NULL;
+    m_pBuffers = NULL;
+    m_bBuffersLocked = false;
+}
+
+/******************************************************************************
+ *   IORingReader PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: create
+ * Description: Set up a multishot receive on a connected socket.
+ *
+ * Return:
+ *   a new reader, NULL if we should read the socket directly
+ ******************************************************************************/
+IORingReader * IORingReader::create(int socket) {
+    IORingReader *reader;
+
+    if(socket <= 0 || ! IORing::enabled() || s_bMultishotUnsupported)
+        return NULL;
+
+    reader = new IORingReader(socket);
+
+    if(! reader->m_oRing.setup(IO_RING_READER_ENTRIES, IO_RING_READER_CQ_ENTRIES) ||
+       ! reader->m_oRing.registerBufferRing(IO_RING_READ_GROUP, IO_RING_READ_BUFFERS,
+                                            IO_RING_READ_BUFFER_SIZE) ||
+       ! reader->arm()) {
+        LOG(INFO) << "io_uring receive not available for fd: " << socket;
+        delete reader;
+        return NULL;
+    }
+
+    LOG(DEBUG) << "io_uring receive on fd: " << socket << " ring fd: " << reader->fd();
+    return reader;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: The socket is left open.
+ ******************************************************************************/
+IORingReader::~IORingReader() {
+    cancel();
+}
+
+/******************************************************************************
+ * Method: read
+ * Description: Collect completed receives and copy out up to size bytes.
+ * Whatever doesn't fit is held for the next read and we post a no-op so the
+ * ring fd stays readable until it's gone.
+ ******************************************************************************/
+uint32_t IORingReader::read(char *buffer, uint32_t size) {
+    uint32_t count;
+
+    reap();
+
+    if(! m_bArmed && ! m_bCancelled && ! m_bClosed && ! m_iError)
+        arm();
+
+    count = m_sPending.length() < size ? m_sPending.length() : size;
+    if(count) {
+        memcpy(buffer, m_sPending.data(), count);
+        m_sPending.erase(0, count);
+        m_oPendingCharge.set(m_sPending.length());
+    }
+
+    if(m_sPending.length())
+        wake();
+
+    return count;
+}
+
+/******************************************************************************
+ * Method: cancel
+ * Description: Cancel the receive and wait for it to end so nothing lands in
+ * our buffers after they are freed or after the socket is handed to another
+ * process.
+ ******************************************************************************/
+void IORingReader::cancel() {
+    struct io_uring_sqe *sqe;
+
+    m_bCancelled = true;
+
+    if(! m_bArmed || ! (sqe = m_oRing.getSQE()))
+        return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = IO_RING_RECV_TAG;
+    sqe->user_data = IO_RING_CANCEL_TAG;
+
+    if(m_oRing.submit(0) < 0)
+        return;
+
+    while(m_bArmed) {
+        if(ringEnter(m_oRing.fd(), 0, 1) < 0)
+            break;
+        reap();
+    }
+}
+
+/******************************************************************************
+ *   IORingReader PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ ******************************************************************************/
+IORingReader::IORingReader(int socket) : m_oPendingCharge(MEMORY_CONNECTION) {
+    m_iSocket = socket;
+    m_bArmed = false;
+    m_bCancelled = false;
+    m_bClosed = false;
+    m_iError = 0;
+}
+
+/******************************************************************************
+ * Method: arm
+ * Description: Start a multishot receive selecting from our buffer ring.
+ ******************************************************************************/
+bool IORingReader::arm() {
+    struct io_uring_sqe *sqe = m_oRing.getSQE();
+
+    if(! sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = m_iSocket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_RING_READ_GROUP;
+    sqe->user_data = IO_RING_RECV_TAG;
+
+    if(m_oRing.submit(0) != 1)
+        return false;
+
+    m_bArmed = true;
+    return true;
+}
+
+/******************************************************************************
+ * Method: reap
+ * Description: Move completed receives into the pending buffer and hand
+ * their buffers back.
+ ******************************************************************************/
+void IORingReader::reap() {
+    struct io_uring_cqe cqe;
+
+    while(m_oRing.peekCQE(cqe)) {
+        if(cqe.user_data != IO_RING_RECV_TAG)
+            continue;
+
+        if(cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+            uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            m_sPending.append(m_oRing.buffer(id), cqe.res);
+            m_oPendingCharge.set(m_sPending.length());
+            m_oRing.recycleBuffer(id);
+        }
+        else if(cqe.res == 0) {
+            m_bClosed = true;
+        }
+        else if(cqe.res == -EINVAL && m_sPending.empty()) {
+            // Kernel has buffer rings but not multishot receive
+            LOG(INFO) << "multishot receive not supported";
+            s_bMultishotUnsupported = true;
+            m_iError = EINVAL;
+        }
+        else if(cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            m_iError = -cqe.res;
+        }
+
+        // Ran out of buffers, the completion queue overflowed or cancelled
+        if(! (cqe.flags & IORING_CQE_F_MORE))
+            m_bArmed = false;
+    }
+}
+
+/******************************************************************************
+ * Method: wake
+ * Description: Post a no-op so the ring fd selects readable.
+ ******************************************************************************/
+void IORingReader::wake() {
+    struct io_uring_sqe *sqe = m_oRing.getSQE();
+
+    if(! sqe)
+        return;
+
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = IO_RING_WAKE_TAG;
+    m_oRing.submit(0);
+}
+
+/******************************************************************************
+ *   IORingBatch PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Open a batch.  Nested batches are inactive, the outer one
+ * submits everything.
+ ******************************************************************************/
+IORingBatch::IORingBatch() {
+    m_bActive = false;
+
+    if(m_pCurrent || ! IORing::enabled() || ! ring())
+        return;
+
+    m_bActive = true;
+    m_pCurrent = this;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Anything not flushed goes out now.  Errors can't be reported
+ * from here so they are only logged.
+ ******************************************************************************/
+IORingBatch::~IORingBatch() {
+    string error;
+
+    if(! m_bActive)
+        return;
+
+    error = flush();
+    if(error.length())
+        LOG(ERROR) << "batched write failed: " << error;
+
+    m_pCurrent = NULL;
+}
+
+/******************************************************************************
+ * Method: registerFile
+ * Description: Register a file with the shared write ring.
+ *
+ * Return:
+ *   the registered slot, -1 if it couldn't be registered
+ ******************************************************************************/
+int IORingBatch::registerFile(int fd) {
+    if(! IORing::enabled() || ! ring() || m_oSlots.empty())
+        return -1;
+
+    for(uint32_t i = 0; i < m_oSlots.size(); i++) {
+        if(! m_oSlots[i] && m_pRing->updateFile(i, fd)) {
+            m_oSlots[i] = true;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Method: unregisterFile
+ * Description: Free a registered slot.
+ ******************************************************************************/
+void IORingBatch::unregisterFile(int slot) {
+    if(slot < 0 || ! m_pRing || slot >= (int)m_oSlots.size())
+        return;
+
+    m_pRing->updateFile(slot, -1);
+    m_oSlots[slot] = false;
+}
+
+/******************************************************************************
+ * Method: write
+ * Description: Queue a write.  The data is copied since the caller's buffer
+ * is usually gone by the time we submit.
+ ******************************************************************************/
+void IORingBatch::write(int fd, const char *buffer, uint32_t size, int slot,
+                        IORingWriter *writer) {
+    Write write;
+
+    write.fd = fd;
+    write.slot = slot;
+    write.writer = writer;
+    write.data.assign(buffer, size);
+    write.result = 0;
+    write.done = false;
+
+    m_oWrites.push_back(write);
+}
+
+/******************************************************************************
+ * Method: flush
+ * Description: Submit the queued writes, grouped by fd with each group linked
+ * so it completes in order, and wait for all of them.
+ *
+ * Once a write in a group doesn't finish nothing after it is written, or
+ * the fd would see its data out of order.  A write with a writer is handed
+ * back to it, short, blocked or cancelled, so a non-blocking socket can
+ * queue the rest.  Other writes are finished with plain writes, in order,
+ * unless an earlier one in the group failed.
+ *
+ * Return:
+ *   error text, empty if everything was written or handed back
+ ******************************************************************************/
+string IORingBatch::flush() {
+    map<int, vector<uint32_t> > groups;
+    vector<int> order;
+    struct io_uring_sqe *sqe;
+    uint32_t inflight = 0;
+    string error;
+
+    if(! m_bActive || m_oWrites.empty())
+        return error;
+
+    for(uint32_t i = 0; i < m_oWrites.size(); i++) {
+        if(groups.find(m_oWrites[i].fd) == groups.end())
+            order.push_back(m_oWrites[i].fd);
+        groups[m_oWrites[i].fd].push_back(i);
+    }
+
+    for(uint32_t g = 0; g < order.size(); g++) {
+        vector<uint32_t> &group = groups[order[g]];
+
+        for(uint32_t i = 0; i < group.size(); i++) {
+            Write &write = m_oWrites[group[i]];
+
+            // Full, finish what we have.  A chain split here still runs in
+            // order since the first part completes first.
+            if(! (sqe = m_pRing->getSQE())) {
+                m_iSubmitCount++;
+                m_pRing->submit(inflight);
+                reap(inflight);
+                sqe = m_pRing->getSQE();
+            }
+
+            // The first part didn't finish, so the rest stays unwritten
+            if(i && m_oWrites[group[i - 1]].done &&
+               m_oWrites[group[i - 1]].result != (int)m_oWrites[group[i - 1]].data.length()) {
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = IO_RING_SKIP_TAG;
+                inflight++;
+                break;
+            }
+
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)write.data.data();
+            sqe->len = write.data.length();
+            sqe->off = (uint64_t)-1;
+            sqe->user_data = group[i];
+
+            if(write.slot >= 0) {
+                sqe->fd = write.slot;
+                sqe->flags |= IOSQE_FIXED_FILE;
+            }
+            else {
+                sqe->fd = write.fd;
+            }
+
+            if(i + 1 < group.size())
+                sqe->flags |= IOSQE_IO_LINK;
+
+            inflight++;
+        }
+    }
+
+    m_iSubmitCount++;
+    m_pRing->submit(inflight);
+    reap(inflight);
+
+    for(uint32_t g = 0; g < order.size(); g++) {
+        vector<uint32_t> &group = groups[order[g]];
+        bool stopped = false;
+
+        for(uint32_t i = 0; i < group.size(); i++) {
+            Write &write = m_oWrites[group[i]];
+            uint32_t length = write.data.length();
+            uint32_t written = write.result > 0 ? write.result : 0;
+            int failure = 0;
+
+            if(stopped)
+                failure = ECANCELED;
+            else if(write.result < 0)
+                failure = -write.result;
+            else if(written < length)
+                failure = EAGAIN;
+
+            if(failure && failure != EAGAIN && failure != EWOULDBLOCK && failure != ECANCELED) {
+                ostringstream out;
+                out << "fd " << write.fd << ": " << strerror(failure) << endl;
+                error += out.str();
+                stopped = true;
+            }
+
+            if(write.writer) {
+                write.writer->batchWritten(write.data.data(), length, written, failure);
+                if(failure)
+                    stopped = true;
+                continue;
+            }
+
+            if(! failure || stopped)
+                continue;
+
+            if(! writeDirect(write.fd, write.data.data() + written, length - written, error))
+                stopped = true;
+        }
+    }
+
+    m_oWrites.clear();
+    return error;
+}
+
+/******************************************************************************
+ *   IORingBatch PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: ring
+ * Description: The shared write ring, created on first use.
+ ******************************************************************************/
+IORing * IORingBatch::ring() {
+    if(! m_pRing) {
+        m_pRing = new IORing();
+
+        if(! m_pRing->setup(IO_RING_BATCH_ENTRIES)) {
+            delete m_pRing;
+            m_pRing = NULL;
+            return NULL;
+        }
+
+        if(m_pRing->registerFiles(IO_RING_FILE_SLOTS))
+            m_oSlots.assign(IO_RING_FILE_SLOTS, false);
+    }
+
+    return m_pRing;
+}
+
+/******************************************************************************
+ * Method: reap
+ * Description: Collect the results of the writes in flight.
+ ******************************************************************************/
+void IORingBatch::reap(uint32_t &inflight) {
+    struct io_uring_cqe cqe;
+
+    for(; inflight; inflight--) {
+        if(! m_pRing->waitCQE(cqe))
+            break;
+
+        if(cqe.user_data == IO_RING_SKIP_TAG)
+            continue;
+
+        m_oWrites[cqe.user_data].result = cqe.res;
+        m_oWrites[cqe.user_data].done = true;
+    }
+}
+
+/******************************************************************************
+ * Method: writeDirect
+ * Description: Plain blocking write for whatever the ring didn't finish.
+ ******************************************************************************/
+bool IORingBatch::writeDirect(int fd, const char *buffer, uint32_t size, string &error) {
+    uint32_t written = 0;
+    int count;
+
+    while(written < size) {
+        count = ::write(fd, buffer + written, size - written);
+
+        if(count < 0 && errno == EINTR)
+            continue;
+
+        if(count < 0) {
+            ostringstream out;
+            out << "fd " << fd << ": " << strerror(errno) << endl;
+            error += out.str();
+            return false;
+        }
+
+        written += count;
+    }
+
+    return true;
+}
@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * Class: IORing
+ * Filename: io_ring.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Optional io_uring I/O backend.  Talks to the kernel with the raw syscalls
+ * so we don't need liburing.  Three pieces:
+ *
+ * IORing        - one ring: submission and completion queues, provided
+ *                 buffer rings and registered files.
+ * IORingReader  - a socket read with a multishot receive into a provided
+ *                 buffer ring.  The ring fd is readable when data is
+ *                 waiting so it can stand in for the socket in a select.
+ * IORingBatch   - collects the writes for one packet fan-out (publisher
+ *                 sockets and archive appends) and submits them with one
+ *                 system call.  Writes to the same fd are linked so they
+ *                 complete in order.  A socket writer is told what its
+ *                 socket didn't take rather than the batch blocking on it.
+ *
+ * The backend is off unless enabled with IORing::setEnabled and falls back
+ * to plain reads and writes when the kernel doesn't support it.  With
+ * IORing::setLockMemory the receive buffers of rings set up afterwards are
+ * locked in memory.
+ *
+ * Usage:
+ *
+ * IORing::setEnabled(true);
+ *
+ * // Reads
+ * IORingReader *reader = IORingReader::create(socketFD);
+ * if(reader) select on reader->fd() and call reader->read(buffer, size)
+ *
+ * // Writes
+ * {
+ *     IORingBatch batch;
+ *     ...  writers call IORingBatch::current()->write(fd, buffer, size)
+ *     ...  or, for a non-blocking socket, pass an IORingWriter that queues
+ *     ...  whatever batchWritten says didn't go out
+ *     string error = batch.flush();
+ * }
+ *
+ ******************************************************************************/
+
+#ifndef __IO_RING_H_
+#define __IO_RING_H_
+
+#include "memory_budget.h"
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Submission queue size of the shared write ring
+#define IO_RING_BATCH_ENTRIES 64
+
+// Registered file slots in the shared write ring
+#define IO_RING_FILE_SLOTS 64
+
+// Submission and completion queue sizes of a reader ring
+#define IO_RING_READER_ENTRIES 4
+#define IO_RING_READER_CQ_ENTRIES 128
+
+// Provided buffers for each reader, count must be a power of 2
+#define IO_RING_READ_BUFFERS 64
+#define IO_RING_READ_BUFFER_SIZE 4096
+
+// Provided buffer group used by readers
+#define IO_RING_READ_GROUP 1
+
+class IORing {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        IORing();
+        virtual ~IORing();
+
+        // Is the backend turned on and does the kernel support it?
+        static bool enabled() { return m_bEnabled && supported(); }
+        static void setEnabled(bool enabled) { m_bEnabled = enabled; }
+        static bool supported();
+        static void setLockMemory(bool lock) { m_bLockMemory = lock; }
+
+        bool setup(uint32_t entries, uint32_t cqEntries = 0);
+        int fd() { return m_iRingFD; }
+
+        /* Submission */
+
+        // Next free submission entry, cleared.  NULL if the queue is full.
+        struct io_uring_sqe * getSQE();
+
+        // Submit what's queued and wait for waitFor completions
+        int submit(uint32_t waitFor = 0);
+
+        /* Completion */
+        bool peekCQE(struct io_uring_cqe &cqe);
+        bool waitCQE(struct io_uring_cqe &cqe);
+
+        /* Provided buffers */
+        bool registerBufferRing(uint16_t group, uint32_t count, uint32_t size);
+        char * buffer(uint16_t id) { return m_pBuffers + (uint32_t)id * m_iBufferSize; }
+        void recycleBuffer(uint16_t id);
+
+        /* Registered files */
+        bool registerFiles(uint32_t count);
+        bool updateFile(uint32_t slot, int fd);
+
+    private:
+        void teardown();
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        static bool m_bEnabled;
+        static bool m_bLockMemory;
+
+        int m_iRingFD;
+
+        void *m_pSQRing;
+        void *m_pCQRing;
+        size_t m_iSQRingSize;
+        size_t m_iCQRingSize;
+        struct io_uring_sqe *m_pSQEs;
+        size_t m_iSQEsSize;
+
+        uint32_t *m_pSQHead;
+        uint32_t *m_pSQTail;
+        uint32_t *m_pSQArray;
+        uint32_t m_iSQMask;
+        uint32_t m_iSQEntries;
+        uint32_t m_iSQLocalTail;
+        uint32_t m_iSQSubmitted;
+
+        uint32_t *m_pCQHead;
+        uint32_t *m_pCQTail;
+        uint32_t m_iCQMask;
+        struct io_uring_cqe *m_pCQEs;
+
+        struct io_uring_buf_ring *m_pBufferRing;
+        char *m_pBuffers;
+        uint32_t m_iBufferCount;
+        uint32_t m_iBufferSize;
+        uint16_t m_iBufferTail;
+        bool m_bBuffersLocked;
+        MemoryCharge m_oBufferCharge;
+};
+
+class IORingReader {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+
+        // A reader for a connected socket, NULL if the backend is off or the
+        // kernel can't do multishot receives.
+        static IORingReader * create(int socket);
+        virtual ~IORingReader();
+
+        // Select on this instead of the socket
+        int fd() { return m_oRing.fd(); }
+
+        // Copy out received data.  Returns bytes read, 0 if nothing is
+        // waiting.  closed() is set when the peer shuts down and error()
+        // when the receive failed.
+        uint32_t read(char *buffer, uint32_t size);
+        bool closed() { return m_bClosed; }
+        int error() { return m_iError; }
+
+        // Stop receiving and wait for the receive to end.  Data already
+        // received is still returned by read.
+        void cancel();
+        bool cancelled() { return m_bCancelled; }
+        bool pending() { return m_sPending.length() > 0; }
+
+    private:
+        IORingReader(int socket);
+        bool arm();
+        void wake();
+        void reap();
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        IORing m_oRing;
+        int m_iSocket;
+        bool m_bArmed;
+        bool m_bCancelled;
+        bool m_bClosed;
+        int m_iError;
+
+        // Received but not yet read by the caller
+        string m_sPending;
+        MemoryCharge m_oPendingCharge;
+};
+
+class IORingWriter {
+    public:
+        virtual ~IORingWriter() {}
+
+        // How a batched write went.  written bytes went out, the writer
+        // finishes the rest.  error is 0, EAGAIN if the socket was full,
+        // ECANCELED if an earlier write to the fd didn't finish, or what
+        // the write failed with.
+        virtual void batchWritten(const char *buffer, uint32_t size, uint32_t written, int error) = 0;
+};
+
+class IORingBatch {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+
+        // Starts a batch if the backend is enabled and no batch is open
+        IORingBatch();
+        virtual ~IORingBatch();
+
+        // The open batch, NULL if writes should go straight out
+        static IORingBatch * current() { return m_pCurrent; }
+
+        // Files written often, like the archive, are registered with the
+        // ring so each append doesn't have to look the fd up.
+        static int registerFile(int fd);
+        static void unregisterFile(int slot);
+
+        // Queue a copy of the buffer.  slot is a registered file slot or -1.
+        // A writer is told how the write went instead of the batch finishing
+        // it with a blocking write.
+        void write(int fd, const char *buffer, uint32_t size, int slot = -1,
+                   IORingWriter *writer = NULL);
+
+        // Submit and wait for all queued writes
+        string flush();
+
+        // System calls made by flush, for benchmarking
+        static uint32_t submitCount() { return m_iSubmitCount; }
+
+    private:
+        static IORing * ring();
+        bool writeDirect(int fd, const char *buffer, uint32_t size, string &error);
+        void reap(uint32_t &inflight);
+
+        struct Write {
+            int fd;
+            int slot;
+            IORingWriter *writer;
+            string data;
+            int result;
+            bool done;
+        };
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        // Per thread, publisher threads write straight through
+        static __thread IORingBatch *m_pCurrent;
+        static IORing *m_pRing;
+        static vector<bool> m_oSlots;
+        static uint32_t m_iSubmitCount;
+
+        bool m_bActive;
+        vector<Write> m_oWrites;
+};
+
+#endif //__IO_RING_H_
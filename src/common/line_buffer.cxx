@@ -0,0 +1,91 @@
+/*******************************************************************************
+ * Class: LineBuffer
+ * Filename: line_buffer.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Reassemble lines from a stream.  See line_buffer.h.
+ ******************************************************************************/
+
+#include "line_buffer.h"
+#include "logger.h"
+
+#include <string.h>
+
+using namespace std;
+using namespace logger;
+
+/******************************************************************************
+ * Method: Constructor
+ *
+ * Parameters:
+ *   maxLine - longest partial line we'll hold
+ ******************************************************************************/
+LineBuffer::LineBuffer(uint32_t maxLine) {
+    m_iMaxLine = maxLine;
+    m_bDiscarding = false;
+}
+
+/******************************************************************************
+ * Method: append
+ * Description: Hold bytes until their lines are taken.  If we are dropping
+ * an over long line everything up to its newline goes too.
+ *
+ * Return:
+ *   false if the partial line passed the limit and was dropped.  The rest
+ *   of that line is dropped quietly as it arrives.
+ ******************************************************************************/
+bool LineBuffer::append(const char *buffer, uint32_t size) {
+    string::size_type last;
+    uint32_t partial;
+
+    if(m_bDiscarding) {
+        const char *newline = (const char *)memchr(buffer, '\n', size);
+        if(! newline)
+            return true;
+
+        m_bDiscarding = false;
+        size -= newline + 1 - buffer;
+        buffer = newline + 1;
+    }
+
+    m_sBuffer.append(buffer, size);
+
+    last = m_sBuffer.rfind('\n');
+    partial = last == string::npos ? m_sBuffer.length() : m_sBuffer.length() - last - 1;
+
+    if(partial > m_iMaxLine) {
+        LOG(ERROR) << "line longer than " << m_iMaxLine << " bytes dropped";
+        m_sBuffer.erase(m_sBuffer.length() - partial);
+        m_bDiscarding = true;
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: nextLine
+ * Description: Take the oldest whole line.
+ *
+ * Parameters:
+ *   line - set to the line without \n or \r\n
+ ******************************************************************************/
+bool LineBuffer::nextLine(string &line) {
+    string::size_type end = m_sBuffer.find('\n');
+
+    if(end == string::npos)
+        return false;
+
+    line.assign(m_sBuffer, 0, end > 0 && m_sBuffer[end - 1] == '\r' ? end - 1 : end);
+    m_sBuffer.erase(0, end + 1);
+    return true;
+}
+
+/******************************************************************************
+ * Method: clear
+ ******************************************************************************/
+void LineBuffer::clear() {
+    m_sBuffer.clear();
+    m_bDiscarding = false;
+}
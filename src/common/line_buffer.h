@@ -0,0 +1,77 @@
+/*******************************************************************************
+ * Class: LineBuffer
+ * Filename: line_buffer.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Split a byte stream into lines.  A TCP read can end anywhere, in the middle
+ * of a line or after several, so bytes are held until their newline arrives
+ * and only whole lines are handed out.  Line ends are stripped, \r\n works
+ * as well as \n.
+ *
+ * A partial line is held up to a maximum length.  A line that grows past it
+ * is dropped, along with the rest of it up to the next newline, so a client
+ * that never sends one can't make us buffer without limit.
+ *
+ * Usage:
+ *
+ * LineBuffer lines(1024);
+ *
+ * // after every read
+ * if(! lines.append(buffer, bytesRead))
+ *     ... a line was too long and has been dropped
+ *
+ * while(lines.nextLine(line))
+ *     ... handle line
+ *
+ ******************************************************************************/
+
+#ifndef __LINE_BUFFER_H_
+#define __LINE_BUFFER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+using namespace std;
+
+// Longest partial line held when no limit is given
+#define LINE_BUFFER_MAX_LINE 65536
+
+class LineBuffer {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        LineBuffer(uint32_t maxLine = LINE_BUFFER_MAX_LINE);
+
+        // Add bytes read from the stream.  False if they made a partial line
+        // longer than the limit and it was dropped.
+        bool append(const char *buffer, uint32_t size);
+
+        // Take the next whole line without its line end, false if there
+        // isn't one yet
+        bool nextLine(string &line);
+
+        // Bytes held, whole lines not yet taken and the partial line
+        uint32_t pending() { return m_sBuffer.length(); }
+
+        // Forget everything held, e.g. when the stream is reconnected
+        void clear();
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        string m_sBuffer;
+        uint32_t m_iMaxLine;
+
+        // Dropping the rest of an over long line
+        bool m_bDiscarding;
+};
+
+#endif //__LINE_BUFFER_H_
@@ -42,6 +42,9 @@
 #include "util.h"
 #include "logger.h"
 #include "exception.h"
+#include "io_ring.h"
+#include "clock.h"
+#include "probe.h"
 
 #include <iostream>
 #include <sstream>
@@ -54,6 +57,8 @@
 
 
 #include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace logger;
@@ -64,6 +69,8 @@ using namespace logger;
  ******************************************************************************/
 LogFile::LogFile() {
 	m_pOutStream = NULL;
+	m_iAppendFD = 0;
+	m_iAppendSlot = -1;
 	m_eRotationType = DAILY;
 }
 
@@ -73,6 +80,8 @@ LogFile::LogFile() {
  ******************************************************************************/
 LogFile::LogFile(string filename) {
 	m_pOutStream = NULL;
+	m_iAppendFD = 0;
+	m_iAppendSlot = -1;
 	setFile(filename);
 }
 
@@ -82,6 +91,8 @@ LogFile::LogFile(string filename) {
  ******************************************************************************/
 LogFile::LogFile(string filebase, string extention, RotationType type) {
 	m_pOutStream = NULL;
+	m_iAppendFD = 0;
+	m_iAppendSlot = -1;
 	setBase(filebase, extention);
     setRotation(type);
 }
@@ -93,6 +104,8 @@ LogFile::LogFile(string filebase, string extention, RotationType type) {
  ******************************************************************************/
 LogFile::LogFile(const LogFile & rhs) {
 	m_pOutStream = NULL;
+	m_iAppendFD = 0;
+	m_iAppendSlot = -1;
 	copy(rhs);
 }
 
@@ -102,6 +115,7 @@ LogFile::LogFile(const LogFile & rhs) {
  * lazily open.
  ******************************************************************************/
 LogFile& LogFile::operator=(const LogFile & rhs) {
+	closeAppend();
 	copy(rhs);
 	return *this;
 }
@@ -153,6 +167,53 @@ void LogFile::close()
     	delete m_pOutStream;
     	m_pOutStream = NULL;
     }
+
+    closeAppend();
+}
+
+/******************************************************************************
+ * Method: closeAppend
+ * Description: Close the append descriptor and free its registered slot.
+ ******************************************************************************/
+void LogFile::closeAppend()
+{
+    if(m_iAppendFD) {
+        IORingBatch::unregisterFile(m_iAppendSlot);
+        ::close(m_iAppendFD);
+    }
+
+    m_iAppendFD = 0;
+    m_iAppendSlot = -1;
+    m_sAppendFile = "";
+}
+
+/******************************************************************************
+ * Method: appendFD
+ * Description: Descriptor for appends submitted through io_uring.  Reopened
+ * when the file rolls or is removed, same as the stream, and registered with
+ * the ring so appends skip the fd lookup.
+ *
+ * Return:
+ *   the open descriptor, 0 if it couldn't be opened
+ ******************************************************************************/
+int LogFile::appendFD()
+{
+    string file = getFilename();
+
+    if(m_iAppendFD && (file != m_sAppendFile || ! file_exists(file.c_str())))
+        closeAppend();
+
+    if(! m_iAppendFD && file.length()) {
+        int fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if(fd <= 0)
+            return 0;
+
+        m_iAppendFD = fd;
+        m_iAppendSlot = IORingBatch::registerFile(fd);
+        m_sAppendFile = file;
+    }
+
+    return m_iAppendFD;
 }
 
 /******************************************************************************
@@ -209,8 +270,7 @@ string LogFile::getFilename() {
 string LogFile::fileDate()
 {
     char buffer[11];
-    time_t t;
-    time(&t);
+    time_t t = Clock::NowSeconds();
     tm r = {0};
     strftime(buffer, sizeof(buffer), "%Y%m%d", localtime_r(&t, &r));
     return buffer;
@@ -226,9 +286,9 @@ string LogFile::fileDate()
 string LogFile::fileTime()
 {
     char buffer[7];
-	time_t ts;
-    time (&ts);
-    struct tm * timeinfo = localtime(&ts);
+	time_t ts = Clock::NowSeconds();
+	tm r = {0};
+    struct tm * timeinfo = localtime_r(&ts, &r);
   
 	int hour = timeinfo->tm_hour;
 	int min = timeinfo->tm_min;
@@ -275,6 +335,7 @@ ofstream * LogFile::getStreamObject() {
 
     // If we don't have an output stream create one.
     if(!m_pOutStream) {
+    	PROBE1(log__open, file.c_str());
     	m_pOutStream = new ofstream(file.c_str(), ios::out | ios::app);
 
     	if(!m_pOutStream || m_pOutStream->fail())
@@ -294,6 +355,7 @@ ofstream * LogFile::getStreamObject() {
     // We can fall into this if the logfile was closed above OR this is
 	// our first call to this method.
 	if(!m_pOutStream || !m_pOutStream->good() ) {
+    	PROBE1(log__open, file.c_str());
     	m_pOutStream = new ofstream(file.c_str(), ios::out | ios::app);
 	    
 	    if(m_pOutStream->fail())
@@ -344,6 +406,14 @@ void LogFile::setRotation(RotationType type) {
  *   size - how big the buffer is
  ******************************************************************************/
 bool LogFile::write(const char *buffer, uint16_t size) {
+    PROBE1(log__write, size);
+    
+    // Appended with the rest of the packet fan-out
+    if(IORingBatch::current() && appendFD()) {
+        IORingBatch::current()->write(m_iAppendFD, buffer, size, m_iAppendSlot);
+        return true;
+    }
+
     ofstream *out = getStreamObject();
     
 	out->write(buffer, size);
@@ -132,6 +132,10 @@ namespace logger {
 		private:
 			void copy(const LogFile & rhs);
 
+			// O_APPEND descriptor used for writes batched through io_uring
+			int appendFD();
+			void closeAppend();
+
 			/******************
 			 * Public Members *
 			 *****************/
@@ -142,6 +146,10 @@ namespace logger {
 
 		    ofstream * m_pOutStream;
 
+		    int m_iAppendFD;
+		    int m_iAppendSlot;
+		    string m_sAppendFile;
+
 			RotationType m_eRotationType;
 		    string m_sFileName;
 		    string m_sFileBase;
@@ -48,6 +48,7 @@
  ******************************************************************************/
 
 #include "logger.h"
+#include "clock.h"
 #include "util.h"
 #include "exception.h"
 
@@ -58,6 +59,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/time.h>
 
@@ -67,6 +69,9 @@ using namespace logger;
 // Global static pointer used to ensure a single instance of the class.
 Logger* Logger::m_pInstance = NULL;
 
+// Publisher threads log too, one message goes out at a time.
+static pthread_mutex_t s_oWriteLock = PTHREAD_MUTEX_INITIALIZER;
+
 /******************************************************************************
  *   PUBLIC METHODS
  ******************************************************************************/
@@ -146,6 +151,24 @@ string Logger::getLogFilename() {
  * Description: Write a log message to the log file
  ******************************************************************************/
 void Logger::WriteLog(string message, TLogLevel level, string file, int line) {
+    pthread_mutex_lock(&s_oWriteLock);
+
+    try {
+        WriteLocked(message, level, file, line);
+    }
+    catch(...) {
+        pthread_mutex_unlock(&s_oWriteLock);
+        throw;
+    }
+
+    pthread_mutex_unlock(&s_oWriteLock);
+}
+
+/******************************************************************************
+ * Method: WriteLocked
+ * Description: Write a log message with the write lock held
+ ******************************************************************************/
+void Logger::WriteLocked(const string &message, TLogLevel level, const string &file, int line) {
     Logger* instance = Logger::Instance();
     
     instance->clearError();
@@ -361,12 +384,11 @@ ostringstream& Logger::get(TLogLevel level, const string &file, int line)
 string Logger::nowTime()
 {
     char buffer[32];
-    time_t t;
-    time(&t);
+    struct timeval tv;
+    Clock::Now(tv);
+    time_t t = tv.tv_sec;
     tm r = {0};
     strftime(buffer, sizeof(buffer), "%Y-%b-%d %X", localtime_r(&t, &r));
-    struct timeval tv;
-    gettimeofday(&tv, 0);
     char result[100] = {0};
     sprintf(result, "%s.%03ld", buffer, (long)tv.tv_usec / 1000); 
     return result;
@@ -381,8 +403,7 @@ string Logger::nowTime()
 int Logger::fileDate()
 {
     char buffer[11];
-    time_t t;
-    time(&t);
+    time_t t = Clock::NowSeconds();
     tm r = {0};
     strftime(buffer, sizeof(buffer), "%Y%m%d", localtime_r(&t, &r));
     return atoi(buffer);
@@ -191,6 +191,9 @@ namespace logger {
 
 		// Return a formatted date for the log file name.
 		int fileDate();
+
+		// WriteLog with the write lock held
+		static void WriteLocked(const string &message, TLogLevel level, const string &file, int line);
                 
 	};
 }
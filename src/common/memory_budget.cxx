@@ -0,0 +1,274 @@
+/*******************************************************************************
+ * Class: MemoryBudget
+ * Filename: memory_budget.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Per subsystem memory accounting and admission.  See memory_budget.h.
+ ******************************************************************************/
+
+#include "memory_budget.h"
+#include "logger.h"
+
+#include <sstream>
+
+using namespace std;
+using namespace logger;
+
+static const char *s_pSubsystemNames[MEMORY_SUBSYSTEMS] = {
+    "packet", "publisher", "connection"
+};
+
+/******************************************************************************
+ *   MEMORY BUDGET
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: No limits and nothing charged.
+ ******************************************************************************/
+MemoryBudget::MemoryBudget() {
+    m_iBudget = 0;
+    m_iPolicy = MEMORY_POLICY_DROP;
+
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        m_iLimit[i] = 0;
+        m_iUsed[i] = 0;
+        m_iPeak[i] = 0;
+        m_iRefused[i] = 0;
+        m_iOvercommits[i] = 0;
+    }
+}
+
+/******************************************************************************
+ * Method: Instance
+ * Description: The process wide budget.  A local static so packets made
+ * during static initialization can be charged.
+ ******************************************************************************/
+MemoryBudget & MemoryBudget::Instance() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+/******************************************************************************
+ * Method: SubsystemName
+ ******************************************************************************/
+const char * MemoryBudget::SubsystemName(MemorySubsystem subsystem) {
+    return subsystem < MEMORY_SUBSYSTEMS ? s_pSubsystemNames[subsystem] : "unknown";
+}
+
+/******************************************************************************
+ * Method: setBudget
+ * Description: Limit the total of every subsystem, 0 for no limit.
+ ******************************************************************************/
+void MemoryBudget::setBudget(uint64_t bytes) {
+    __atomic_store_n(&m_iBudget, bytes, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: setLimit
+ * Description: Limit one subsystem, 0 for no limit.
+ ******************************************************************************/
+void MemoryBudget::setLimit(MemorySubsystem subsystem, uint64_t bytes) {
+    __atomic_store_n(&m_iLimit[subsystem], bytes, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: setPolicy
+ ******************************************************************************/
+void MemoryBudget::setPolicy(MemoryPolicy policy) {
+    __atomic_store_n(&m_iPolicy, (uint32_t)policy, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: limit
+ ******************************************************************************/
+uint64_t MemoryBudget::limit(MemorySubsystem subsystem) {
+    return __atomic_load_n(&m_iLimit[subsystem], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: admit
+ * Description: Charge bytes to a subsystem if that keeps it and the total
+ * inside their limits.  Otherwise the policy decides.  Two threads may
+ * both be admitted just under a limit, the limits are a target rather than
+ * a hard cap.
+ *
+ * Return:
+ *   false if the bytes were refused and nothing was charged
+ ******************************************************************************/
+bool MemoryBudget::admit(MemorySubsystem subsystem, uint64_t bytes) {
+    if(overLimit(subsystem, bytes)) {
+        if(policy() == MEMORY_POLICY_DROP) {
+            if(__atomic_fetch_add(&m_iRefused[subsystem], 1, __ATOMIC_RELAXED) == 0)
+                LOG(ERROR) << SubsystemName(subsystem) << " memory over budget, shedding "
+                           << "(used: " << used(subsystem) << " total: " << used() << ")";
+            return false;
+        }
+
+        if(__atomic_fetch_add(&m_iOvercommits[subsystem], 1, __ATOMIC_RELAXED) == 0)
+            LOG(WARNING) << SubsystemName(subsystem) << " memory over budget "
+                         << "(used: " << used(subsystem) << " total: " << used() << ")";
+    }
+
+    charge(subsystem, bytes);
+    return true;
+}
+
+/******************************************************************************
+ * Method: charge
+ * Description: Charge bytes to a subsystem without asking.
+ ******************************************************************************/
+void MemoryBudget::charge(MemorySubsystem subsystem, uint64_t bytes) {
+    uint64_t now = __atomic_add_fetch(&m_iUsed[subsystem], bytes, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&m_iPeak[subsystem], __ATOMIC_RELAXED);
+
+    while(now > peak &&
+          ! __atomic_compare_exchange_n(&m_iPeak[subsystem], &peak, now, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/******************************************************************************
+ * Method: release
+ ******************************************************************************/
+void MemoryBudget::release(MemorySubsystem subsystem, uint64_t bytes) {
+    __atomic_sub_fetch(&m_iUsed[subsystem], bytes, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: used
+ * Description: Bytes charged to every subsystem.
+ ******************************************************************************/
+uint64_t MemoryBudget::used() {
+    uint64_t total = 0;
+
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        total += used((MemorySubsystem)i);
+
+    return total;
+}
+
+/******************************************************************************
+ * Method: used
+ ******************************************************************************/
+uint64_t MemoryBudget::used(MemorySubsystem subsystem) {
+    return __atomic_load_n(&m_iUsed[subsystem], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: peak
+ ******************************************************************************/
+uint64_t MemoryBudget::peak(MemorySubsystem subsystem) {
+    return __atomic_load_n(&m_iPeak[subsystem], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: refused
+ ******************************************************************************/
+uint64_t MemoryBudget::refused(MemorySubsystem subsystem) {
+    return __atomic_load_n(&m_iRefused[subsystem], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: overcommits
+ ******************************************************************************/
+uint64_t MemoryBudget::overcommits(MemorySubsystem subsystem) {
+    return __atomic_load_n(&m_iOvercommits[subsystem], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: resetStats
+ * Description: Peaks start again from what is in use now.
+ ******************************************************************************/
+void MemoryBudget::resetStats() {
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        __atomic_store_n(&m_iPeak[i], used((MemorySubsystem)i), __ATOMIC_RELAXED);
+        __atomic_store_n(&m_iRefused[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_iOvercommits[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+/******************************************************************************
+ * Method: stats
+ * Description: Usage and limits as "name value" lines.
+ ******************************************************************************/
+string MemoryBudget::stats() {
+    ostringstream out;
+
+    out << "memory_budget " << budget() << endl
+        << "memory_used " << used() << endl
+        << "memory_policy " << (policy() == MEMORY_POLICY_WARN ? "warn" : "drop") << endl;
+
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        MemorySubsystem subsystem = (MemorySubsystem)i;
+        const char *name = SubsystemName(subsystem);
+
+        out << "memory_" << name << "_used " << used(subsystem) << endl
+            << "memory_" << name << "_peak " << peak(subsystem) << endl
+            << "memory_" << name << "_limit " << limit(subsystem) << endl
+            << "memory_" << name << "_refused " << refused(subsystem) << endl
+            << "memory_" << name << "_overcommits " << overcommits(subsystem) << endl;
+    }
+
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: overLimit
+ * Description: Would charging bytes put the subsystem or the total past
+ * its limit.
+ ******************************************************************************/
+bool MemoryBudget::overLimit(MemorySubsystem subsystem, uint64_t bytes) {
+    uint64_t subsystemLimit = limit(subsystem);
+    uint64_t totalLimit = budget();
+
+    if(subsystemLimit && used(subsystem) + bytes > subsystemLimit)
+        return true;
+
+    if(totalLimit && used() + bytes > totalLimit)
+        return true;
+
+    return false;
+}
+
+/******************************************************************************
+ *   MEMORY CHARGE
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ ******************************************************************************/
+MemoryCharge::MemoryCharge(MemorySubsystem subsystem, MemoryBudget &budget)
+    : m_oBudget(budget), m_tSubsystem(subsystem), m_iBytes(0) {
+}
+
+/******************************************************************************
+ * Method: resize
+ * Description: Track a buffer growing or shrinking to bytes.  Only the
+ * growth is asked for.
+ ******************************************************************************/
+bool MemoryCharge::resize(uint64_t bytes) {
+    if(bytes > m_iBytes) {
+        if(! m_oBudget.admit(m_tSubsystem, bytes - m_iBytes))
+            return false;
+    }
+    else if(bytes < m_iBytes) {
+        m_oBudget.release(m_tSubsystem, m_iBytes - bytes);
+    }
+
+    m_iBytes = bytes;
+    return true;
+}
+
+/******************************************************************************
+ * Method: set
+ ******************************************************************************/
+void MemoryCharge::set(uint64_t bytes) {
+    if(bytes > m_iBytes)
+        m_oBudget.charge(m_tSubsystem, bytes - m_iBytes);
+    else if(bytes < m_iBytes)
+        m_oBudget.release(m_tSubsystem, m_iBytes - bytes);
+
+    m_iBytes = bytes;
+}
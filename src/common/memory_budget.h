@@ -0,0 +1,167 @@
+/*******************************************************************************
+ * Class: MemoryBudget
+ * Filename: memory_budget.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Account for the memory the port agent holds on to.  Each buffer that can
+ * grow with load is charged to a subsystem when it is allocated or grown
+ * and released when it shrinks or is freed:
+ *
+ *  * packet - packet data buffers
+ *  * publisher - data held back before it's published, e.g. partial routed
+ *    records
+ *  * connection - instrument write queues and receive buffers
+ *
+ * A total budget and a limit per subsystem can be set, 0 for no limit.
+ * Buffers whose data can be shed ask for admission before they grow.  Past a
+ * limit the policy decides: MEMORY_POLICY_DROP refuses the request and the
+ * caller sheds the data, MEMORY_POLICY_WARN lets it through and counts it.
+ * Buffers that can't give up data, like a packet being built, are charged
+ * without asking so their use still counts against the budget the
+ * admitted buffers see.
+ *
+ * Counters are atomic so buffers can be charged from publisher threads.
+ *
+ * Usage:
+ *
+ * MemoryBudget &budget = MemoryBudget::Instance();
+ * budget.setBudget(16777216);
+ * budget.setLimit(MEMORY_CONNECTION, 4194304);
+ * budget.setPolicy(MEMORY_POLICY_DROP);
+ *
+ * // A buffer that tracks its own charge
+ * MemoryCharge charge(MEMORY_CONNECTION);
+ * if(! charge.resize(queue.length() + size))
+ *     ... shed the data
+ * queue.append(buffer, size);
+ *
+ ******************************************************************************/
+
+#ifndef __MEMORY_BUDGET_H_
+#define __MEMORY_BUDGET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+using namespace std;
+
+typedef enum {
+    MEMORY_PACKET     = 0,
+    MEMORY_PUBLISHER  = 1,
+    MEMORY_CONNECTION = 2,
+    MEMORY_SUBSYSTEMS = 3
+} MemorySubsystem;
+
+typedef enum {
+    MEMORY_POLICY_DROP = 0,
+    MEMORY_POLICY_WARN = 1
+} MemoryPolicy;
+
+class MemoryBudget {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        MemoryBudget();
+
+        // The budget every buffer in the process is charged to
+        static MemoryBudget & Instance();
+
+        // Name used in stats and config, e.g. "packet"
+        static const char * SubsystemName(MemorySubsystem subsystem);
+
+        /* Limits, 0 for none */
+        void setBudget(uint64_t bytes);
+        void setLimit(MemorySubsystem subsystem, uint64_t bytes);
+        void setPolicy(MemoryPolicy policy);
+
+        uint64_t budget() { return __atomic_load_n(&m_iBudget, __ATOMIC_RELAXED); }
+        uint64_t limit(MemorySubsystem subsystem);
+        MemoryPolicy policy() { return (MemoryPolicy)__atomic_load_n(&m_iPolicy, __ATOMIC_RELAXED); }
+
+        /* Accounting */
+
+        // Charge bytes if they fit the limits or the policy lets them
+        // through.  Nothing is charged if they're refused.
+        bool admit(MemorySubsystem subsystem, uint64_t bytes);
+
+        // Charge bytes whatever the limits
+        void charge(MemorySubsystem subsystem, uint64_t bytes);
+        void release(MemorySubsystem subsystem, uint64_t bytes);
+
+        uint64_t used();
+        uint64_t used(MemorySubsystem subsystem);
+        uint64_t peak(MemorySubsystem subsystem);
+
+        // Admissions refused under MEMORY_POLICY_DROP
+        uint64_t refused(MemorySubsystem subsystem);
+
+        // Admissions past a limit let through under MEMORY_POLICY_WARN
+        uint64_t overcommits(MemorySubsystem subsystem);
+
+        // Clear the peaks and counters, usage is left alone
+        void resetStats();
+
+        // "memory_..." lines for get_stats
+        string stats();
+
+    private:
+        bool overLimit(MemorySubsystem subsystem, uint64_t bytes);
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        uint64_t m_iBudget;
+        uint32_t m_iPolicy;
+
+        uint64_t m_iLimit[MEMORY_SUBSYSTEMS];
+        uint64_t m_iUsed[MEMORY_SUBSYSTEMS];
+        uint64_t m_iPeak[MEMORY_SUBSYSTEMS];
+        uint64_t m_iRefused[MEMORY_SUBSYSTEMS];
+        uint64_t m_iOvercommits[MEMORY_SUBSYSTEMS];
+};
+
+/* The charge held by one buffer, released when the buffer goes away */
+class MemoryCharge {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        MemoryCharge(MemorySubsystem subsystem, MemoryBudget &budget = MemoryBudget::Instance());
+        virtual ~MemoryCharge() { set(0); }
+
+        // Grow or shrink to bytes.  Growth needs admission, false and the
+        // charge is unchanged if it's refused.
+        bool resize(uint64_t bytes);
+
+        // Charge exactly bytes whatever the limits
+        void set(uint64_t bytes);
+
+        uint64_t bytes() { return m_iBytes; }
+
+    private:
+        MemoryCharge(const MemoryCharge &rhs);
+        MemoryCharge & operator=(const MemoryCharge &rhs);
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        MemoryBudget &m_oBudget;
+        MemorySubsystem m_tSubsystem;
+        uint64_t m_iBytes;
+};
+
+#endif //__MEMORY_BUDGET_H_
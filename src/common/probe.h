@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * Filename: probe.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Static tracepoints (USDT probes) on the port agent hot paths.  A probe
+ * is a single nop in the code plus a note in the binary that tells perf,
+ * bpftrace and SystemTap where it is and where to find its arguments.  It
+ * costs nothing until a tracer attaches, so the probes are always built in
+ * and a live agent can be profiled without a debugger or DEBUG logging.
+ *
+ * The provider is port_agent.  Every argument is recorded as a signed 64
+ * bit value, strings are passed as pointers.  See tools/port_agent_probes.bt
+ * for the list of probes and their arguments.
+ *
+ * sys/sdt.h from SystemTap is used when it is installed.  Otherwise the
+ * same notes are written here for x86_64 and aarch64, and on anything else
+ * the probes compile away.  Define PORT_AGENT_NO_PROBES to leave them out.
+ *
+ * Usage:
+ *
+ * PROBE2(instrument__read, fd, bytes);
+ *
+ * # list the probes in a binary
+ * readelf -n port_agent | grep -A2 stapsdt
+ * bpftrace -l 'usdt:./port_agent:*'
+ *
+ * # count instrument reads on a live agent
+ * bpftrace -e 'usdt:./port_agent:port_agent:instrument__read { @[arg0] = count(); }' -p PID
+ *
+ ******************************************************************************/
+
+#ifndef __PROBE_H_
+#define __PROBE_H_
+
+#include <stdint.h>
+
+#if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    define PROBE_HAVE_SDT
+#  endif
+#endif
+
+#if defined(PORT_AGENT_NO_PROBES)
+
+#define PROBE(name)
+#define PROBE1(name, a1)
+#define PROBE2(name, a1, a2)
+#define PROBE3(name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4)
+
+#elif defined(PROBE_HAVE_SDT)
+
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(port_agent, name)
+#define PROBE1(name, a1) \
+    DTRACE_PROBE1(port_agent, name, (int64_t)(a1))
+#define PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(port_agent, name, (int64_t)(a1), (int64_t)(a2))
+#define PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(port_agent, name, (int64_t)(a1), (int64_t)(a2), (int64_t)(a3))
+#define PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(port_agent, name, (int64_t)(a1), (int64_t)(a2), (int64_t)(a3), (int64_t)(a4))
+
+#elif defined(__x86_64__) || defined(__aarch64__)
+
+// The nop the tracer replaces, and a .note.stapsdt entry in the format
+// SystemTap defines: probe address, base address, semaphore (none),
+// provider, name and argument locations as "size@operand".
+#define PROBE_NOTE(name, args)                                               \
+    "990: nop\n"                                                             \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                            \
+    ".balign 4\n"                                                            \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                       \
+    "991: .asciz \"stapsdt\"\n"                                              \
+    "992: .balign 4\n"                                                       \
+    "993: .8byte 990b\n"                                                     \
+    ".8byte _.stapsdt.base\n"                                                \
+    ".8byte 0\n"                                                             \
+    ".asciz \"port_agent\"\n"                                                \
+    ".asciz \"" #name "\"\n"                                                 \
+    ".asciz \"" args "\"\n"                                                  \
+    "994: .balign 4\n"                                                       \
+    ".popsection\n"                                                          \
+    ".ifndef _.stapsdt.base\n"                                               \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"  \
+    ".weak _.stapsdt.base\n"                                                 \
+    ".hidden _.stapsdt.base\n"                                               \
+    "_.stapsdt.base: .space 1\n"                                             \
+    ".size _.stapsdt.base, 1\n"                                              \
+    ".popsection\n"                                                          \
+    ".endif\n"
+
+#define PROBE(name) \
+    __asm__ __volatile__(PROBE_NOTE(name, "") ::)
+#define PROBE1(name, a1) \
+    __asm__ __volatile__(PROBE_NOTE(name, "-8@%[p1]") \
+        :: [p1] "nor" ((int64_t)(a1)))
+#define PROBE2(name, a1, a2) \
+    __asm__ __volatile__(PROBE_NOTE(name, "-8@%[p1] -8@%[p2]") \
+        :: [p1] "nor" ((int64_t)(a1)), [p2] "nor" ((int64_t)(a2)))
+#define PROBE3(name, a1, a2, a3) \
+    __asm__ __volatile__(PROBE_NOTE(name, "-8@%[p1] -8@%[p2] -8@%[p3]") \
+        :: [p1] "nor" ((int64_t)(a1)), [p2] "nor" ((int64_t)(a2)), \
+           [p3] "nor" ((int64_t)(a3)))
+#define PROBE4(name, a1, a2, a3, a4) \
+    __asm__ __volatile__(PROBE_NOTE(name, "-8@%[p1] -8@%[p2] -8@%[p3] -8@%[p4]") \
+        :: [p1] "nor" ((int64_t)(a1)), [p2] "nor" ((int64_t)(a2)), \
+           [p3] "nor" ((int64_t)(a3)), [p4] "nor" ((int64_t)(a4)))
+
+#else
+
+#define PROBE(name)
+#define PROBE1(name, a1)
+#define PROBE2(name, a1, a2)
+#define PROBE3(name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4)
+
+#endif
+
+#endif //__PROBE_H_
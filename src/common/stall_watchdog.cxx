@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * Class: StallWatchdog
+ * Filename: stall_watchdog.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Data stall detection.  See stall_watchdog.h.
+ ******************************************************************************/
+
+#include "stall_watchdog.h"
+#include "clock.h"
+#include "logger.h"
+
+using namespace logger;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Start turned off.
+ ******************************************************************************/
+StallWatchdog::StallWatchdog() {
+    m_iConfigured = 0;
+    m_iStalls = 0;
+    m_iRecoveries = 0;
+    m_iLastRecovery = 0;
+    m_iTotalRecovery = 0;
+    m_iLastGap = 0;
+    reset();
+}
+
+/******************************************************************************
+ * Method: setTimeout
+ * Description: Set the timeout.  A new value throws away what was learned.
+ ******************************************************************************/
+void StallWatchdog::setTimeout(uint32_t seconds) {
+    if(seconds == m_iConfigured)
+        return;
+
+    if(seconds == STALL_TIMEOUT_AUTO)
+        LOG(INFO) << "data stall timeout learned from the data cadence";
+    else
+        LOG(INFO) << "data stall timeout: " << seconds << "s";
+
+    m_iConfigured = seconds;
+    reset();
+}
+
+/******************************************************************************
+ * Method: reset
+ * Description: Forget the cadence and any stall in progress.  Totals are
+ * kept.
+ ******************************************************************************/
+void StallWatchdog::reset() {
+    m_iLongestGap = 0;
+    m_iSamples = 0;
+    m_iLastData = 0;
+    m_iStallStart = 0;
+    m_iLastFire = 0;
+    m_iBackoff = 1;
+}
+
+/******************************************************************************
+ * Method: dataReceived
+ * Description: Note data arriving.  Ends a stall, otherwise the gap since the
+ * last read is learned.
+ ******************************************************************************/
+void StallWatchdog::dataReceived() {
+    uint64_t now = Clock::MonotonicUsec();
+
+    if(m_iStallStart) {
+        m_iLastRecovery = now - m_iStallStart;
+        m_iTotalRecovery += m_iLastRecovery;
+        m_iLastGap = now - m_iLastData;
+        m_iRecoveries++;
+
+        LOG(INFO) << "data stall recovered after: " << m_iLastRecovery / 1000
+                  << "ms, no data for: " << m_iLastGap / 1000 << "ms";
+
+        m_iStallStart = 0;
+        m_iLastFire = 0;
+        m_iBackoff = 1;
+    }
+    else if(m_iLastData && now > m_iLastData) {
+        uint64_t gap = now - m_iLastData;
+        uint64_t decayed = m_iLongestGap - m_iLongestGap / STALL_GAP_DECAY;
+
+        m_iLongestGap = gap > decayed ? gap : decayed;
+        m_iSamples++;
+    }
+
+    m_iLastData = now;
+}
+
+/******************************************************************************
+ * Method: timeoutUsec
+ * Description: The timeout in use.
+ * Return:
+ *   microseconds, 0 if off or still learning
+ ******************************************************************************/
+uint64_t StallWatchdog::timeoutUsec() {
+    uint64_t learned;
+
+    if(! m_iConfigured)
+        return 0;
+
+    if(m_iConfigured != STALL_TIMEOUT_AUTO)
+        return m_iConfigured * CLOCK_USEC_PER_SEC;
+
+    if(m_iSamples < STALL_LEARN_SAMPLES)
+        return 0;
+
+    learned = m_iLongestGap * STALL_CADENCE_FACTOR;
+    return learned > STALL_MIN_TIMEOUT_USEC ? learned : STALL_MIN_TIMEOUT_USEC;
+}
+
+/******************************************************************************
+ * Method: timerDelay
+ * Description: How long until the next check is due.
+ * Return:
+ *   microseconds, 0 if nothing is watched
+ ******************************************************************************/
+uint64_t StallWatchdog::timerDelay() {
+    uint64_t due = deadline();
+    uint64_t now;
+
+    if(! due)
+        return 0;
+
+    now = Clock::MonotonicUsec();
+    return due > now ? due - now : 1;
+}
+
+/******************************************************************************
+ * Method: check
+ * Description: See if the deadline has passed.  The first time starts a
+ * stall.  Each time doubles the wait before the next, up to
+ * STALL_BACKOFF_MAX timeouts.
+ * Return:
+ *   true if the owner should recover the stream
+ ******************************************************************************/
+bool StallWatchdog::check() {
+    uint64_t due = deadline();
+    uint64_t now = Clock::MonotonicUsec();
+
+    if(! due || now < due)
+        return false;
+
+    if(! m_iStallStart) {
+        m_iStallStart = now;
+        m_iStalls++;
+    }
+
+    if(m_iBackoff < STALL_BACKOFF_MAX)
+        m_iBackoff *= 2;
+
+    m_iLastFire = now;
+
+    LOG(WARNING) << "data stall, no data for: " << (now - m_iLastData) / 1000
+                 << "ms, timeout: " << timeoutUsec() / 1000 << "ms";
+    return true;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: deadline
+ * Description: When the next check is due, a timeout after the last data or
+ * a backed off timeout after the last check that fired.
+ * Return:
+ *   microseconds since the epoch, 0 if nothing is watched
+ ******************************************************************************/
+uint64_t StallWatchdog::deadline() {
+    uint64_t timeout = timeoutUsec();
+
+    if(! timeout || ! m_iLastData)
+        return 0;
+
+    if(m_iLastFire)
+        return m_iLastFire + timeout * m_iBackoff;
+
+    return m_iLastData + timeout;
+}
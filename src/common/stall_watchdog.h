@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Class: StallWatchdog
+ * Filename: stall_watchdog.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Notice when a data stream that normally has a steady cadence stops.  A TCP
+ * instrument that went away without a FIN or a wedged serial converter
+ * looks like an instrument with nothing to say, so without this nobody
+ * notices until a person looks at the data.
+ *
+ * The timeout is either set or learned.  A learned timeout is a multiple of
+ * the longest gap between reads seen recently, and isn't used until enough
+ * gaps have been seen.  Nothing is watched until the first data arrives.
+ *
+ * When check finds the deadline has passed the stream is stalled.  The owner
+ * reconnects and data arriving again ends the stall.  While it stays stalled
+ * check fires again on a back off so reconnects don't spin.  The time from
+ * noticing a stall to data flowing again is kept for reporting.
+ *
+ * Time is read from Clock's monotonic reading so tests can simulate hours
+ * of stalls and a change to the system time doesn't fake or hide one.
+ *
+ * Usage:
+ *
+ * StallWatchdog watchdog;
+ * watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+ *
+ * // on every read with data
+ * watchdog.dataReceived();
+ *
+ * // in the main loop, waiting at most timerDelay() microseconds
+ * if(watchdog.check())
+ *     ... publish a fault and reconnect
+ *
+ ******************************************************************************/
+
+#ifndef __STALL_WATCHDOG_H_
+#define __STALL_WATCHDOG_H_
+
+#include <stdint.h>
+
+// setTimeout value to learn the timeout from the data cadence
+#define STALL_TIMEOUT_AUTO 0xFFFFFFFF
+
+// Gaps seen before a learned timeout is used
+#define STALL_LEARN_SAMPLES 10
+
+// A learned timeout is this many times the longest recent gap
+#define STALL_CADENCE_FACTOR 4
+
+// Shortest learned timeout, microseconds
+#define STALL_MIN_TIMEOUT_USEC 10000000ULL
+
+// The longest gap shrinks by 1/STALL_GAP_DECAY with every read so the
+// timeout follows an instrument that speeds up
+#define STALL_GAP_DECAY 1024
+
+// Most timeouts between checks while the stream stays stalled
+#define STALL_BACKOFF_MAX 8
+
+class StallWatchdog {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        StallWatchdog();
+
+        // Seconds without data before the stream is stalled, 0 to turn the
+        // watchdog off or STALL_TIMEOUT_AUTO to learn it.  Changing it
+        // starts over.
+        void setTimeout(uint32_t seconds);
+        uint32_t configuredTimeout() { return m_iConfigured; }
+
+        // Data arrived
+        void dataReceived();
+
+        // Forget everything seen so far
+        void reset();
+
+        // Microseconds until check should be called, 0 if nothing is watched
+        uint64_t timerDelay();
+
+        // True if the deadline has passed and the owner should recover
+        bool check();
+
+        // Timeout in use, 0 if not watching yet
+        uint64_t timeoutUsec();
+
+        /* Accessors */
+        bool stalled() { return m_iStallStart != 0; }
+        uint64_t longestGapUsec() { return m_iLongestGap; }
+        uint32_t stalls() { return m_iStalls; }
+        uint32_t recoveries() { return m_iRecoveries; }
+        uint64_t lastRecoveryUsec() { return m_iLastRecovery; }
+        uint64_t totalRecoveryUsec() { return m_iTotalRecovery; }
+        uint64_t lastGapUsec() { return m_iLastGap; }
+        uint64_t lastDataUsec() { return m_iLastData; }
+
+    private:
+        uint64_t deadline();
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        uint32_t m_iConfigured;
+
+        // Learned cadence
+        uint64_t m_iLongestGap;
+        uint32_t m_iSamples;
+
+        uint64_t m_iLastData;
+
+        // Current stall, 0 if data is flowing
+        uint64_t m_iStallStart;
+        uint64_t m_iLastFire;
+        uint32_t m_iBackoff;
+
+        // Totals
+        uint32_t m_iStalls;
+        uint32_t m_iRecoveries;
+        uint64_t m_iLastRecovery;
+        uint64_t m_iTotalRecovery;
+        uint64_t m_iLastGap;
+};
+
+#endif //__STALL_WATCHDOG_H_
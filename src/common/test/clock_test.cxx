@@ -0,0 +1,122 @@
+#include "common/logger.h"
+#include "common/clock.h"
+#include "common/timestamp.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <math.h>
+
+using namespace std;
+using namespace logger;
+
+class ClockTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "            ClockTest Start Up";
+            LOG(INFO) << "************************************************";
+        }
+
+        virtual void TearDown() {
+            Clock::SetClock(NULL);
+        }
+};
+
+/* The system clock is used unless another is set */
+TEST_F(ClockTest, SystemClock) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    EXPECT_LE(labs(Clock::NowSeconds() - tv.tv_sec), 1);
+
+    VirtualClock clock(1000);
+    Clock::SetClock(&clock);
+    EXPECT_EQ(Clock::Instance(), &clock);
+    EXPECT_EQ(Clock::NowSeconds(), 1000);
+
+    Clock::SetClock(NULL);
+    EXPECT_NE(Clock::Instance(), &clock);
+    EXPECT_LE(labs(Clock::NowSeconds() - tv.tv_sec), 1);
+
+    // A virtual clock going out of scope puts the system clock back
+    {
+        VirtualClock scoped(2000);
+        Clock::SetClock(&scoped);
+        EXPECT_EQ(Clock::NowSeconds(), 2000);
+    }
+    EXPECT_LE(labs(Clock::NowSeconds() - tv.tv_sec), 1);
+}
+
+/* Virtual time only moves when told to */
+TEST_F(ClockTest, VirtualClock) {
+    VirtualClock clock(1000, 250000);
+    struct timeval tv;
+
+    Clock::SetClock(&clock);
+
+    EXPECT_EQ(Clock::NowUsec(), 1000250000ULL);
+    usleep(10000);
+    EXPECT_EQ(Clock::NowUsec(), 1000250000ULL);
+
+    clock.advance(750000);
+    Clock::Now(tv);
+    EXPECT_EQ(tv.tv_sec, 1001);
+    EXPECT_EQ(tv.tv_usec, 0);
+
+    clock.set(5 * CLOCK_USEC_PER_SEC + 1);
+    EXPECT_EQ(clock.usec(), 5 * CLOCK_USEC_PER_SEC + 1);
+    EXPECT_EQ(Clock::NowSeconds(), 5);
+
+    // Defaults to the time of day
+    VirtualClock today;
+    gettimeofday(&tv, NULL);
+    EXPECT_LE(labs((long)(today.usec() / CLOCK_USEC_PER_SEC) - tv.tv_sec), 1);
+}
+
+/* The monotonic clock only moves forward and ignores the time of day */
+TEST_F(ClockTest, Monotonic) {
+    uint64_t start = Clock::MonotonicUsec();
+    usleep(10000);
+    EXPECT_GE(Clock::MonotonicUsec(), start + 10000);
+    EXPECT_LE(Clock::MonotonicSeconds(), (time_t)(Clock::MonotonicUsec() / CLOCK_USEC_PER_SEC));
+
+    VirtualClock clock(1000, 250000);
+    Clock::SetClock(&clock);
+    EXPECT_EQ(Clock::MonotonicUsec(), 1000250000ULL);
+
+    clock.advance(750000);
+    EXPECT_EQ(Clock::MonotonicUsec(), 1001000000ULL);
+    EXPECT_EQ(Clock::MonotonicSeconds(), 1001);
+
+    // Stepping the wall clock leaves deadlines alone
+    clock.set(5 * CLOCK_USEC_PER_SEC);
+    EXPECT_EQ(Clock::NowSeconds(), 5);
+    EXPECT_EQ(Clock::MonotonicUsec(), 1001000000ULL);
+
+    clock.advance(1);
+    EXPECT_EQ(Clock::MonotonicUsec(), 1001000001ULL);
+    EXPECT_EQ(clock.usec(), 5 * CLOCK_USEC_PER_SEC + 1);
+}
+
+/* Timestamps are taken from the clock */
+TEST_F(ClockTest, Timestamp) {
+    VirtualClock clock(1000);
+
+    Clock::SetClock(&clock);
+
+    Timestamp start;
+    EXPECT_EQ(start.seconds(), 1000 + EPOCH);
+    EXPECT_EQ(start.fraction(), 0);
+    EXPECT_EQ(start.elapseTime(), 0);
+
+    // A week goes by
+    clock.advance(7 * 86400 * CLOCK_USEC_PER_SEC + 500000);
+    EXPECT_NEAR(start.elapseTime(), 7 * 86400 + 0.5, 0.001);
+
+    start.setNow();
+    EXPECT_EQ(start.seconds(), 1000 + 7 * 86400 + EPOCH);
+}
@@ -0,0 +1,148 @@
+#include "common/logger.h"
+#include "common/deflate_stream.h"
+#include "common/exception.h"
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+#include <string.h>
+
+using namespace std;
+using namespace logger;
+
+// Typical ASCII instrument record
+#define TEST_RECORD "2013-01-01T00:00:00 #SBE37 temp 12.3456 cond 4.5678 press 100.00\r\n"
+
+class DeflateStreamTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "           DeflateStreamTest Start Up";
+            LOG(INFO) << "************************************************";
+
+            memset(&m_oInflate, 0, sizeof(m_oInflate));
+            inflateInit(&m_oInflate);
+        }
+
+        virtual void TearDown() {
+            inflateEnd(&m_oInflate);
+        }
+
+        // Inflate what a client received, starting a new stream after the
+        // end of one like a client does after a live upgrade.
+        string decompress(const string &in) {
+            char out[DEFLATE_CHUNK_SIZE];
+            string result;
+            int status;
+
+            m_oInflate.next_in = (Bytef *)in.data();
+            m_oInflate.avail_in = in.size();
+
+            do {
+                m_oInflate.next_out = (Bytef *)out;
+                m_oInflate.avail_out = sizeof(out);
+
+                status = inflate(&m_oInflate, Z_SYNC_FLUSH);
+                EXPECT_TRUE(status == Z_OK || status == Z_STREAM_END || status == Z_BUF_ERROR);
+                result.append(out, sizeof(out) - m_oInflate.avail_out);
+
+                if(status == Z_STREAM_END)
+                    inflateReset(&m_oInflate);
+            } while(m_oInflate.avail_in || m_oInflate.avail_out == 0);
+
+            return result;
+        }
+
+        z_stream m_oInflate;
+};
+
+/* Test data written and flushed inflates back to the original */
+TEST_F(DeflateStreamTest, RoundTrip) {
+    DeflateStream stream(6);
+    string data, out;
+
+    for(int i = 0; i < 1000; i++)
+        data += TEST_RECORD;
+
+    stream.write(data.data(), data.size(), out);
+    EXPECT_TRUE(stream.pending());
+
+    stream.flush(out);
+    EXPECT_FALSE(stream.pending());
+    EXPECT_EQ(stream.flushes(), 1);
+
+    EXPECT_EQ(decompress(out), data);
+}
+
+/* Test each sync flush makes everything so far readable */
+TEST_F(DeflateStreamTest, SyncFlush) {
+    DeflateStream stream;
+    string out;
+
+    for(int i = 0; i < 10; i++) {
+        stream.write(TEST_RECORD, strlen(TEST_RECORD), out);
+        stream.flush(out);
+
+        EXPECT_EQ(decompress(out), TEST_RECORD);
+        out.clear();
+    }
+
+    // Nothing written, nothing to flush
+    stream.flush(out);
+    EXPECT_EQ(out.size(), 0);
+    EXPECT_EQ(stream.flushes(), 10);
+}
+
+/* Test the statistics reported for a stream */
+TEST_F(DeflateStreamTest, Statistics) {
+    DeflateStream stream;
+    string out;
+
+    EXPECT_EQ(stream.ratio(), 0);
+
+    for(int i = 0; i < 10000; i++)
+        stream.write(TEST_RECORD, strlen(TEST_RECORD), out);
+    stream.flush(out);
+
+    EXPECT_EQ(stream.bytesIn(), 10000 * strlen(TEST_RECORD));
+    EXPECT_EQ(stream.bytesOut(), out.size());
+    EXPECT_GT(stream.ratio(), 4);
+    EXPECT_GT(stream.cpuUsec(), 0);
+
+    LOG(INFO) << "ratio: " << stream.ratio() << " cpu usec: " << stream.cpuUsec();
+}
+
+/* Test a client can carry on with a new stream after the end of one */
+TEST_F(DeflateStreamTest, Finish) {
+    DeflateStream *stream = new DeflateStream();
+    string out;
+
+    stream->write("before", 6, out);
+    stream->finish(out);
+    delete stream;
+
+    stream = new DeflateStream();
+    stream->write("after", 5, out);
+    stream->flush(out);
+    delete stream;
+
+    EXPECT_EQ(decompress(out), "beforeafter");
+}
+
+/* Test a bad level is reported */
+TEST_F(DeflateStreamTest, BadLevel) {
+    bool exceptionRaised = false;
+
+    try {
+        DeflateStream stream(42);
+    }
+    catch(CompressionFailure &e) {
+        exceptionRaised = true;
+    }
+
+    EXPECT_TRUE(exceptionRaised);
+}
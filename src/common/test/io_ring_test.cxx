@@ -0,0 +1,336 @@
+#include "common/logger.h"
+#include "common/log_file.h"
+#include "common/io_ring.h"
+#include "common/exception.h"
+#include "gtest/gtest.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace logger;
+
+#define TEST_ARCHIVE "/tmp/io_ring_test.dat"
+
+// Benchmark size: packets fanned out to publishers
+#define BENCHMARK_PACKETS    5000
+#define BENCHMARK_PUBLISHERS 4
+#define BENCHMARK_PACKET_SIZE 256
+
+class IORingTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "             IORingTest Start Up";
+            LOG(INFO) << "************************************************";
+
+            IORing::setEnabled(true);
+        }
+
+        virtual void TearDown() {
+            IORing::setEnabled(false);
+        }
+
+        // Wait for an fd to select readable
+        bool readable(int fd, int timeout = 1) {
+            struct timeval tv = { timeout, 0 };
+            fd_set fds;
+
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            return select(fd + 1, &fds, NULL, NULL, &tv) == 1;
+        }
+
+        double now() {
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            return tv.tv_sec + tv.tv_usec / 1000000.0;
+        }
+};
+
+
+/* Test everything goes straight through when the backend is off */
+TEST_F(IORingTest, Disabled) {
+    int sockets[2];
+
+    IORing::setEnabled(false);
+    EXPECT_FALSE(IORing::enabled());
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    EXPECT_TRUE(IORingReader::create(sockets[0]) == NULL);
+
+    IORingBatch batch;
+    EXPECT_TRUE(IORingBatch::current() == NULL);
+    EXPECT_EQ(batch.flush(), "");
+
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+/* Test a fan-out reaches every fd in order */
+TEST_F(IORingTest, BatchFanOut) {
+    int sockets[3][2];
+    char buffer[128];
+
+    if(! IORing::supported()) {
+        LOG(INFO) << "io_uring not supported, skipping";
+        return;
+    }
+
+    for(int i = 0; i < 3; i++)
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[i]), 0);
+
+    {
+        IORingBatch batch;
+        ASSERT_TRUE(IORingBatch::current() == &batch);
+
+        // Nested batches leave the outer one in charge
+        IORingBatch nested;
+        EXPECT_TRUE(IORingBatch::current() == &batch);
+
+        for(int i = 0; i < 3; i++)
+            IORingBatch::current()->write(sockets[i][0], "first,", 6);
+        for(int i = 0; i < 3; i++)
+            IORingBatch::current()->write(sockets[i][0], "second", 6);
+
+        EXPECT_EQ(batch.flush(), "");
+    }
+    EXPECT_TRUE(IORingBatch::current() == NULL);
+
+    for(int i = 0; i < 3; i++) {
+        ASSERT_EQ(read(sockets[i][1], buffer, sizeof(buffer)), 12);
+        EXPECT_EQ(string(buffer, 12), "first,second");
+        close(sockets[i][0]);
+        close(sockets[i][1]);
+    }
+}
+
+/* Test write failures come back from flush */
+TEST_F(IORingTest, BatchError) {
+    int sockets[2];
+    char buffer[16];
+
+    if(! IORing::supported())
+        return;
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    IORingBatch batch;
+    batch.write(9999, "lost", 4);
+    batch.write(sockets[0], "kept", 4);
+
+    EXPECT_NE(batch.flush(), "");
+    ASSERT_EQ(read(sockets[1], buffer, sizeof(buffer)), 4);
+    EXPECT_EQ(string(buffer, 4), "kept");
+
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+/* Records what a batch hands back */
+class TestWriter : public IORingWriter {
+    public:
+        void batchWritten(const char *buffer, uint32_t size, uint32_t written, int error) {
+            sizes.push_back(size);
+            writtens.push_back(written);
+            errors.push_back(error);
+        }
+
+        vector<uint32_t> sizes;
+        vector<uint32_t> writtens;
+        vector<int> errors;
+};
+
+/* Test a full non-blocking socket's writes are handed back, and nothing after
+ * a write that didn't finish goes out
+ */
+TEST_F(IORingTest, BatchWriter) {
+    int sockets[2];
+    int optval = 4096;
+    string big(262144, 'x');
+    char buffer[65536];
+    uint32_t received = 0;
+    int count;
+    TestWriter writer;
+
+    if(! IORing::supported())
+        return;
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+    fcntl(sockets[0], F_SETFL, O_NONBLOCK);
+
+    {
+        IORingBatch batch;
+        batch.write(sockets[0], "head", 4, -1, &writer);
+        batch.write(sockets[0], big.data(), big.size(), -1, &writer);
+        batch.write(sockets[0], "tail", 4, -1, &writer);
+        EXPECT_EQ(batch.flush(), "");
+    }
+
+    ASSERT_EQ(writer.sizes.size(), 3);
+    EXPECT_EQ(writer.writtens[0], 4);
+    EXPECT_EQ(writer.errors[0], 0);
+    EXPECT_LT(writer.writtens[1], big.size());
+    EXPECT_EQ(writer.errors[1], EAGAIN);
+    EXPECT_EQ(writer.writtens[2], 0);
+    EXPECT_EQ(writer.errors[2], ECANCELED);
+
+    // Only what was reported went out
+    fcntl(sockets[1], F_SETFL, O_NONBLOCK);
+    while((count = read(sockets[1], buffer, sizeof(buffer))) > 0)
+        received += count;
+    EXPECT_EQ(received, 4 + writer.writtens[1]);
+
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+/* Test the multishot reader, leftovers and peer shutdown */
+TEST_F(IORingTest, Reader) {
+    int sockets[2];
+    char buffer[1024];
+    string large(3000, 'x');
+    string received;
+    IORingReader *reader;
+
+    if(! IORing::supported())
+        return;
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    reader = IORingReader::create(sockets[0]);
+    if(! reader) {
+        LOG(INFO) << "multishot receive not supported, skipping";
+        close(sockets[0]);
+        close(sockets[1]);
+        return;
+    }
+
+    EXPECT_NE(reader->fd(), sockets[0]);
+    EXPECT_FALSE(readable(reader->fd(), 0));
+
+    ASSERT_EQ(write(sockets[1], "hello", 5), 5);
+    ASSERT_TRUE(readable(reader->fd()));
+    ASSERT_EQ(reader->read(buffer, sizeof(buffer)), 5);
+    EXPECT_EQ(string(buffer, 5), "hello");
+
+    // More than one read's worth, the ring stays readable until it's drained
+    ASSERT_EQ(write(sockets[1], large.data(), large.length()), large.length());
+    while(received.length() < large.length() && readable(reader->fd())) {
+        uint32_t count = reader->read(buffer, 1000);
+        EXPECT_LE(count, 1000);
+        received.append(buffer, count);
+    }
+    EXPECT_EQ(received, large);
+    EXPECT_FALSE(reader->closed());
+
+    shutdown(sockets[1], SHUT_WR);
+    ASSERT_TRUE(readable(reader->fd()));
+    EXPECT_EQ(reader->read(buffer, sizeof(buffer)), 0);
+    EXPECT_TRUE(reader->closed());
+    EXPECT_EQ(reader->error(), 0);
+
+    delete reader;
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+/* Test archive appends through a registered file */
+TEST_F(IORingTest, ArchiveAppend) {
+    string content;
+
+    if(! IORing::supported())
+        return;
+
+    unlink(TEST_ARCHIVE);
+
+    {
+        LogFile file(TEST_ARCHIVE);
+
+        {
+            IORingBatch batch;
+            EXPECT_TRUE(file.write("abc", 3));
+            EXPECT_TRUE(file.write("def", 3));
+            EXPECT_EQ(batch.flush(), "");
+        }
+
+        // Outside a batch it's the stream again
+        EXPECT_TRUE(file.write("ghi", 3));
+
+        // A removed file is recreated
+        unlink(TEST_ARCHIVE);
+        IORingBatch batch;
+        EXPECT_TRUE(file.write("jkl", 3));
+        EXPECT_EQ(batch.flush(), "");
+    }
+
+    ifstream in(TEST_ARCHIVE);
+    getline(in, content);
+    EXPECT_EQ(content, "jkl");
+}
+
+/* Compare a fan-out written with plain writes against one batched submit.
+ * There's no epoll loop in this tree, the readiness path is select with a
+ * write per publisher, so that's the baseline. */
+TEST_F(IORingTest, Benchmark) {
+    int fds[BENCHMARK_PUBLISHERS];
+    char packet[BENCHMARK_PACKET_SIZE];
+    uint32_t submits;
+    double start, syncTime, batchTime;
+
+    if(! IORing::supported())
+        return;
+
+    memset(packet, 'p', sizeof(packet));
+    for(int i = 0; i < BENCHMARK_PUBLISHERS; i++)
+        ASSERT_GT(fds[i] = open("/dev/null", O_WRONLY), 0);
+
+    start = now();
+    for(int p = 0; p < BENCHMARK_PACKETS; p++)
+        for(int i = 0; i < BENCHMARK_PUBLISHERS; i++)
+            ASSERT_EQ(write(fds[i], packet, sizeof(packet)), sizeof(packet));
+    syncTime = now() - start;
+
+    submits = IORingBatch::submitCount();
+    start = now();
+    for(int p = 0; p < BENCHMARK_PACKETS; p++) {
+        IORingBatch batch;
+        for(int i = 0; i < BENCHMARK_PUBLISHERS; i++)
+            batch.write(fds[i], packet, sizeof(packet));
+        ASSERT_EQ(batch.flush(), "");
+    }
+    batchTime = now() - start;
+    submits = IORingBatch::submitCount() - submits;
+
+    // One system call per packet instead of one per publisher
+    EXPECT_EQ(submits, BENCHMARK_PACKETS);
+
+    LOG(INFO) << "fan-out of " << BENCHMARK_PACKETS << " packets to " << BENCHMARK_PUBLISHERS
+              << " publishers, write: " << syncTime << "s io_uring: " << batchTime << "s";
+
+    ostringstream out;
+    out << syncTime;
+    RecordProperty("write_seconds", out.str().c_str());
+    out.str("");
+    out << batchTime;
+    RecordProperty("io_uring_seconds", out.str().c_str());
+    RecordProperty("write_syscalls", BENCHMARK_PACKETS * BENCHMARK_PUBLISHERS);
+    RecordProperty("io_uring_syscalls", submits);
+
+    for(int i = 0; i < BENCHMARK_PUBLISHERS; i++)
+        close(fds[i]);
+}
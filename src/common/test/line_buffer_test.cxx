@@ -0,0 +1,71 @@
+#include "common/logger.h"
+#include "common/line_buffer.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace std;
+using namespace logger;
+
+class LineBufferTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "         LineBufferTest Start Up";
+            LOG(INFO) << "************************************************";
+        }
+};
+
+/* Lines split across appends come out whole */
+TEST_F(LineBufferTest, Split) {
+    LineBuffer lines;
+    string line;
+
+    EXPECT_TRUE(lines.append("get_st", 6));
+    EXPECT_FALSE(lines.nextLine(line));
+    EXPECT_EQ(lines.pending(), 6);
+
+    EXPECT_TRUE(lines.append("ats\nping\r\nhea", 13));
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "get_stats");
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "ping");
+    EXPECT_FALSE(lines.nextLine(line));
+    EXPECT_EQ(lines.pending(), 3);
+
+    EXPECT_TRUE(lines.append("rtbeat_interval 5\n\n", 19));
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "heartbeat_interval 5");
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "");
+    EXPECT_EQ(lines.pending(), 0);
+
+    lines.append("partial", 7);
+    lines.clear();
+    EXPECT_EQ(lines.pending(), 0);
+}
+
+/* An over long line is dropped up to its newline, the next line is kept */
+TEST_F(LineBufferTest, Overflow) {
+    LineBuffer lines(8);
+    string line;
+
+    EXPECT_TRUE(lines.append("ok\n12345", 8));
+    EXPECT_FALSE(lines.append("6789", 4));
+    EXPECT_EQ(lines.pending(), 3);
+
+    // Still the long line
+    EXPECT_TRUE(lines.append("more", 4));
+    EXPECT_EQ(lines.pending(), 3);
+
+    EXPECT_TRUE(lines.append("end\nping\n", 9));
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "ok");
+    EXPECT_TRUE(lines.nextLine(line));
+    EXPECT_EQ(line, "ping");
+    EXPECT_FALSE(lines.nextLine(line));
+}
@@ -10,6 +10,7 @@
 #include "common/log_file.h"
 #include "common/logger.h"
 #include "common/util.h"
+#include "common/clock.h"
 #include "gmock/gmock.h"
 
 #include <iostream>
@@ -17,6 +18,7 @@
 #include <fstream>
 #include <stdio.h>
 #include <time.h>
+#include <set>
 
 using namespace std;
 using namespace logger;
@@ -37,6 +39,7 @@ class LogFileTest : public testing::Test {
         }
     
         virtual void TearDown() {
+            Clock::SetClock(NULL);
 			remove_file(LOGFILE);
             remove_file(Logger::Instance()->getLogFilename().c_str());
         }
@@ -299,9 +302,12 @@ TEST_F(LogFileTest, LogFileRotationType) {
 	LogFile log;
 	ostringstream expected;
 	char buffer[7];
-	time_t ts;
-    time (&ts);
+	VirtualClock clock;
+	time_t ts = clock.usec() / CLOCK_USEC_PER_SEC;
     struct tm * timeinfo = localtime(&ts);
+
+	// Hold the time still so the second doesn't turn over on us
+	Clock::SetClock(&clock);
 	int hour = timeinfo->tm_hour;
 	int min = timeinfo->tm_min;
 	int sec = timeinfo->tm_sec;
@@ -339,10 +345,13 @@ TEST_F(LogFileTest, LogFileRotationType) {
 
 TEST_F(LogFileTest, LogFileRotation) {
 	LogFile log;
+	VirtualClock clock;
 	string result;
 	string file1;
 	string file2;
 	
+	Clock::SetClock(&clock);
+	
 	log.setBase(LOGBASE, LOGEXT);
 	log.setRotation(SECOND);
 	file1 = log.getFilename();
@@ -353,7 +362,7 @@ TEST_F(LogFileTest, LogFileRotation) {
 	EXPECT_TRUE(result.length());
 	
 	// Let some time elapse so we have to roll a file
-	sleep(2);
+	clock.advance(2 * CLOCK_USEC_PER_SEC);
 	file2 = log.getFilename();
 	EXPECT_NE(file1, file2);
 	log << "foo";
@@ -361,4 +370,43 @@ TEST_F(LogFileTest, LogFileRotation) {
 	EXPECT_TRUE(result.length());
 }
 
+// A simulated day of hourly rotation
+TEST_F(LogFileTest, LogFileRotationDay) {
+	LogFile log;
+	set<string> files;
+	tm start = {0};
+
+	// 2026-01-01 00:30 local time
+	start.tm_year = 126;
+	start.tm_mday = 1;
+	start.tm_min = 30;
+	start.tm_isdst = -1;
 
+	VirtualClock clock(mktime(&start));
+	Clock::SetClock(&clock);
+
+	log.setBase(LOGBASE, LOGEXT);
+	log.setRotation(HOURLY);
+
+	// Write every ten minutes for a day
+	for(int i = 0; i < 24 * 6; i++) {
+		if(files.insert(log.getFilename()).second)
+			remove_file(log.getFilename().c_str());
+
+		log << "x";
+		log.flush();
+		clock.advance(600 * CLOCK_USEC_PER_SEC);
+	}
+	log.close();
+
+	// Every hour of the first day and the first of the second
+	EXPECT_EQ(files.size(), 25);
+	EXPECT_EQ(*files.begin(), LOGBASE ".20260101_000000." LOGEXT);
+	EXPECT_EQ(*files.rbegin(), LOGBASE ".20260102_000000." LOGEXT);
+
+	for(set<string>::iterator i = files.begin(); i != files.end(); i++) {
+		string result = read_file(i->c_str());
+		EXPECT_EQ(result, i == files.begin() ? "xxx" : (*i == *files.rbegin() ? "xxx" : "xxxxxx"));
+		remove_file(i->c_str());
+	}
+}
@@ -0,0 +1,126 @@
+#include "common/logger.h"
+#include "common/memory_budget.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace std;
+using namespace logger;
+
+class MemoryBudgetTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "         MemoryBudgetTest Start Up";
+            LOG(INFO) << "************************************************";
+        }
+};
+
+/* With no limits everything is admitted and counted */
+TEST_F(MemoryBudgetTest, Unlimited) {
+    MemoryBudget budget;
+
+    EXPECT_TRUE(budget.admit(MEMORY_CONNECTION, 1000));
+    budget.charge(MEMORY_PACKET, 500);
+
+    EXPECT_EQ(budget.used(MEMORY_CONNECTION), 1000);
+    EXPECT_EQ(budget.used(MEMORY_PACKET), 500);
+    EXPECT_EQ(budget.used(), 1500);
+
+    budget.release(MEMORY_CONNECTION, 1000);
+    EXPECT_EQ(budget.used(MEMORY_CONNECTION), 0);
+    EXPECT_EQ(budget.peak(MEMORY_CONNECTION), 1000);
+    EXPECT_EQ(budget.refused(MEMORY_CONNECTION), 0);
+}
+
+/* A subsystem limit or the total budget refuses under the drop policy */
+TEST_F(MemoryBudgetTest, Drop) {
+    MemoryBudget budget;
+
+    budget.setLimit(MEMORY_CONNECTION, 1000);
+    EXPECT_TRUE(budget.admit(MEMORY_CONNECTION, 600));
+    EXPECT_FALSE(budget.admit(MEMORY_CONNECTION, 600));
+    EXPECT_EQ(budget.used(MEMORY_CONNECTION), 600);
+    EXPECT_EQ(budget.refused(MEMORY_CONNECTION), 1);
+
+    // Other subsystems aren't held to it
+    EXPECT_TRUE(budget.admit(MEMORY_PUBLISHER, 2000));
+
+    // Unconditional charges count against the total
+    budget.setBudget(4000);
+    budget.charge(MEMORY_PACKET, 1300);
+    EXPECT_FALSE(budget.admit(MEMORY_PUBLISHER, 200));
+    EXPECT_TRUE(budget.admit(MEMORY_PUBLISHER, 100));
+    EXPECT_EQ(budget.used(), 4000);
+    EXPECT_EQ(budget.refused(MEMORY_PUBLISHER), 1);
+
+    budget.release(MEMORY_PACKET, 1300);
+    EXPECT_TRUE(budget.admit(MEMORY_PUBLISHER, 200));
+}
+
+/* The warn policy lets everything through and counts it */
+TEST_F(MemoryBudgetTest, Warn) {
+    MemoryBudget budget;
+
+    budget.setPolicy(MEMORY_POLICY_WARN);
+    budget.setBudget(100);
+
+    EXPECT_TRUE(budget.admit(MEMORY_PUBLISHER, 200));
+    EXPECT_EQ(budget.used(MEMORY_PUBLISHER), 200);
+    EXPECT_EQ(budget.overcommits(MEMORY_PUBLISHER), 1);
+    EXPECT_EQ(budget.refused(MEMORY_PUBLISHER), 0);
+
+    budget.resetStats();
+    EXPECT_EQ(budget.overcommits(MEMORY_PUBLISHER), 0);
+    EXPECT_EQ(budget.peak(MEMORY_PUBLISHER), 200);
+}
+
+/* A charge follows its buffer and is returned when it goes away */
+TEST_F(MemoryBudgetTest, Charge) {
+    MemoryBudget budget;
+
+    budget.setLimit(MEMORY_CONNECTION, 1000);
+
+    {
+        MemoryCharge charge(MEMORY_CONNECTION, budget);
+
+        EXPECT_TRUE(charge.resize(800));
+        EXPECT_FALSE(charge.resize(1200));
+        EXPECT_EQ(charge.bytes(), 800);
+        EXPECT_EQ(budget.used(MEMORY_CONNECTION), 800);
+
+        // Shrinking always works
+        EXPECT_TRUE(charge.resize(100));
+        EXPECT_EQ(budget.used(MEMORY_CONNECTION), 100);
+
+        charge.set(5000);
+        EXPECT_EQ(budget.used(MEMORY_CONNECTION), 5000);
+    }
+
+    EXPECT_EQ(budget.used(MEMORY_CONNECTION), 0);
+}
+
+/* Stats report every subsystem */
+TEST_F(MemoryBudgetTest, Stats) {
+    MemoryBudget budget;
+    string stats;
+
+    budget.setBudget(8192);
+    budget.setLimit(MEMORY_PACKET, 4096);
+    budget.charge(MEMORY_PACKET, 10);
+
+    stats = budget.stats();
+    EXPECT_NE(stats.find("memory_budget 8192\n"), string::npos);
+    EXPECT_NE(stats.find("memory_used 10\n"), string::npos);
+    EXPECT_NE(stats.find("memory_policy drop\n"), string::npos);
+    EXPECT_NE(stats.find("memory_packet_used 10\n"), string::npos);
+    EXPECT_NE(stats.find("memory_packet_limit 4096\n"), string::npos);
+    EXPECT_NE(stats.find("memory_connection_refused 0\n"), string::npos);
+    EXPECT_NE(stats.find("memory_publisher_peak 0\n"), string::npos);
+
+    EXPECT_STREQ(MemoryBudget::SubsystemName(MEMORY_CONNECTION), "connection");
+}
@@ -0,0 +1,216 @@
+#include "common/logger.h"
+#include "common/clock.h"
+#include "common/stall_watchdog.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace logger;
+
+#define SEC CLOCK_USEC_PER_SEC
+
+class StallWatchdogTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "         StallWatchdogTest Start Up";
+            LOG(INFO) << "************************************************";
+
+            Clock::SetClock(&m_oClock);
+        }
+
+        virtual void TearDown() {
+            Clock::SetClock(NULL);
+        }
+
+        // Data every interval, count times
+        void feed(StallWatchdog &watchdog, uint64_t interval, int count) {
+            for(int i = 0; i < count; i++) {
+                m_oClock.advance(interval);
+                watchdog.dataReceived();
+            }
+        }
+
+        VirtualClock m_oClock;
+};
+
+/* Off by default and nothing fires */
+TEST_F(StallWatchdogTest, Off) {
+    StallWatchdog watchdog;
+
+    EXPECT_EQ(watchdog.configuredTimeout(), 0);
+
+    feed(watchdog, SEC, 20);
+    m_oClock.advance(86400 * SEC);
+
+    EXPECT_EQ(watchdog.timeoutUsec(), 0);
+    EXPECT_EQ(watchdog.timerDelay(), 0);
+    EXPECT_FALSE(watchdog.check());
+    EXPECT_EQ(watchdog.stalls(), 0);
+}
+
+/* A fixed timeout starts with the first data */
+TEST_F(StallWatchdogTest, FixedTimeout) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(30);
+    EXPECT_EQ(watchdog.timeoutUsec(), 30 * SEC);
+
+    // Nothing to watch until data arrives
+    m_oClock.advance(3600 * SEC);
+    EXPECT_EQ(watchdog.timerDelay(), 0);
+    EXPECT_FALSE(watchdog.check());
+
+    watchdog.dataReceived();
+    EXPECT_EQ(watchdog.timerDelay(), 30 * SEC);
+
+    m_oClock.advance(29 * SEC);
+    EXPECT_EQ(watchdog.timerDelay(), 1 * SEC);
+    EXPECT_FALSE(watchdog.check());
+
+    // Data resets the deadline
+    watchdog.dataReceived();
+    m_oClock.advance(29 * SEC);
+    EXPECT_FALSE(watchdog.check());
+
+    // Setting the time of day doesn't fake a stall
+    m_oClock.set(m_oClock.usec() + 3600 * SEC);
+    EXPECT_FALSE(watchdog.check());
+
+    m_oClock.advance(1 * SEC);
+    EXPECT_TRUE(watchdog.check());
+    EXPECT_TRUE(watchdog.stalled());
+    EXPECT_EQ(watchdog.stalls(), 1);
+}
+
+/* The timeout is learned from the cadence */
+TEST_F(StallWatchdogTest, Learned) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+
+    // Still learning
+    feed(watchdog, 5 * SEC, STALL_LEARN_SAMPLES);
+    EXPECT_EQ(watchdog.timeoutUsec(), 0);
+    m_oClock.advance(600 * SEC);
+    EXPECT_FALSE(watchdog.check());
+
+    // The long gap just seen is learned too
+    watchdog.dataReceived();
+    EXPECT_EQ(watchdog.longestGapUsec(), 600 * SEC);
+    EXPECT_EQ(watchdog.timeoutUsec(), 600 * STALL_CADENCE_FACTOR * SEC);
+
+    // A fast instrument is held to the floor
+    StallWatchdog fast;
+    fast.setTimeout(STALL_TIMEOUT_AUTO);
+    feed(fast, 100000, 100);
+    EXPECT_EQ(fast.timeoutUsec(), STALL_MIN_TIMEOUT_USEC);
+
+    // A slow one gets a multiple of its cadence
+    StallWatchdog slow;
+    slow.setTimeout(STALL_TIMEOUT_AUTO);
+    feed(slow, 60 * SEC, 20);
+    EXPECT_NEAR(slow.timeoutUsec(), 240 * SEC, SEC);
+
+    m_oClock.advance(230 * SEC);
+    EXPECT_FALSE(slow.check());
+    m_oClock.advance(10 * SEC);
+    EXPECT_TRUE(slow.check());
+}
+
+/* The longest gap decays so the timeout follows a faster cadence */
+TEST_F(StallWatchdogTest, Decay) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+    feed(watchdog, 60 * SEC, 20);
+    EXPECT_NEAR(watchdog.timeoutUsec(), 240 * SEC, SEC);
+
+    feed(watchdog, 1 * SEC, 10000);
+    EXPECT_LT(watchdog.timeoutUsec(), 20 * SEC);
+    EXPECT_GE(watchdog.timeoutUsec(), STALL_MIN_TIMEOUT_USEC);
+}
+
+/* Reconnects back off while the stream stays stalled */
+TEST_F(StallWatchdogTest, Backoff) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(10);
+    watchdog.dataReceived();
+
+    m_oClock.advance(10 * SEC);
+    EXPECT_TRUE(watchdog.check());
+    EXPECT_FALSE(watchdog.check());
+
+    uint64_t expected[] = { 20, 40, 80, 80, 80 };
+    for(int i = 0; i < 5; i++) {
+        EXPECT_EQ(watchdog.timerDelay(), expected[i] * SEC);
+        m_oClock.advance(expected[i] * SEC - 1);
+        EXPECT_FALSE(watchdog.check());
+        m_oClock.advance(1);
+        EXPECT_TRUE(watchdog.check());
+    }
+
+    // Still one stall
+    EXPECT_EQ(watchdog.stalls(), 1);
+    EXPECT_EQ(watchdog.recoveries(), 0);
+}
+
+/* Data flowing again ends the stall and is measured */
+TEST_F(StallWatchdogTest, Recovery) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(10);
+    watchdog.dataReceived();
+
+    m_oClock.advance(10 * SEC);
+    EXPECT_TRUE(watchdog.check());
+
+    m_oClock.advance(2 * SEC);
+    watchdog.dataReceived();
+
+    EXPECT_FALSE(watchdog.stalled());
+    EXPECT_EQ(watchdog.recoveries(), 1);
+    EXPECT_EQ(watchdog.lastRecoveryUsec(), 2 * SEC);
+    EXPECT_EQ(watchdog.lastGapUsec(), 12 * SEC);
+
+    // The back off starts over
+    m_oClock.advance(10 * SEC);
+    EXPECT_TRUE(watchdog.check());
+    EXPECT_EQ(watchdog.timerDelay(), 20 * SEC);
+    m_oClock.advance(25 * SEC);
+    EXPECT_TRUE(watchdog.check());
+    m_oClock.advance(1 * SEC);
+    watchdog.dataReceived();
+
+    EXPECT_EQ(watchdog.stalls(), 2);
+    EXPECT_EQ(watchdog.recoveries(), 2);
+    EXPECT_EQ(watchdog.lastRecoveryUsec(), 26 * SEC);
+    EXPECT_EQ(watchdog.totalRecoveryUsec(), 28 * SEC);
+}
+
+/* Changing the timeout starts learning over but keeps the totals */
+TEST_F(StallWatchdogTest, SetTimeout) {
+    StallWatchdog watchdog;
+
+    watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+    feed(watchdog, 60 * SEC, 20);
+    EXPECT_NE(watchdog.timeoutUsec(), 0);
+
+    // Same value is a no-op
+    watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+    EXPECT_NE(watchdog.timeoutUsec(), 0);
+
+    m_oClock.advance(300 * SEC);
+    EXPECT_TRUE(watchdog.check());
+
+    watchdog.setTimeout(0);
+    watchdog.setTimeout(STALL_TIMEOUT_AUTO);
+    EXPECT_EQ(watchdog.timeoutUsec(), 0);
+    EXPECT_EQ(watchdog.lastDataUsec(), 0);
+    EXPECT_FALSE(watchdog.stalled());
+    EXPECT_EQ(watchdog.stalls(), 1);
+}
@@ -0,0 +1,151 @@
+#include "common/logger.h"
+#include "common/thread_tuning.h"
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+using namespace logger;
+
+class ThreadTuningTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "         ThreadTuningTest Start Up";
+            LOG(INFO) << "************************************************";
+        }
+
+        virtual void TearDown() {
+            ThreadTuning::SetAffinity(pthread_self(), "all");
+            ThreadTuning::UnlockStack();
+        }
+
+        // The first CPU we are allowed on
+        int firstCpu() {
+            cpu_set_t set;
+            sched_getaffinity(0, sizeof(set), &set);
+            for(int i = 0; i < CPU_SETSIZE; i++)
+                if(CPU_ISSET(i, &set))
+                    return i;
+            return 0;
+        }
+};
+
+static void * readAffinity(void *arg) {
+    *(string *)arg = ThreadTuning::Affinity(pthread_self());
+    return NULL;
+}
+
+/* CPU lists read and print the way taskset writes them */
+TEST_F(ThreadTuningTest, CpuList) {
+    cpu_set_t set;
+
+    EXPECT_TRUE(ThreadTuning::ParseCpuList("0-3,6", set));
+    EXPECT_EQ(CPU_COUNT(&set), 5);
+    EXPECT_TRUE(CPU_ISSET(6, &set));
+    EXPECT_FALSE(CPU_ISSET(4, &set));
+    EXPECT_EQ(ThreadTuning::CpuListString(set), "0-3,6");
+
+    EXPECT_TRUE(ThreadTuning::ParseCpuList("5", set));
+    EXPECT_EQ(ThreadTuning::CpuListString(set), "5");
+
+    EXPECT_TRUE(ThreadTuning::ParseCpuList("1,2,3,8-9", set));
+    EXPECT_EQ(ThreadTuning::CpuListString(set), "1-3,8-9");
+
+    EXPECT_TRUE(ThreadTuning::ParseCpuList("all", set));
+    EXPECT_EQ(CPU_COUNT(&set), CPU_SETSIZE);
+
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("3-1", set));
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("1,", set));
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("-1", set));
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("1-", set));
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("one", set));
+    EXPECT_FALSE(ThreadTuning::ParseCpuList("100000", set));
+}
+
+/* A pinned thread stays on its CPU and new threads inherit it */
+TEST_F(ThreadTuningTest, Affinity) {
+    ostringstream cpu;
+    string inherited;
+    pthread_t thread;
+
+    cpu << firstCpu();
+
+    EXPECT_TRUE(ThreadTuning::SetAffinity(pthread_self(), cpu.str()));
+    EXPECT_EQ(ThreadTuning::Affinity(pthread_self()), cpu.str());
+
+    ASSERT_EQ(pthread_create(&thread, NULL, readAffinity, &inherited), 0);
+    pthread_join(thread, NULL);
+    EXPECT_EQ(inherited, cpu.str());
+
+    // all goes back to where we started
+    EXPECT_TRUE(ThreadTuning::SetAffinity(pthread_self(), "all"));
+    EXPECT_GE(ThreadTuning::Affinity(pthread_self()).length(), cpu.str().length());
+
+    EXPECT_FALSE(ThreadTuning::SetAffinity(pthread_self(), "bad"));
+}
+
+/* Priorities past the limit are refused, 0 is always allowed */
+TEST_F(ThreadTuningTest, Realtime) {
+    EXPECT_FALSE(ThreadTuning::SetRealtime(pthread_self(), THREAD_MAX_RT_PRIORITY + 1));
+
+    // Needs privileges we may not have
+    if(ThreadTuning::SetRealtime(pthread_self(), 1)) {
+        EXPECT_EQ(ThreadTuning::RealtimePriority(pthread_self()), 1);
+    }
+
+    EXPECT_TRUE(ThreadTuning::SetRealtime(pthread_self(), 0));
+    EXPECT_EQ(ThreadTuning::RealtimePriority(pthread_self()), 0);
+}
+
+/* The locked stack is remembered per thread */
+TEST_F(ThreadTuningTest, LockStack) {
+    EXPECT_EQ(ThreadTuning::LockedStack(), 0);
+
+    // RLIMIT_MEMLOCK may be too small for us
+    if(ThreadTuning::LockStack(65536)) {
+        EXPECT_EQ(ThreadTuning::LockedStack(), 65536);
+        ThreadTuning::UnlockStack();
+    }
+
+    EXPECT_EQ(ThreadTuning::LockedStack(), 0);
+}
+
+/* Scheduler counters for the calling thread */
+TEST_F(ThreadTuningTest, Measurements) {
+    uint64_t start = ThreadTuning::MonotonicUsec();
+
+    EXPECT_EQ(ThreadTuning::ThreadId(), getpid());
+    EXPECT_EQ(ThreadTuning::RunDelayUsec(0), 0);
+
+    usleep(10000);
+    EXPECT_GE(ThreadTuning::MonotonicUsec() - start, 10000);
+}
+
+/* Wake ups are summarized and late ones counted */
+TEST_F(ThreadTuningTest, WakeLatency) {
+    WakeLatency latency;
+
+    EXPECT_EQ(latency.wakeups(), 0);
+    EXPECT_EQ(latency.meanUsec(), 0);
+
+    latency.record(100);
+    latency.record(300);
+    latency.record(WAKE_LATENCY_LATE_USEC + 1);
+
+    EXPECT_EQ(latency.wakeups(), 3);
+    EXPECT_EQ(latency.late(), 1);
+    EXPECT_EQ(latency.maxUsec(), WAKE_LATENCY_LATE_USEC + 1);
+    EXPECT_EQ(latency.lastUsec(), WAKE_LATENCY_LATE_USEC + 1);
+    EXPECT_EQ(latency.meanUsec(), (400 + WAKE_LATENCY_LATE_USEC + 1) / 3);
+
+    latency.reset();
+    EXPECT_EQ(latency.wakeups(), 0);
+    EXPECT_EQ(latency.maxUsec(), 0);
+}
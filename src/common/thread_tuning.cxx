@@ -0,0 +1,357 @@
+/*******************************************************************************
+ * Class: ThreadTuning
+ * Filename: thread_tuning.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * CPU placement, real time scheduling and memory locking.  See
+ * thread_tuning.h.
+ ******************************************************************************/
+
+#include "thread_tuning.h"
+#include "logger.h"
+
+#include <alloca.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace logger;
+
+// The CPUs we were started with, what "all" goes back to
+static cpu_set_t s_oStartAffinity;
+static pthread_once_t s_oStartAffinityOnce = PTHREAD_ONCE_INIT;
+
+static void readStartAffinity() {
+    if(sched_getaffinity(0, sizeof(s_oStartAffinity), &s_oStartAffinity))
+        ThreadTuning::ParseCpuList("all", s_oStartAffinity);
+}
+
+// The stack region each thread has locked
+static __thread char *s_pLockedStack = NULL;
+static __thread size_t s_iLockedStack = 0;
+
+/******************************************************************************
+ *   THREAD TUNING
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: ParseCpuList
+ * Description: Read a list of CPUs and ranges, e.g. "0-3,6".  "all" or ""
+ * is every CPU.
+ *
+ * Return:
+ *   false if the list is malformed or names a CPU past CPU_SETSIZE
+ ******************************************************************************/
+bool ThreadTuning::ParseCpuList(const string &list, cpu_set_t &set) {
+    const char *next = list.c_str();
+
+    CPU_ZERO(&set);
+
+    if(list.empty() || list == "all") {
+        for(int i = 0; i < CPU_SETSIZE; i++)
+            CPU_SET(i, &set);
+        return true;
+    }
+
+    while(*next) {
+        char *end;
+        long first, last;
+
+        if(! isdigit(*next))
+            return false;
+
+        first = last = strtol(next, &end, 10);
+
+        if(*end == '-') {
+            next = end + 1;
+            if(! isdigit(*next))
+                return false;
+            last = strtol(next, &end, 10);
+        }
+
+        if(last < first || last >= CPU_SETSIZE)
+            return false;
+
+        for(long i = first; i <= last; i++)
+            CPU_SET(i, &set);
+
+        if(*end == ',' && end[1])
+            end++;
+        else if(*end)
+            return false;
+
+        next = end;
+    }
+
+    return CPU_COUNT(&set) > 0;
+}
+
+/******************************************************************************
+ * Method: CpuListString
+ * Description: The shortest list for a set, ranges collapsed.
+ ******************************************************************************/
+string ThreadTuning::CpuListString(const cpu_set_t &set) {
+    ostringstream out;
+    int i = 0;
+
+    while(i < CPU_SETSIZE) {
+        int first;
+
+        if(! CPU_ISSET(i, &set)) {
+            i++;
+            continue;
+        }
+
+        first = i;
+        while(i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, &set))
+            i++;
+
+        if(out.tellp() > 0)
+            out << ",";
+        out << first;
+        if(i > first)
+            out << "-" << i;
+        i++;
+    }
+
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: SetAffinity
+ * Description: Restrict a thread to a set of CPUs.  CPUs we don't have are
+ * dropped, the kernel refuses a set with none we have.  "all" is the CPUs
+ * the process was started on, e.g. by taskset, as of the first call.
+ ******************************************************************************/
+bool ThreadTuning::SetAffinity(pthread_t thread, const string &cpus) {
+    cpu_set_t set;
+    int result;
+
+    pthread_once(&s_oStartAffinityOnce, readStartAffinity);
+
+    if(! ParseCpuList(cpus, set)) {
+        LOG(ERROR) << "invalid cpu list: " << cpus;
+        return false;
+    }
+
+    if(cpus.empty() || cpus == "all")
+        set = s_oStartAffinity;
+
+    result = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if(result) {
+        LOG(ERROR) << "failed to set cpu affinity " << cpus << ": " << strerror(result);
+        return false;
+    }
+
+    LOG(INFO) << "cpu affinity set to " << cpus;
+    return true;
+}
+
+/******************************************************************************
+ * Method: Affinity
+ * Description: The CPUs a thread may run on.
+ ******************************************************************************/
+string ThreadTuning::Affinity(pthread_t thread) {
+    cpu_set_t set;
+
+    if(pthread_getaffinity_np(thread, sizeof(set), &set))
+        return "";
+
+    return CpuListString(set);
+}
+
+/******************************************************************************
+ * Method: SetRealtime
+ * Description: Run a thread under SCHED_FIFO.
+ *
+ * Parameters:
+ *   priority - 1 to THREAD_MAX_RT_PRIORITY, 0 for SCHED_OTHER
+ ******************************************************************************/
+bool ThreadTuning::SetRealtime(pthread_t thread, uint32_t priority) {
+    struct sched_param param;
+    int policy = priority ? SCHED_FIFO : SCHED_OTHER;
+    int result;
+
+    if(priority > THREAD_MAX_RT_PRIORITY) {
+        LOG(ERROR) << "real time priority " << priority << " above " << THREAD_MAX_RT_PRIORITY;
+        return false;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    result = pthread_setschedparam(thread, policy, &param);
+    if(result) {
+        LOG(ERROR) << "failed to set real time priority " << priority << ": " << strerror(result);
+        return false;
+    }
+
+    LOG(INFO) << "real time priority set to " << priority;
+    return true;
+}
+
+/******************************************************************************
+ * Method: RealtimePriority
+ * Description: A thread's SCHED_FIFO priority, 0 under any other policy.
+ ******************************************************************************/
+uint32_t ThreadTuning::RealtimePriority(pthread_t thread) {
+    struct sched_param param;
+    int policy;
+
+    if(pthread_getschedparam(thread, &policy, &param) || policy != SCHED_FIFO)
+        return 0;
+
+    return param.sched_priority;
+}
+
+/******************************************************************************
+ * Method: Lock
+ * Description: Keep a buffer in memory.
+ ******************************************************************************/
+bool ThreadTuning::Lock(const void *address, size_t size) {
+    if(mlock(address, size)) {
+        LOG(ERROR) << "failed to lock " << size << " bytes: " << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: Unlock
+ ******************************************************************************/
+void ThreadTuning::Unlock(const void *address, size_t size) {
+    munlock(address, size);
+}
+
+/******************************************************************************
+ * Method: LockStack
+ * Description: Touch size bytes of stack below the caller so the pages are
+ * there, then lock them.  They stay locked after we return.
+ ******************************************************************************/
+bool ThreadTuning::LockStack(size_t size) {
+    char *stack;
+
+    UnlockStack();
+
+    stack = (char *)alloca(size);
+    memset(stack, 0, size);
+
+    if(! Lock(stack, size))
+        return false;
+
+    s_pLockedStack = stack;
+    s_iLockedStack = size;
+
+    LOG(INFO) << "locked " << size << " bytes of stack";
+    return true;
+}
+
+/******************************************************************************
+ * Method: UnlockStack
+ ******************************************************************************/
+void ThreadTuning::UnlockStack() {
+    if(! s_pLockedStack)
+        return;
+
+    Unlock(s_pLockedStack, s_iLockedStack);
+    s_pLockedStack = NULL;
+    s_iLockedStack = 0;
+}
+
+/******************************************************************************
+ * Method: LockedStack
+ * Description: Bytes of the calling thread's stack locked by LockStack.
+ ******************************************************************************/
+size_t ThreadTuning::LockedStack() {
+    return s_iLockedStack;
+}
+
+/******************************************************************************
+ * Method: ThreadId
+ ******************************************************************************/
+pid_t ThreadTuning::ThreadId() {
+    return syscall(SYS_gettid);
+}
+
+/******************************************************************************
+ * Method: RunDelayUsec
+ * Description: The second field of the thread's schedstat, nanoseconds
+ * spent on a run queue.
+ ******************************************************************************/
+uint64_t ThreadTuning::RunDelayUsec(pid_t tid) {
+    ostringstream path;
+    uint64_t running = 0, waiting = 0;
+
+    path << "/proc/self/task/" << tid << "/schedstat";
+
+    ifstream in(path.str().c_str());
+    if(! (in >> running >> waiting))
+        return 0;
+
+    return waiting / 1000;
+}
+
+/******************************************************************************
+ * Method: InvoluntarySwitches
+ ******************************************************************************/
+uint64_t ThreadTuning::InvoluntarySwitches() {
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_THREAD, &usage))
+        return 0;
+
+    return usage.ru_nivcsw;
+}
+
+/******************************************************************************
+ * Method: MonotonicUsec
+ ******************************************************************************/
+uint64_t ThreadTuning::MonotonicUsec() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/******************************************************************************
+ *   WAKE LATENCY
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: record
+ * Description: Count one timed wake up.
+ ******************************************************************************/
+void WakeLatency::record(uint64_t lateUsec) {
+    m_iWakeups++;
+    m_iTotal += lateUsec;
+    m_iLast = lateUsec;
+
+    if(lateUsec > m_iMax)
+        m_iMax = lateUsec;
+
+    if(lateUsec > WAKE_LATENCY_LATE_USEC)
+        m_iLate++;
+}
+
+/******************************************************************************
+ * Method: reset
+ ******************************************************************************/
+void WakeLatency::reset() {
+    m_iWakeups = 0;
+    m_iLate = 0;
+    m_iTotal = 0;
+    m_iMax = 0;
+    m_iLast = 0;
+}
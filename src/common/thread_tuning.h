@@ -0,0 +1,143 @@
+/*******************************************************************************
+ * Class: ThreadTuning
+ * Filename: thread_tuning.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Keep the threads that read instruments on the CPU.  On a shared node a
+ * busy neighbour can hold the agent off long enough for a serial FIFO to
+ * overrun.  Three controls help:
+ *
+ *  * CPU affinity - pin a thread to a set of CPUs, given as a list like
+ *    "0-3,6".  "all" or an empty list allows every CPU.
+ *  * SCHED_FIFO - run a thread ahead of normal processes at a priority no
+ *    higher than THREAD_MAX_RT_PRIORITY, below the kernel's interrupt
+ *    threads.
+ *  * mlock - keep hot buffers and a thread's stack out of swap so a read
+ *    never waits on a page fault.
+ *
+ * Raising priority and locking memory need CAP_SYS_NICE and CAP_IPC_LOCK
+ * or matching rlimits.  Failures are logged and reported, the thread just
+ * carries on as it was.
+ *
+ * WakeLatency keeps how late a thread woke from a timed sleep, a direct
+ * measure of scheduling delay.  RunDelayUsec reads the time a thread sat
+ * runnable waiting for a CPU from /proc.
+ *
+ * Usage:
+ *
+ * ThreadTuning::SetAffinity(pthread_self(), "2-3");
+ * ThreadTuning::SetRealtime(pthread_self(), 10);
+ * ThreadTuning::LockStack(THREAD_LOCK_STACK_SIZE);
+ *
+ * WakeLatency latency;
+ * latency.record(woke - deadline);
+ *
+ ******************************************************************************/
+
+#ifndef __THREAD_TUNING_H_
+#define __THREAD_TUNING_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+using namespace std;
+
+// Highest SCHED_FIFO priority we'll set.  Kernel interrupt threads run at 50.
+#define THREAD_MAX_RT_PRIORITY 49
+
+// Stack locked for a thread when memory locking is on
+#define THREAD_LOCK_STACK_SIZE 262144
+
+// Wake ups later than this count as late
+#define WAKE_LATENCY_LATE_USEC 1000
+
+class ThreadTuning {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+
+        /* CPU sets */
+
+        // Parse a CPU list, false if malformed or past CPU_SETSIZE
+        static bool ParseCpuList(const string &list, cpu_set_t &set);
+        static string CpuListString(const cpu_set_t &set);
+
+        // Pin a thread, "" or "all" for every CPU
+        static bool SetAffinity(pthread_t thread, const string &cpus);
+        static string Affinity(pthread_t thread);
+
+        /* Scheduling */
+
+        // SCHED_FIFO at priority, 0 goes back to SCHED_OTHER
+        static bool SetRealtime(pthread_t thread, uint32_t priority);
+
+        // Current SCHED_FIFO priority, 0 if not real time
+        static uint32_t RealtimePriority(pthread_t thread);
+
+        /* Memory */
+        static bool Lock(const void *address, size_t size);
+        static void Unlock(const void *address, size_t size);
+
+        // Fault in and lock size bytes of the calling thread's stack below
+        // this call.  Only one region per thread is kept locked.
+        static bool LockStack(size_t size);
+        static void UnlockStack();
+        static size_t LockedStack();
+
+        /* Measurements */
+
+        // Kernel id of the calling thread
+        static pid_t ThreadId();
+
+        // Microseconds a thread has waited runnable for a CPU, 0 if unknown
+        static uint64_t RunDelayUsec(pid_t tid);
+
+        // Times the calling thread was switched out while still runnable
+        static uint64_t InvoluntarySwitches();
+
+        // Monotonic microseconds for measuring sleeps
+        static uint64_t MonotonicUsec();
+};
+
+class WakeLatency {
+    /********************
+     *      METHODS     *
+     ********************/
+
+    public:
+        ///////////////////////
+        // Public Methods
+        WakeLatency() { reset(); }
+
+        // A timed sleep ended lateUsec after its deadline
+        void record(uint64_t lateUsec);
+        void reset();
+
+        uint64_t wakeups() { return m_iWakeups; }
+        uint64_t late() { return m_iLate; }
+        uint64_t maxUsec() { return m_iMax; }
+        uint64_t lastUsec() { return m_iLast; }
+        uint64_t meanUsec() { return m_iWakeups ? m_iTotal / m_iWakeups : 0; }
+
+    /********************
+     *      MEMBERS     *
+     ********************/
+
+    private:
+        uint64_t m_iWakeups;
+        uint64_t m_iLate;
+        uint64_t m_iTotal;
+        uint64_t m_iMax;
+        uint64_t m_iLast;
+};
+
+#endif //__THREAD_TUNING_H_
@@ -1,4 +1,5 @@
 #include "timestamp.h"
+#include "clock.h"
 #include "logger.h"
 #include "util.h"
 
@@ -21,7 +22,7 @@ Timestamp::Timestamp() {
 
 void Timestamp::setNow() {
     struct timeval now;
-    gettimeofday(&now, NULL);
+    Clock::Now(now);
     setTime(&now);
 }
 
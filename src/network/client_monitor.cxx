@@ -0,0 +1,312 @@
+/*******************************************************************************
+ * Class: ClientMonitor
+ * Filename: client_monitor.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Slow TCP client detection.  See client_monitor.h.
+ ******************************************************************************/
+
+#include "client_monitor.h"
+#include "common/logger.h"
+#include "common/clock.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace logger;
+using namespace network;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: No client and no limit.
+ ******************************************************************************/
+ClientMonitor::ClientMonitor() {
+    pthread_mutex_init(&m_oLock, NULL);
+
+    m_iQueueLimit = 0;
+    m_ePolicy = SLOW_CLIENT_DECIMATE;
+    m_iPeakQueued = 0;
+    m_iSamples = 0;
+    m_iDropped = 0;
+    m_iSlowEpisodes = 0;
+    m_iEvictions = 0;
+
+    start(0);
+}
+
+/******************************************************************************
+ * Method: Copy Constructor
+ * Description: Copy the policy.  The client stays with the original.
+ ******************************************************************************/
+ClientMonitor::ClientMonitor(const ClientMonitor &rhs) {
+    pthread_mutex_init(&m_oLock, NULL);
+
+    m_iPeakQueued = 0;
+    m_iSamples = 0;
+    m_iDropped = 0;
+    m_iSlowEpisodes = 0;
+    m_iEvictions = 0;
+
+    start(0);
+    *this = rhs;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ ******************************************************************************/
+ClientMonitor::~ClientMonitor() {
+    pthread_mutex_destroy(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: Assignment operator
+ * Description: Copy the policy.  The client stays with the original.
+ ******************************************************************************/
+ClientMonitor & ClientMonitor::operator=(const ClientMonitor &rhs) {
+    m_iQueueLimit = rhs.m_iQueueLimit;
+    m_ePolicy = rhs.m_ePolicy;
+    return *this;
+}
+
+/******************************************************************************
+ * Method: setPolicy
+ * Description: Set when a client is slow and what to do about it.
+ *
+ * Parameters:
+ *   queueLimit - bytes the client may leave in our send queue, 0 to only
+ *                keep samples
+ *   policy - decimate or evict a slow client
+ ******************************************************************************/
+void ClientMonitor::setPolicy(uint32_t queueLimit, SlowClientPolicy policy) {
+    pthread_mutex_lock(&m_oLock);
+    m_iQueueLimit = queueLimit;
+    m_ePolicy = policy;
+    pthread_mutex_unlock(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: start
+ * Description: Watch a new client.  What was learned about the last one is
+ * dropped, the totals are kept.
+ *
+ * Parameters:
+ *   fd - client socket, 0 for none
+ ******************************************************************************/
+void ClientMonitor::start(int fd) {
+    pthread_mutex_lock(&m_oLock);
+    m_iFD = fd;
+    m_iLastSample = 0;
+    m_iRtt = 0;
+    m_iUnacked = 0;
+    m_iQueued = 0;
+    m_iSlowSince = 0;
+    m_iWrites = 0;
+    pthread_mutex_unlock(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: admit
+ * Description: Decide what to do with the next write, sampling the socket if
+ * the last sample is old.  Control writes are never decimated, a slow
+ * client still gets its faults and command replies, but can be evicted.
+ *
+ * Parameters:
+ *   control - the write is control traffic rather than bulk data
+ * Return:
+ *   CLIENT_SEND to write, CLIENT_DROP to skip the write or CLIENT_EVICT to
+ *   close the client
+ ******************************************************************************/
+ClientAction ClientMonitor::admit(bool control) {
+    ClientAction action = CLIENT_SEND;
+    uint64_t now;
+
+    pthread_mutex_lock(&m_oLock);
+
+    if(m_iFD <= 0) {
+        pthread_mutex_unlock(&m_oLock);
+        return CLIENT_SEND;
+    }
+
+    now = Clock::MonotonicUsec();
+    if(now >= m_iLastSample + CLIENT_SAMPLE_USEC)
+        sample(now);
+
+    if(m_iSlowSince) {
+        if(m_ePolicy == SLOW_CLIENT_EVICT ||
+           m_iQueued >= (uint64_t)m_iQueueLimit * CLIENT_EVICT_FACTOR ||
+           now >= m_iSlowSince + CLIENT_EVICT_USEC) {
+            LOG(WARNING) << "evicting slow client FD: " << m_iFD
+                         << " queued: " << m_iQueued
+                         << " rtt usec: " << m_iRtt
+                         << " slow for ms: " << (now - m_iSlowSince) / 1000;
+            m_iEvictions++;
+            action = CLIENT_EVICT;
+        }
+        else if(! control && m_iWrites++ % CLIENT_DECIMATE_RATIO) {
+            m_iDropped++;
+            action = CLIENT_DROP;
+        }
+    }
+
+    pthread_mutex_unlock(&m_oLock);
+    return action;
+}
+
+/******************************************************************************
+ * Method: sample
+ * Description: Read the client socket state now.
+ * Return:
+ *   false if there is no client or the socket couldn't be read
+ ******************************************************************************/
+bool ClientMonitor::sample() {
+    bool result;
+
+    pthread_mutex_lock(&m_oLock);
+    result = m_iFD > 0 && sample(Clock::MonotonicUsec());
+    pthread_mutex_unlock(&m_oLock);
+
+    return result;
+}
+
+/******************************************************************************
+ * Accessors
+ * Description: Read under the lock, publisher threads update these.
+ ******************************************************************************/
+bool ClientMonitor::slow() {
+    bool result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iSlowSince != 0;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::rttUsec() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iRtt;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::unacked() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iUnacked;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::queued() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iQueued;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::peakQueued() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iPeakQueued;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint64_t ClientMonitor::samples() {
+    uint64_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iSamples;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint64_t ClientMonitor::dropped() {
+    uint64_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iDropped;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::slowEpisodes() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iSlowEpisodes;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+uint32_t ClientMonitor::evictions() {
+    uint32_t result;
+    pthread_mutex_lock(&m_oLock);
+    result = m_iEvictions;
+    pthread_mutex_unlock(&m_oLock);
+    return result;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: sample
+ * Description: Read TCP_INFO and the send queue and work out if the client
+ * is slow.  Called with the lock held.
+ *
+ * Parameters:
+ *   now - current time in microseconds
+ * Return:
+ *   false if the socket couldn't be read
+ ******************************************************************************/
+bool ClientMonitor::sample(uint64_t now) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    int queued = 0;
+
+    m_iLastSample = now;
+
+    if(getsockopt(m_iFD, IPPROTO_TCP, TCP_INFO, &info, &length) < 0 ||
+       ioctl(m_iFD, SIOCOUTQ, &queued) < 0) {
+        LOG(DEBUG) << "client sample failed FD: " << m_iFD << " " << strerror(errno);
+        return false;
+    }
+
+    m_iRtt = info.tcpi_rtt;
+    m_iUnacked = info.tcpi_unacked;
+    m_iQueued = queued;
+    if(m_iQueued > m_iPeakQueued)
+        m_iPeakQueued = m_iQueued;
+    m_iSamples++;
+
+    LOG(DEBUG2) << "client FD: " << m_iFD << " rtt usec: " << m_iRtt
+                << " unacked: " << m_iUnacked << " queued: " << m_iQueued;
+
+    if(! m_iQueueLimit)
+        return true;
+
+    if(! m_iSlowSince && m_iQueued >= m_iQueueLimit) {
+        LOG(WARNING) << "slow client FD: " << m_iFD << " queued: " << m_iQueued
+                     << " limit: " << m_iQueueLimit << " rtt usec: " << m_iRtt;
+        m_iSlowSince = now;
+        m_iWrites = 0;
+        m_iSlowEpisodes++;
+    }
+    else if(m_iSlowSince && m_iQueued < m_iQueueLimit / 2) {
+        LOG(INFO) << "slow client FD: " << m_iFD << " caught up after ms: "
+                  << (now - m_iSlowSince) / 1000;
+        m_iSlowSince = 0;
+    }
+
+    return true;
+}
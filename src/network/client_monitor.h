@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * Class: ClientMonitor
+ * Filename: client_monitor.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Watch a TCP client we write to and decide what to do with the next write
+ * when it can't keep up.  Without this a slow client is only noticed when a
+ * write fails, after its socket buffer is full and the writer has blocked
+ * or data has been lost.
+ *
+ * Before a write the socket is sampled, at most every CLIENT_SAMPLE_USEC:
+ * TCP_INFO for the round trip time and unacknowledged segments and
+ * SIOCOUTQ for the bytes the client hasn't taken yet.  When the queued
+ * bytes pass the limit the client is slow.  The policy then either
+ * decimates, passing one write in CLIENT_DECIMATE_RATIO, or evicts the
+ * client.  A decimated client that stays slow for CLIENT_EVICT_USEC or
+ * backs up to CLIENT_EVICT_FACTOR times the limit is evicted too.  The
+ * client is well again once its queue is under half the limit.
+ *
+ * Whole writes are dropped so a decimated client still sees complete
+ * packets.  Only bulk writes are dropped, control writes always go.
+ * Samples are kept with no limit set so the numbers can be reported either
+ * way.
+ *
+ * Usage:
+ *
+ * ClientMonitor monitor;
+ * monitor.setPolicy(262144, SLOW_CLIENT_DECIMATE);
+ * monitor.start(clientFD);
+ *
+ * // before every write
+ * switch(monitor.admit()) {
+ *     case CLIENT_SEND:  write(...); break;
+ *     case CLIENT_DROP:  break;
+ *     case CLIENT_EVICT: close(clientFD); monitor.stop(); break;
+ * }
+ *
+ ******************************************************************************/
+
+#ifndef __CLIENT_MONITOR_H_
+#define __CLIENT_MONITOR_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Shortest time between samples of the client socket
+#define CLIENT_SAMPLE_USEC 100000
+
+// A slow client being decimated gets one write in this many
+#define CLIENT_DECIMATE_RATIO 4
+
+// Longest a client may stay slow before it is evicted
+#define CLIENT_EVICT_USEC 5000000
+
+// Queued bytes, as a multiple of the limit, that evict a client right away
+#define CLIENT_EVICT_FACTOR 4
+
+namespace network {
+    typedef enum {
+        SLOW_CLIENT_DECIMATE = 0,
+        SLOW_CLIENT_EVICT    = 1
+    } SlowClientPolicy;
+
+    typedef enum {
+        CLIENT_SEND  = 0,
+        CLIENT_DROP  = 1,
+        CLIENT_EVICT = 2
+    } ClientAction;
+
+    class ClientMonitor {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            ClientMonitor();
+            ClientMonitor(const ClientMonitor &rhs);
+            virtual ~ClientMonitor();
+
+            ClientMonitor & operator=(const ClientMonitor &rhs);
+
+            // Queued bytes that make a client slow, 0 to never act, and what
+            // to do about it
+            void setPolicy(uint32_t queueLimit, SlowClientPolicy policy);
+            uint32_t queueLimit() { return m_iQueueLimit; }
+            SlowClientPolicy policy() { return m_ePolicy; }
+
+            // Watch a new client, or none
+            void start(int fd);
+            void stop() { start(0); }
+
+            // What to do with the next write.  Control writes aren't dropped.
+            ClientAction admit(bool control = false);
+
+            // Read the socket state now
+            bool sample();
+
+            /* Last sample */
+            bool slow();
+            uint32_t rttUsec();
+            uint32_t unacked();
+            uint32_t queued();
+            uint32_t peakQueued();
+
+            /* Totals for every client */
+            uint64_t samples();
+            uint64_t dropped();
+            uint32_t slowEpisodes();
+            uint32_t evictions();
+
+        private:
+            bool sample(uint64_t now);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            uint32_t m_iQueueLimit;
+            SlowClientPolicy m_ePolicy;
+
+            int m_iFD;
+            uint64_t m_iLastSample;
+
+            // Last sample
+            uint32_t m_iRtt;
+            uint32_t m_iUnacked;
+            uint32_t m_iQueued;
+            uint32_t m_iPeakQueued;
+
+            // Slow since, 0 if keeping up
+            uint64_t m_iSlowSince;
+            uint32_t m_iWrites;
+
+            // Totals
+            uint64_t m_iSamples;
+            uint64_t m_iDropped;
+            uint32_t m_iSlowEpisodes;
+            uint32_t m_iEvictions;
+
+            // Publisher threads admit writes while the main loop reports
+            pthread_mutex_t m_oLock;
+    };
+}
+
+#endif //__CLIENT_MONITOR_H_
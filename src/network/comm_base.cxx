@@ -14,6 +14,12 @@
 #include "common/logger.h"
 #include "common/exception.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <errno.h>
 
 
 using namespace std;
@@ -32,6 +38,9 @@ CommBase::CommBase() {
     // Default behavior for sockets is non-blocking
     m_bBlocking = false;
     m_bConnected = false;
+    m_eSocketProfile = SOCKET_PROFILE_DEFAULT;
+    m_iSocketBufferSize = 0;
+    m_iKeepalive = 0;
 }
 
 
@@ -40,6 +49,9 @@ CommBase::CommBase() {
  * Description: Copy constructor.
  ******************************************************************************/
 CommBase::CommBase(const CommBase &rhs) {
+    m_eSocketProfile = rhs.m_eSocketProfile;
+    m_iSocketBufferSize = rhs.m_iSocketBufferSize;
+    m_iKeepalive = rhs.m_iKeepalive;
 }
 
 
@@ -56,6 +68,9 @@ CommBase::~CommBase() {
  * Description: overloaded assignment operator.
  ******************************************************************************/
 CommBase & CommBase::operator=(const CommBase &rhs) {
+    m_eSocketProfile = rhs.m_eSocketProfile;
+    m_iSocketBufferSize = rhs.m_iSocketBufferSize;
+    m_iKeepalive = rhs.m_iKeepalive;
 	return *this;
 }
 
@@ -68,3 +83,157 @@ bool CommBase::operator==(CommBase &rhs) {
 	throw NotImplemented();
 }
 
+/******************************************************************************
+ *   PROTECTED METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: applySocketProfile
+ * Description: Set the socket options for the configured profile.  Options
+ * the kernel refuses (busy polling needs CAP_NET_ADMIN above the sysctl
+ * default) are logged and skipped so the socket is still usable.
+ *
+ * Parameters:
+ *   fd - socket to configure
+ * Return:
+ *   true if all options were applied
+ ******************************************************************************/
+bool CommBase::applySocketProfile(int fd) {
+    bool tcp = type() == COMM_TCP_SOCKET || type() == COMM_TCP_LISTENER;
+    uint32_t bufferSize = m_iSocketBufferSize;
+    bool result = true;
+    int optval;
+
+    if(fd <= 0)
+        return false;
+
+    if(m_eSocketProfile == SOCKET_PROFILE_LATENCY) {
+        LOG(DEBUG2) << "apply latency socket profile to fd: " << fd;
+
+        if(tcp) {
+            optval = 1;
+            if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
+                LOG(ERROR) << "setsockopt TCP_NODELAY failed: " << strerror(errno);
+                result = false;
+            }
+
+            quickAck(fd);
+
+#ifdef TCP_NOTSENT_LOWAT
+            optval = LATENCY_NOTSENT_LOWAT;
+            if(setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &optval, sizeof(optval)) < 0) {
+                LOG(ERROR) << "setsockopt TCP_NOTSENT_LOWAT failed: " << strerror(errno);
+                result = false;
+            }
+#endif
+        }
+
+#ifdef SO_BUSY_POLL
+        optval = LATENCY_BUSY_POLL_USEC;
+        if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)) < 0) {
+            LOG(INFO) << "setsockopt SO_BUSY_POLL not applied: " << strerror(errno);
+            result = false;
+        }
+#endif
+    }
+
+    else if(m_eSocketProfile == SOCKET_PROFILE_BULK) {
+        LOG(DEBUG2) << "apply bulk socket profile to fd: " << fd;
+        if(! bufferSize)
+            bufferSize = BULK_SOCKET_BUFFER_SIZE;
+    }
+
+    if(tcp && m_iKeepalive && ! applyKeepalive(fd))
+        result = false;
+
+    if(bufferSize) {
+        optval = bufferSize;
+        if(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)) < 0) {
+            LOG(ERROR) << "setsockopt SO_SNDBUF failed: " << strerror(errno);
+            result = false;
+        }
+
+        if(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval)) < 0) {
+            LOG(ERROR) << "setsockopt SO_RCVBUF failed: " << strerror(errno);
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Method: applyKeepalive
+ * Description: Probe a peer that has been silent for the keepalive time and
+ * drop it after KEEPALIVE_PROBES go unanswered.  TCP_USER_TIMEOUT drops it
+ * as quickly if our own data goes unacknowledged, which keepalive alone
+ * doesn't cover.  Either way the next read fails and we reconnect instead
+ * of waiting on a peer that is gone.
+ *
+ * Parameters:
+ *   fd - socket to configure
+ * Return:
+ *   true if all options were applied
+ ******************************************************************************/
+bool CommBase::applyKeepalive(int fd) {
+    int interval = m_iKeepalive / KEEPALIVE_PROBES ? m_iKeepalive / KEEPALIVE_PROBES : 1;
+    bool result = true;
+    int optval = 1;
+
+    LOG(DEBUG2) << "keepalive: " << m_iKeepalive << "s interval: " << interval << "s fd: " << fd;
+
+    if(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) < 0) {
+        LOG(ERROR) << "setsockopt SO_KEEPALIVE failed: " << strerror(errno);
+        return false;
+    }
+
+#ifdef TCP_KEEPIDLE
+    optval = m_iKeepalive;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &optval, sizeof(optval)) < 0) {
+        LOG(ERROR) << "setsockopt TCP_KEEPIDLE failed: " << strerror(errno);
+        result = false;
+    }
+
+    optval = interval;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &optval, sizeof(optval)) < 0) {
+        LOG(ERROR) << "setsockopt TCP_KEEPINTVL failed: " << strerror(errno);
+        result = false;
+    }
+
+    optval = KEEPALIVE_PROBES;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &optval, sizeof(optval)) < 0) {
+        LOG(ERROR) << "setsockopt TCP_KEEPCNT failed: " << strerror(errno);
+        result = false;
+    }
+#endif
+
+#ifdef TCP_USER_TIMEOUT
+    optval = (m_iKeepalive + interval * KEEPALIVE_PROBES) * 1000;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &optval, sizeof(optval)) < 0) {
+        LOG(ERROR) << "setsockopt TCP_USER_TIMEOUT failed: " << strerror(errno);
+        result = false;
+    }
+#endif
+
+    return result;
+}
+
+/******************************************************************************
+ * Method: quickAck
+ * Description: Ack immediately instead of waiting to piggyback on a reply.
+ * Only applies to TCP sockets using the latency profile.
+ ******************************************************************************/
+void CommBase::quickAck(int fd) {
+#ifdef TCP_QUICKACK
+    int optval = 1;
+
+    if(m_eSocketProfile != SOCKET_PROFILE_LATENCY || fd <= 0)
+        return;
+
+    if(type() != COMM_TCP_SOCKET && type() != COMM_TCP_LISTENER)
+        return;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &optval, sizeof(optval)) < 0)
+        LOG(DEBUG) << "setsockopt TCP_QUICKACK failed: " << strerror(errno);
+#endif
+}
@@ -15,19 +15,41 @@
 #include "common/logger.h"
 
 #include <stdint.h>
+#include <sys/select.h>
 
 using namespace std;
 using namespace logger;
 
+// Socket profile tuning
+#define LATENCY_BUSY_POLL_USEC   50
+#define LATENCY_NOTSENT_LOWAT    16384
+#define BULK_SOCKET_BUFFER_SIZE  1048576
+
+// Unanswered keepalive probes before a silent TCP peer is dropped
+#define KEEPALIVE_PROBES 3
+
 namespace network {
+    class FDHandoff;
+    
     typedef enum CommType {
         COMM_UNKNOWN,
         COMM_TCP_LISTENER,
         COMM_TCP_SOCKET,
         COMM_UDP_SOCKET,
-        COMM_SERIAL_SOCKET
+        COMM_SERIAL_SOCKET,
+        COMM_DUPLEX_SOCKET
     } CommType;
     
+    // Socket option sets applied when a socket is created.
+    //   default - leave the kernel defaults alone
+    //   latency - no nagle, quick acks and busy polling for small exchanges
+    //   bulk    - large buffers for streaming data
+    typedef enum SocketProfile {
+        SOCKET_PROFILE_DEFAULT = 0,
+        SOCKET_PROFILE_LATENCY = 1,
+        SOCKET_PROFILE_BULK    = 2
+    } SocketProfile;
+    
     class CommBase {
         /********************
          *      METHODS     *
@@ -48,6 +70,9 @@ namespace network {
 
             /* Accessors */
             bool blocking() {return m_bBlocking;}
+            SocketProfile socketProfile() { return m_eSocketProfile; }
+            uint32_t socketBufferSize() { return m_iSocketBufferSize; }
+            uint32_t keepalive() { return m_iKeepalive; }
             virtual bool connected() = 0;
             virtual CommType type() = 0;
             
@@ -55,18 +80,71 @@ namespace network {
             
             /* Methods */
             void setBlocking(bool block) {m_bBlocking = block;}
+            void setSocketProfile(SocketProfile profile) { m_eSocketProfile = profile; }
+            void setSocketBufferSize(uint32_t size) { m_iSocketBufferSize = size; }
+
+            // Seconds a TCP peer may be silent before it is probed, 0 for
+            // the kernel default of no keepalive
+            void setKeepalive(uint32_t seconds) { m_iKeepalive = seconds; }
             virtual bool initialize() = 0;
             virtual bool connectClient() = 0;
 	    
             virtual uint32_t writeData(const char *buffer, uint32_t size) = 0;
             virtual uint32_t readData(char *buffer, uint32_t size) = 0;
+
+            // Control traffic like command replies, faults and heartbeats.
+            // Sockets that queue writes send it ahead of queued data.
+            virtual uint32_t writeControl(const char *buffer, uint32_t size) { return writeData(buffer, size); }
             
             virtual uint16_t getListenPort() { return 0; }
 
+            // fds to select on for reads and writes, 0 if not connected
+            virtual int readFD() { return 0; }
+            virtual int writeFD() { return 0; }
+
+            // Queued writes.  Sockets that buffer outbound data override
+            // these so the caller can drain them when the fd is writable.
+            virtual bool writePending() { return false; }
+            virtual uint32_t writeDelay() { return 0; }
+            virtual uint32_t flushWriteQueue() { return 0; }
+
+            // Connects in progress.  Sockets that connect without blocking
+            // add their fds so the caller can select for write, then hand
+            // back the writable set to finish the connects.
+            virtual void addConnectFDs(int &maxFD, fd_set &writeFDs) {}
+            virtual void handleConnectFDs(const fd_set &writeFDs) {}
+
+            // Data already taken off the socket but not yet read, like an
+            // io_uring receive.  A live upgrade stops reading ahead and
+            // drains this before the socket is handed over.
+            virtual void stopReadAhead() {}
+            virtual bool readPending() { return false; }
+
+            // Add our open descriptors to a live upgrade handoff
+            virtual void handoffFDs(FDHandoff &handoff) {}
+
+            // Work scheduled for later instead of blocking the caller, like
+            // ending a serial break or retrying an open.  timerDelay is
+            // microseconds until the next timer, 0 if none are set.
+            // eventFD is an extra fd to select on for reads that should
+            // wake the caller to runTimers.
+            virtual uint32_t timerDelay() { return 0; }
+            virtual void runTimers() {}
+            virtual int eventFD() { return 0; }
+
 
 
 
         protected:
+            // Apply the socket profile to a newly created socket
+            bool applySocketProfile(int fd);
+
+            // Keepalive probes and a matching TCP_USER_TIMEOUT
+            bool applyKeepalive(int fd);
+            
+            // Quick acks get cleared by the kernel so they are reset after
+            // every read.
+            void quickAck(int fd);
 
         private:
         
@@ -76,6 +154,9 @@ namespace network {
         
         private:
             bool m_bBlocking;
+            SocketProfile m_eSocketProfile;
+            uint32_t m_iSocketBufferSize;
+            uint32_t m_iKeepalive;
             
         protected:
             bool m_bConnected;
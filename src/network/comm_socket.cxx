@@ -12,6 +12,7 @@
 #include "common/util.h"
 #include "common/logger.h"
 #include "common/exception.h"
+#include "common/probe.h"
 
 #include <netinet/in.h>
 #include <netdb.h>
@@ -38,6 +39,8 @@ using namespace network;
 CommSocket::CommSocket() {
     m_pSocketFD = 0;
 	m_iPort = 0;
+	m_pRingReader = NULL;
+	m_bRingReads = true;
 }
 
 
@@ -49,6 +52,8 @@ CommSocket::CommSocket(const CommSocket &rhs) {
 	m_pSocketFD = rhs.m_pSocketFD;
 	m_iPort = rhs.m_iPort;
 	m_sHostname = rhs.m_sHostname;
+	m_pRingReader = NULL;
+	m_bRingReads = rhs.m_bRingReads;
 }
 
 
@@ -57,6 +62,7 @@ CommSocket::CommSocket(const CommSocket &rhs) {
  * Description: destructor.
  ******************************************************************************/
 CommSocket::~CommSocket() {
+    stopRingReader();
 }
 
 
@@ -101,10 +107,13 @@ bool CommSocket::disconnect() {
     if(!m_pSocketFD)
         return true;
 
+    stopRingReader();
+
     LOG(DEBUG) << "Shutdown socket";
     shutdown(m_pSocketFD, 1);
     
     LOG(DEBUG) << "Close socket";
+    PROBE1(socket__close, m_pSocketFD);
     close(m_pSocketFD);
     
     m_pSocketFD = 0;
@@ -118,6 +127,31 @@ bool CommSocket::disconnect() {
  *   PROTECTED METHODS
  ******************************************************************************/
 
+/******************************************************************************
+ * Method: startRingReader
+ * Description: Once connected, read through a multishot io_uring receive if
+ * that backend is enabled.  readFD then returns the ring fd.
+ ******************************************************************************/
+void CommSocket::startRingReader() {
+    if(m_pRingReader || ! m_pSocketFD || ! m_bRingReads)
+        return;
+
+    m_pRingReader = IORingReader::create(m_pSocketFD);
+}
+
+/******************************************************************************
+ * Method: stopRingReader
+ * Description: Cancel the io_uring receive and go back to plain reads.  Must
+ * happen before the socket is closed or handed to another process.
+ ******************************************************************************/
+void CommSocket::stopRingReader() {
+    if(! m_pRingReader)
+        return;
+
+    delete m_pRingReader;
+    m_pRingReader = NULL;
+}
+
 /******************************************************************************
  * Method: write
  * Description: write a number of bytes to the socket connection.  Currently we
@@ -193,6 +227,36 @@ uint32_t CommSocket::readData(char *buffer, const uint32_t size) {
 
     if(! connected())
         throw(SocketReadFailure("not connected"));
+
+    if(m_pRingReader) {
+        bytesRead = m_pRingReader->read(buffer, size);
+
+        if(bytesRead) {
+            LOG(DEBUG) << "READ DEVICE: " << buffer;
+            return bytesRead;
+        }
+
+        if(m_pRingReader->closed()) {
+            LOG(INFO) << " -- Device connection closed. zero bytes recv.";
+            disconnect();
+            return 0;
+        }
+
+        if(m_pRingReader->error() == EINVAL || m_pRingReader->cancelled()) {
+            // No multishot receive in this kernel or drained after
+            // stopReadAhead, read the socket directly
+            stopRingReader();
+        }
+        else if(m_pRingReader->error()) {
+            int error = m_pRingReader->error();
+            disconnect();
+            LOG(ERROR) << "io_uring read_device: " << strerror(error) << "(errno: " << error << ")";
+            throw(SocketReadFailure(strerror(error)));
+        }
+        else {
+            return 0;
+        }
+    }
     
     if ((bytesRead = read(m_pSocketFD, buffer, size)) < 0) {
         if(errno != EAGAIN && errno != EINPROGRESS) {
@@ -210,8 +274,10 @@ uint32_t CommSocket::readData(char *buffer, const uint32_t size) {
         LOG(INFO) << " -- Device connection closed. zero bytes recv.";
         disconnect();
     }
-    else
+    else {
         LOG(DEBUG) << "READ DEVICE: " << buffer;
+        quickAck(m_pSocketFD);
+    }
 
     return bytesRead < 0 ? 0 : bytesRead;
 }
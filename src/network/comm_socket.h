@@ -14,6 +14,7 @@
 #include <stdio.h>
 
 #include "common/logger.h"
+#include "common/io_ring.h"
 #include "network/comm_base.h"
 
 using namespace std;
@@ -40,6 +41,8 @@ namespace network {
             void setPort(const uint16_t port) { m_iPort = port; }
             void setHostname(const string &hostname) { m_sHostname = hostname; }
             int getSocketFD() { return m_pSocketFD; }
+            virtual int readFD() { return m_pRingReader ? m_pRingReader->fd() : m_pSocketFD; }
+            virtual int writeFD() { return m_pSocketFD; }
             virtual bool connected() { return m_pSocketFD > 0; }
             
             // Connect, must be overloaded in the derived class
@@ -54,10 +57,20 @@ namespace network {
             virtual uint32_t writeData(const char *buffer, uint32_t size);
             virtual uint32_t readData(char *buffer, uint32_t size);
 
+            virtual void stopReadAhead() { if(m_pRingReader) m_pRingReader->cancel(); }
+            virtual bool readPending() { return m_pRingReader && m_pRingReader->pending(); }
+
+            // Owners that read the socket fd themselves turn io_uring reads off
+            void setRingReads(bool enabled) { m_bRingReads = enabled; }
+
         protected:
 
             void setSocket(int fd) { m_pSocketFD = fd; }
 
+            // Read through io_uring when that backend is enabled
+            void startRingReader();
+            void stopRingReader();
+
         private:
         
         /********************
@@ -69,6 +82,9 @@ namespace network {
             uint16_t m_iPort;
             
 			int m_pSocketFD;
+
+            IORingReader *m_pRingReader;
+            bool m_bRingReads;
             
         private:
 
@@ -0,0 +1,400 @@
+/*******************************************************************************
+ * Class: DuplexCommSocket
+ * Filename: duplex_comm_socket.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Present a pair of TCP connections, one for writing and one for reading, as
+ * a single full-duplex comm object.
+ *
+ ******************************************************************************/
+
+#include "duplex_comm_socket.h"
+#include "common/logger.h"
+#include "common/exception.h"
+#include "common/clock.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+using namespace logger;
+using namespace network;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor.
+ ******************************************************************************/
+DuplexCommSocket::DuplexCommSocket() : m_oWriteQueueCharge(MEMORY_CONNECTION) {
+    m_tNextTxConnect = 0;
+    m_tNextRxConnect = 0;
+
+    // readData drains the rx socket itself
+    m_oTxSocket.setRingReads(false);
+    m_oRxSocket.setRingReads(false);
+}
+
+/******************************************************************************
+ * Method: Copy Constructor
+ * Description: Copy the configuration.  Connections and queued data are not
+ * copied.
+ ******************************************************************************/
+DuplexCommSocket::DuplexCommSocket(const DuplexCommSocket &rhs)
+    : CommBase(rhs), m_oWriteQueueCharge(MEMORY_CONNECTION) {
+    m_oTxSocket = rhs.m_oTxSocket;
+    m_oRxSocket = rhs.m_oRxSocket;
+    m_tNextTxConnect = 0;
+    m_tNextRxConnect = 0;
+
+    m_oTxSocket.setRingReads(false);
+    m_oRxSocket.setRingReads(false);
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Close both sides.
+ ******************************************************************************/
+DuplexCommSocket::~DuplexCommSocket() {
+    disconnect();
+}
+
+/******************************************************************************
+ * Method: Assignment operator
+ * Description: Copy the configuration.
+ ******************************************************************************/
+DuplexCommSocket & DuplexCommSocket::operator=(const DuplexCommSocket &rhs) {
+    CommBase::operator=(rhs);
+    m_oTxSocket = rhs.m_oTxSocket;
+    m_oRxSocket = rhs.m_oRxSocket;
+    return *this;
+}
+
+/******************************************************************************
+ * Method: copy
+ * Description: return a new object deep copied.
+ ******************************************************************************/
+CommBase * DuplexCommSocket::copy() {
+    return new DuplexCommSocket(*this);
+}
+
+/******************************************************************************
+ * Method: setHostname
+ * Description: Both sides connect to the same host.
+ ******************************************************************************/
+void DuplexCommSocket::setHostname(const string &hostname) {
+    m_oTxSocket.setHostname(hostname);
+    m_oRxSocket.setHostname(hostname);
+}
+
+/******************************************************************************
+ * Method: compare
+ * Description: Two duplex sockets are the same if they point at the same
+ * host and ports.
+ ******************************************************************************/
+bool DuplexCommSocket::compare(CommBase *rhs) {
+    if(! rhs || rhs->type() != COMM_DUPLEX_SOCKET)
+        return false;
+
+    DuplexCommSocket *target = (DuplexCommSocket *)rhs;
+    return hostname() == target->hostname() &&
+           txPort() == target->txPort() &&
+           rxPort() == target->rxPort();
+}
+
+/******************************************************************************
+ * Method: isConfigured
+ * Description: Do we have a host and both ports?
+ ******************************************************************************/
+bool DuplexCommSocket::isConfigured() {
+    return m_oTxSocket.isConfigured() && m_oRxSocket.isConfigured();
+}
+
+/******************************************************************************
+ * Method: initialize
+ * Description: Start connecting whichever sides aren't connected.  Connects
+ * don't block; a side still connecting is finished by handleConnectFDs.  A
+ * side that fails, or takes longer than DUPLEX_CONNECT_TIMEOUT, is closed
+ * and not retried until DUPLEX_RECONNECT_INTERVAL has passed, so calling
+ * this from the main loop never sleeps and never drops the side that is
+ * still up.
+ *
+ * Return:
+ *   true if both sides are connected
+ * Exceptions:
+ *   SocketMissingConfig
+ ******************************************************************************/
+bool DuplexCommSocket::initialize() {
+    if(! isConfigured())
+        throw SocketMissingConfig("missing port or hostname");
+
+    connectSide(m_oTxSocket, m_tNextTxConnect, "tx");
+    connectSide(m_oRxSocket, m_tNextRxConnect, "rx");
+
+    m_bConnected = connected();
+    return m_bConnected;
+}
+
+/******************************************************************************
+ * Method: disconnect
+ * Description: Close both sides and drop anything left in the write queue.
+ ******************************************************************************/
+bool DuplexCommSocket::disconnect() {
+    m_sWriteQueue.clear();
+    m_oWriteQueueCharge.set(0);
+    m_tNextTxConnect = m_tNextRxConnect = 0;
+    m_bConnected = false;
+
+    return m_oTxSocket.disconnect() && m_oRxSocket.disconnect();
+}
+
+/******************************************************************************
+ * Method: writeData
+ * Description: queue data for the tx side and write what we can without
+ * blocking.  The rest goes out from flushWriteQueue.
+ *
+ * Return:
+ *   returns the number of bytes accepted, which is always size.
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+uint32_t DuplexCommSocket::writeData(const char *buffer, const uint32_t size) {
+    if(! txConnected())
+        throw(SocketWriteFailure("not connected"));
+
+    if(m_sWriteQueue.length() + size > DUPLEX_WRITE_QUEUE_MAX)
+        throw(SocketWriteFailure("write queue full"));
+
+    if(! m_oWriteQueueCharge.resize(m_sWriteQueue.length() + size))
+        throw(SocketWriteFailure("connection memory budget exceeded"));
+
+    m_sWriteQueue.append(buffer, size);
+    flushWriteQueue();
+
+    return size;
+}
+
+/******************************************************************************
+ * Method: flushWriteQueue
+ * Description: write as much of the queue as the tx side will take.  If the
+ * tx side has failed it is closed so the next initialize reconnects it.
+ *
+ * Return:
+ *   returns the number of bytes written.
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+uint32_t DuplexCommSocket::flushWriteQueue() {
+    uint32_t bytesWritten = 0;
+    int count;
+
+    if(! txConnected())
+        return 0;
+
+    while(bytesWritten < m_sWriteQueue.length()) {
+        count = send(writeFD(), m_sWriteQueue.data() + bytesWritten,
+                     m_sWriteQueue.length() - bytesWritten, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(count < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                break;
+
+            LOG(ERROR) << "tx write failed: " << strerror(errno) << "(errno: " << errno << ")";
+            m_sWriteQueue.clear();
+            m_oWriteQueueCharge.set(0);
+            m_oTxSocket.disconnect();
+            m_bConnected = false;
+            throw(SocketWriteFailure(strerror(errno)));
+        }
+
+        bytesWritten += count;
+    }
+
+    m_sWriteQueue.erase(0, bytesWritten);
+    m_oWriteQueueCharge.set(m_sWriteQueue.length());
+
+    LOG(DEBUG2) << "tx wrote bytes: " << bytesWritten << " bytes queued: " << m_sWriteQueue.length();
+    return bytesWritten;
+}
+
+/******************************************************************************
+ * Method: readData
+ * Description: read from the rx side until the buffer is full or there is
+ * nothing more to read, so one wakeup moves everything that has arrived.
+ *
+ * Return:
+ *   returns the number of bytes read.
+ * Exceptions:
+ *   SocketReadFailure
+ ******************************************************************************/
+uint32_t DuplexCommSocket::readData(char *buffer, const uint32_t size) {
+    uint32_t bytesRead = 0;
+    int count;
+
+    if(! rxConnected())
+        throw(SocketReadFailure("not connected"));
+
+    while(bytesRead < size) {
+        count = recv(readFD(), buffer + bytesRead, size - bytesRead, MSG_DONTWAIT);
+
+        if(count < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                break;
+
+            LOG(ERROR) << "rx read failed: " << strerror(errno) << "(errno: " << errno << ")";
+            m_oRxSocket.disconnect();
+            m_bConnected = false;
+
+            // Hand back what we already have, the next read will fail
+            if(bytesRead)
+                break;
+            throw(SocketReadFailure(strerror(errno)));
+        }
+
+        if(count == 0) {
+            LOG(INFO) << " -- rx connection closed. zero bytes recv.";
+            m_oRxSocket.disconnect();
+            m_bConnected = false;
+            break;
+        }
+
+        bytesRead += count;
+    }
+
+    if(bytesRead)
+        quickAck(readFD());
+
+    LOG(DEBUG2) << "rx read bytes: " << bytesRead;
+    return bytesRead;
+}
+
+/******************************************************************************
+ * Method: handoffFDs
+ * Description: Add both sides to a live upgrade handoff.
+ ******************************************************************************/
+void DuplexCommSocket::handoffFDs(FDHandoff &handoff) {
+    m_oTxSocket.handoffFDs(handoff);
+    m_oRxSocket.handoffFDs(handoff);
+}
+
+/******************************************************************************
+ * Method: addConnectFDs
+ * Description: Add the sides with a connect in progress to a write fd_set.
+ ******************************************************************************/
+void DuplexCommSocket::addConnectFDs(int &maxFD, fd_set &writeFDs) {
+    TCPCommSocket *sides[2] = { &m_oTxSocket, &m_oRxSocket };
+
+    for(int i = 0; i < 2; i++) {
+        int fd = sides[i]->getSocketFD();
+
+        if(sides[i]->connecting() && fd > 0) {
+            maxFD = fd > maxFD ? fd : maxFD;
+            FD_SET(fd, &writeFDs);
+        }
+    }
+}
+
+/******************************************************************************
+ * Method: handleConnectFDs
+ * Description: Finish the connects whose fds are writable.
+ ******************************************************************************/
+void DuplexCommSocket::handleConnectFDs(const fd_set &writeFDs) {
+    if(m_oTxSocket.connecting() && FD_ISSET(m_oTxSocket.getSocketFD(), &writeFDs))
+        finishSide(m_oTxSocket, m_tNextTxConnect, "tx");
+
+    if(m_oRxSocket.connecting() && FD_ISSET(m_oRxSocket.getSocketFD(), &writeFDs))
+        finishSide(m_oRxSocket, m_tNextRxConnect, "rx");
+
+    m_bConnected = connected();
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: connectSide
+ * Description: Start connecting one side if it is down and we are past its
+ * retry time, or give up on a connect that has taken too long.  The socket
+ * profile of this object is applied to the side before it connects.
+ *
+ * Return:
+ *   true if the side is connected
+ ******************************************************************************/
+bool DuplexCommSocket::connectSide(TCPCommSocket &socket, time_t &nextAttempt, const char *name) {
+    time_t now;
+
+    if(socket.connected())
+        return true;
+
+    now = Clock::MonotonicSeconds();
+
+    if(socket.connecting()) {
+        if(now < nextAttempt)
+            return false;
+
+        LOG(ERROR) << name << " connect timed out, port: " << socket.port();
+        socket.disconnect();
+        nextAttempt = now + DUPLEX_RECONNECT_INTERVAL;
+        return false;
+    }
+
+    if(now < nextAttempt) {
+        LOG(DEBUG2) << name << " reconnect held off for: " << nextAttempt - now;
+        return false;
+    }
+
+    socket.setSocketProfile(socketProfile());
+    socket.setSocketBufferSize(socketBufferSize());
+    socket.setKeepalive(keepalive());
+
+    try {
+        LOG(DEBUG) << "connecting " << name << " side to port: " << socket.port();
+        if(socket.startConnect()) {
+            nextAttempt = 0;
+            return true;
+        }
+
+        nextAttempt = now + DUPLEX_CONNECT_TIMEOUT;
+    }
+    catch(OOIException &e) {
+        string msg = e.what();
+        LOG(ERROR) << name << " connect failed: " << msg;
+        socket.disconnect();
+        nextAttempt = now + DUPLEX_RECONNECT_INTERVAL;
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Method: finishSide
+ * Description: Finish a side's connect now that its fd is writable.  A
+ * failed connect is held off like any other.
+ *
+ * Return:
+ *   true if the side is connected
+ ******************************************************************************/
+bool DuplexCommSocket::finishSide(TCPCommSocket &socket, time_t &nextAttempt, const char *name) {
+    try {
+        if(! socket.finishConnect())
+            return false;
+
+        LOG(INFO) << name << " side connected, port: " << socket.port();
+        nextAttempt = 0;
+        return true;
+    }
+    catch(OOIException &e) {
+        string msg = e.what();
+        LOG(ERROR) << name << " connect failed: " << msg;
+        socket.disconnect();
+        nextAttempt = Clock::MonotonicSeconds() + DUPLEX_RECONNECT_INTERVAL;
+    }
+
+    return false;
+}
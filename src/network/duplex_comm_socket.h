@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * Class: DuplexCommSocket
+ * Filename: duplex_comm_socket.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Present a pair of TCP connections, one we only write to and one we only
+ * read from, as a single full-duplex comm object.  Writes are queued and
+ * drained when the tx socket is writable, reads pull everything the rx
+ * socket has ready.  Each side reconnects on its own without blocking the
+ * other or the caller; connects are finished when the fd is writable.
+ *
+ * Usage:
+ *
+ * DuplexCommSocket socket;
+ *
+ * socket.setHostname("localhost");
+ * socket.setTxPort(4001);
+ * socket.setRxPort(4002);
+ *
+ * // Connect whichever side isn't connected
+ * socket.initialize();
+ *
+ * // Select for write on the sides still connecting
+ * socket.addConnectFDs(maxFD, writeFDs);
+ * select(...);
+ * socket.handleConnectFDs(writeFDs);
+ *
+ * socket.writeData("data", 4);
+ * if(socket.writePending())
+ *     socket.flushWriteQueue();   // when writeFD() is writable
+ *
+ * socket.readData(buffer, size);  // when readFD() is readable
+ *
+ ******************************************************************************/
+
+#ifndef __DUPLEX_COMM_SOCKET_H_
+#define __DUPLEX_COMM_SOCKET_H_
+
+#include "common/logger.h"
+#include "common/memory_budget.h"
+#include "comm_base.h"
+#include "tcp_comm_socket.h"
+
+#include <string>
+#include <time.h>
+
+using namespace std;
+using namespace logger;
+
+// Most data we will hold for the tx side before refusing writes
+#define DUPLEX_WRITE_QUEUE_MAX 1048576
+
+// Seconds to wait before retrying a side that failed to connect
+#define DUPLEX_RECONNECT_INTERVAL 1
+
+// Seconds a side may take to connect before it is abandoned and retried
+#define DUPLEX_CONNECT_TIMEOUT 10
+
+namespace network {
+    class DuplexCommSocket : public CommBase {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            DuplexCommSocket();
+            DuplexCommSocket(const DuplexCommSocket &rhs);
+            virtual ~DuplexCommSocket();
+
+            virtual CommBase *copy();
+
+            /* Operators */
+            virtual DuplexCommSocket & operator=(const DuplexCommSocket &rhs);
+
+            /* Accessors */
+            CommType type() { return COMM_DUPLEX_SOCKET; }
+
+            void setHostname(const string &hostname);
+            void setTxPort(const uint16_t port) { m_oTxSocket.setPort(port); }
+            void setRxPort(const uint16_t port) { m_oRxSocket.setPort(port); }
+
+            const string & hostname() { return m_oRxSocket.hostname(); }
+            uint16_t txPort() { return m_oTxSocket.port(); }
+            uint16_t rxPort() { return m_oRxSocket.port(); }
+
+            bool txConnected() { return m_oTxSocket.connected(); }
+            bool rxConnected() { return m_oRxSocket.connected(); }
+            bool connected() { return txConnected() && rxConnected(); }
+
+            int readFD() { return m_oRxSocket.getSocketFD(); }
+            int writeFD() { return m_oTxSocket.getSocketFD(); }
+
+            virtual bool compare(CommBase *rhs);
+
+            // Does this object have a complete configuration?
+            bool isConfigured();
+
+            /* Commands */
+
+            // Connect the sides that aren't connected
+            bool initialize();
+            bool connectClient() { return initialize(); }
+            bool disconnect();
+
+            virtual uint32_t writeData(const char *buffer, uint32_t size);
+            virtual uint32_t readData(char *buffer, uint32_t size);
+
+            virtual bool writePending() { return m_sWriteQueue.length() > 0; }
+            virtual uint32_t flushWriteQueue();
+            uint32_t writeQueueSize() { return m_sWriteQueue.length(); }
+
+            virtual void handoffFDs(FDHandoff &handoff);
+
+            // Sides with a connect in progress
+            virtual void addConnectFDs(int &maxFD, fd_set &writeFDs);
+            virtual void handleConnectFDs(const fd_set &writeFDs);
+
+        protected:
+
+        private:
+            bool connectSide(TCPCommSocket &socket, time_t &nextAttempt, const char *name);
+            bool finishSide(TCPCommSocket &socket, time_t &nextAttempt, const char *name);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        protected:
+
+        private:
+            TCPCommSocket m_oTxSocket;
+            TCPCommSocket m_oRxSocket;
+
+            // Next connect attempt, or while connecting when it times out
+            time_t m_tNextTxConnect;
+            time_t m_tNextRxConnect;
+
+            string m_sWriteQueue;
+            MemoryCharge m_oWriteQueueCharge;
+    };
+}
+
+#endif //__DUPLEX_COMM_SOCKET_H_
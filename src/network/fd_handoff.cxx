@@ -0,0 +1,376 @@
+/*******************************************************************************
+ * Class: FDHandoff
+ * Filename: fd_handoff.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Pass open file descriptors and named values between processes with
+ * SCM_RIGHTS.
+ *
+ * A handoff is one message:
+ *
+ * magic            32 bits
+ * fd count         32 bits
+ * text length      32 bits
+ * text             fd names one per line in the order of the descriptors,
+ *                  then values as "name length\n" followed by the bytes
+ *
+ * The descriptors ride along with the header as ancillary data.
+ ******************************************************************************/
+
+#include "fd_handoff.h"
+#include "common/logger.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace logger;
+using namespace network;
+
+FDHandoff *FDHandoff::m_pInstance = NULL;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor.
+ ******************************************************************************/
+FDHandoff::FDHandoff() {
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Descriptors are left open.  Whoever took them owns them.
+ ******************************************************************************/
+FDHandoff::~FDHandoff() {
+}
+
+/******************************************************************************
+ * Method: instance
+ * Description: Descriptors this process inherited from the one before it.
+ ******************************************************************************/
+FDHandoff * FDHandoff::instance() {
+    if(! m_pInstance)
+        m_pInstance = new FDHandoff();
+
+    return m_pInstance;
+}
+
+/******************************************************************************
+ * Method: listenerKey
+ * Description: name of a TCP listener's server socket
+ ******************************************************************************/
+string FDHandoff::listenerKey(uint16_t port) {
+    ostringstream out;
+    out << "tcp_listener:" << port;
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: listenerClientKey
+ * Description: name of the client accepted by a TCP listener
+ ******************************************************************************/
+string FDHandoff::listenerClientKey(uint16_t port) {
+    ostringstream out;
+    out << "tcp_client:" << port;
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: listenerStreamKey
+ * Description: name of the value holding what a TCP listener's client was
+ * being sent, raw or compressed
+ ******************************************************************************/
+string FDHandoff::listenerStreamKey(uint16_t port) {
+    ostringstream out;
+    out << "tcp_client_stream:" << port;
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: socketKey
+ * Description: name of an outbound TCP connection
+ ******************************************************************************/
+string FDHandoff::socketKey(const string &host, uint16_t port) {
+    ostringstream out;
+    out << "tcp_socket:" << host << ":" << port;
+    return out.str();
+}
+
+/******************************************************************************
+ * Method: deviceKey
+ * Description: name of an open device
+ ******************************************************************************/
+string FDHandoff::deviceKey(const string &path) {
+    return "device:" + path;
+}
+
+/******************************************************************************
+ * Method: add
+ * Description: Add a descriptor to pass.  Closed descriptors are ignored.
+ ******************************************************************************/
+void FDHandoff::add(const string &name, int fd) {
+    if(fd <= 0)
+        return;
+
+    LOG(DEBUG) << "handoff add " << name << " fd: " << fd;
+    m_oFDs[name] = fd;
+}
+
+/******************************************************************************
+ * Method: take
+ * Description: Claim a descriptor.  It is removed so it's only handed out
+ * once.
+ *
+ * Return:
+ *   the descriptor, 0 if we don't have one by that name
+ ******************************************************************************/
+int FDHandoff::take(const string &name) {
+    map<string, int>::iterator i = m_oFDs.find(name);
+    int fd;
+
+    if(i == m_oFDs.end())
+        return 0;
+
+    fd = i->second;
+    m_oFDs.erase(i);
+
+    LOG(INFO) << "adopting inherited " << name << " fd: " << fd;
+    return fd;
+}
+
+/******************************************************************************
+ * Method: value
+ * Description: return a named value, empty if it wasn't passed
+ ******************************************************************************/
+string FDHandoff::value(const string &name) {
+    map<string, string>::iterator i = m_oValues.find(name);
+    return i == m_oValues.end() ? "" : i->second;
+}
+
+/******************************************************************************
+ * Method: send
+ * Description: Send our descriptors and values over a unix domain socket.
+ *
+ * Return:
+ *   true if everything was written
+ ******************************************************************************/
+bool FDHandoff::send(int socket) {
+    ostringstream text;
+    vector<int> fds;
+    uint32_t header[3];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    string body;
+    int sent;
+
+    if(m_oFDs.size() > HANDOFF_MAX_FDS) {
+        LOG(ERROR) << "too many descriptors to hand off: " << m_oFDs.size();
+        return false;
+    }
+
+    for(map<string, int>::iterator i = m_oFDs.begin(); i != m_oFDs.end(); i++) {
+        text << i->first << "\n";
+        fds.push_back(i->second);
+    }
+
+    for(map<string, string>::iterator i = m_oValues.begin(); i != m_oValues.end(); i++)
+        text << i->first << " " << i->second.length() << "\n" << i->second;
+
+    body = text.str();
+
+    header[0] = HANDOFF_MAGIC;
+    header[1] = fds.size();
+    header[2] = body.length();
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if(fds.size()) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), &fds[0], sizeof(int) * fds.size());
+    }
+
+    LOG(INFO) << "handing off " << fds.size() << " descriptors, "
+              << m_oValues.size() << " values";
+
+    do {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while(sent < 0 && errno == EINTR);
+
+    if(sent != sizeof(header)) {
+        LOG(ERROR) << "handoff send failed: " << strerror(errno);
+        return false;
+    }
+
+    return writeAll(socket, body.data(), body.length());
+}
+
+/******************************************************************************
+ * Method: receive
+ * Description: Read a handoff from a unix domain socket.  Descriptors and
+ * values are added to what we already have.  Received descriptors are close
+ * on exec.
+ *
+ * Return:
+ *   true if a complete handoff was read
+ ******************************************************************************/
+bool FDHandoff::receive(int socket) {
+    uint32_t header[3];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    vector<int> fds;
+    string line;
+    int count;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        count = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while(count < 0 && errno == EINTR);
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *data = (int *)CMSG_DATA(cmsg);
+            fds.insert(fds.end(), data, data + n);
+        }
+    }
+
+    if(count != sizeof(header) || header[0] != HANDOFF_MAGIC ||
+       header[1] != fds.size() || (msg.msg_flags & MSG_CTRUNC)) {
+        LOG(ERROR) << "bad handoff header, read: " << count
+                   << " descriptors: " << fds.size();
+        for(uint32_t i = 0; i < fds.size(); i++)
+            close(fds[i]);
+        return false;
+    }
+
+    vector<char> body(header[2] + 1);
+    if(! readAll(socket, &body[0], header[2])) {
+        for(uint32_t i = 0; i < fds.size(); i++)
+            close(fds[i]);
+        return false;
+    }
+
+    istringstream text(string(&body[0], header[2]));
+
+    for(uint32_t i = 0; i < fds.size(); i++) {
+        getline(text, line);
+        add(line, fds[i]);
+    }
+
+    while(getline(text, line)) {
+        size_t space = line.rfind(' ');
+        if(space == string::npos)
+            break;
+
+        uint32_t length = atoi(line.substr(space + 1).c_str());
+        vector<char> value(length + 1);
+        text.read(&value[0], length);
+
+        m_oValues[line.substr(0, space)] = string(&value[0], length);
+    }
+
+    LOG(INFO) << "received " << fds.size() << " descriptors, "
+              << m_oValues.size() << " values";
+    return true;
+}
+
+/******************************************************************************
+ * Method: closeAll
+ * Description: Close every descriptor that hasn't been claimed.
+ ******************************************************************************/
+void FDHandoff::closeAll() {
+    for(map<string, int>::iterator i = m_oFDs.begin(); i != m_oFDs.end(); i++) {
+        LOG(INFO) << "closing unclaimed " << i->first << " fd: " << i->second;
+        close(i->second);
+    }
+
+    m_oFDs.clear();
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: writeAll
+ * Description: write the whole buffer to a blocking socket
+ ******************************************************************************/
+bool FDHandoff::writeAll(int socket, const char *buffer, uint32_t size) {
+    uint32_t written = 0;
+    int count;
+
+    while(written < size) {
+        count = ::send(socket, buffer + written, size - written, MSG_NOSIGNAL);
+
+        if(count < 0) {
+            if(errno == EINTR)
+                continue;
+
+            LOG(ERROR) << "handoff write failed: " << strerror(errno);
+            return false;
+        }
+
+        written += count;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: readAll
+ * Description: read exactly size bytes from a blocking socket
+ ******************************************************************************/
+bool FDHandoff::readAll(int socket, char *buffer, uint32_t size) {
+    uint32_t bytesRead = 0;
+    int count;
+
+    while(bytesRead < size) {
+        count = recv(socket, buffer + bytesRead, size - bytesRead, 0);
+
+        if(count < 0 && errno == EINTR)
+            continue;
+
+        if(count <= 0) {
+            LOG(ERROR) << "handoff read failed: " << (count ? strerror(errno) : "closed");
+            return false;
+        }
+
+        bytesRead += count;
+    }
+
+    return true;
+}
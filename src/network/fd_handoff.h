@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Class: FDHandoff
+ * Filename: fd_handoff.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Pass open file descriptors and a few named values from one process to
+ * another over a unix domain socket using SCM_RIGHTS.  Used for live
+ * upgrades: the running port agent hands its listeners, clients and
+ * instrument connections to a new binary so nothing has to be rebound or
+ * reconnected.
+ *
+ * Descriptors are named after what they connect to (see the *Key methods) so
+ * the comm objects in the new process can find them when they initialize.
+ *
+ * Usage:
+ *
+ * // Old process
+ * FDHandoff handoff;
+ * handoff.add(FDHandoff::listenerKey(4001), serverFD);
+ * handoff.setValue("config", config);
+ * handoff.send(socketFD);
+ *
+ * // New process
+ * FDHandoff::instance()->receive(socketFD);
+ * string config = FDHandoff::instance()->value("config");
+ *
+ * // In a comm object initialize()
+ * int fd = FDHandoff::instance()->take(FDHandoff::listenerKey(m_iPort));
+ *
+ ******************************************************************************/
+
+#ifndef __FD_HANDOFF_H_
+#define __FD_HANDOFF_H_
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+// Most descriptors we will pass in one handoff
+#define HANDOFF_MAX_FDS 64
+
+// Marks the start of a handoff message
+#define HANDOFF_MAGIC 0x50414846
+
+namespace network {
+    class FDHandoff {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            FDHandoff();
+            virtual ~FDHandoff();
+
+            // Descriptors inherited by this process
+            static FDHandoff * instance();
+
+            // Names for the descriptors we pass
+            static string listenerKey(uint16_t port);
+            static string listenerClientKey(uint16_t port);
+            static string listenerStreamKey(uint16_t port);
+            static string socketKey(const string &host, uint16_t port);
+            static string deviceKey(const string &path);
+
+            /* Accessors */
+            void add(const string &name, int fd);
+            int take(const string &name);
+            uint32_t size() { return m_oFDs.size(); }
+
+            void setValue(const string &name, const string &value) { m_oValues[name] = value; }
+            string value(const string &name);
+
+            /* Commands */
+            bool send(int socket);
+            bool receive(int socket);
+
+            // Close descriptors nobody claimed
+            void closeAll();
+
+        private:
+            bool writeAll(int socket, const char *buffer, uint32_t size);
+            bool readAll(int socket, char *buffer, uint32_t size);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            static FDHandoff *m_pInstance;
+
+            map<string, int> m_oFDs;
+            map<string, string> m_oValues;
+    };
+}
+
+#endif //__FD_HANDOFF_H_
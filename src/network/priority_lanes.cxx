@@ -0,0 +1,211 @@
+/*******************************************************************************
+ * Class: PriorityLanes
+ * Filename: priority_lanes.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Control and bulk write queues for a client.  See priority_lanes.h.
+ ******************************************************************************/
+
+#include "priority_lanes.h"
+#include "common/logger.h"
+
+using namespace std;
+using namespace logger;
+using namespace network;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ *
+ * Parameters:
+ *   bulkLimit - most bulk bytes to queue, 0 for no limit
+ ******************************************************************************/
+PriorityLanes::PriorityLanes(uint32_t bulkLimit) : m_oCharge(MEMORY_CONNECTION) {
+    m_iBulkLimit = bulkLimit;
+    m_iOffset = 0;
+    m_iQueued = 0;
+    m_iBulkQueued = 0;
+    m_iBypassed = 0;
+    m_iDropped = 0;
+    m_iPeakQueued = 0;
+
+    for(int i = 0; i < LANES; i++)
+        m_iWrites[i] = 0;
+}
+
+/******************************************************************************
+ * Method: push
+ * Description: Queue a copy of a write at the back of its lane.  Bulk writes
+ * have to fit under the limit and the connection memory budget unless
+ * nothing else bulk is queued.
+ *
+ * Return:
+ *   false if the write was dropped and nothing was queued
+ ******************************************************************************/
+bool PriorityLanes::push(Lane lane, const char *buffer, uint32_t size) {
+    if(lane == LANE_BULK && m_iBulkQueued) {
+        if((m_iBulkLimit && m_iBulkQueued + size > m_iBulkLimit) ||
+           ! m_oCharge.resize(m_iQueued + size)) {
+            __atomic_add_fetch(&m_iDropped, 1, __ATOMIC_RELAXED);
+            LOG(DEBUG) << "bulk lane full, dropping bytes: " << size << " queued: " << m_iBulkQueued;
+            return false;
+        }
+    }
+    else {
+        m_oCharge.set(m_iQueued + size);
+    }
+
+    if(lane == LANE_CONTROL && ! m_oLanes[LANE_BULK].empty())
+        __atomic_add_fetch(&m_iBypassed, 1, __ATOMIC_RELAXED);
+
+    m_oLanes[lane].push_back(string(buffer, size));
+
+    m_iQueued += size;
+    if(lane == LANE_BULK)
+        m_iBulkQueued += size;
+
+    if(m_iQueued > m_iPeakQueued)
+        __atomic_store_n(&m_iPeakQueued, m_iQueued, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&m_iWrites[lane], 1, __ATOMIC_RELAXED);
+
+    LOG(DEBUG2) << "queued lane: " << lane << " bytes: " << size << " total: " << m_iQueued;
+    return true;
+}
+
+/******************************************************************************
+ * Method: sent
+ ******************************************************************************/
+void PriorityLanes::sent(Lane lane) {
+    __atomic_add_fetch(&m_iWrites[lane], 1, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Method: putBack
+ * Description: Return the unwritten part of a write that was sent outside
+ * the lanes, e.g. in an io_uring batch.  Everything queued since came after
+ * it so it goes first: as the started write if some of it went out,
+ * otherwise at the head of its lane.
+ *
+ * Parameters:
+ *   lane - lane the write was for
+ *   buffer - the unwritten bytes
+ *   size - how many
+ *   started - some of the write already went out
+ ******************************************************************************/
+void PriorityLanes::putBack(Lane lane, const char *buffer, uint32_t size, bool started) {
+    m_oCharge.set(m_iQueued + size);
+
+    if(started && m_sCurrent.empty()) {
+        m_sCurrent.assign(buffer, size);
+        m_iOffset = 0;
+    }
+    else {
+        m_oLanes[lane].push_front(string(buffer, size));
+        if(lane == LANE_BULK)
+            m_iBulkQueued += size;
+    }
+
+    m_iQueued += size;
+
+    if(m_iQueued > m_iPeakQueued)
+        __atomic_store_n(&m_iPeakQueued, m_iQueued, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&m_iWrites[lane], 1, __ATOMIC_RELAXED);
+
+    LOG(DEBUG2) << "put back lane: " << lane << " bytes: " << size << " total: " << m_iQueued;
+}
+
+/******************************************************************************
+ * Method: front
+ * Description: Find the next bytes to write.  A started write is finished
+ * first, otherwise the next write is taken from the control lane before the
+ * bulk lane.
+ *
+ * Parameters:
+ *   buffer - set to the bytes
+ *   size - set to how many
+ * Return:
+ *   false if nothing is queued
+ ******************************************************************************/
+bool PriorityLanes::front(const char *&buffer, uint32_t &size) {
+    if(m_sCurrent.empty()) {
+        for(int i = 0; i < LANES; i++) {
+            if(m_oLanes[i].empty())
+                continue;
+
+            m_sCurrent.swap(m_oLanes[i].front());
+            m_oLanes[i].pop_front();
+            m_iOffset = 0;
+
+            // Once started it no longer counts against the bulk limit
+            if(i == LANE_BULK)
+                m_iBulkQueued -= m_sCurrent.length();
+            break;
+        }
+
+        if(m_sCurrent.empty())
+            return false;
+    }
+
+    buffer = m_sCurrent.data() + m_iOffset;
+    size = m_sCurrent.length() - m_iOffset;
+    return true;
+}
+
+/******************************************************************************
+ * Method: consume
+ * Description: Bytes given by front were written.
+ ******************************************************************************/
+void PriorityLanes::consume(uint32_t bytes) {
+    m_iOffset += bytes;
+    m_iQueued -= bytes;
+
+    if(m_iOffset >= m_sCurrent.length()) {
+        m_sCurrent.clear();
+        m_iOffset = 0;
+    }
+
+    m_oCharge.set(m_iQueued);
+}
+
+/******************************************************************************
+ * Method: clear
+ ******************************************************************************/
+void PriorityLanes::clear() {
+    if(m_iQueued)
+        LOG(DEBUG) << "dropping queued writes, bytes: " << m_iQueued;
+
+    for(int i = 0; i < LANES; i++)
+        m_oLanes[i].clear();
+
+    m_sCurrent.clear();
+    m_iOffset = 0;
+    m_iQueued = 0;
+    m_iBulkQueued = 0;
+    m_oCharge.set(0);
+}
+
+/******************************************************************************
+ * Totals
+ * Description: Atomic so the main loop can report while publishers write.
+ ******************************************************************************/
+uint64_t PriorityLanes::writes(Lane lane) {
+    return __atomic_load_n(&m_iWrites[lane], __ATOMIC_RELAXED);
+}
+
+uint64_t PriorityLanes::bypassed() {
+    return __atomic_load_n(&m_iBypassed, __ATOMIC_RELAXED);
+}
+
+uint64_t PriorityLanes::dropped() {
+    return __atomic_load_n(&m_iDropped, __ATOMIC_RELAXED);
+}
+
+uint32_t PriorityLanes::peakQueued() {
+    return __atomic_load_n(&m_iPeakQueued, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Class: PriorityLanes
+ * Filename: priority_lanes.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Writes waiting for a client socket, kept in two lanes so control traffic
+ * doesn't sit behind bulk data.  Driver commands, status, faults and
+ * heartbeats go in the control lane, instrument data in the bulk lane.  The
+ * next bytes to write are the rest of a write already started, so packets
+ * never interleave, then the oldest control write, then the oldest bulk
+ * write.
+ *
+ * Writes are queued whole.  The bulk lane holds at most the bulk limit and
+ * what it holds is charged to the connection memory budget.  A bulk write
+ * that doesn't fit is dropped whole, so the client still sees complete
+ * packets, and counted.  An empty lane takes a write of any size.  Control
+ * writes are always taken.
+ *
+ * Not thread safe, the owner locks around it.  The totals can be read
+ * from any thread.
+ *
+ * Usage:
+ *
+ * PriorityLanes lanes;
+ *
+ * if(! lanes.push(LANE_BULK, buffer, size))
+ *     ... full, the write was dropped
+ *
+ * // when the socket is writable
+ * while(lanes.front(data, size) && (count = send(fd, data, size, MSG_DONTWAIT)) > 0)
+ *     lanes.consume(count);
+ *
+ ******************************************************************************/
+
+#ifndef __PRIORITY_LANES_H_
+#define __PRIORITY_LANES_H_
+
+#include "common/memory_budget.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+
+using namespace std;
+
+// Most bulk bytes queued for one client before bulk writes are dropped
+#define LANE_BULK_MAX 1048576
+
+namespace network {
+    typedef enum {
+        LANE_CONTROL = 0,
+        LANE_BULK    = 1,
+        LANES        = 2
+    } Lane;
+
+    class PriorityLanes {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            PriorityLanes(uint32_t bulkLimit = LANE_BULK_MAX);
+
+            void setBulkLimit(uint32_t bytes) { m_iBulkLimit = bytes; }
+            uint32_t bulkLimit() { return m_iBulkLimit; }
+
+            // Queue a whole write.  False if it is bulk and was dropped.
+            bool push(Lane lane, const char *buffer, uint32_t size);
+
+            // A write that went straight out without queuing, for the totals
+            void sent(Lane lane);
+
+            // A write that didn't go out, or only partly, goes back ahead of
+            // its lane.  The rest of a started write is finished first.
+            // Never dropped.
+            void putBack(Lane lane, const char *buffer, uint32_t size, bool started);
+
+            // Bytes to write next, false if nothing is queued
+            bool front(const char *&buffer, uint32_t &size);
+
+            // Bytes from front were written
+            void consume(uint32_t bytes);
+
+            // Drop everything queued, e.g. when the client goes
+            void clear();
+
+            bool empty() { return m_iQueued == 0; }
+            uint32_t queued() { return m_iQueued; }
+
+            /* Totals */
+            uint64_t writes(Lane lane);
+            uint64_t bypassed();
+            uint64_t dropped();
+            uint32_t peakQueued();
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            deque<string> m_oLanes[LANES];
+            uint32_t m_iBulkLimit;
+
+            // Write started but not finished
+            string m_sCurrent;
+            uint32_t m_iOffset;
+
+            uint32_t m_iQueued;
+            uint32_t m_iBulkQueued;
+            MemoryCharge m_oCharge;
+
+            // Writes per lane, control writes queued ahead of bulk and
+            // bulk writes that didn't fit
+            uint64_t m_iWrites[LANES];
+            uint64_t m_iBypassed;
+            uint64_t m_iDropped;
+            uint32_t m_iPeakQueued;
+    };
+}
+
+#endif //__PRIORITY_LANES_H_
@@ -12,6 +12,9 @@
 #include "common/util.h"
 #include "common/logger.h"
 #include "common/exception.h"
+#include "common/probe.h"
+#include "common/clock.h"
+#include "network/fd_handoff.h"
 
 #include <fcntl.h>
 #include <termios.h>
@@ -21,11 +24,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 
 using namespace std;
 using namespace logger;
 using namespace network;
     
+/******************************************************************************
+ * Method: currentTime
+ * Description: Monotonic microseconds used to pace writes and time the
+ * read hold, breaks and open retries.
+ ******************************************************************************/
+static uint64_t currentTime() {
+    return Clock::MonotonicUsec();
+}
+
 /******************************************************************************
  *   PUBLIC METHODS
  ******************************************************************************/
@@ -34,7 +54,7 @@ using namespace network;
  * Method: Constructor
  * Description: Default constructor.
  ******************************************************************************/
-SerialCommSocket::SerialCommSocket() {
+SerialCommSocket::SerialCommSocket() : m_oWriteQueueCharge(MEMORY_CONNECTION) {
 
     m_sDevicePath = "devicePath not initialized!";
     m_baud = B9600;
@@ -42,6 +62,17 @@ SerialCommSocket::SerialCommSocket() {
     m_dataBits = DATABITS_8;
     m_stopBits = STOPBITS_1;
     m_flowControl = FLOW_CONTROL_NONE;
+    m_readMode = READ_MODE_LOW_LATENCY;
+    m_iReadCount = 0;
+    m_iBytesRead = 0;
+    m_iCharDelay = 0;
+    m_iLineDelay = 0;
+    m_iNextWrite = 0;
+    m_iBreakEnd = 0;
+    m_iReadHold = 0;
+    m_iNextOpen = 0;
+    m_iOpenBackoff = OPEN_RETRY_MIN;
+    m_iWatchFD = 0;
 
 }
 
@@ -50,7 +81,12 @@ SerialCommSocket::SerialCommSocket() {
  * Method: Copy Constructor
  * Description: Copy constructor.
  ******************************************************************************/
-SerialCommSocket::SerialCommSocket(const SerialCommSocket &rhs) {
+SerialCommSocket::SerialCommSocket(const SerialCommSocket &rhs) : m_oWriteQueueCharge(MEMORY_CONNECTION) {
+    m_iBreakEnd = 0;
+    m_iReadHold = 0;
+    m_iNextOpen = 0;
+    m_iOpenBackoff = OPEN_RETRY_MIN;
+    m_iWatchFD = 0;
 }
 
 
@@ -59,6 +95,7 @@ SerialCommSocket::SerialCommSocket(const SerialCommSocket &rhs) {
  * Description: destructor.
  ******************************************************************************/
 SerialCommSocket::~SerialCommSocket() {
+    unwatchDevice();
 }
 
 /******************************************************************************
@@ -113,6 +150,12 @@ bool SerialCommSocket::initialize() {
     string infoString;
     ostringstream os;
 
+    // Still backing off from the last failed open
+    if (! connected() && m_iNextOpen > currentTime()) {
+        LOG(DEBUG2) << "device open held off: " << m_sDevicePath;
+        return false;
+    }
+
     if (m_pSocketFD) {
         os << "Device already open: " << m_sDevicePath << ". Closing and reopening.";
         infoString = os.str();
@@ -124,19 +167,42 @@ bool SerialCommSocket::initialize() {
     infoString = os.str();
     LOG(INFO) << infoString;
 
-    m_pSocketFD = open(m_sDevicePath.c_str(), O_RDWR);
+    m_sWriteQueue.clear();
+    m_oWriteQueueCharge.set(0);
+    m_iNextWrite = 0;
+    m_iBreakEnd = 0;
+    m_iReadHold = 0;
+
+    // Pick up the device handed to us by a live upgrade.  An older process
+    // may have left it blocking.
+    if((m_pSocketFD = FDHandoff::instance()->take(FDHandoff::deviceKey(m_sDevicePath)))) {
+        fcntl(m_pSocketFD, F_SETFL, fcntl(m_pSocketFD, F_GETFL) | O_NONBLOCK);
+        return bReturnCode;
+    }
+
+    // Open non-blocking so we don't hang waiting on carrier detect, and
+    // stay that way so neither reads nor writes can stall the main loop.
+    m_pSocketFD = open(m_sDevicePath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (0 > m_pSocketFD) {
         os << "Failed to open device: " << m_sDevicePath << ": " << strerror(errno);
         infoString = os.str();
         LOG(ERROR) << infoString;
-        // DHE: I've noticed that without this, CPU runs to 99/100 percent.
-        // Doesn't seem like the select() sleep is working.  This definitely
-        // helps; leaving it in until select() sleep is resolved.
-        sleep(OPEN_FAIL_SLEEP_TIME);
+
+        // Don't spin on a missing device.  Try again after a back off, or
+        // sooner if the device shows up.
+        m_iNextOpen = currentTime() + (uint64_t)m_iOpenBackoff * 1000;
+        m_iOpenBackoff = m_iOpenBackoff * 2 > OPEN_RETRY_MAX ? OPEN_RETRY_MAX : m_iOpenBackoff * 2;
+        watchDevice();
+
         throw DeviceOpenFailure(infoString);
         bReturnCode = false;
     }
 
+    m_iNextOpen = 0;
+    m_iOpenBackoff = OPEN_RETRY_MIN;
+    unwatchDevice();
+    PROBE1(device__open, m_pSocketFD);
+
     os << "Opened: " << m_sDevicePath;
     infoString = os.str();
     LOG(INFO) << infoString;
@@ -144,6 +210,15 @@ bool SerialCommSocket::initialize() {
     return bReturnCode;
 }
 
+/******************************************************************************
+ * Method: handoffFDs
+ * Description: Add the open device to a live upgrade handoff.
+ ******************************************************************************/
+void SerialCommSocket::handoffFDs(FDHandoff &handoff) {
+    if(connected())
+        handoff.add(FDHandoff::deviceKey(m_sDevicePath), m_pSocketFD);
+}
+
 /******************************************************************************
  * Method: initializeSerialSettings
  * Description: Initialize all serial settings
@@ -238,11 +313,45 @@ bool SerialCommSocket::initializeSerialSettings() {
     }
 
     //
-    // One input byte is enough to return from read()
-    // Inter-character timer off
+    // Read batching based on the read mode.
     //
-    config.c_cc[VMIN]  = 1;
-    config.c_cc[VTIME] = 0;
+    if (m_readMode == READ_MODE_RECORD && m_sSentinle.length()) {
+        //
+        // Let the line discipline assemble records for us; we are only
+        // woken when the last byte of the sentinle arrives.  All of the
+        // editing characters are disabled so data passes through untouched.
+        //
+        config.c_lflag |= ICANON;
+        config.c_cc[VEOL]   = m_sSentinle[m_sSentinle.length() - 1];
+        config.c_cc[VEOL2]  = _POSIX_VDISABLE;
+        config.c_cc[VEOF]   = _POSIX_VDISABLE;
+        config.c_cc[VERASE] = _POSIX_VDISABLE;
+        config.c_cc[VKILL]  = _POSIX_VDISABLE;
+        setLowLatency(false);
+    }
+    else if (m_readMode == READ_MODE_THROUGHPUT ||
+             m_readMode == READ_MODE_RECORD) {
+        if (m_readMode == READ_MODE_RECORD)
+            LOG(ERROR) << "record read mode requires a sentinle, using throughput";
+
+        //
+        // The device is non-blocking so VMIN/VTIME can't batch for us,
+        // readData holds short reads instead.  Leave the UART on its own
+        // timer so bytes arrive in chunks.
+        //
+        config.c_cc[VMIN]  = 1;
+        config.c_cc[VTIME] = 0;
+        setLowLatency(false);
+    }
+    else {
+        //
+        // One input byte is enough to return from read()
+        // Inter-character timer off
+        //
+        config.c_cc[VMIN]  = 1;
+        config.c_cc[VTIME] = 0;
+        setLowLatency(true);
+    }
 
     //
     // Communication speed (simple version, using the predefined
@@ -278,60 +387,262 @@ bool SerialCommSocket::connected() {
 
 /******************************************************************************
  * Method: write
- * Description: write a number of bytes to the socket connection.  Currently we
- * try to write three times before we fail.  We might want to update this retry
- * so that it keeps retrying if it see progress being made?
+ * Description: queue a number of bytes for the device and write what we can
+ * without blocking.  Whatever is left is written by flushWriteQueue when the
+ * device becomes writable so a slow baud rate doesn't stall the port agent.
  *
  * Parameters:
  *   buffer - the data to write
  *   size - the size of the buffer array
  * Return:
- *   returns the actual number of bytes written.
+ *   returns the number of bytes accepted, which is always size.
  * Exceptions:
- *   SocketNotConnected
  *   SocketWriteFailure
  ******************************************************************************/
 uint32_t SerialCommSocket::writeData(const char *buffer, const uint32_t size) {
-    int bytesWritten = 0;
-    int bytesRemaining = size;
-    int count;
-
     if(! connected())
         throw(SocketWriteFailure("not connected"));
 
-    while( bytesRemaining > 0 ) {
-        LOG(DEBUG) << "WRITE DEVICE: " << buffer;
-        count = write(m_pSocketFD, buffer + bytesWritten, bytesRemaining );
+    if(m_sWriteQueue.length() + size > SERIAL_WRITE_QUEUE_MAX)
+        throw(SocketWriteFailure("write queue full"));
+
+    if(! m_oWriteQueueCharge.resize(m_sWriteQueue.length() + size))
+        throw(SocketWriteFailure("connection memory budget exceeded"));
+
+    LOG(DEBUG) << "WRITE DEVICE: " << buffer;
+    m_sWriteQueue.append(buffer, size);
+    flushWriteQueue();
+
+    return size;
+}
+
+/******************************************************************************
+ * Method: writeDelay
+ * Description: How long before the pacing delays allow the next write.
+ * Return:
+ *   microseconds until the next write, 0 if we can write now.
+ ******************************************************************************/
+uint32_t SerialCommSocket::writeDelay() {
+    uint64_t now;
+    uint64_t next = m_iNextWrite > m_iBreakEnd ? m_iNextWrite : m_iBreakEnd;
+
+    if(! next)
+        return 0;
+
+    // Writes wait for the break to end
+    now = currentTime();
+    if(m_iBreakEnd && m_iBreakEnd <= now)
+        return 1;
+
+    return next > now ? next - now : 0;
+}
+
+/******************************************************************************
+ * Method: timerDelay
+ * Description: How long until the break in progress ends, a held read is
+ * due or the next device open is due.
+ * Return:
+ *   microseconds until the next timer, 0 if none are set.
+ ******************************************************************************/
+uint32_t SerialCommSocket::timerDelay() {
+    uint64_t now = currentTime();
+    uint64_t next = m_iBreakEnd;
+
+    if(connected() && m_iReadHold && (! next || m_iReadHold < next))
+        next = m_iReadHold;
+
+    if(! connected() && m_iNextOpen && (! next || m_iNextOpen < next))
+        next = m_iNextOpen;
+
+    if(! next)
+        return 0;
+
+    return next > now ? next - now : 1;
+}
+
+/******************************************************************************
+ * Method: runTimers
+ * Description: End the break if it's time and check if the device we are
+ * waiting on has appeared.
+ ******************************************************************************/
+void SerialCommSocket::runTimers() {
+    char buffer[sizeof(struct inotify_event) + NAME_MAX + 1];
+    string name = m_sDevicePath.substr(m_sDevicePath.rfind('/') + 1);
+    int count;
+
+    if(m_iBreakEnd && m_iBreakEnd <= currentTime()) {
+        LOG(DEBUG) << "clear break";
+        if(connected() && ioctl(m_pSocketFD, TIOCCBRK) < 0)
+            LOG(ERROR) << "Failed to clear break: " << strerror(errno);
+
+        m_iBreakEnd = 0;
+    }
+
+    if(! m_iWatchFD)
+        return;
+
+    while((count = read(m_iWatchFD, buffer, sizeof(buffer))) > 0) {
+        for(int i = 0; i < count; ) {
+            struct inotify_event *event = (struct inotify_event *)(buffer + i);
+
+            if(event->len && name == event->name) {
+                LOG(INFO) << "device appeared: " << m_sDevicePath;
+                m_iNextOpen = 0;
+                m_iOpenBackoff = OPEN_RETRY_MIN;
+            }
+
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/******************************************************************************
+ * Method: flushWriteQueue
+ * Description: write as much of the write queue as the device will take
+ * without blocking.  With a character delay one byte goes out per call, with
+ * a line delay we stop after each newline.
+ *
+ * Return:
+ *   returns the number of bytes written.
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+uint32_t SerialCommSocket::flushWriteQueue() {
+    uint32_t bytesWritten = 0;
+    uint32_t length;
+    int count;
+    size_t eol;
+
+    if(! connected() || m_sWriteQueue.empty() || writeDelay())
+        return 0;
+
+    length = m_sWriteQueue.length();
+    if(m_iCharDelay)
+        length = 1;
+    else if(m_iLineDelay && (eol = m_sWriteQueue.find('\n')) != string::npos)
+        length = eol + 1;
+
+    while(bytesWritten < length) {
+        count = write(m_pSocketFD, m_sWriteQueue.data() + bytesWritten, length - bytesWritten);
         LOG(DEBUG1) << "bytes written: " << count;
+
         if(count < 0) {
-            m_pSocketFD = 0;
+            if(errno == EAGAIN || errno == EINTR)
+                break;
+
             LOG(ERROR) << strerror(errno) << "(errno: " << errno << ")";
+            m_sWriteQueue.clear();
+            m_oWriteQueueCharge.set(0);
+            disconnect();
             throw(SocketWriteFailure(strerror(errno)));
         }
 
         bytesWritten += count;
-        bytesRemaining -= count;
+    }
 
-        LOG(DEBUG2) << "wrote bytes: " << count << " bytes remaining: " << bytesRemaining;
+    // Start the pacing timer once the paced chunk is out
+    if(bytesWritten && bytesWritten == length) {
+        uint32_t delay = m_iCharDelay;
+        if(m_iLineDelay && m_sWriteQueue[bytesWritten - 1] == '\n')
+            delay = m_iLineDelay;
+
+        m_iNextWrite = delay ? currentTime() + (uint64_t)delay * 1000 : 0;
     }
 
+    m_sWriteQueue.erase(0, bytesWritten);
+    m_oWriteQueueCharge.set(m_sWriteQueue.length());
+
+    LOG(DEBUG2) << "wrote bytes: " << bytesWritten << " bytes queued: " << m_sWriteQueue.length();
     return bytesWritten;
 }
 
+/******************************************************************************
+ * Method: readData
+ * Description: read from the device and keep track of how many reads it takes
+ * to move the data.  The ratio of bytes to reads shows how much the read mode
+ * is cutting down on wakeups.
+ *
+ * In throughput mode a read with less than THROUGHPUT_READ_MIN bytes waiting
+ * is held for THROUGHPUT_READ_TIME so the rest of the burst can arrive.  The
+ * fd is left out of the select until then, see readFD and timerDelay.
+ *
+ * Parameters:
+ *   buffer - where to store the data
+ *   size - the size of the buffer array
+ * Return:
+ *   returns the actual number of bytes read, 0 if the read is held.
+ ******************************************************************************/
+uint32_t SerialCommSocket::readData(char *buffer, const uint32_t size) {
+    uint32_t bytesRead;
+    int waiting = 0;
+    bool batch = m_readMode == READ_MODE_THROUGHPUT ||
+                 (m_readMode == READ_MODE_RECORD && m_sSentinle.empty());
+
+    if(connected() && batch && ! m_iReadHold &&
+       ioctl(m_pSocketFD, FIONREAD, &waiting) == 0 && waiting < THROUGHPUT_READ_MIN) {
+        m_iReadHold = currentTime() + THROUGHPUT_READ_TIME * 1000;
+        LOG(DEBUG2) << "holding read, bytes waiting: " << waiting;
+        return 0;
+    }
+
+    m_iReadHold = 0;
+    bytesRead = CommSocket::readData(buffer, size);
+
+    m_iReadCount++;
+    m_iBytesRead += bytesRead;
+
+    return bytesRead;
+}
+
+/******************************************************************************
+ * Method: readFD
+ * Description: The device fd, or 0 while a throughput read is held so the
+ * select doesn't spin on bytes we are leaving for later.
+ ******************************************************************************/
+int SerialCommSocket::readFD() {
+    if(m_iReadHold && m_iReadHold > currentTime())
+        return 0;
+
+    return CommSocket::readFD();
+}
+
+/******************************************************************************
+ * Method: sendBreak
+ * Description: Start a break and schedule its end so we don't block for the
+ * duration.  Writes are held until the break is over.
+ *
+ * Parameters:
+ *   iDuration - break length in milliseconds, 0 for the default
+ ******************************************************************************/
 bool SerialCommSocket::sendBreak(uint32_t  iDuration) {
-    bool bReturnCode = true;
+    if(! connected()) {
+        LOG(ERROR) << "Failed to send break: not connected";
+        return false;
+    }
 
-    if (0 < tcsendbreak(m_pSocketFD, iDuration)) {
-        LOG(ERROR) << "Failed to send break";
-        bReturnCode = false;
+    if(! iDuration)
+        iDuration = SERIAL_BREAK_DEFAULT;
+
+    if (ioctl(m_pSocketFD, TIOCSBRK) < 0) {
+        LOG(ERROR) << "Failed to send break: " << strerror(errno);
+        return false;
     }
 
-    return bReturnCode;
+    LOG(DEBUG) << "break for " << iDuration << " ms";
+    m_iBreakEnd = currentTime() + (uint64_t)iDuration * 1000;
+
+    return true;
 }
 
 void SerialCommSocket::setDevicePath(string sDevicePath) {
     LOG(INFO) << "setDevicePath: " << sDevicePath;
 
+    if(sDevicePath != m_sDevicePath) {
+        unwatchDevice();
+        m_iNextOpen = 0;
+        m_iOpenBackoff = OPEN_RETRY_MIN;
+    }
+
     m_sDevicePath = sDevicePath;
 }
 
@@ -390,3 +701,110 @@ void SerialCommSocket::setParity(uint16_t iParity) {
 
     m_stopBits = iParity;
 }
+
+/******************************************************************************
+ * Method: setReadMode
+ * Description: Set how reads are batched.  Takes effect on the next call to
+ * initializeSerialSettings.
+ ******************************************************************************/
+void SerialCommSocket::setReadMode(uint16_t iReadMode) {
+    LOG(INFO) << "setReadMode: " << iReadMode;
+
+    m_readMode = iReadMode;
+}
+
+/******************************************************************************
+ * Method: setSentinle
+ * Description: Set the record terminator used by the record read mode.
+ ******************************************************************************/
+void SerialCommSocket::setSentinle(const string &sSentinle) {
+    m_sSentinle = sSentinle;
+}
+
+/******************************************************************************
+ * Method: setLowLatency
+ * Description: Toggle the ASYNC_LOW_LATENCY flag on the UART so the driver
+ * pushes received bytes to us immediately instead of on its own timer.  Not
+ * all devices support this (USB adapters, ptys) so failures are only logged.
+ ******************************************************************************/
+void SerialCommSocket::setLowLatency(bool bEnabled) {
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct serial;
+
+    if (ioctl(m_pSocketFD, TIOCGSERIAL, &serial) < 0) {
+        LOG(DEBUG) << "low latency not supported by device: " << strerror(errno);
+        return;
+    }
+
+    if (bEnabled)
+        serial.flags |= ASYNC_LOW_LATENCY;
+    else
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+
+    if (ioctl(m_pSocketFD, TIOCSSERIAL, &serial) < 0)
+        LOG(DEBUG) << "failed to set low latency: " << strerror(errno);
+#endif
+}
+
+/******************************************************************************
+ * Method: setCharDelay
+ * Description: Milliseconds to wait between each character written.
+ ******************************************************************************/
+void SerialCommSocket::setCharDelay(uint32_t iCharDelay) {
+    LOG(INFO) << "setCharDelay: " << iCharDelay;
+
+    m_iCharDelay = iCharDelay;
+}
+
+/******************************************************************************
+ * Method: setLineDelay
+ * Description: Milliseconds to wait after each newline written.
+ ******************************************************************************/
+void SerialCommSocket::setLineDelay(uint32_t iLineDelay) {
+    LOG(INFO) << "setLineDelay: " << iLineDelay;
+
+    m_iLineDelay = iLineDelay;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: watchDevice
+ * Description: Watch the directory the device lives in so we know as soon as
+ * it's plugged in.  A failed watch just means we wait out the back off.
+ ******************************************************************************/
+void SerialCommSocket::watchDevice() {
+    size_t slash = m_sDevicePath.rfind('/');
+    string dir = slash == string::npos ? "." : m_sDevicePath.substr(0, slash ? slash : 1);
+
+    if(m_iWatchFD)
+        return;
+
+    m_iWatchFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_iWatchFD < 0) {
+        LOG(DEBUG) << "failed to create device watch: " << strerror(errno);
+        m_iWatchFD = 0;
+        return;
+    }
+
+    if(inotify_add_watch(m_iWatchFD, dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+        LOG(DEBUG) << "failed to watch " << dir << ": " << strerror(errno);
+        unwatchDevice();
+        return;
+    }
+
+    LOG(DEBUG) << "watching " << dir << " for " << m_sDevicePath;
+}
+
+/******************************************************************************
+ * Method: unwatchDevice
+ * Description: Stop watching for the device.
+ ******************************************************************************/
+void SerialCommSocket::unwatchDevice() {
+    if(m_iWatchFD)
+        close(m_iWatchFD);
+
+    m_iWatchFD = 0;
+}
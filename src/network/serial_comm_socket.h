@@ -12,13 +12,30 @@
 #define __SERIAL_COMM_SOCKET_H_
 
 #include "common/logger.h"
+#include "common/memory_budget.h"
 #include "network/comm_socket.h"
 
 using namespace std;
 using namespace logger;
 using namespace network;
 
-#define OPEN_FAIL_SLEEP_TIME 1
+// Device open retry back off in milliseconds.  Doubles after each failed
+// open up to the max.
+#define OPEN_RETRY_MIN 100
+#define OPEN_RETRY_MAX 5000
+
+// Break length in milliseconds when none is given
+#define SERIAL_BREAK_DEFAULT 250
+
+// Read batching used by the throughput read mode.  With fewer than
+// THROUGHPUT_READ_MIN bytes buffered the read is held off the select for up
+// to THROUGHPUT_READ_TIME milliseconds so a burst is read in one go.  The
+// device stays non-blocking so the main loop never waits in read().
+#define THROUGHPUT_READ_MIN  255
+#define THROUGHPUT_READ_TIME 100
+
+// Most bytes we will hold for the device before rejecting writes
+#define SERIAL_WRITE_QUEUE_MAX 1048576
 
 namespace network {
 
@@ -34,6 +51,9 @@ namespace network {
     const uint16_t DATABITS_8 = 8;
     const uint16_t STOPBITS_1 = 1;
     const uint16_t STOPBITS_2 = 2;
+    const uint16_t READ_MODE_LOW_LATENCY = 0;
+    const uint16_t READ_MODE_THROUGHPUT  = 1;
+    const uint16_t READ_MODE_RECORD      = 2;
 
 
     class SerialCommSocket : public CommSocket {
@@ -54,6 +74,8 @@ namespace network {
             // Initialize
             bool initializeSerialSettings();
             bool initialize();
+            
+            virtual void handoffFDs(FDHandoff &handoff);
 			
             // Does this object have a complete configuration?
             bool isConfigured();
@@ -64,6 +86,23 @@ namespace network {
             virtual bool connectClient() { return false; }
 
             virtual uint32_t writeData(const char *buffer, uint32_t size);
+            virtual uint32_t readData(char *buffer, uint32_t size);
+
+            // No fd to select on while a throughput read is held
+            virtual int readFD();
+
+            // Outbound data is queued and written when the device is ready
+            virtual bool writePending() { return m_sWriteQueue.length() > 0; }
+            virtual uint32_t writeDelay();
+            virtual uint32_t flushWriteQueue();
+            uint32_t writeQueueSize() { return m_sWriteQueue.length(); }
+            
+            // Breaks and open retries run on timers
+            virtual uint32_t timerDelay();
+            virtual void runTimers();
+            virtual int eventFD() { return m_iWatchFD; }
+            bool breaking() { return m_iBreakEnd > 0; }
+            
             bool sendBreak(uint32_t iDuration);
             void setDevicePath(string sDevicePath);
             const string &devicePath() { return m_sDevicePath; }
@@ -73,17 +112,30 @@ namespace network {
             void setStopBits(uint16_t iStopBits);
             void setDataBits(uint16_t iDataBits);
             void setParity(uint16_t iParity);
+            void setReadMode(uint16_t iReadMode);
+            void setSentinle(const string &sSentinle);
+            void setCharDelay(uint32_t iCharDelay);
+            void setLineDelay(uint32_t iLineDelay);
             
             /* Operators */
             virtual SerialCommSocket & operator=(const SerialCommSocket &rhs);
 
             /* Accessors */
             bool connected();
+            uint16_t readMode() { return m_readMode; }
+
+            // Read statistics used to gauge how well the read mode batches
+            uint32_t readCount() { return m_iReadCount; }
+            uint32_t bytesRead() { return m_iBytesRead; }
+            void clearReadStats() { m_iReadCount = m_iBytesRead = 0; }
 
             
         protected:
 
         private:
+            void setLowLatency(bool bEnabled);
+            void watchDevice();
+            void unwatchDevice();
         
         /********************
          *      MEMBERS     *
@@ -100,6 +152,30 @@ namespace network {
             uint16_t m_stopBits;
             uint16_t m_dataBits;
             uint16_t m_parity;
+            uint16_t m_readMode;
+            string   m_sSentinle;
+
+            // Write queue and pacing, delays are in milliseconds
+            string   m_sWriteQueue;
+            MemoryCharge m_oWriteQueueCharge;
+            uint32_t m_iCharDelay;
+            uint32_t m_iLineDelay;
+            uint64_t m_iNextWrite;
+
+            uint32_t m_iReadCount;
+            uint32_t m_iBytesRead;
+
+            // When a held throughput read is due, microseconds
+            uint64_t m_iReadHold;
+
+            // End of the break in progress, microseconds
+            uint64_t m_iBreakEnd;
+
+            // Open retry schedule and the inotify watch on the device
+            // directory that cuts it short when the device shows up.
+            uint64_t m_iNextOpen;
+            uint32_t m_iOpenBackoff;
+            int      m_iWatchFD;
 
     };
 }
@@ -0,0 +1,276 @@
+/*******************************************************************************
+ * Class: SplicePipe
+ * Filename: splice_pipe.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Move data between two file descriptors inside the kernel using splice(2).
+ *
+ ******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "splice_pipe.h"
+#include "common/logger.h"
+#include "common/exception.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+using namespace logger;
+using namespace network;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor.
+ ******************************************************************************/
+SplicePipe::SplicePipe() {
+    m_pPipe[0] = m_pPipe[1] = 0;
+    m_pTeePipe[0] = m_pTeePipe[1] = 0;
+    m_iPending = 0;
+    m_iBytesSpliced = 0;
+    m_iTeeFailures = 0;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: close the pipes
+ ******************************************************************************/
+SplicePipe::~SplicePipe() {
+    close();
+}
+
+/******************************************************************************
+ * Method: initialize
+ * Description: Create the splice pipe and the tee pipe used for archive
+ * copies.  Both are non-blocking so a full pipe never stalls the caller.
+ *
+ * Return:
+ *   true if the pipes were created
+ ******************************************************************************/
+bool SplicePipe::initialize() {
+    close();
+
+    if(pipe2(m_pPipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG(ERROR) << "splice pipe create failed: " << strerror(errno);
+        m_pPipe[0] = m_pPipe[1] = 0;
+        return false;
+    }
+
+    if(pipe2(m_pTeePipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG(ERROR) << "tee pipe create failed: " << strerror(errno);
+        m_pTeePipe[0] = m_pTeePipe[1] = 0;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: fill
+ * Description: splice whatever the source has ready into the pipe.
+ *
+ * Parameters:
+ *   sourceFD - fd to read from
+ *   closed - set true if the source has been shut down
+ * Return:
+ *   the number of bytes moved into the pipe
+ * Exceptions:
+ *   SocketReadFailure
+ ******************************************************************************/
+uint32_t SplicePipe::fill(int sourceFD, bool &closed) {
+    ssize_t count;
+
+    closed = false;
+
+    if(! initialized())
+        throw(SocketNotInitialized("splice pipe"));
+
+    count = splice(sourceFD, NULL, m_pPipe[1], NULL, SPLICE_CHUNK_SIZE - m_iPending,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if(count < 0) {
+        if(errno == EAGAIN || errno == EINTR)
+            return 0;
+
+        LOG(ERROR) << "splice read failed: " << strerror(errno);
+        throw(SocketReadFailure(strerror(errno)));
+    }
+
+    if(count == 0) {
+        LOG(INFO) << "splice source closed";
+        closed = true;
+        return 0;
+    }
+
+    LOG(DEBUG2) << "spliced bytes into pipe: " << count;
+    m_iPending += count;
+    return count;
+}
+
+/******************************************************************************
+ * Method: peek
+ * Description: tee the data in the pipe into the tee pipe and read it back
+ * so it can be archived.  The data in the splice pipe is not consumed.  We
+ * only hand back a copy of everything pending, anything less would leave a
+ * hole in the archive, so a short copy counts as a failure.
+ *
+ * Parameters:
+ *   buffer - where to store the copy
+ *   size - size of the buffer
+ * Return:
+ *   the number of bytes copied, 0 if a complete copy couldn't be made
+ ******************************************************************************/
+uint32_t SplicePipe::peek(char *buffer, uint32_t size) {
+    ssize_t count;
+
+    if(! m_iPending)
+        return 0;
+
+    if(size < m_iPending) {
+        LOG(ERROR) << "tee buffer too small: " << size << " pending: " << m_iPending;
+        m_iTeeFailures++;
+        return 0;
+    }
+
+    count = tee(m_pPipe[0], m_pTeePipe[1], m_iPending, SPLICE_F_NONBLOCK);
+
+    if(count < 0) {
+        LOG(ERROR) << "tee failed: " << strerror(errno);
+        m_iTeeFailures++;
+        return 0;
+    }
+
+    if(count > 0)
+        count = read(m_pTeePipe[0], buffer, count);
+
+    if(count != (ssize_t)m_iPending) {
+        LOG(ERROR) << "short tee: " << count << " pending: " << m_iPending;
+        m_iTeeFailures++;
+        clearTee();
+        return 0;
+    }
+
+    return count;
+}
+
+/******************************************************************************
+ * Method: consume
+ * Description: read the data in the pipe into user space.  Used when a tee
+ * copy couldn't be made, the caller then handles the data the buffered way.
+ *
+ * Parameters:
+ *   buffer - where to store the data
+ *   size - size of the buffer
+ * Return:
+ *   the number of bytes read out of the pipe
+ ******************************************************************************/
+uint32_t SplicePipe::consume(char *buffer, uint32_t size) {
+    uint32_t bytesRead = 0;
+    ssize_t count;
+
+    while(m_iPending && bytesRead < size) {
+        count = read(m_pPipe[0], buffer + bytesRead,
+                     size - bytesRead < m_iPending ? size - bytesRead : m_iPending);
+
+        if(count <= 0) {
+            if(count < 0 && errno == EINTR)
+                continue;
+
+            LOG(ERROR) << "splice pipe read failed: " << strerror(errno);
+            break;
+        }
+
+        m_iPending -= count;
+        bytesRead += count;
+    }
+
+    return bytesRead;
+}
+
+/******************************************************************************
+ * Method: drain
+ * Description: splice the data in the pipe out to the destination.  Whatever
+ * the destination can't take stays in the pipe for the next call.
+ *
+ * Parameters:
+ *   destinationFD - fd to write to
+ * Return:
+ *   the number of bytes written
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+uint32_t SplicePipe::drain(int destinationFD) {
+    uint32_t bytesWritten = 0;
+    ssize_t count;
+
+    while(m_iPending) {
+        count = splice(m_pPipe[0], NULL, destinationFD, NULL, m_iPending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if(count < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                break;
+
+            LOG(ERROR) << "splice write failed: " << strerror(errno);
+            throw(SocketWriteFailure(strerror(errno)));
+        }
+
+        m_iPending -= count;
+        bytesWritten += count;
+    }
+
+    m_iBytesSpliced += bytesWritten;
+    LOG(DEBUG2) << "spliced bytes out of pipe: " << bytesWritten << " pending: " << m_iPending;
+    return bytesWritten;
+}
+
+/******************************************************************************
+ * Method: reset
+ * Description: drop any data left in the pipe by recreating it.
+ ******************************************************************************/
+void SplicePipe::reset() {
+    if(m_iPending) {
+        LOG(INFO) << "dropping spliced bytes: " << m_iPending;
+        initialize();
+    }
+    m_iPending = 0;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: clearTee
+ * Description: throw away a partial copy left in the tee pipe
+ ******************************************************************************/
+void SplicePipe::clearTee() {
+    char buffer[1024];
+
+    while(read(m_pTeePipe[0], buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+/******************************************************************************
+ * Method: close
+ * Description: close all pipe file descriptors
+ ******************************************************************************/
+void SplicePipe::close() {
+    for(int i = 0; i < 2; i++) {
+        if(m_pPipe[i]) ::close(m_pPipe[i]);
+        if(m_pTeePipe[i]) ::close(m_pTeePipe[i]);
+        m_pPipe[i] = m_pTeePipe[i] = 0;
+    }
+    m_iPending = 0;
+}
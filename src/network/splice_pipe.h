@@ -0,0 +1,102 @@
+/*******************************************************************************
+ * Class: SplicePipe
+ * Filename: splice_pipe.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Move data between two file descriptors inside the kernel using splice(2).
+ * Data is spliced from the source into a pipe and from the pipe into the
+ * destination so it never passes through user space.  A second pipe can be
+ * fed with tee(2) so a copy of the data is available to be archived.  If
+ * the copy can't be made the data can be taken back out of the pipe with
+ * consume() so it is never forwarded without being archived.
+ *
+ * Usage:
+ *
+ * SplicePipe pipe;
+ * bool closed;
+ *
+ * if(! pipe.pending() && pipe.fill(sourceFD, closed)) {
+ *     if((count = pipe.peek(buffer, size)))
+ *         archive(buffer, count);
+ *     else
+ *         archiveAndWrite(buffer, pipe.consume(buffer, size));
+ * }
+ * pipe.drain(destinationFD);
+ *
+ ******************************************************************************/
+
+#ifndef __SPLICE_PIPE_H_
+#define __SPLICE_PIPE_H_
+
+#include "common/logger.h"
+
+#include <stdint.h>
+
+using namespace std;
+using namespace logger;
+
+// Most bytes we move through the pipe per fill.  Keep this under the default
+// pipe capacity and the max packet size so archive copies fit in one packet.
+#define SPLICE_CHUNK_SIZE 16384
+
+namespace network {
+    class SplicePipe {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            SplicePipe();
+            virtual ~SplicePipe();
+
+            // Create the pipes
+            bool initialize();
+            bool initialized() { return m_pPipe[0] > 0; }
+
+            // Move data from the source fd into the pipe
+            uint32_t fill(int sourceFD, bool &closed);
+
+            // Copy the data sitting in the pipe without consuming it
+            uint32_t peek(char *buffer, uint32_t size);
+
+            // Read the data sitting in the pipe out to user space
+            uint32_t consume(char *buffer, uint32_t size);
+
+            // Move data from the pipe into the destination fd
+            uint32_t drain(int destinationFD);
+
+            // Bytes in the pipe that haven't been drained
+            uint32_t pending() { return m_iPending; }
+
+            // Throw away anything left in the pipe
+            void reset();
+
+            /* Accessors */
+            uint32_t bytesSpliced() { return m_iBytesSpliced; }
+            uint32_t teeFailures() { return m_iTeeFailures; }
+
+        protected:
+
+        private:
+            void close();
+            void clearTee();
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        protected:
+
+        private:
+            int m_pPipe[2];
+            int m_pTeePipe[2];
+            uint32_t m_iPending;
+            uint32_t m_iBytesSpliced;
+            uint32_t m_iTeeFailures;
+    };
+}
+
+#endif //__SPLICE_PIPE_H_
@@ -33,6 +33,9 @@
  * // Write data to the client.
  * int bytes_written = ts.writeData("Hello World", strlen("Hello World"));
  *
+ * // Offer clients a compressed stream, sync flushed within 100ms
+ * ts.setCompression(6, 100000);
+ *
  * // When using non-blocking you may want to use a select read loop to monitor
  * // the file descriptors.  They are exposed via accessors
  * int serverFD = ts.getServerFD();
@@ -44,22 +47,36 @@
 #include "common/logger.h"
 #include "common/exception.h"
 #include "common/timestamp.h"
+#include "common/clock.h"
+#include "common/io_ring.h"
+#include "common/probe.h"
+#include "network/fd_handoff.h"
 
 #include <netinet/in.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
 
 
 using namespace std;
 using namespace logger;
 using namespace network;
     
+/******************************************************************************
+ * Method: currentTime
+ * Description: Monotonic microseconds used to time compressed flushes.
+ ******************************************************************************/
+static uint64_t currentTime() {
+    return Clock::MonotonicUsec();
+}
+
 /******************************************************************************
  *   PUBLIC METHODS
  ******************************************************************************/
@@ -70,9 +87,26 @@ using namespace network;
  ******************************************************************************/
 TCPCommListener::TCPCommListener() : CommBase() {
     m_iPort = 0;
+    m_iBacklog = TCP_LISTEN_BACKLOG;
+    m_bReusePort = false;
+    m_bTakeover = false;
+    m_iFDFloor = 0;
 	    
     m_pServerFD = 0;
     m_pClientFD = 0;
+    
+    m_iCompressLevel = 0;
+    m_iCompressFlush = TCP_COMPRESS_FLUSH_USEC;
+    m_pDeflate = NULL;
+    m_iPendingSince = 0;
+    m_bHandshakeDone = false;
+    m_iCompressedIn = 0;
+    m_iCompressedOut = 0;
+    m_iCompressCpu = 0;
+    pthread_mutex_init(&m_oDeflateLock, NULL);
+    pthread_mutex_init(&m_oLaneLock, NULL);
+    m_bBatched = false;
+    m_eBatchLane = LANE_BULK;
 }
 
 
@@ -83,9 +117,30 @@ TCPCommListener::TCPCommListener() : CommBase() {
 TCPCommListener::TCPCommListener(const TCPCommListener &rhs) : CommBase(rhs) {
 	LOG(DEBUG) << "TCPCommListener Copy CTOR!!";
     m_iPort = rhs.m_iPort;
+    m_iBacklog = rhs.m_iBacklog;
+    m_bReusePort = rhs.m_bReusePort;
+    m_bTakeover = rhs.m_bTakeover;
+    m_iFDFloor = rhs.m_iFDFloor;
 	    
     m_pServerFD = rhs.m_pServerFD;
     m_pClientFD = rhs.m_pClientFD;
+    
+    // The stream belongs to the original, the copy starts on the next client
+    m_iCompressLevel = rhs.m_iCompressLevel;
+    m_iCompressFlush = rhs.m_iCompressFlush;
+    m_pDeflate = NULL;
+    m_iPendingSince = 0;
+    m_bHandshakeDone = rhs.m_bHandshakeDone;
+    m_iCompressedIn = 0;
+    m_iCompressedOut = 0;
+    m_iCompressCpu = 0;
+    pthread_mutex_init(&m_oDeflateLock, NULL);
+    pthread_mutex_init(&m_oLaneLock, NULL);
+    m_bBatched = false;
+    m_eBatchLane = LANE_BULK;
+    
+    // Policy only, the monitor follows the copy's own clients
+    m_oClientMonitor = rhs.m_oClientMonitor;
 }
 
 
@@ -96,6 +151,8 @@ TCPCommListener::TCPCommListener(const TCPCommListener &rhs) : CommBase(rhs) {
 TCPCommListener::~TCPCommListener() {
     LOG(DEBUG) << "TCPCommListener DTOR";
 	disconnect();
+	pthread_mutex_destroy(&m_oDeflateLock);
+	pthread_mutex_destroy(&m_oLaneLock);
 }
 
 /******************************************************************************
@@ -133,6 +190,131 @@ bool TCPCommListener::compare(CommBase *rhs) {
 }
 
 
+/******************************************************************************
+ * Method: setCompression
+ * Description: Offer clients a compressed stream.  Level 0 turns it off for
+ * the next client, the current one keeps what it has.
+ *
+ * Parameters:
+ *   level - zlib compression level 1-9, 0 to send raw data only
+ *   flushUsec - longest compressed output waits before a sync flush, 0
+ *               flushes every write
+ ******************************************************************************/
+void TCPCommListener::setCompression(int level, uint32_t flushUsec) {
+    m_iCompressLevel = level;
+    m_iCompressFlush = flushUsec;
+}
+
+/******************************************************************************
+ * Method: setSlowClientPolicy
+ * Description: Set when a client is too far behind and what to do with it.
+ *
+ * Parameters:
+ *   queueLimit - bytes the client may leave unread, 0 to only sample it
+ *   policy - decimate or evict a slow client
+ ******************************************************************************/
+void TCPCommListener::setSlowClientPolicy(uint32_t queueLimit, SlowClientPolicy policy) {
+    m_oClientMonitor.setPolicy(queueLimit, policy);
+}
+
+/******************************************************************************
+ * Method: compressedBytesIn
+ * Description: Bytes given to the compressor for every client so far.
+ ******************************************************************************/
+uint64_t TCPCommListener::compressedBytesIn() {
+    uint64_t result;
+    
+    pthread_mutex_lock(&m_oDeflateLock);
+    result = m_iCompressedIn + (m_pDeflate ? m_pDeflate->bytesIn() : 0);
+    pthread_mutex_unlock(&m_oDeflateLock);
+    
+    return result;
+}
+
+/******************************************************************************
+ * Method: compressedBytesOut
+ * Description: Compressed bytes produced for every client so far.
+ ******************************************************************************/
+uint64_t TCPCommListener::compressedBytesOut() {
+    uint64_t result;
+    
+    pthread_mutex_lock(&m_oDeflateLock);
+    result = m_iCompressedOut + (m_pDeflate ? m_pDeflate->bytesOut() : 0);
+    pthread_mutex_unlock(&m_oDeflateLock);
+    
+    return result;
+}
+
+/******************************************************************************
+ * Method: compressionCpuUsec
+ * Description: CPU time spent compressing for every client so far.
+ ******************************************************************************/
+uint64_t TCPCommListener::compressionCpuUsec() {
+    uint64_t result;
+    
+    pthread_mutex_lock(&m_oDeflateLock);
+    result = m_iCompressCpu + (m_pDeflate ? m_pDeflate->cpuUsec() : 0);
+    pthread_mutex_unlock(&m_oDeflateLock);
+    
+    return result;
+}
+
+/******************************************************************************
+ * Method: timerDelay
+ * Description: Microseconds until compressed output is due for a flush.
+ *
+ * Return:
+ *   0 if nothing is waiting
+ ******************************************************************************/
+uint32_t TCPCommListener::timerDelay() {
+    uint64_t due, now;
+    uint32_t result = 0;
+    
+    if(! m_pDeflate)
+        return 0;
+    
+    pthread_mutex_lock(&m_oDeflateLock);
+    if(m_pDeflate && m_pDeflate->pending()) {
+        due = m_iPendingSince + m_iCompressFlush;
+        now = currentTime();
+        result = due > now ? due - now : 1;
+    }
+    pthread_mutex_unlock(&m_oDeflateLock);
+    
+    return result;
+}
+
+/******************************************************************************
+ * Method: runTimers
+ * Description: Sync flush compressed output that has waited long enough.  A
+ * client we can't write to is dropped.
+ ******************************************************************************/
+void TCPCommListener::runTimers() {
+    if(! m_pDeflate)
+        return;
+    
+    bool queued = true;
+    
+    pthread_mutex_lock(&m_oDeflateLock);
+    try {
+        if(m_pDeflate && m_pDeflate->pending() &&
+           currentTime() >= m_iPendingSince + m_iCompressFlush)
+            queued = flushCompressed();
+    }
+    catch(OOIException &e) {
+        pthread_mutex_unlock(&m_oDeflateLock);
+        LOG(ERROR) << "compressed flush failed, dropping client: " << e.what();
+        disconnectClient();
+        return;
+    }
+    pthread_mutex_unlock(&m_oDeflateLock);
+    
+    if(! queued) {
+        LOG(ERROR) << "compressed flush can't be queued, dropping client FD: " << m_pClientFD;
+        disconnectClient();
+    }
+}
+
 /******************************************************************************
  * Method: isConfigured
  * Description: Nothing to do here.
@@ -158,17 +340,23 @@ bool TCPCommListener::disconnect() {
 
 /******************************************************************************
  * Method: disconnectClient
- * Description: Disconnect a client
+ * Description: Disconnect a client.  The listener is only rebuilt if it isn't
+ * still listening.
  ******************************************************************************/
 bool TCPCommListener::disconnectClient(bool server_shutdown) {
     if(connected()) {
         LOG(DEBUG2) << "Disconnecting client";
 	    //shutdown(m_pClientFD,2);
+	    PROBE2(client__close, m_iPort, m_pClientFD);
 	    close(m_pClientFD);
 	    m_pClientFD = 0;
     }
+    
+    m_oClientMonitor.stop();
+    clearLanes();
+    stopCompression();
 	
-	if(!server_shutdown) {
+	if(!server_shutdown && !listening()) {
 		LOG(DEBUG) << "Re-initalize tcp listener";
 	    initialize();
 	}
@@ -192,69 +380,107 @@ bool TCPCommListener::disconnectServer() {
 
 /******************************************************************************
  * Method: acceptClient
- * Description: Accept a client connection and create a new FD
+ * Description: Accept every pending client connection.  The listener stays
+ * open so a reconnecting client never waits on a rebind.
+ *
+ * The current client is kept and the rest are closed, unless that client's
+ * peer has already gone away.  A port scan or health check never cuts off the
+ * driver.  A non-persistent listener with takeover enabled keeps the newest
+ * connection instead, so a restarted driver takes over right away.
+ *
+ * Return:
+ *   true if a new client was installed
+ *
  * Exceptions:
  *   SocketNotInitialized
- *   SocketAlreadyConnected
+ *   SocketAlreadyConnected - every pending client was turned away
+ *   SocketConnectFailure
  ******************************************************************************/
 bool TCPCommListener::acceptClient(bool persistent) {
     socklen_t clilen;
     struct sockaddr_in cli_addr;
     int newsockfd;
+    int flags = SOCK_CLOEXEC;
+    int rejected = 0;
+    bool accepted = false;
+    bool takeover = m_bTakeover && ! persistent;
 
-    LOG(DEBUG) << "persistent: " << persistent;
+    LOG(DEBUG) << "persistent: " << persistent << " takeover: " << takeover;
 
     if (!listening())
         throw SocketNotInitialized();
 
-    if (connected()) {
-        LOG(ERROR) << "Already connected!.";
+    // Set the client to non blocking if needed
+    if(! blocking())
+        flags |= SOCK_NONBLOCK;
+
+    LOG(DEBUG) << "accepting client connection from FD: " << m_pServerFD;
 
+    // A blocking listener takes one client per call, otherwise drain the
+    // accept queue.
+    do {
         clilen = sizeof(cli_addr);
-        newsockfd = accept(m_pServerFD, 
-                    (struct sockaddr *) &cli_addr, 
-                    &clilen);
-		if (newsockfd) {
-		    close(newsockfd);
-		}
-        throw SocketAlreadyConnected();
-	}
+        newsockfd = accept4(m_pServerFD, (struct sockaddr *) &cli_addr, &clilen, flags);
 
-    LOG(DEBUG) << "accepting client connection from FD: " << m_pServerFD;
-     
-    clilen = sizeof(cli_addr);
-    newsockfd = accept(m_pServerFD, 
-                (struct sockaddr *) &cli_addr, 
-                &clilen);
-     
-    LOG(DEBUG) << "client FD: " << newsockfd;
-    
-    if (newsockfd < 0) {
-	    if(errno == EAGAIN  || errno == EWOULDBLOCK) {
-	        LOG(DEBUG) << "Non-blocking error ignored: " << strerror(errno) << "(" << errno << ")";
-    	    return false;
-	    }
-	    else {
-                throw SocketConnectFailure(strerror(errno));
-	    }
-    }
-    
-    // Set the client to non blocking if needed
-    if(! blocking()) {
-	    LOG(DEBUG) << "set client non-blocking";
-	    fcntl(newsockfd, F_SETFL, O_NONBLOCK);
-	    LOG(DEBUG) << "Set to non-blocking";
+        LOG(DEBUG) << "client FD: " << newsockfd;
+
+        if (newsockfd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                LOG(DEBUG) << "Non-blocking error ignored: " << strerror(errno) << "(" << errno << ")";
+                break;
+            }
+
+            throw SocketConnectFailure(strerror(errno));
+        }
+
+        // Checked for every connection, a burst of connects that close
+        // right away must not lock out the one that stays
+        if (! takeover && connected()) {
+            if (! clientClosed()) {
+                close(newsockfd);
+                rejected++;
+                continue;
+            }
+
+            LOG(INFO) << "Client gone, replacing FD: " << m_pClientFD;
+            disconnectClient(true);
+        }
+
+        if (connected()) {
+            LOG(INFO) << "Newer client waiting, closing FD: " << m_pClientFD;
+            close(m_pClientFD);
+        }
+        
+        // The new client makes its own choice of stream and gets none of
+        // the old one's queued writes
+        stopCompression();
+        clearLanes();
+
+        newsockfd = raiseFD(newsockfd);
+
+        // Not every option is inherited from the listener
+        applySocketProfile(newsockfd);
+
+        LOG(DEBUG) << "Storing new FD: " << newsockfd;
+        PROBE2(client__accept, m_iPort, newsockfd);
+        m_pClientFD = newsockfd;
+        m_oClientMonitor.start(newsockfd);
+        accepted = true;
+    } while (! blocking());
+
+    // Once a client has been installed the caller has to see it, so turning
+    // away the rest of the queue is only logged
+    if (rejected && accepted)
+        LOG(WARNING) << "rejected clients: " << rejected << " keeping FD: " << m_pClientFD;
+    else if (rejected) {
+        LOG(ERROR) << "Already connected!. rejected clients: " << rejected;
+        throw SocketAlreadyConnected();
     }
-    
-    LOG(DEBUG) << "Storing new FD: " << newsockfd;
-	m_pClientFD = newsockfd;
-	
-	if (!persistent) {
-	    LOG(DEBUG) << "Disconnect server";
-	    disconnectServer();
-	}
-	
-    return true;
+
+    return accepted;
 }
 
 /******************************************************************************
@@ -284,6 +510,57 @@ uint16_t TCPCommListener::getListenPort() {
     return iPort;
 }
 
+/******************************************************************************
+ * Method: handoffFDs
+ * Description: Add the server and client descriptors to a live upgrade
+ * handoff.
+ *
+ * A compressed stream is ended so the client starts inflating a new one,
+ * which is what the new process sends.  We keep a fresh stream too in case
+ * the upgrade fails and we carry on.
+ ******************************************************************************/
+void TCPCommListener::handoffFDs(FDHandoff &handoff) {
+    uint16_t port = getListenPort();
+    string out;
+
+    if(! port)
+        return;
+
+    handoff.add(FDHandoff::listenerKey(port), m_pServerFD);
+    handoff.add(FDHandoff::listenerClientKey(port), m_pClientFD);
+
+    if(connected() && m_bHandshakeDone)
+        handoff.setValue(FDHandoff::listenerStreamKey(port), m_pDeflate ? "deflate" : "raw");
+
+    // The new process starts its own stream
+    if(connected() && m_bHandshakeDone && m_pDeflate) {
+        pthread_mutex_lock(&m_oDeflateLock);
+        try {
+            m_pDeflate->finish(out);
+            if(! writeStream(out.data(), out.size()))
+                LOG(ERROR) << "failed to queue the end of the compressed stream";
+        }
+        catch(OOIException &e) {
+            LOG(ERROR) << "failed to end compressed stream: " << e.what();
+        }
+        pthread_mutex_unlock(&m_oDeflateLock);
+
+        stopCompression();
+        m_bHandshakeDone = true;
+        startCompression();
+    }
+
+    // Queued writes go out before the new process starts writing
+    if(connected()) {
+        try {
+            drainLanes();
+        }
+        catch(OOIException &e) {
+            LOG(ERROR) << "failed to drain queued writes: " << e.what();
+        }
+    }
+}
+
 /******************************************************************************
  * Method: initalize
  * Description: Setup a TCP listener
@@ -298,7 +575,7 @@ bool TCPCommListener::initialize() {
 	struct hostent *server;
     int retval;
 	int newsock;
-	Timestamp ts;
+	uint32_t bind_attempts = 0;
 	int bind_result = -1;
 	
 	LOG(DEBUG) << "TCP Listener initialize()";
@@ -306,17 +583,42 @@ bool TCPCommListener::initialize() {
 	if(!isConfigured())
 		throw SocketMissingConfig("missing inet port");
 
+	// Pick up the listener and client handed to us by a live upgrade
+	if(m_iPort && (newsock = FDHandoff::instance()->take(FDHandoff::listenerKey(m_iPort)))) {
+		m_pServerFD = newsock;
+		m_pClientFD = FDHandoff::instance()->take(FDHandoff::listenerClientKey(m_iPort));
+		m_oClientMonitor.start(m_pClientFD);
+		
+		// A client that already chose its stream doesn't handshake again
+		string stream = FDHandoff::instance()->value(FDHandoff::listenerStreamKey(m_iPort));
+		if(m_pClientFD && stream.length()) {
+		    m_bHandshakeDone = true;
+		    if(stream == "deflate")
+		        startCompression();
+		}
+		return true;
+	}
+
 	LOG(DEBUG2) << "Creating INET socket";
-	newsock = socket(AF_INET, SOCK_STREAM, 0);
+	newsock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (blocking() ? 0 : SOCK_NONBLOCK), 0);
 
-	if(!newsock)
+	if(newsock < 0)
 		throw SocketCreateFailure("socket create failure");
 
 	optval = 1;
 	if (setsockopt(newsock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval) == -1) {
+	    close(newsock);
 	    throw SocketCreateFailure("setsockopt SO_REUSADDR failure");
 	}
 
+	if (m_bReusePort &&
+	    setsockopt(newsock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof optval) == -1) {
+	    close(newsock);
+	    throw SocketCreateFailure("setsockopt SO_REUSEPORT failure");
+	}
+
+	applySocketProfile(newsock);
+
 	bzero((char *) &serv_addr, sizeof(serv_addr));
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_addr.s_addr = INADDR_ANY;
@@ -330,35 +632,32 @@ bool TCPCommListener::initialize() {
             LOG(ERROR) << "Failed to bind: " << strerror(errno) << "(" << errno << ")";
 			
 			// Retry on address in use errors if we haven't exceeded timeout.  Otherwise
-			// raise an exception.
-			if(errno == EADDRINUSE && ts.elapseTime() < TCP_BIND_TIMEOUT) {
+			// raise an exception.  Attempts are counted rather than timed so
+			// a stopped test clock can't keep us here.
+			if(errno == EADDRINUSE &&
+			   ++bind_attempts < TCP_BIND_TIMEOUT * CLOCK_USEC_PER_SEC / TCP_BIND_RETRY_USEC) {
 				LOG(INFO) << "Waiting for port to freeup.  retrying bind.";
 			}
 			else {
+			    close(newsock);
 		        throw SocketConnectFailure(strerror(errno));
 			}
 			
-		    sleep(1);
+		    usleep(TCP_BIND_RETRY_USEC);
 	    }
 	}
 	    
 	LOG(DEBUG2) << "Starting server";
-	retval = listen(newsock, 0);
-	LOG(DEBUG3) << "listen return value: " << retval;
+	retval = listen(newsock, m_iBacklog);
+	LOG(DEBUG3) << "listen return value: " << retval << " backlog: " << m_iBacklog;
 	
 	if (retval < 0)
-	    if(errno != EINPROGRESS ) // ignore EINPROGRESS error because we are NON-Blocking
+	    if(errno != EINPROGRESS ) { // ignore EINPROGRESS error because we are NON-Blocking
+	        close(newsock);
                 throw(SocketConnectFailure(strerror(errno)));
-
-	if(! blocking()) {
-		LOG(DEBUG3) << "set server socket non-blocking";
-		fcntl(newsock, F_SETFL, O_NONBLOCK);
-		int opts = fcntl(newsock, F_GETFL);
-		LOG(DEBUG3) << "fd: " << hex << newsock << " "
-		            << "sock opts: " << hex << opts << " "
-		            << "non block flag: " << hex << O_NONBLOCK;
-	}
+	    }
 	
+	newsock = raiseFD(newsock);
 	LOG(DEBUG2) << "storing new fd: " << newsock;
 	m_pServerFD = newsock;
 	
@@ -373,49 +672,118 @@ bool TCPCommListener::initialize() {
 
 
 /******************************************************************************
- * Method: write
- * Description: write a number of bytes to the socket connection.  Currently we
- * try to write three times before we fail.  We might want to update this retry
- * so that it keeps retrying if it see progress being made?
+ * Method: writeData
+ * Description: write a number of bytes of data to the socket connection.  A
+ * client that asked for compression gets the data through its deflate
+ * stream, which is sync flushed once the oldest unflushed write is
+ * m_iCompressFlush old.  Otherwise what the socket can't take right away is
+ * queued behind any control writes.  A client that has fallen behind may
+ * have the write dropped or be disconnected, see ClientMonitor.
  *
  * Parameters:
  *   buffer - the data to write
  *   size - the size of the buffer array
  * Return:
- *   returns the actual number of bytes written.
+ *   returns the number of bytes written or queued, before compression.
  * Exceptions:
  *   SocketNotInitialized
  *   SocketNotConnected
  *   SocketWriteFailure
+ *   CompressionFailure
  ******************************************************************************/
 uint32_t TCPCommListener::writeData(const char *buffer, const uint32_t size) {
-    int bytesWritten = 0;
-    int bytesRemaining = size;
-    int count;
+    return writeLane(LANE_BULK, buffer, size);
+}
 
-    if(! connected()) {
-		LOG(DEBUG) << "Socket (FD: " << m_pClientFD << ") not connected";
-		return 0;
-    }
-    
-    while( bytesRemaining > 0 ) {
-        LOG(DEBUG) << "WRITE DEVICE: " << buffer << "FD: " << m_pClientFD;
-        count = write(m_pClientFD, buffer + bytesWritten, bytesRemaining );
-        LOG(DEBUG1) << "bytes written: " << count << " remaining: " << bytesRemaining;
-        if(count < 0) {
-            LOG(ERROR) << strerror(errno) << "(errno: " << errno << ")";
-            throw(SocketWriteFailure(strerror(errno)));
-        }
+/******************************************************************************
+ * Method: writeControl
+ * Description: write control traffic to the socket connection.  It goes out
+ * ahead of queued data, is never decimated and a compressed stream is
+ * flushed right away rather than waiting for the flush timer.
+ *
+ * Return:
+ *   returns the number of bytes written or queued, before compression.
+ * Exceptions:
+ *   SocketWriteFailure
+ *   CompressionFailure
+ ******************************************************************************/
+uint32_t TCPCommListener::writeControl(const char *buffer, const uint32_t size) {
+    return writeLane(LANE_CONTROL, buffer, size);
+}
+
+/******************************************************************************
+ * Method: writePending
+ * Description: Are there queued writes waiting for the client?
+ ******************************************************************************/
+bool TCPCommListener::writePending() {
+    bool result;
+
+    pthread_mutex_lock(&m_oLaneLock);
+    result = ! m_oLanes.empty();
+    pthread_mutex_unlock(&m_oLaneLock);
 
-        bytesWritten += count;
-        bytesRemaining -= count;
+    return result;
+}
+
+/******************************************************************************
+ * Method: flushWriteQueue
+ * Description: Write as much of the queue as the client will take without
+ * blocking, control writes first.  A client we can't write to is dropped.
+ *
+ * Return:
+ *   bytes written
+ ******************************************************************************/
+uint32_t TCPCommListener::flushWriteQueue() {
+    uint32_t written;
 
-        LOG(DEBUG2) << "wrote bytes: " << count << " bytes remaining: " << bytesRemaining;
+    pthread_mutex_lock(&m_oLaneLock);
+    try {
+        written = m_bBatched ? 0 : flushLanes();
+    }
+    catch(OOIException &e) {
+        pthread_mutex_unlock(&m_oLaneLock);
+        LOG(ERROR) << "queued write failed, dropping client: " << e.what();
+        disconnectClient();
+        return 0;
     }
+    pthread_mutex_unlock(&m_oLaneLock);
 
-    return bytesWritten;
+    LOG(DEBUG2) << "flushed queued bytes: " << written;
+    return written;
 }
 
+/******************************************************************************
+ * Method: batchWritten
+ * Description: Hear how a write sent in an IORingBatch went.  What the
+ * socket didn't take is put back ahead of the writes queued behind it, which
+ * go out from flushWriteQueue.  A write that failed is left to the batch to
+ * report.
+ ******************************************************************************/
+void TCPCommListener::batchWritten(const char *buffer, uint32_t size, uint32_t written, int error) {
+    pthread_mutex_lock(&m_oLaneLock);
+
+    // The client went while the batch was open
+    if(! m_bBatched) {
+        pthread_mutex_unlock(&m_oLaneLock);
+        return;
+    }
+
+    m_bBatched = false;
+
+    if(written == size) {
+        m_oLanes.sent(m_eBatchLane);
+    }
+    else if(error == EAGAIN || error == EWOULDBLOCK || error == ECANCELED) {
+        LOG(DEBUG2) << "client FD: " << m_pClientFD << " full, queuing batched bytes: "
+                    << size - written;
+        m_oLanes.putBack(m_eBatchLane, buffer + written, size - written, written > 0);
+    }
+    else {
+        LOG(ERROR) << "batched write failed, client FD: " << m_pClientFD << " " << strerror(error);
+    }
+
+    pthread_mutex_unlock(&m_oLaneLock);
+}
 
 /******************************************************************************
  * Method: read
@@ -433,13 +801,22 @@ uint32_t TCPCommListener::writeData(const char *buffer, const uint32_t size) {
  ******************************************************************************/
 uint32_t TCPCommListener::readData(char *buffer, const uint32_t size) {
     int bytesRead = 0;
+    bool handshake = handshakePending();
+    uint32_t limit = size;
 
     if(! connected()) {
 	    LOG(ERROR) << "Socket Not Connected in readData";
         throw(SocketNotConnected("in TCPCommListener readData"));
 	}
     
-    if ((bytesRead = read(m_pClientFD, buffer, size)) < 0) {
+    // Leave room for the bytes held while we wait to see if they're the hello
+    if(handshake) {
+        if(size <= m_sHandshake.size())
+            return 0;
+        limit = size - m_sHandshake.size();
+    }
+    
+    if ((bytesRead = read(m_pClientFD, buffer, limit)) < 0) {
         if (errno == EAGAIN || errno == EINPROGRESS) {
             LOG(DEBUG2) << "Error Ignored: " << strerror(errno);
         } else if( errno == ETIMEDOUT ) {
@@ -456,8 +833,410 @@ uint32_t TCPCommListener::readData(char *buffer, const uint32_t size) {
         LOG(INFO) << " -- Device connection closed; zero bytes received.";
         disconnectClient();
     }
-    else
+    else {
         LOG(DEBUG) << "READ DEVICE: " << buffer;
+        quickAck(m_pClientFD);
+        
+        if(handshake)
+            bytesRead = checkHandshake(buffer, bytesRead);
+    }
 
     return bytesRead < 0 ? 0 : bytesRead;
 }
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: writeLane
+ * Description: Admit a write and send it, compressed if the client asked.
+ ******************************************************************************/
+uint32_t TCPCommListener::writeLane(Lane lane, const char *buffer, const uint32_t size) {
+    bool queued = true;
+    string out;
+
+    if(! connected()) {
+		LOG(DEBUG) << "Socket (FD: " << m_pClientFD << ") not connected";
+		return 0;
+    }
+
+    switch(m_oClientMonitor.admit(lane == LANE_CONTROL)) {
+        case CLIENT_DROP:
+            return size;
+        case CLIENT_EVICT:
+            disconnectClient();
+            return 0;
+        default:
+            break;
+    }
+
+    if(! m_pDeflate) {
+        queueWrite(lane, buffer, size);
+        return size;
+    }
+
+    // The compressed stream is one ordered stream so it has no lanes.
+    // Control writes just don't wait for the flush.
+    pthread_mutex_lock(&m_oDeflateLock);
+    if(! m_pDeflate) {
+        pthread_mutex_unlock(&m_oDeflateLock);
+        queueWrite(lane, buffer, size);
+        return size;
+    }
+
+    try {
+        if(! m_pDeflate->pending())
+            m_iPendingSince = currentTime();
+
+        m_pDeflate->write(buffer, size, out);
+        LOG(DEBUG2) << "compressed bytes: " << size << " ready: " << out.size();
+
+        if(out.size())
+            queued = writeStream(out.data(), out.size());
+
+        if(queued && (lane == LANE_CONTROL || ! m_iCompressFlush ||
+                      currentTime() >= m_iPendingSince + m_iCompressFlush))
+            queued = flushCompressed();
+    }
+    catch(...) {
+        // The stream has taken the data, what follows can't be inflated
+        pthread_mutex_unlock(&m_oDeflateLock);
+        LOG(ERROR) << "compressed write failed, dropping client FD: " << m_pClientFD;
+        disconnectClient();
+        throw;
+    }
+    pthread_mutex_unlock(&m_oDeflateLock);
+
+    if(! queued) {
+        LOG(ERROR) << "compressed stream can't be queued, dropping client FD: " << m_pClientFD;
+        disconnectClient();
+        return 0;
+    }
+
+    return size;
+}
+
+/******************************************************************************
+ * Method: queueWrite
+ * Description: Send a write now if nothing is queued ahead of it and the
+ * socket takes it, otherwise queue it in its lane.  The unsent part of a
+ * write that only partly went out is finished before anything else.  A bulk
+ * write that doesn't fit in its lane is dropped, see PriorityLanes.
+ *
+ * In a fan-out the first write goes in the IORingBatch and is only counted
+ * once batchWritten says it went.  Writes after it are queued until then.
+ *
+ * Return:
+ *   false if the write was dropped
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+bool TCPCommListener::queueWrite(Lane lane, const char *buffer, const uint32_t size) {
+    const char *data;
+    uint32_t length;
+    int count = 0;
+    bool queued = true;
+
+    pthread_mutex_lock(&m_oLaneLock);
+    try {
+        if(m_oLanes.empty() && ! m_bBatched && IORingBatch::current()) {
+            IORingBatch::current()->write(m_pClientFD, buffer, size, -1, this);
+            m_bBatched = true;
+            m_eBatchLane = lane;
+        }
+        else if(m_oLanes.empty() && ! m_bBatched) {
+            do {
+                count = send(m_pClientFD, buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            } while(count < 0 && errno == EINTR);
+
+            if(count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG(ERROR) << strerror(errno) << "(errno: " << errno << ")";
+                throw(SocketWriteFailure(strerror(errno)));
+            }
+
+            if(count == (int)size) {
+                m_oLanes.sent(lane);
+            }
+            else {
+                LOG(DEBUG2) << "client FD: " << m_pClientFD << " full, queuing bytes: "
+                            << size - (count > 0 ? count : 0);
+                m_oLanes.push(lane, buffer, size);
+                if(count > 0 && m_oLanes.front(data, length))
+                    m_oLanes.consume(count);
+            }
+        }
+        else {
+            queued = m_oLanes.push(lane, buffer, size);
+            if(! m_bBatched)
+                flushLanes();
+        }
+    }
+    catch(...) {
+        pthread_mutex_unlock(&m_oLaneLock);
+        throw;
+    }
+    pthread_mutex_unlock(&m_oLaneLock);
+
+    return queued;
+}
+
+/******************************************************************************
+ * Method: writeStream
+ * Description: Send the compression ack and compressed output.  All of it
+ * goes in the bulk lane so no piece passes another, and none of it may be
+ * dropped: a client missing part of its stream can't inflate the rest.
+ * Called with the deflate lock held once the stream has started.
+ *
+ * Return:
+ *   false if it couldn't be queued and the client has to go
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+bool TCPCommListener::writeStream(const char *buffer, const uint32_t size) {
+    return queueWrite(LANE_BULK, buffer, size);
+}
+
+/******************************************************************************
+ * Method: flushLanes
+ * Description: Write queued bytes, control first.  Called with the lane lock
+ * held.
+ *
+ * Parameters:
+ *   wait - block until the client takes something, then return
+ * Return:
+ *   bytes written
+ * Exceptions:
+ *   SocketWriteFailure - also if we waited TCP_DRAIN_TIMEOUT_MSEC for nothing
+ ******************************************************************************/
+uint32_t TCPCommListener::flushLanes(bool wait) {
+    struct pollfd writable;
+    const char *data;
+    uint32_t size;
+    uint32_t written = 0;
+    int count;
+
+    while(m_oLanes.front(data, size)) {
+        count = send(m_pClientFD, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(count < 0) {
+            if(errno == EINTR)
+                continue;
+
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG(ERROR) << strerror(errno) << "(errno: " << errno << ")";
+                throw(SocketWriteFailure(strerror(errno)));
+            }
+
+            if(! wait)
+                break;
+
+            writable.fd = m_pClientFD;
+            writable.events = POLLOUT;
+            writable.revents = 0;
+            if(poll(&writable, 1, TCP_DRAIN_TIMEOUT_MSEC) == 0)
+                throw(SocketWriteFailure("client not taking queued writes"));
+            continue;
+        }
+
+        m_oLanes.consume(count);
+        written += count;
+
+        if(wait)
+            break;
+    }
+
+    return written;
+}
+
+/******************************************************************************
+ * Method: drainLanes
+ * Description: Block until everything queued is written.  Only for a live
+ * upgrade, where the new process must not write ahead of us.
+ *
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+void TCPCommListener::drainLanes() {
+    pthread_mutex_lock(&m_oLaneLock);
+    try {
+        while(! m_oLanes.empty())
+            flushLanes(true);
+    }
+    catch(...) {
+        pthread_mutex_unlock(&m_oLaneLock);
+        throw;
+    }
+    pthread_mutex_unlock(&m_oLaneLock);
+}
+
+/******************************************************************************
+ * Method: clearLanes
+ * Description: Forget writes queued for a client that has gone.
+ ******************************************************************************/
+void TCPCommListener::clearLanes() {
+    pthread_mutex_lock(&m_oLaneLock);
+    m_oLanes.clear();
+    m_bBatched = false;
+    pthread_mutex_unlock(&m_oLaneLock);
+}
+
+/******************************************************************************
+ * Method: clientClosed
+ * Description: Peek at the client socket to see if the peer has closed it or
+ * it has failed.  Nothing is consumed.
+ *
+ * Return:
+ *   true if the client is gone
+ ******************************************************************************/
+bool TCPCommListener::clientClosed() {
+    char c;
+    int result;
+
+    if(! connected())
+        return true;
+
+    result = recv(m_pClientFD, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if(result == 0)
+        return true;
+
+    if(result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return true;
+
+    return false;
+}
+
+/******************************************************************************
+ * Method: raiseFD
+ * Description: Move an fd to the floor or above so the low numbers stay free
+ * for select.  If the fd limit is too low to move it the fd is kept where it
+ * is.
+ *
+ * Return:
+ *   the fd to use
+ ******************************************************************************/
+int TCPCommListener::raiseFD(int fd) {
+    int raised;
+
+    if(! m_iFDFloor || fd >= m_iFDFloor)
+        return fd;
+
+    raised = fcntl(fd, F_DUPFD_CLOEXEC, m_iFDFloor);
+    if(raised < 0) {
+        LOG(DEBUG) << "fd " << fd << " kept below " << m_iFDFloor << ": " << strerror(errno);
+        return fd;
+    }
+
+    close(fd);
+    return raised;
+}
+
+/******************************************************************************
+ * Method: checkHandshake
+ * Description: Look for the compression hello at the start of what a new
+ * client sends.  Bytes that could still be the start of the hello are held
+ * back.  Once we know, the hello is answered and dropped and anything else
+ * is handed back as normal data.
+ *
+ * The ack is queued behind the raw writes the client hasn't taken yet, in
+ * the bulk lane where the stream will follow, so the loop never waits on a
+ * slow client here.  A client the ack can't be queued for is dropped.
+ *
+ * Parameters:
+ *   buffer - bytes just read, replaced with the bytes to pass on
+ *   size - bytes just read
+ * Return:
+ *   number of bytes now in buffer
+ ******************************************************************************/
+uint32_t TCPCommListener::checkHandshake(char *buffer, uint32_t size) {
+    string hello = TCP_COMPRESS_HELLO;
+    uint32_t length;
+
+    m_sHandshake.append(buffer, size);
+
+    if(m_sHandshake.size() < hello.size() &&
+       hello.compare(0, m_sHandshake.size(), m_sHandshake) == 0) {
+        LOG(DEBUG2) << "holding possible hello bytes: " << m_sHandshake.size();
+        return 0;
+    }
+
+    m_bHandshakeDone = true;
+
+    if(m_sHandshake.compare(0, hello.size(), hello) == 0) {
+        m_sHandshake.erase(0, hello.size());
+
+        if(! writeStream(TCP_COMPRESS_ACK, strlen(TCP_COMPRESS_ACK))) {
+            LOG(ERROR) << "compression ack can't be queued, dropping client FD: " << m_pClientFD;
+            disconnectClient();
+            return 0;
+        }
+
+        startCompression();
+    }
+
+    length = m_sHandshake.size();
+    memcpy(buffer, m_sHandshake.data(), length);
+    m_sHandshake.clear();
+
+    return length;
+}
+
+/******************************************************************************
+ * Method: startCompression
+ * Description: Start a deflate stream for the current client.
+ ******************************************************************************/
+void TCPCommListener::startCompression() {
+    DeflateStream *stream = new DeflateStream(m_iCompressLevel ? m_iCompressLevel : Z_DEFAULT_COMPRESSION);
+
+    pthread_mutex_lock(&m_oDeflateLock);
+    m_pDeflate = stream;
+    m_iPendingSince = 0;
+    pthread_mutex_unlock(&m_oDeflateLock);
+
+    LOG(INFO) << "compressed stream started, port: " << m_iPort << " level: " << m_iCompressLevel;
+}
+
+/******************************************************************************
+ * Method: stopCompression
+ * Description: Drop the current client's stream, keeping its statistics, and
+ * wait for the next client's handshake.
+ ******************************************************************************/
+void TCPCommListener::stopCompression() {
+    pthread_mutex_lock(&m_oDeflateLock);
+    if(m_pDeflate) {
+        LOG(INFO) << "compressed stream ended, port: " << m_iPort
+                  << " ratio: " << m_pDeflate->ratio()
+                  << " cpu usec: " << m_pDeflate->cpuUsec();
+
+        m_iCompressedIn += m_pDeflate->bytesIn();
+        m_iCompressedOut += m_pDeflate->bytesOut();
+        m_iCompressCpu += m_pDeflate->cpuUsec();
+
+        delete m_pDeflate;
+        m_pDeflate = NULL;
+    }
+    pthread_mutex_unlock(&m_oDeflateLock);
+
+    m_bHandshakeDone = false;
+    m_sHandshake.clear();
+}
+
+/******************************************************************************
+ * Method: flushCompressed
+ * Description: Sync flush the stream and send the output.  Called with the
+ * deflate lock held.
+ *
+ * Return:
+ *   false if the output couldn't be queued
+ * Exceptions:
+ *   SocketWriteFailure
+ *   CompressionFailure
+ ******************************************************************************/
+bool TCPCommListener::flushCompressed() {
+    string out;
+
+    m_pDeflate->flush(out);
+
+    return out.size() ? writeStream(out.data(), out.size()) : true;
+}
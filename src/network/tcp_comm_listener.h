@@ -16,6 +16,16 @@
  * // Enable blocking connections. Default is non-blocking
  * ts.setBlocking(true);
  *
+ * // Size of the kernel accept queue and whether other processes may bind
+ * // the same port.  Set before initialize.
+ * ts.setBacklog(128);
+ * ts.setReusePort(true);
+ *
+ * // Keep the listener and client fds at FD_SETSIZE or above, out of the way
+ * // of sockets watched by select.  Fds stay low if the fd limit won't allow
+ * // it.
+ * ts.setFDFloor(FD_SETSIZE);
+ *
  * // Initialize the server
  * ts.initalize();
  *
@@ -23,7 +33,11 @@
  * // random ports.
  * uint16_t port = ts.getListenPort();
  * 
- * // Accept client connections
+ * // Accept client connections.  Every pending connection is taken in one
+ * // call.  The listener keeps the client it has and turns the rest away
+ * // unless that client is gone.  With takeover set a non-persistent
+ * // listener keeps the newest client instead.
+ * ts.setTakeover(true);
  * ts.acceptClient();
  *
  * // Read data from the client. Honors the blocking flag set earlier.
@@ -33,6 +47,31 @@
  * // Write data to the client.
  * int bytes_written = ts.writeData("Hello World", strlen("Hello World"));
  *
+ * // Offer a compressed stream.  A client that sends TCP_COMPRESS_HELLO as
+ * // its first bytes gets TCP_COMPRESS_ACK and then a zlib stream that is
+ * // sync flushed at most the given microseconds after a write.  Clients
+ * // that don't ask get the raw data.  timerDelay/runTimers drive the flush.
+ * // The stream is queued like any write, all of it in the bulk lane so it
+ * // stays in order, and a client whose stream can't be queued is dropped.
+ * ts.setCompression(6, 100000);
+ *
+ * // Watch the client's send queue.  Once 256k is waiting for it writes are
+ * // decimated, and if it doesn't catch up it is dropped.  See
+ * // client_monitor.h.
+ * ts.setSlowClientPolicy(262144, SLOW_CLIENT_DECIMATE);
+ *
+ * // Writes the client's socket can't take right away are queued and go out
+ * // from flushWriteQueue when it is writable.  Inside an IORingBatch a write
+ * // goes in the batch and what the socket didn't take comes back through
+ * // batchWritten to be queued.  Control writes, like
+ * // command replies and faults, are queued ahead of data.  See
+ * // priority_lanes.h.  Only writes queued here can be passed, so the
+ * // latency socket profile, which keeps the kernel's unsent bytes small,
+ * // gets the most from this.
+ * ts.writeControl(reply, replySize);
+ * if(ts.writePending())
+ *     ... select for write on ts.writeFD() and call ts.flushWriteQueue()
+ *
  * // When using non-blocking you may want to use a select read loop to monitor
  * // the file descriptors.  They are exposed via accessors
  * int serverFD = ts.getServerFD();
@@ -43,16 +82,39 @@
 #define __TCP_COMM_LISTENER_H_
 
 #include "common/logger.h"
+#include "common/deflate_stream.h"
+#include "common/io_ring.h"
 #include "network/comm_base.h"
+#include "network/client_monitor.h"
+#include "network/priority_lanes.h"
+
+#include <pthread.h>
 
 #define TCP_BIND_TIMEOUT 10
 
+// Microseconds between bind attempts while waiting for a port to free up
+#define TCP_BIND_RETRY_USEC 50000
+
+// Default length of the kernel accept queue
+#define TCP_LISTEN_BACKLOG 128
+
+// Compressed stream handshake.  The client sends the hello as its first
+// bytes, everything it receives after the ack is a zlib stream.
+#define TCP_COMPRESS_HELLO "PA_DEFLATE\n"
+#define TCP_COMPRESS_ACK   "PA_DEFLATE OK\n"
+
+// Default longest time compressed output waits for a sync flush
+#define TCP_COMPRESS_FLUSH_USEC 100000
+
+// Longest we wait for a client to take its queued writes at a live upgrade
+#define TCP_DRAIN_TIMEOUT_MSEC 1000
+
 using namespace std;
 using namespace logger;
 
 namespace network {
 	
-    class TCPCommListener : public CommBase {
+    class TCPCommListener : public CommBase, public IORingWriter {
         /********************
          *      METHODS     *
          ********************/
@@ -80,13 +142,49 @@ namespace network {
 	    
 	        int serverFD() { return m_pServerFD; }
 	        int clientFD() { return m_pClientFD; }
+	        virtual int readFD() { return m_pClientFD; }
+	        virtual int writeFD() { return m_pClientFD; }
 			
 	        void setPort(const uint16_t port) { m_iPort = port; }
+	        void setBacklog(const uint32_t backlog) { m_iBacklog = backlog; }
+	        void setReusePort(const bool reuse) { m_bReusePort = reuse; }
+	        void setTakeover(const bool takeover) { m_bTakeover = takeover; }
+	        void setFDFloor(const int floor) { m_iFDFloor = floor; }
+	        void setCompression(int level, uint32_t flushUsec);
+	        void setSlowClientPolicy(uint32_t queueLimit, SlowClientPolicy policy);
             virtual bool compare(CommBase *rhs);
 	    
 	        uint16_t port() { return m_iPort; }
+	        uint32_t backlog() { return m_iBacklog; }
+	        bool reusePort() { return m_bReusePort; }
+	        bool takeover() { return m_bTakeover; }
+	        int fdFloor() { return m_iFDFloor; }
+	        int compressionLevel() { return m_iCompressLevel; }
+	        
+	        // Is the current client getting the compressed stream?
+	        bool compressing() { return m_pDeflate != NULL; }
+	        
+	        // Are we still waiting for the current client's first bytes?
+	        bool handshakePending() { return m_iCompressLevel && connected() && ! m_bHandshakeDone; }
+	        
+	        // Compression totals for every client served
+	        uint64_t compressedBytesIn();
+	        uint64_t compressedBytesOut();
+	        uint64_t compressionCpuUsec();
+	        
+	        // Socket samples and slow client totals for the clients served
+	        ClientMonitor & clientMonitor() { return m_oClientMonitor; }
+	        
+	        // Writes queued for the client and totals for the clients served
+	        PriorityLanes & lanes() { return m_oLanes; }
+	        
+	        // Sync flush compressed output that has waited long enough
+	        virtual uint32_t timerDelay();
+	        virtual void runTimers();
 	    
 	        uint16_t getListenPort();
+	        
+	        virtual void handoffFDs(FDHandoff &handoff);
 	    
 	        /* Commands */
 	        bool disconnect();
@@ -99,13 +197,36 @@ namespace network {
             bool initialize();
             
 	        virtual uint32_t writeData(const char *buffer, uint32_t size);
+	        virtual uint32_t writeControl(const char *buffer, uint32_t size);
             virtual uint32_t readData(char *buffer, uint32_t size);
+            
+            // Writes waiting for the client to take them
+            virtual bool writePending();
+            virtual uint32_t flushWriteQueue();
+            
+            // What the socket didn't take of a write sent in a batch
+            virtual void batchWritten(const char *buffer, uint32_t size, uint32_t written, int error);
 
             // Does this object have a complete configuration?
             bool isConfigured();
         protected:
 
         private:
+            // Has the peer of the current client gone away?
+            bool clientClosed();
+            
+            int raiseFD(int fd);
+            
+            uint32_t writeLane(Lane lane, const char *buffer, uint32_t size);
+            bool queueWrite(Lane lane, const char *buffer, uint32_t size);
+            bool writeStream(const char *buffer, uint32_t size);
+            uint32_t flushLanes(bool wait = false);
+            void drainLanes();
+            void clearLanes();
+            uint32_t checkHandshake(char *buffer, uint32_t size);
+            void startCompression();
+            void stopCompression();
+            bool flushCompressed();
 
         /********************
          *      MEMBERS     *
@@ -115,10 +236,44 @@ namespace network {
             
         private:
             uint16_t m_iPort;
+            uint32_t m_iBacklog;
+            bool m_bReusePort;
+            bool m_bTakeover;
+            int m_iFDFloor;
 	    
 	        int m_pServerFD;
 	        int m_pClientFD;
             
+            int m_iCompressLevel;
+            uint32_t m_iCompressFlush;
+            DeflateStream *m_pDeflate;
+            uint64_t m_iPendingSince;
+            
+            // Publisher threads write while the main loop flushes
+            pthread_mutex_t m_oDeflateLock;
+            
+            // First bytes from the client, held while they could be the hello
+            bool m_bHandshakeDone;
+            string m_sHandshake;
+            
+            // Totals from clients that have gone
+            uint64_t m_iCompressedIn;
+            uint64_t m_iCompressedOut;
+            uint64_t m_iCompressCpu;
+            
+            // Notices a client falling behind
+            ClientMonitor m_oClientMonitor;
+            
+            // Writes the client couldn't take yet.  Publisher threads queue
+            // while the main loop drains.
+            PriorityLanes m_oLanes;
+            pthread_mutex_t m_oLaneLock;
+            
+            // A write is out in an IORingBatch.  Nothing else is sent until
+            // we hear how it went.
+            bool m_bBatched;
+            Lane m_eBatchLane;
+            
     };
 }
 
@@ -12,9 +12,12 @@
 #include "common/util.h"
 #include "common/logger.h"
 #include "common/exception.h"
+#include "common/probe.h"
+#include "network/fd_handoff.h"
 
 #include <netinet/in.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
@@ -38,6 +41,7 @@ using namespace network;
 TCPCommSocket::TCPCommSocket() {
 	m_sHostname = "";
 	m_iPort = 0;
+	m_bConnecting = false;
 }
 
 
@@ -48,6 +52,7 @@ TCPCommSocket::TCPCommSocket() {
 TCPCommSocket::TCPCommSocket(const TCPCommSocket &rhs) {
 	m_sHostname = rhs.m_sHostname;
 	m_iPort = rhs.m_iPort;
+	m_bConnecting = false;
 }
 
 
@@ -88,31 +93,28 @@ CommBase * TCPCommSocket::copy() {
 bool TCPCommSocket::initialize() {
 	int fflags;
 	struct sockaddr_in serv_addr;
-	struct hostent *server;
 
 	LOG(DEBUG) << "TCP Port Agent initialize()";
 
 	if(!isConfigured())
 		throw SocketMissingConfig("missing port or hostname");
 
+	// Pick up the connection handed to us by a live upgrade
+	if((m_pSocketFD = FDHandoff::instance()->take(FDHandoff::socketKey(m_sHostname, m_iPort)))) {
+		m_bConnected = true;
+		startRingReader();
+		return true;
+	}
+
 	LOG(DEBUG2) << "Creating INET socket";
 	m_pSocketFD = socket(AF_INET, SOCK_STREAM, 0);
 
 	if(!m_pSocketFD)
 		throw SocketCreateFailure("socket create failure");
 
-	LOG(DEBUG2) << "Looking up server name";
-	server = gethostbyname(m_sHostname.c_str());
+	applySocketProfile(m_pSocketFD);
 
-	if(!server)
-		throw SocketHostFailure(m_sHostname.c_str());
-
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr,
-		 (char *)&serv_addr.sin_addr.s_addr,
-		 server->h_length);
-	serv_addr.sin_port = htons(m_iPort);
+	lookupHost(serv_addr);
 
 	LOG(INFO) << "Connecting to server: " << m_sHostname << ", port: "<< m_iPort;
 	int retval = connect(m_pSocketFD,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
@@ -128,10 +130,130 @@ bool TCPCommSocket::initialize() {
 	}
 
 	m_bConnected = true;
+	PROBE2(socket__connect, m_pSocketFD, m_iPort);
+	startRingReader();
 	
 	return true;
 }
 
+/******************************************************************************
+ * Method: startConnect
+ * Description: Start connecting to the network server without blocking.  The
+ * socket is non-blocking from the start so an unreachable host can't hold
+ * us in connect().
+ *
+ * Return:
+ *   true if connected, false if the connection is in progress
+ * Exceptions:
+ *   SocketMissingConfig
+ *   SocketCreateFailure
+ *   SocketHostFailure
+ *   SocketConnectFailure
+ ******************************************************************************/
+bool TCPCommSocket::startConnect() {
+	struct sockaddr_in serv_addr;
+
+	if(!isConfigured())
+		throw SocketMissingConfig("missing port or hostname");
+
+	disconnect();
+
+	// Pick up the connection handed to us by a live upgrade
+	if((m_pSocketFD = FDHandoff::instance()->take(FDHandoff::socketKey(m_sHostname, m_iPort)))) {
+		m_bConnected = true;
+		startRingReader();
+		return true;
+	}
+
+	lookupHost(serv_addr);
+
+	m_pSocketFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(m_pSocketFD < 0) {
+		m_pSocketFD = 0;
+		throw SocketCreateFailure(strerror(errno));
+	}
+
+	applySocketProfile(m_pSocketFD);
+
+	LOG(INFO) << "Connecting to server: " << m_sHostname << ", port: "<< m_iPort;
+	if(connect(m_pSocketFD, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		if(errno != EINPROGRESS) {
+			string error = strerror(errno);
+			disconnect();
+			throw SocketConnectFailure(error);
+		}
+
+		LOG(DEBUG2) << "connect in progress, fd: " << m_pSocketFD;
+		m_bConnecting = true;
+		return false;
+	}
+
+	m_bConnected = true;
+	PROBE2(socket__connect, m_pSocketFD, m_iPort);
+	startRingReader();
+
+	return true;
+}
+
+/******************************************************************************
+ * Method: finishConnect
+ * Description: Complete a connect started by startConnect once the fd is
+ * writable.
+ *
+ * Return:
+ *   true if connected, false if still in progress
+ * Exceptions:
+ *   SocketConnectFailure
+ ******************************************************************************/
+bool TCPCommSocket::finishConnect() {
+	int error = 0;
+	socklen_t length = sizeof(error);
+
+	if(! m_bConnecting)
+		return connected();
+
+	if(getsockopt(m_pSocketFD, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+		error = errno;
+
+	if(error == EINPROGRESS || error == EALREADY)
+		return false;
+
+	m_bConnecting = false;
+
+	if(error) {
+		disconnect();
+		throw SocketConnectFailure(strerror(error));
+	}
+
+	LOG(INFO) << "Connected to server: " << m_sHostname << ", port: "<< m_iPort;
+	m_bConnected = true;
+	PROBE2(socket__connect, m_pSocketFD, m_iPort);
+	startRingReader();
+
+	return true;
+}
+
+/******************************************************************************
+ * Method: disconnect
+ * Description: Close the socket, including a connect in progress.
+ ******************************************************************************/
+bool TCPCommSocket::disconnect() {
+	m_bConnecting = false;
+	return CommSocket::disconnect();
+}
+
+/******************************************************************************
+ * Method: handoffFDs
+ * Description: Add the connection to a live upgrade handoff.
+ ******************************************************************************/
+void TCPCommSocket::handoffFDs(FDHandoff &handoff) {
+    // Leave unread data in the socket for the new process
+    stopRingReader();
+
+    if(connected())
+        handoff.add(FDHandoff::socketKey(m_sHostname, m_iPort), m_pSocketFD);
+}
+
 /******************************************************************************
  * Method: isConfigured
  * Description: Does this class have enough config info?
@@ -139,3 +261,35 @@ bool TCPCommSocket::initialize() {
 bool TCPCommSocket::isConfigured() {
     return m_sHostname.length() && m_iPort > 0;
 }
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: lookupHost
+ * Description: Fill in the server address.  Dotted addresses are used as is
+ * so they never wait on a name lookup.
+ * Exceptions:
+ *   SocketHostFailure
+ ******************************************************************************/
+void TCPCommSocket::lookupHost(struct sockaddr_in &addr) {
+	struct hostent *server;
+
+	bzero((char *) &addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(m_iPort);
+
+	if(inet_aton(m_sHostname.c_str(), &addr.sin_addr))
+		return;
+
+	LOG(DEBUG2) << "Looking up server name";
+	server = gethostbyname(m_sHostname.c_str());
+
+	if(!server)
+		throw SocketHostFailure(m_sHostname.c_str());
+
+	bcopy((char *)server->h_addr,
+		 (char *)&addr.sin_addr.s_addr,
+		 server->h_length);
+}
@@ -14,6 +14,8 @@
 #include "common/logger.h"
 #include "comm_socket.h"
 
+#include <netinet/in.h>
+
 using namespace std;
 using namespace logger;
 
@@ -45,6 +47,17 @@ namespace network {
             
             // Connect to the network host
             bool initialize();
+
+            // Connect without blocking.  startConnect returns true if the
+            // connection is up, otherwise it is in progress and finishConnect
+            // completes it once the fd is writable.
+            bool startConnect();
+            bool finishConnect();
+            bool connecting() { return m_bConnecting; }
+            virtual bool connected() { return m_pSocketFD > 0 && ! m_bConnecting; }
+            virtual bool disconnect();
+            
+            virtual void handoffFDs(FDHandoff &handoff);
 			
             // Does this object have a complete configuration?
             bool isConfigured();
@@ -52,6 +65,7 @@ namespace network {
         protected:
 
         private:
+            void lookupHost(struct sockaddr_in &addr);
 
         /********************
          *      MEMBERS     *
@@ -60,6 +74,7 @@ namespace network {
         protected:
             
         private:
+            bool m_bConnecting;
     };
 }
 
@@ -0,0 +1,251 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/clock.h"
+#include "network/client_monitor.h"
+#include "network/tcp_comm_listener.h"
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG";
+
+/*
+ * A loopback connection to a client that reads nothing.  The client's
+ * receive buffer is kept small so our send queue backs up quickly.
+ */
+class ClientMonitorTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            struct sockaddr_in addr;
+            socklen_t length = sizeof(addr);
+            int listener, optval = 4096;
+
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "        Client Monitor Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            Clock::SetClock(&m_oClock);
+
+            listener = socket(AF_INET, SOCK_STREAM, 0);
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            ASSERT_EQ(bind(listener, (struct sockaddr *)&addr, sizeof(addr)), 0);
+            ASSERT_EQ(listen(listener, 1), 0);
+            ASSERT_EQ(getsockname(listener, (struct sockaddr *)&addr, &length), 0);
+
+            m_iClient = socket(AF_INET, SOCK_STREAM, 0);
+            setsockopt(m_iClient, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+            ASSERT_EQ(connect(m_iClient, (struct sockaddr *)&addr, sizeof(addr)), 0);
+
+            m_iServer = accept(listener, NULL, NULL);
+            ASSERT_GT(m_iServer, 0);
+            close(listener);
+
+            fcntl(m_iServer, F_SETFL, O_NONBLOCK);
+        }
+
+        virtual void TearDown() {
+            close(m_iServer);
+            close(m_iClient);
+            Clock::SetClock(NULL);
+        }
+
+        // Write until the kernel won't take any more
+        void fill() {
+            char buffer[4096];
+            memset(buffer, 'x', sizeof(buffer));
+            while(write(m_iServer, buffer, sizeof(buffer)) > 0) ;
+            usleep(50000);
+        }
+
+        // Read everything the client has been sent
+        void drain() {
+            char buffer[65536];
+            fcntl(m_iClient, F_SETFL, O_NONBLOCK);
+            for(int i = 0; i < 20; i++) {
+                while(read(m_iClient, buffer, sizeof(buffer)) > 0) ;
+                usleep(10000);
+            }
+        }
+
+        // Bytes we have queued for the client once it stops reading
+        uint32_t backlog() {
+            ClientMonitor monitor;
+            fill();
+            monitor.start(m_iServer);
+            monitor.sample();
+            return monitor.queued();
+        }
+
+        VirtualClock m_oClock;
+        int m_iServer;
+        int m_iClient;
+};
+
+/* Samples are kept without a limit and nothing is dropped */
+TEST_F(ClientMonitorTest, Sample) {
+    ClientMonitor monitor;
+
+    EXPECT_FALSE(monitor.sample());
+    EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    EXPECT_EQ(monitor.samples(), 0);
+
+    monitor.start(m_iServer);
+    EXPECT_TRUE(monitor.sample());
+    EXPECT_EQ(monitor.samples(), 1);
+    EXPECT_EQ(monitor.queued(), 0);
+
+    fill();
+    EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    EXPECT_EQ(monitor.samples(), 1);
+
+    // Once the sample is old the next write takes another
+    m_oClock.advance(CLIENT_SAMPLE_USEC);
+    EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    EXPECT_EQ(monitor.samples(), 2);
+    EXPECT_GT(monitor.queued(), 0);
+    EXPECT_EQ(monitor.peakQueued(), monitor.queued());
+    EXPECT_FALSE(monitor.slow());
+    EXPECT_EQ(monitor.dropped(), 0);
+
+    // A new client starts fresh, totals stay
+    monitor.stop();
+    EXPECT_EQ(monitor.queued(), 0);
+    EXPECT_EQ(monitor.samples(), 2);
+}
+
+/* A slow client is decimated, then evicted if it stays slow */
+TEST_F(ClientMonitorTest, Decimate) {
+    ClientMonitor monitor;
+    uint32_t queued = backlog();
+
+    ASSERT_GT(queued, 0);
+
+    monitor.setPolicy(queued / 2, SLOW_CLIENT_DECIMATE);
+    monitor.start(m_iServer);
+
+    for(int i = 0; i < CLIENT_DECIMATE_RATIO * 3; i++)
+        EXPECT_EQ(monitor.admit(), i % CLIENT_DECIMATE_RATIO ? CLIENT_DROP : CLIENT_SEND);
+
+    EXPECT_TRUE(monitor.slow());
+    EXPECT_EQ(monitor.slowEpisodes(), 1);
+    EXPECT_EQ(monitor.dropped(), (CLIENT_DECIMATE_RATIO - 1) * 3);
+
+    m_oClock.advance(CLIENT_EVICT_USEC - 1);
+    EXPECT_NE(monitor.admit(), CLIENT_EVICT);
+
+    m_oClock.advance(1);
+    EXPECT_EQ(monitor.admit(), CLIENT_EVICT);
+    EXPECT_EQ(monitor.evictions(), 1);
+}
+
+/* Control writes to a slow client aren't decimated or counted against it */
+TEST_F(ClientMonitorTest, Control) {
+    ClientMonitor monitor;
+    uint32_t queued = backlog();
+
+    monitor.setPolicy(queued / 2, SLOW_CLIENT_DECIMATE);
+    monitor.start(m_iServer);
+
+    EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    for(int i = 0; i < CLIENT_DECIMATE_RATIO; i++)
+        EXPECT_EQ(monitor.admit(true), CLIENT_SEND);
+    EXPECT_EQ(monitor.admit(), CLIENT_DROP);
+    EXPECT_EQ(monitor.dropped(), 1);
+}
+
+/* A client that catches up is sent everything again */
+TEST_F(ClientMonitorTest, Recover) {
+    ClientMonitor monitor;
+    uint32_t queued = backlog();
+
+    monitor.setPolicy(queued / 2, SLOW_CLIENT_DECIMATE);
+    monitor.start(m_iServer);
+
+    EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    EXPECT_EQ(monitor.admit(), CLIENT_DROP);
+    EXPECT_TRUE(monitor.slow());
+
+    drain();
+    m_oClock.advance(CLIENT_SAMPLE_USEC);
+
+    for(int i = 0; i < CLIENT_DECIMATE_RATIO; i++)
+        EXPECT_EQ(monitor.admit(), CLIENT_SEND);
+    EXPECT_FALSE(monitor.slow());
+    EXPECT_EQ(monitor.dropped(), 1);
+    EXPECT_EQ(monitor.evictions(), 0);
+}
+
+/* The evict policy and a badly backed up client don't wait */
+TEST_F(ClientMonitorTest, Evict) {
+    ClientMonitor evict, decimate;
+    uint32_t queued = backlog();
+
+    evict.setPolicy(queued / 2, SLOW_CLIENT_EVICT);
+    evict.start(m_iServer);
+    EXPECT_EQ(evict.admit(), CLIENT_EVICT);
+
+    decimate.setPolicy(queued / CLIENT_EVICT_FACTOR, SLOW_CLIENT_DECIMATE);
+    decimate.start(m_iServer);
+    EXPECT_EQ(decimate.admit(), CLIENT_EVICT);
+    EXPECT_EQ(decimate.dropped(), 0);
+}
+
+/* A listener drops a slow client rather than blocking on it */
+TEST_F(ClientMonitorTest, Listener) {
+    TCPCommListener listener;
+    struct sockaddr_in addr;
+    char buffer[4096];
+    int client, optval = 4096;
+
+    listener.setPort(0);
+    listener.setBlocking(false);
+    listener.initialize();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(listener.getListenPort());
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+    ASSERT_EQ(connect(client, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    usleep(10000);
+    ASSERT_TRUE(listener.acceptClient());
+
+    // Sampled even without a limit
+    EXPECT_EQ(listener.writeData("first\n", 6), 6);
+    EXPECT_EQ(listener.clientMonitor().samples(), 1);
+    EXPECT_FALSE(listener.clientMonitor().slow());
+
+    // The client stops reading and our queue backs up
+    memset(buffer, 'x', sizeof(buffer));
+    while(write(listener.clientFD(), buffer, sizeof(buffer)) > 0) ;
+    usleep(50000);
+
+    listener.setSlowClientPolicy(optval, SLOW_CLIENT_EVICT);
+    m_oClock.advance(CLIENT_SAMPLE_USEC);
+
+    EXPECT_EQ(listener.writeData("last\n", 5), 0);
+    EXPECT_FALSE(listener.connected());
+    EXPECT_GE(listener.clientMonitor().peakQueued(), optval);
+    EXPECT_EQ(listener.clientMonitor().evictions(), 1);
+    EXPECT_EQ(listener.clientMonitor().slowEpisodes(), 1);
+
+    close(client);
+}
@@ -0,0 +1,283 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/clock.h"
+#include "network/duplex_comm_socket.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG3";
+
+const char* TEST_DATA="Test";
+
+#define TX_PORT 6101
+#define RX_PORT 6102
+
+/*
+ * Two loopback listeners play the instrument, one for each side of the
+ * duplex socket.
+ */
+class DuplexCommSocketTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "       Duplex Comm Socket Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            m_iTxListener = listenOn(TX_PORT);
+            m_iRxListener = listenOn(RX_PORT);
+            ASSERT_GT(m_iTxListener, 0);
+            ASSERT_GT(m_iRxListener, 0);
+        }
+
+        void TearDown() {
+            LOG(INFO) << "Tear down test";
+            Clock::SetClock(NULL);
+            if(m_iTxListener > 0) close(m_iTxListener);
+            if(m_iRxListener > 0) close(m_iRxListener);
+        }
+
+        int listenOn(uint16_t port, int backlog = 5) {
+            struct sockaddr_in addr;
+            int on = 1;
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+            if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, backlog)) {
+                close(fd);
+                return -1;
+            }
+
+            return fd;
+        }
+
+        void configure(DuplexCommSocket &socket) {
+            socket.setHostname("127.0.0.1");
+            socket.setTxPort(TX_PORT);
+            socket.setRxPort(RX_PORT);
+        }
+
+        // Start the connects and finish them as the main loop would
+        bool connectSides(DuplexCommSocket &socket) {
+            struct timeval timeout;
+            fd_set writeFDs;
+            int maxFD;
+
+            socket.initialize();
+
+            for(int i = 0; i < 10; i++) {
+                maxFD = 0;
+                FD_ZERO(&writeFDs);
+                socket.addConnectFDs(maxFD, writeFDs);
+                if(! maxFD)
+                    break;
+
+                timeout.tv_sec = 0;
+                timeout.tv_usec = 100000;
+                select(maxFD + 1, NULL, &writeFDs, NULL, &timeout);
+                socket.handleConnectFDs(writeFDs);
+            }
+
+            return socket.connected();
+        }
+
+        // Is either side still connecting
+        bool connecting(DuplexCommSocket &socket) {
+            fd_set writeFDs;
+            int maxFD = 0;
+
+            FD_ZERO(&writeFDs);
+            socket.addConnectFDs(maxFD, writeFDs);
+            return maxFD > 0;
+        }
+
+    protected:
+        int m_iTxListener;
+        int m_iRxListener;
+};
+
+/* Test configuration and compare */
+TEST_F(DuplexCommSocketTest, Configuration) {
+    DuplexCommSocket socket;
+
+    EXPECT_FALSE(socket.isConfigured());
+    EXPECT_THROW(socket.initialize(), SocketMissingConfig);
+
+    configure(socket);
+    EXPECT_TRUE(socket.isConfigured());
+    EXPECT_EQ(socket.type(), COMM_DUPLEX_SOCKET);
+    EXPECT_EQ(socket.txPort(), TX_PORT);
+    EXPECT_EQ(socket.rxPort(), RX_PORT);
+
+    DuplexCommSocket copy(socket);
+    EXPECT_TRUE(copy.compare(&socket));
+    EXPECT_FALSE(copy.connected());
+
+    copy.setRxPort(TX_PORT);
+    EXPECT_FALSE(copy.compare(&socket));
+}
+
+/* Test writes go out the tx side and reads come in on the rx side */
+TEST_F(DuplexCommSocketTest, WriteAndRead) {
+    DuplexCommSocket socket;
+    char buffer[128];
+    int tx, rx;
+
+    configure(socket);
+    ASSERT_TRUE(connectSides(socket));
+    EXPECT_NE(socket.readFD(), socket.writeFD());
+
+    tx = accept(m_iTxListener, NULL, NULL);
+    rx = accept(m_iRxListener, NULL, NULL);
+    ASSERT_GT(tx, 0);
+    ASSERT_GT(rx, 0);
+
+    EXPECT_EQ(socket.writeData(TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_FALSE(socket.writePending());
+    EXPECT_EQ(read(tx, buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, strlen(TEST_DATA)), TEST_DATA);
+
+    // Two writes from the instrument come back in one read
+    ASSERT_EQ(write(rx, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    ASSERT_EQ(write(rx, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), 2 * strlen(TEST_DATA));
+
+    // Nothing left to read doesn't block
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), 0);
+
+    close(tx);
+    close(rx);
+}
+
+/* Test one side dropping doesn't take down the other */
+TEST_F(DuplexCommSocketTest, IndependentReconnect) {
+    DuplexCommSocket socket;
+    char buffer[128];
+    int tx, rx;
+
+    configure(socket);
+    ASSERT_TRUE(connectSides(socket));
+
+    tx = accept(m_iTxListener, NULL, NULL);
+    rx = accept(m_iRxListener, NULL, NULL);
+    ASSERT_GT(tx, 0);
+    ASSERT_GT(rx, 0);
+
+    // The instrument closes the rx side
+    close(rx);
+    usleep(100000);
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_FALSE(socket.rxConnected());
+    EXPECT_TRUE(socket.txConnected());
+    EXPECT_FALSE(socket.connected());
+
+    // Only the rx side reconnects
+    int txFD = socket.writeFD();
+    EXPECT_TRUE(connectSides(socket));
+    EXPECT_EQ(socket.writeFD(), txFD);
+
+    rx = accept(m_iRxListener, NULL, NULL);
+    ASSERT_GT(rx, 0);
+
+    ASSERT_EQ(write(rx, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+
+    close(tx);
+    close(rx);
+}
+
+/* Test a failed side is held off instead of retried right away */
+TEST_F(DuplexCommSocketTest, ReconnectHoldOff) {
+    DuplexCommSocket socket;
+    VirtualClock clock;
+
+    Clock::SetClock(&clock);
+    configure(socket);
+
+    close(m_iRxListener);
+    m_iRxListener = 0;
+
+    EXPECT_FALSE(connectSides(socket));
+    EXPECT_TRUE(socket.txConnected());
+    EXPECT_FALSE(socket.rxConnected());
+
+    // Listener is back but we are inside the retry interval
+    m_iRxListener = listenOn(RX_PORT);
+    ASSERT_GT(m_iRxListener, 0);
+    EXPECT_FALSE(connectSides(socket));
+
+    clock.advance((DUPLEX_RECONNECT_INTERVAL - 1) * CLOCK_USEC_PER_SEC);
+    EXPECT_FALSE(connectSides(socket));
+
+    clock.advance(CLOCK_USEC_PER_SEC);
+    EXPECT_TRUE(connectSides(socket));
+}
+
+/* Test a side whose SYNs go unanswered doesn't block and is given up on */
+TEST_F(DuplexCommSocketTest, ConnectTimeout) {
+    DuplexCommSocket duplex;
+    VirtualClock clock;
+    int fillers[2];
+
+    Clock::SetClock(&clock);
+    configure(duplex);
+
+    // A full accept queue drops the SYNs for the rx side
+    close(m_iRxListener);
+    m_iRxListener = listenOn(RX_PORT, 0);
+    ASSERT_GT(m_iRxListener, 0);
+
+    for(int i = 0; i < 2; i++) {
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(RX_PORT);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+        fillers[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        connect(fillers[i], (struct sockaddr *)&addr, sizeof(addr));
+    }
+    usleep(100000);
+
+    EXPECT_FALSE(connectSides(duplex));
+    EXPECT_TRUE(duplex.txConnected());
+    EXPECT_FALSE(duplex.rxConnected());
+    EXPECT_TRUE(connecting(duplex));
+
+    // Still waiting just before the timeout
+    clock.advance((DUPLEX_CONNECT_TIMEOUT - 1) * CLOCK_USEC_PER_SEC);
+    EXPECT_FALSE(duplex.initialize());
+    EXPECT_TRUE(connecting(duplex));
+
+    // Given up on and held off before the next try
+    clock.advance(CLOCK_USEC_PER_SEC);
+    EXPECT_FALSE(duplex.initialize());
+    EXPECT_FALSE(connecting(duplex));
+    EXPECT_TRUE(duplex.txConnected());
+
+    for(int i = 0; i < 2; i++)
+        close(fillers[i]);
+}
+
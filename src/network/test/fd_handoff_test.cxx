@@ -0,0 +1,136 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "network/fd_handoff.h"
+#include "network/tcp_comm_listener.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG3";
+
+const char* TEST_DATA="Test";
+
+#define TEST_PORT 6111
+
+/*
+ * A socket pair stands in for the old and new port agent processes.
+ */
+class FDHandoffTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "          FD Handoff Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, m_aSockets), 0);
+        }
+
+        void TearDown() {
+            LOG(INFO) << "Tear down test";
+            close(m_aSockets[0]);
+            close(m_aSockets[1]);
+        }
+
+    protected:
+        int m_aSockets[2];
+};
+
+/* Test descriptors and values make it across */
+TEST_F(FDHandoffTest, SendAndReceive) {
+    FDHandoff sender, receiver;
+    char buffer[128];
+    int fds[2];
+    int fd;
+
+    ASSERT_EQ(pipe(fds), 0);
+
+    sender.add("pipe", fds[1]);
+    sender.add("closed", 0);
+    sender.setValue("config", "command_port 4001\nsentinle 'a b'\n");
+    sender.setValue("empty", "");
+    EXPECT_EQ(sender.size(), 1);
+
+    ASSERT_TRUE(sender.send(m_aSockets[0]));
+    ASSERT_TRUE(receiver.receive(m_aSockets[1]));
+
+    EXPECT_EQ(receiver.size(), 1);
+    EXPECT_EQ(receiver.value("config"), "command_port 4001\nsentinle 'a b'\n");
+    EXPECT_EQ(receiver.value("empty"), "");
+    EXPECT_EQ(receiver.value("missing"), "");
+
+    // We got a new descriptor for the same pipe
+    fd = receiver.take("pipe");
+    ASSERT_GT(fd, 0);
+    EXPECT_NE(fd, fds[1]);
+    EXPECT_EQ(receiver.take("pipe"), 0);
+    EXPECT_EQ(receiver.size(), 0);
+
+    ASSERT_EQ(write(fd, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_EQ(read(fds[0], buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, strlen(TEST_DATA)), TEST_DATA);
+
+    close(fd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Test a garbage handoff is rejected */
+TEST_F(FDHandoffTest, BadHeader) {
+    FDHandoff receiver;
+    uint32_t header[3] = { 0, 0, 0 };
+
+    ASSERT_EQ(write(m_aSockets[0], header, sizeof(header)), sizeof(header));
+    EXPECT_FALSE(receiver.receive(m_aSockets[1]));
+    EXPECT_EQ(receiver.size(), 0);
+}
+
+/* Test a listener in the new process adopts the inherited socket */
+TEST_F(FDHandoffTest, AdoptListener) {
+    TCPCommListener oldListener, newListener;
+    FDHandoff handoff;
+    struct sockaddr_in addr;
+    int client;
+
+    oldListener.setPort(TEST_PORT);
+    ASSERT_TRUE(oldListener.initialize());
+
+    oldListener.handoffFDs(handoff);
+    EXPECT_EQ(handoff.size(), 1);
+    ASSERT_TRUE(handoff.send(m_aSockets[0]));
+    ASSERT_TRUE(FDHandoff::instance()->receive(m_aSockets[1]));
+
+    // The old process goes away
+    oldListener.disconnect();
+
+    // Picks up the inherited socket instead of binding a new one
+    newListener.setPort(TEST_PORT);
+    ASSERT_TRUE(newListener.initialize());
+    EXPECT_TRUE(newListener.listening());
+    EXPECT_EQ(FDHandoff::instance()->size(), 0);
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ASSERT_EQ(connect(client, (struct sockaddr *)&addr, sizeof(addr)), 0);
+
+    usleep(100000);
+    EXPECT_TRUE(newListener.acceptClient());
+    EXPECT_TRUE(newListener.connected());
+
+    close(client);
+}
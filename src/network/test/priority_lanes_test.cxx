@@ -0,0 +1,260 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/memory_budget.h"
+#include "network/priority_lanes.h"
+#include "network/tcp_comm_listener.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG";
+
+class PriorityLanesTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "        Priority Lanes Test Start Up";
+            LOG(INFO) << "************************************************";
+        }
+
+        // Take the next write whole
+        string next(PriorityLanes &lanes) {
+            const char *data;
+            uint32_t size;
+
+            if(! lanes.front(data, size))
+                return "";
+
+            string result(data, size);
+            lanes.consume(size);
+            return result;
+        }
+};
+
+/* Control goes first, but never into the middle of a started write */
+TEST_F(PriorityLanesTest, Order) {
+    PriorityLanes lanes;
+    const char *data;
+    uint32_t size;
+
+    EXPECT_TRUE(lanes.empty());
+    EXPECT_FALSE(lanes.front(data, size));
+
+    EXPECT_TRUE(lanes.push(LANE_BULK, "bulk1", 5));
+    EXPECT_TRUE(lanes.push(LANE_BULK, "bulk2", 5));
+    EXPECT_TRUE(lanes.push(LANE_CONTROL, "ctl1", 4));
+    EXPECT_EQ(lanes.queued(), 14);
+    EXPECT_EQ(lanes.bypassed(), 1);
+
+    EXPECT_EQ(next(lanes), "ctl1");
+
+    // Half of bulk1 goes out, then control arrives
+    ASSERT_TRUE(lanes.front(data, size));
+    EXPECT_EQ(string(data, size), "bulk1");
+    lanes.consume(2);
+    EXPECT_TRUE(lanes.push(LANE_CONTROL, "ctl2", 4));
+
+    EXPECT_EQ(next(lanes), "lk1");
+    EXPECT_EQ(next(lanes), "ctl2");
+    EXPECT_EQ(next(lanes), "bulk2");
+    EXPECT_TRUE(lanes.empty());
+
+    EXPECT_EQ(lanes.writes(LANE_CONTROL), 2);
+    EXPECT_EQ(lanes.writes(LANE_BULK), 2);
+    EXPECT_EQ(lanes.peakQueued(), 14);
+}
+
+/* A full bulk lane drops whole writes, control is always taken */
+TEST_F(PriorityLanesTest, Limit) {
+    PriorityLanes lanes(10);
+
+    // An empty lane takes anything
+    EXPECT_TRUE(lanes.push(LANE_BULK, "0123456789ab", 12));
+    EXPECT_FALSE(lanes.push(LANE_BULK, "x", 1));
+    EXPECT_TRUE(lanes.push(LANE_CONTROL, "0123456789", 10));
+    EXPECT_EQ(lanes.dropped(), 1);
+    EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_CONNECTION), 22);
+
+    // Started writes no longer hold the lane
+    EXPECT_EQ(next(lanes), "0123456789");
+    EXPECT_EQ(next(lanes), "0123456789ab");
+    EXPECT_TRUE(lanes.push(LANE_BULK, "012345", 6));
+    EXPECT_TRUE(lanes.push(LANE_BULK, "0123", 4));
+    EXPECT_FALSE(lanes.push(LANE_BULK, "x", 1));
+
+    lanes.clear();
+    EXPECT_TRUE(lanes.empty());
+    EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_CONNECTION), 0);
+}
+
+/* A write that only partly went out is finished before what queued behind it */
+TEST_F(PriorityLanesTest, PutBack) {
+    PriorityLanes lanes(4);
+
+    EXPECT_TRUE(lanes.push(LANE_BULK, "bulk2", 5));
+    EXPECT_TRUE(lanes.push(LANE_CONTROL, "ctl1", 4));
+
+    // Never dropped, even over the limit
+    lanes.putBack(LANE_BULK, "lk1", 3, true);
+    EXPECT_EQ(lanes.queued(), 12);
+    EXPECT_EQ(lanes.writes(LANE_BULK), 2);
+
+    EXPECT_EQ(next(lanes), "lk1");
+    EXPECT_EQ(next(lanes), "ctl1");
+    EXPECT_EQ(next(lanes), "bulk2");
+
+    // One that didn't go out at all waits for control like any other
+    EXPECT_TRUE(lanes.push(LANE_BULK, "bulk4", 5));
+    EXPECT_TRUE(lanes.push(LANE_CONTROL, "ctl2", 4));
+    lanes.putBack(LANE_BULK, "bulk3", 5, false);
+
+    EXPECT_EQ(next(lanes), "ctl2");
+    EXPECT_EQ(next(lanes), "bulk3");
+    EXPECT_EQ(next(lanes), "bulk4");
+    EXPECT_TRUE(lanes.empty());
+    EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_CONNECTION), 0);
+}
+
+/* A listener's control write reaches a backed up client ahead of its data */
+TEST_F(PriorityLanesTest, Listener) {
+    TCPCommListener listener;
+    struct sockaddr_in addr;
+    char buffer[65536];
+    string received;
+    string::size_type control, lastBulk;
+    int client, count, optval = 4096;
+
+    listener.setPort(0);
+    listener.setBlocking(false);
+    listener.initialize();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(listener.getListenPort());
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+    ASSERT_EQ(connect(client, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    usleep(10000);
+    ASSERT_TRUE(listener.acceptClient());
+    setsockopt(listener.clientFD(), SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+
+    // The client isn't reading, data backs up behind its socket
+    memset(buffer, 'd', 1000);
+    buffer[999] = '\n';
+    for(int i = 0; i < 10000 && ! listener.writePending(); i++)
+        EXPECT_EQ(listener.writeData(buffer, 1000), 1000);
+    ASSERT_TRUE(listener.writePending());
+
+    for(int i = 0; i < 10; i++)
+        EXPECT_EQ(listener.writeData(buffer, 1000), 1000);
+
+    EXPECT_EQ(listener.writeControl("CONTROL\n", 8), 8);
+    EXPECT_GE(listener.lanes().bypassed(), 1);
+
+    // Catch up
+    fcntl(client, F_SETFL, O_NONBLOCK);
+    for(int i = 0; i < 200 && (listener.writePending() || i < 20); i++) {
+        listener.flushWriteQueue();
+        while((count = read(client, buffer, sizeof(buffer))) > 0)
+            received.append(buffer, count);
+        usleep(5000);
+    }
+
+    EXPECT_FALSE(listener.writePending());
+
+    control = received.find("CONTROL\n");
+    lastBulk = received.rfind("d\n");
+    ASSERT_NE(control, string::npos);
+    EXPECT_LT(control, lastBulk);
+
+    // Every write arrived whole
+    EXPECT_EQ(received.length() % 1000, 8);
+    EXPECT_EQ(listener.lanes().dropped(), 0);
+
+    close(client);
+}
+
+/* Fan-outs through an io_uring batch to a backed up client arrive whole and
+ * in order, and only writes that went out are counted as sent
+ */
+TEST_F(PriorityLanesTest, ListenerBatch) {
+    TCPCommListener listener;
+    struct sockaddr_in addr;
+    char buffer[65536];
+    char line[1000];
+    string received, expected;
+    int client, count, optval = 4096;
+    int writes = 0;
+
+    IORing::setEnabled(true);
+    if(! IORing::enabled())
+        return;
+
+    listener.setPort(0);
+    listener.setBlocking(false);
+    listener.initialize();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(listener.getListenPort());
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+    ASSERT_EQ(connect(client, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    usleep(10000);
+    ASSERT_TRUE(listener.acceptClient());
+    setsockopt(listener.clientFD(), SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+
+    // Two writes per fan-out, the second waits for the first
+    for(int i = 0; i < 10000 && (! listener.writePending() || i < 100); i++) {
+        IORingBatch batch;
+
+        for(int j = 0; j < 2; j++) {
+            memset(line, 'a' + writes % 26, sizeof(line));
+            line[sizeof(line) - 1] = '\n';
+            EXPECT_EQ(listener.writeData(line, sizeof(line)), sizeof(line));
+            expected.append(line, sizeof(line));
+            writes++;
+        }
+
+        EXPECT_EQ(batch.flush(), "");
+    }
+    ASSERT_TRUE(listener.writePending());
+
+    // Catch up
+    fcntl(client, F_SETFL, O_NONBLOCK);
+    for(int i = 0; i < 400 && (listener.writePending() || i < 20); i++) {
+        listener.flushWriteQueue();
+        while((count = read(client, buffer, sizeof(buffer))) > 0)
+            received.append(buffer, count);
+        usleep(5000);
+    }
+
+    EXPECT_FALSE(listener.writePending());
+    EXPECT_EQ(listener.lanes().dropped(), 0);
+    EXPECT_EQ(listener.lanes().writes(LANE_BULK), writes);
+    EXPECT_TRUE(received == expected);
+
+    IORing::setEnabled(false);
+    close(client);
+}
@@ -0,0 +1,305 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/util.h"
+#include "common/clock.h"
+#include "network/serial_comm_socket.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG3";
+
+const char* TEST_DATA="Test";
+
+/*
+ * The serial tests run against a pseudo terminal.  The slave side is the
+ * "device" we hand to the serial socket and the master side plays the
+ * instrument.
+ */
+class SerialSocketTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "        Serial Comm Socket Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            m_iMasterFD = posix_openpt(O_RDWR | O_NOCTTY);
+            ASSERT_GT(m_iMasterFD, 0);
+            ASSERT_EQ(grantpt(m_iMasterFD), 0);
+            ASSERT_EQ(unlockpt(m_iMasterFD), 0);
+            m_sDevicePath = ptsname(m_iMasterFD);
+
+            fcntl(m_iMasterFD, F_SETFL, fcntl(m_iMasterFD, F_GETFL) | O_NONBLOCK);
+        }
+
+        void TearDown() {
+            LOG(INFO) << "Tear down test";
+            Clock::SetClock(NULL);
+            if(m_iMasterFD > 0)
+                close(m_iMasterFD);
+        }
+
+        // Read whatever the "instrument" has received
+        string readMaster() {
+            char buffer[128];
+            int count = read(m_iMasterFD, buffer, sizeof(buffer));
+            return count > 0 ? string(buffer, count) : string();
+        }
+
+        void openDevice(SerialCommSocket &socket) {
+            socket.setDevicePath(m_sDevicePath);
+            socket.setBaud(9600);
+            socket.initialize();
+            socket.initializeSerialSettings();
+        }
+
+    protected:
+        int m_iMasterFD;
+        string m_sDevicePath;
+};
+
+/* Test that the device is opened non-blocking so reads can't stall the loop */
+TEST_F(SerialSocketTest, Open) {
+    SerialCommSocket socket;
+
+    openDevice(socket);
+    ASSERT_TRUE(socket.connected());
+
+    int opts = fcntl(socket.getSocketFD(), F_GETFL);
+    EXPECT_TRUE(opts & O_NONBLOCK);
+}
+
+/* Test throughput reads are held for a burst without blocking */
+TEST_F(SerialSocketTest, ThroughputRead) {
+    SerialCommSocket socket;
+    char buffer[1024];
+    string burst(300, 'x');
+
+    socket.setReadMode(READ_MODE_THROUGHPUT);
+    openDevice(socket);
+    ASSERT_TRUE(socket.connected());
+
+    // A short read is held off the select until it is due
+    ASSERT_EQ(write(m_iMasterFD, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(10000);
+
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_EQ(socket.readFD(), 0);
+    EXPECT_GT(socket.timerDelay(), 0);
+    EXPECT_LE(socket.timerDelay(), THROUGHPUT_READ_TIME * 1000);
+
+    usleep(THROUGHPUT_READ_TIME * 1000 + 10000);
+    EXPECT_EQ(socket.readFD(), socket.getSocketFD());
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(socket.timerDelay(), 0);
+
+    // A full burst is read right away
+    ASSERT_EQ(write(m_iMasterFD, burst.data(), burst.length()), burst.length());
+    usleep(10000);
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), burst.length());
+
+    // Nothing waiting doesn't block
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_EQ(socket.readFD(), 0);
+}
+
+/* Test queued writes go out when nothing is holding them back */
+TEST_F(SerialSocketTest, QueuedWrite) {
+    SerialCommSocket socket;
+
+    openDevice(socket);
+    ASSERT_TRUE(socket.connected());
+
+    EXPECT_EQ(socket.writeData(TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_FALSE(socket.writePending());
+    EXPECT_EQ(socket.writeDelay(), 0);
+
+    usleep(10000);
+    EXPECT_EQ(readMaster(), TEST_DATA);
+}
+
+/* Test inter-character pacing */
+TEST_F(SerialSocketTest, CharDelay) {
+    SerialCommSocket socket;
+
+    openDevice(socket);
+    socket.setCharDelay(50);
+
+    EXPECT_EQ(socket.writeData("abc", 3), 3);
+    EXPECT_TRUE(socket.writePending());
+    EXPECT_EQ(socket.writeQueueSize(), 2);
+    EXPECT_GT(socket.writeDelay(), 0);
+
+    // Nothing goes out until the delay has passed
+    EXPECT_EQ(socket.flushWriteQueue(), 0);
+
+    usleep(60000);
+    EXPECT_EQ(socket.writeDelay(), 0);
+    EXPECT_EQ(socket.flushWriteQueue(), 1);
+    usleep(60000);
+    EXPECT_EQ(socket.flushWriteQueue(), 1);
+    EXPECT_FALSE(socket.writePending());
+
+    usleep(10000);
+    EXPECT_EQ(readMaster(), "abc");
+}
+
+/* Test inter-line pacing */
+TEST_F(SerialSocketTest, LineDelay) {
+    SerialCommSocket socket;
+
+    openDevice(socket);
+    socket.setLineDelay(50);
+
+    EXPECT_EQ(socket.writeData("ab\ncd\n", 6), 6);
+    EXPECT_EQ(socket.writeQueueSize(), 3);
+    EXPECT_GT(socket.writeDelay(), 0);
+
+    usleep(60000);
+    EXPECT_EQ(socket.flushWriteQueue(), 3);
+    EXPECT_FALSE(socket.writePending());
+
+    usleep(10000);
+    EXPECT_EQ(readMaster(), "ab\ncd\n");
+}
+
+/* Test read statistics */
+TEST_F(SerialSocketTest, ReadStats) {
+    SerialCommSocket socket;
+    char buffer[128];
+
+    openDevice(socket);
+
+    ASSERT_EQ(write(m_iMasterFD, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(10000);
+
+    EXPECT_EQ(socket.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(socket.readCount(), 1);
+    EXPECT_EQ(socket.bytesRead(), strlen(TEST_DATA));
+
+    socket.clearReadStats();
+    EXPECT_EQ(socket.readCount(), 0);
+    EXPECT_EQ(socket.bytesRead(), 0);
+}
+
+/* Test writing to a closed device */
+TEST_F(SerialSocketTest, WriteNotConnected) {
+    SerialCommSocket socket;
+    bool exceptionRaised = false;
+
+    try {
+        socket.writeData(TEST_DATA, strlen(TEST_DATA));
+    }
+    catch(SocketWriteFailure &e) {
+        exceptionRaised = true;
+    }
+
+    EXPECT_TRUE(exceptionRaised);
+}
+
+/* Test a break holds writes without blocking and is ended by the timer */
+TEST_F(SerialSocketTest, Break) {
+    SerialCommSocket socket;
+
+    openDevice(socket);
+    ASSERT_TRUE(socket.connected());
+
+    EXPECT_EQ(socket.timerDelay(), 0);
+
+    ASSERT_TRUE(socket.sendBreak(50));
+    EXPECT_TRUE(socket.breaking());
+    EXPECT_GT(socket.timerDelay(), 0);
+    EXPECT_LE(socket.timerDelay(), 50000);
+
+    // Writes wait for the break to end
+    EXPECT_EQ(socket.writeData(TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_TRUE(socket.writePending());
+    EXPECT_GT(socket.writeDelay(), 0);
+
+    // Not due yet
+    socket.runTimers();
+    EXPECT_TRUE(socket.breaking());
+
+    usleep(60000);
+    socket.runTimers();
+    EXPECT_FALSE(socket.breaking());
+    EXPECT_EQ(socket.timerDelay(), 0);
+    EXPECT_EQ(socket.writeDelay(), 0);
+
+    EXPECT_EQ(socket.flushWriteQueue(), strlen(TEST_DATA));
+    usleep(10000);
+    EXPECT_EQ(readMaster(), TEST_DATA);
+}
+
+/* Test a missing device is retried on a back off or when it shows up */
+TEST_F(SerialSocketTest, OpenRetry) {
+    SerialCommSocket socket;
+    char dir[] = "/tmp/serial_test.XXXXXX";
+    VirtualClock clock;
+    string path;
+    int fd;
+
+    // Back off is measured on a clock we move by hand
+    Clock::SetClock(&clock);
+
+    ASSERT_TRUE(mkdtemp(dir));
+    path = string(dir) + "/ttyTEST";
+
+    socket.setDevicePath(path);
+    EXPECT_THROW(socket.initialize(), DeviceOpenFailure);
+    EXPECT_FALSE(socket.connected());
+
+    // Held off, waiting on the device to appear
+    EXPECT_GT(socket.timerDelay(), 0);
+    EXPECT_LE(socket.timerDelay(), OPEN_RETRY_MIN * 1000);
+    EXPECT_GT(socket.eventFD(), 0);
+    EXPECT_FALSE(socket.initialize());
+
+    // The back off grows with each failure until it reaches the limit
+    clock.advance(OPEN_RETRY_MIN * 1000);
+    EXPECT_THROW(socket.initialize(), DeviceOpenFailure);
+    EXPECT_EQ(socket.timerDelay(), OPEN_RETRY_MIN * 2 * 1000);
+
+    for(int i = 0; i < 20; i++) {
+        clock.advance(socket.timerDelay());
+        EXPECT_THROW(socket.initialize(), DeviceOpenFailure);
+    }
+    EXPECT_EQ(socket.timerDelay(), OPEN_RETRY_MAX * 1000);
+
+    // Still held off just before the retry is due
+    clock.advance(socket.timerDelay() - 1);
+    EXPECT_FALSE(socket.initialize());
+
+    // Setting the time of day doesn't end it
+    clock.set(clock.usec() + 3600 * CLOCK_USEC_PER_SEC);
+    EXPECT_FALSE(socket.initialize());
+
+    // Plugging the device in ends the back off
+    fd = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+    ASSERT_GT(fd, 0);
+    close(fd);
+
+    socket.runTimers();
+    EXPECT_EQ(socket.timerDelay(), 0);
+    EXPECT_TRUE(socket.initialize());
+    EXPECT_TRUE(socket.connected());
+    EXPECT_EQ(socket.eventFD(), 0);
+
+    socket.disconnect();
+    unlink(path.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,140 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "network/splice_pipe.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace logger;
+using namespace network;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG3";
+
+const char* TEST_DATA="Test";
+
+/*
+ * Splice between two socket pairs.  The first pair plays the driver and the
+ * second the instrument.
+ */
+class SplicePipeTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "          Splice Pipe Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, m_pSource), 0);
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, m_pDestination), 0);
+        }
+
+        void TearDown() {
+            LOG(INFO) << "Tear down test";
+            for(int i = 0; i < 2; i++) {
+                if(m_pSource[i] > 0) close(m_pSource[i]);
+                if(m_pDestination[i] > 0) close(m_pDestination[i]);
+            }
+        }
+
+    protected:
+        int m_pSource[2];
+        int m_pDestination[2];
+};
+
+/* Test data moves from source to destination with a copy for the archive */
+TEST_F(SplicePipeTest, SpliceData) {
+    SplicePipe pipe;
+    char buffer[128];
+    bool closed;
+
+    ASSERT_TRUE(pipe.initialize());
+    ASSERT_EQ(write(m_pSource[0], TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+
+    EXPECT_EQ(pipe.fill(m_pSource[1], closed), strlen(TEST_DATA));
+    EXPECT_FALSE(closed);
+    EXPECT_EQ(pipe.pending(), strlen(TEST_DATA));
+
+    EXPECT_EQ(pipe.peek(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, strlen(TEST_DATA)), TEST_DATA);
+    EXPECT_EQ(pipe.pending(), strlen(TEST_DATA));
+
+    EXPECT_EQ(pipe.drain(m_pDestination[0]), strlen(TEST_DATA));
+    EXPECT_EQ(pipe.pending(), 0);
+    EXPECT_EQ(pipe.bytesSpliced(), strlen(TEST_DATA));
+
+    EXPECT_EQ(read(m_pDestination[1], buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, strlen(TEST_DATA)), TEST_DATA);
+}
+
+/* Test a closed source is detected */
+TEST_F(SplicePipeTest, SourceClosed) {
+    SplicePipe pipe;
+    bool closed;
+
+    ASSERT_TRUE(pipe.initialize());
+    close(m_pSource[0]);
+    m_pSource[0] = 0;
+
+    EXPECT_EQ(pipe.fill(m_pSource[1], closed), 0);
+    EXPECT_TRUE(closed);
+}
+
+/* Test reset drops pending data */
+TEST_F(SplicePipeTest, Reset) {
+    SplicePipe pipe;
+    bool closed;
+
+    ASSERT_TRUE(pipe.initialize());
+    ASSERT_EQ(write(m_pSource[0], TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_EQ(pipe.fill(m_pSource[1], closed), strlen(TEST_DATA));
+
+    pipe.reset();
+    EXPECT_EQ(pipe.pending(), 0);
+    EXPECT_TRUE(pipe.initialized());
+    EXPECT_EQ(pipe.drain(m_pDestination[0]), 0);
+}
+
+/* Test a failed copy is counted and the data can still be read out */
+TEST_F(SplicePipeTest, TeeFailure) {
+    SplicePipe pipe;
+    char buffer[16];
+    bool closed;
+
+    ASSERT_TRUE(pipe.initialize());
+    ASSERT_EQ(write(m_pSource[0], TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_EQ(pipe.fill(m_pSource[1], closed), strlen(TEST_DATA));
+
+    // A partial copy is a failure, the data stays in the pipe
+    EXPECT_EQ(pipe.peek(buffer, 2), 0);
+    EXPECT_EQ(pipe.teeFailures(), 1);
+    EXPECT_EQ(pipe.pending(), strlen(TEST_DATA));
+
+    EXPECT_EQ(pipe.consume(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, strlen(TEST_DATA)), TEST_DATA);
+    EXPECT_EQ(pipe.pending(), 0);
+    EXPECT_EQ(pipe.drain(m_pDestination[0]), 0);
+    EXPECT_EQ(pipe.bytesSpliced(), 0);
+}
+
+/* Test filling an uninitialized pipe */
+TEST_F(SplicePipeTest, NotInitialized) {
+    SplicePipe pipe;
+    bool closed;
+    bool exceptionRaised = false;
+
+    try {
+        pipe.fill(m_pSource[1], closed);
+    }
+    catch(SocketNotInitialized &e) {
+        exceptionRaised = true;
+    }
+
+    EXPECT_TRUE(exceptionRaised);
+}
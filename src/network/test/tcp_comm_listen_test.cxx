@@ -15,6 +15,7 @@
 #include <sys/fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 //
 // List all tests
@@ -105,6 +106,24 @@ class TCPListenerTest : public testing::Test {
 	    m_oProcess = process;
 	}
 	
+	// Connect a plain client socket to a local port
+	int connectClient(uint16_t port) {
+	    struct sockaddr_in addr;
+	    int fd = socket(AF_INET, SOCK_STREAM, 0);
+	    
+	    bzero((char *) &addr, sizeof(addr));
+	    addr.sin_family = AF_INET;
+	    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	    addr.sin_port = htons(port);
+	    
+	    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+	        close(fd);
+	        return -1;
+	    }
+	    
+	    return fd;
+	}
+	
 	void zeroBuffer(char *buf, int size) {
 	    for(int i = 0; i < size; i++) {
 		buf[i] = 0;
@@ -398,7 +417,7 @@ TEST_F(TCPListenerTest, BlockingNonBlockingSelect) {
 		        LOG(DEBUG2) << "New client connection detected.";
 		        server.acceptClient();
     		    ASSERT_TRUE(server.connected());
-    		    ASSERT_FALSE(server.listening());
+    		    ASSERT_TRUE(server.listening());
 	        }
 	    
 	        if(FD_ISSET(server.clientFD(), &readFDs)) {
@@ -467,11 +486,11 @@ TEST_F(TCPListenerTest, Reconnection) {
         // Start the tcp echo client with a delay.
         startTCPEchoClient(server.getListenPort(), 1, 0, 0, TEST_DATA);
 		
-		// Accept the client connection.  At this point we shouldn't be listening
-		// anymore.
+		// Accept the client connection.  The listener stays open so the
+		// next client doesn't wait on a rebind.
 		server.acceptClient();
 		ASSERT_TRUE(server.connected());
-		ASSERT_FALSE(server.listening());
+		ASSERT_TRUE(server.listening());
 		
         // Now send and receive data
 		zeroBuffer(buffer, 128);
@@ -498,11 +517,11 @@ TEST_F(TCPListenerTest, Reconnection) {
 		// Start the tcp echo client with a delay.
         startTCPEchoClient(server.getListenPort(), 1, 0, 0, TEST_DATA);
 		
-		// Accept the client connection.  At this point we shouldn't be listening
-		// anymore.
+		// Accept the client connection.  The listener stays open so the
+		// next client doesn't wait on a rebind.
 		server.acceptClient();
 		ASSERT_TRUE(server.connected());
-		ASSERT_FALSE(server.listening());
+		ASSERT_TRUE(server.listening());
 		
         // Now send and receive data
 		zeroBuffer(buffer, 128);
@@ -525,6 +544,467 @@ TEST_F(TCPListenerTest, Reconnection) {
 }
 
 
+/* Test a non-persistent listener drains the accept queue in one call, keeps
+ * the client it has and turns the rest away.
+*/
+TEST_F(TCPListenerTest, AcceptKeepsClient) {
+    char buffer[128];
+    int first, second, third;
+    bool exceptionRaised = false;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setBacklog(16);
+    EXPECT_EQ(server.backlog(), 16);
+    EXPECT_FALSE(server.takeover());
+    
+    server.initialize();
+    ASSERT_TRUE(server.listening());
+    
+    first = connectClient(TEST_PORT + 1);
+    ASSERT_GT(first, 0);
+    EXPECT_TRUE(server.acceptClient());
+    ASSERT_TRUE(server.connected());
+    
+    // Only turning every pending client away is an error
+    second = connectClient(TEST_PORT + 1);
+    ASSERT_GT(second, 0);
+    try {
+        server.acceptClient();
+    }
+    catch(SocketAlreadyConnected &e) {
+        exceptionRaised = true;
+    }
+    
+    EXPECT_TRUE(exceptionRaised);
+    ASSERT_TRUE(server.connected());
+    ASSERT_TRUE(server.listening());
+    
+    // The first client was kept and the second turned away
+    EXPECT_EQ(read(second, buffer, sizeof(buffer)), 0);
+    ASSERT_EQ(write(first, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    
+    // Nothing pending, nothing changes
+    int clientFD = server.clientFD();
+    EXPECT_FALSE(server.acceptClient());
+    EXPECT_EQ(server.clientFD(), clientFD);
+    
+    // A reconnecting client replaces one that has gone without a rebind
+    close(first);
+    third = connectClient(TEST_PORT + 1);
+    ASSERT_GT(third, 0);
+    usleep(100000);
+    EXPECT_TRUE(server.acceptClient());
+    
+    ASSERT_EQ(write(third, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    
+    close(second);
+    close(third);
+}
+
+/* Test a client that has gone is replaced by the first queued connect even
+ * when more are turned away behind it.  The new client is installed with
+ * none of the old one's state and no exception hides it from the caller.
+*/
+TEST_F(TCPListenerTest, AcceptReplacesDeadClient) {
+    char buffer[128];
+    int first, second, third, count;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setCompression(6, 50000);
+    server.initialize();
+    ASSERT_TRUE(server.listening());
+    
+    // The first client switches to the compressed stream
+    first = connectClient(TEST_PORT + 1);
+    ASSERT_GT(first, 0);
+    EXPECT_TRUE(server.acceptClient(true));
+    ASSERT_EQ(write(first, TCP_COMPRESS_HELLO, strlen(TCP_COMPRESS_HELLO)), strlen(TCP_COMPRESS_HELLO));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_TRUE(server.compressing());
+    
+    // It goes away and two more queue up before we accept
+    close(first);
+    second = connectClient(TEST_PORT + 1);
+    third = connectClient(TEST_PORT + 1);
+    ASSERT_GT(second, 0);
+    ASSERT_GT(third, 0);
+    usleep(100000);
+    
+    EXPECT_TRUE(server.acceptClient(true));
+    ASSERT_TRUE(server.connected());
+    EXPECT_FALSE(server.compressing());
+    EXPECT_TRUE(server.handshakePending());
+    EXPECT_FALSE(server.writePending());
+    
+    // The second client was installed and the third turned away
+    EXPECT_EQ(read(third, buffer, sizeof(buffer)), 0);
+    ASSERT_EQ(write(second, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_FALSE(server.compressing());
+    
+    EXPECT_EQ(server.writeData(TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    count = read(second, buffer, sizeof(buffer));
+    ASSERT_EQ(count, strlen(TEST_DATA));
+    EXPECT_EQ(string(buffer, count), TEST_DATA);
+    
+    close(second);
+    close(third);
+}
+
+/* Test a non-persistent listener with takeover keeps the newest client */
+TEST_F(TCPListenerTest, AcceptTakeover) {
+    char buffer[128];
+    int first, second, third;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setTakeover(true);
+    EXPECT_TRUE(server.takeover());
+    
+    server.initialize();
+    ASSERT_TRUE(server.listening());
+    
+    first = connectClient(TEST_PORT + 1);
+    second = connectClient(TEST_PORT + 1);
+    ASSERT_GT(first, 0);
+    ASSERT_GT(second, 0);
+    
+    EXPECT_TRUE(server.acceptClient());
+    ASSERT_TRUE(server.connected());
+    
+    // The older client was closed
+    EXPECT_EQ(read(first, buffer, sizeof(buffer)), 0);
+    
+    // A reconnecting client takes over without a rebind
+    third = connectClient(TEST_PORT + 1);
+    ASSERT_GT(third, 0);
+    EXPECT_TRUE(server.acceptClient());
+    EXPECT_EQ(read(second, buffer, sizeof(buffer)), 0);
+    
+    ASSERT_EQ(write(third, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    
+    close(first);
+    close(second);
+    close(third);
+}
+
+/* Test a persistent listener turns away extra clients, but replaces a client
+ * that has already gone away.
+*/
+TEST_F(TCPListenerTest, AcceptPersistent) {
+    char buffer[128];
+    int first, second, third;
+    bool exceptionRaised = false;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.initialize();
+    
+    first = connectClient(TEST_PORT + 1);
+    ASSERT_GT(first, 0);
+    EXPECT_TRUE(server.acceptClient(true));
+    int clientFD = server.clientFD();
+    
+    second = connectClient(TEST_PORT + 1);
+    ASSERT_GT(second, 0);
+    
+    try {
+        server.acceptClient(true);
+    }
+    catch(SocketAlreadyConnected &e) {
+        exceptionRaised = true;
+    }
+    
+    EXPECT_TRUE(exceptionRaised);
+    EXPECT_EQ(server.clientFD(), clientFD);
+    EXPECT_EQ(read(second, buffer, sizeof(buffer)), 0);
+    
+    // The first client goes away before we notice, the next one replaces it
+    close(first);
+    third = connectClient(TEST_PORT + 1);
+    ASSERT_GT(third, 0);
+    usleep(100000);
+    
+    EXPECT_TRUE(server.acceptClient(true));
+    
+    ASSERT_EQ(write(third, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    
+    close(second);
+    close(third);
+}
+
+/* Test two listeners can share a port with SO_REUSEPORT */
+TEST_F(TCPListenerTest, ReusePort) {
+    TCPCommListener server, anotherServer;
+    
+    server.setPort(TEST_PORT + 1);
+    server.setReusePort(true);
+    anotherServer.setPort(TEST_PORT + 1);
+    anotherServer.setReusePort(true);
+    
+    server.initialize();
+    anotherServer.initialize();
+    
+    EXPECT_TRUE(server.listening());
+    EXPECT_TRUE(anotherServer.listening());
+    EXPECT_EQ(anotherServer.getListenPort(), TEST_PORT + 1);
+}
+
+/* Test a client that sends the hello gets a compressed stream and one that
+ * doesn't gets raw data.
+*/
+TEST_F(TCPListenerTest, Compression) {
+    char buffer[4096];
+    string data, received;
+    int legacy, client, count;
+    z_stream inflater;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setCompression(6, 50000);
+    server.initialize();
+    
+    // A legacy client's data passes straight through
+    legacy = connectClient(TEST_PORT + 1);
+    ASSERT_GT(legacy, 0);
+    EXPECT_TRUE(server.acceptClient());
+    EXPECT_TRUE(server.handshakePending());
+    
+    ASSERT_EQ(write(legacy, TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), strlen(TEST_DATA));
+    EXPECT_FALSE(server.handshakePending());
+    EXPECT_FALSE(server.compressing());
+    
+    EXPECT_EQ(server.writeData(TEST_DATA, strlen(TEST_DATA)), strlen(TEST_DATA));
+    EXPECT_EQ(read(legacy, buffer, sizeof(buffer)), strlen(TEST_DATA));
+    close(legacy);
+    usleep(100000);
+    
+    // The hello can arrive in pieces, data after it is passed on
+    client = connectClient(TEST_PORT + 1);
+    ASSERT_GT(client, 0);
+    EXPECT_TRUE(server.acceptClient());
+    
+    ASSERT_EQ(write(client, "PA_DEF", 6), 6);
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_TRUE(server.handshakePending());
+    
+    ASSERT_EQ(write(client, "LATE\nabc", 8), 8);
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), 3);
+    EXPECT_EQ(string(buffer, 3), "abc");
+    EXPECT_TRUE(server.compressing());
+    
+    count = read(client, buffer, sizeof(buffer));
+    ASSERT_EQ(string(buffer, count), TCP_COMPRESS_ACK);
+    
+    // Writes are held until the flush deadline
+    for(int i = 0; i < 100; i++)
+        data += "2013-01-01T00:00:00 #SBE37 temp 12.3456 cond 4.5678 press 100.00\r\n";
+    
+    EXPECT_EQ(server.writeData(data.data(), data.size()), data.size());
+    EXPECT_GT(server.timerDelay(), 0);
+    
+    usleep(60000);
+    server.runTimers();
+    EXPECT_EQ(server.timerDelay(), 0);
+    
+    memset(&inflater, 0, sizeof(inflater));
+    ASSERT_EQ(inflateInit(&inflater), Z_OK);
+    
+    while(received.size() < data.size() &&
+          (count = read(client, buffer, sizeof(buffer))) > 0) {
+        char out[8192];
+        
+        inflater.next_in = (Bytef *)buffer;
+        inflater.avail_in = count;
+        do {
+            inflater.next_out = (Bytef *)out;
+            inflater.avail_out = sizeof(out);
+            ASSERT_NE(inflate(&inflater, Z_SYNC_FLUSH), Z_STREAM_ERROR);
+            received.append(out, sizeof(out) - inflater.avail_out);
+        } while(inflater.avail_out == 0);
+    }
+    inflateEnd(&inflater);
+    
+    EXPECT_EQ(received, data);
+    EXPECT_EQ(server.compressedBytesIn(), data.size());
+    EXPECT_GT(server.compressedBytesIn(), server.compressedBytesOut() * 4);
+    
+    // Totals survive the client going away
+    uint64_t bytesOut = server.compressedBytesOut();
+    server.disconnectClient();
+    EXPECT_FALSE(server.compressing());
+    EXPECT_EQ(server.compressedBytesIn(), data.size());
+    EXPECT_EQ(server.compressedBytesOut(), bytesOut);
+    
+    close(client);
+}
+
+/* Test compressed output a client can't take yet is queued in order, and a
+ * client whose stream overflows the queue is dropped rather than sent a
+ * stream with a hole in it.
+*/
+TEST_F(TCPListenerTest, CompressionBackedUp) {
+    char buffer[65536];
+    string data, received;
+    int client, count, optval = 4096;
+    z_stream inflater;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setCompression(1, 0);
+    server.initialize();
+    
+    client = connectClient(TEST_PORT + 1);
+    ASSERT_GT(client, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+    EXPECT_TRUE(server.acceptClient());
+    setsockopt(server.clientFD(), SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+    
+    ASSERT_EQ(write(client, TCP_COMPRESS_HELLO, strlen(TCP_COMPRESS_HELLO)), strlen(TCP_COMPRESS_HELLO));
+    usleep(100000);
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), 0);
+    ASSERT_TRUE(server.compressing());
+    
+    // Random bytes don't compress, the client isn't reading so they back up
+    srand(1);
+    for(int i = 0; i < 1000 && (! server.writePending() || i < 100); i++) {
+        string chunk;
+        for(int j = 0; j < 1000; j++)
+            chunk += (char)(rand() & 0xff);
+        EXPECT_EQ(server.writeData(chunk.data(), chunk.size()), chunk.size());
+        data += chunk;
+    }
+    ASSERT_TRUE(server.writePending());
+    EXPECT_TRUE(server.connected());
+    
+    // Catch up
+    count = read(client, buffer, strlen(TCP_COMPRESS_ACK));
+    ASSERT_EQ(string(buffer, count), TCP_COMPRESS_ACK);
+    
+    memset(&inflater, 0, sizeof(inflater));
+    ASSERT_EQ(inflateInit(&inflater), Z_OK);
+    
+    fcntl(client, F_SETFL, O_NONBLOCK);
+    for(int i = 0; i < 400 && received.size() < data.size(); i++) {
+        server.flushWriteQueue();
+        while((count = read(client, buffer, sizeof(buffer))) > 0) {
+            char out[65536];
+            
+            inflater.next_in = (Bytef *)buffer;
+            inflater.avail_in = count;
+            do {
+                inflater.next_out = (Bytef *)out;
+                inflater.avail_out = sizeof(out);
+                ASSERT_NE(inflate(&inflater, Z_SYNC_FLUSH), Z_STREAM_ERROR);
+                received.append(out, sizeof(out) - inflater.avail_out);
+            } while(inflater.avail_out == 0);
+        }
+        usleep(5000);
+    }
+    inflateEnd(&inflater);
+    
+    EXPECT_TRUE(received == data);
+    EXPECT_FALSE(server.writePending());
+    
+    // Now it stops reading with a small queue
+    server.lanes().setBulkLimit(16384);
+    for(int i = 0; i < 1000 && server.connected(); i++) {
+        string chunk;
+        for(int j = 0; j < 1000; j++)
+            chunk += (char)(rand() & 0xff);
+        server.writeData(chunk.data(), chunk.size());
+    }
+    
+    EXPECT_FALSE(server.connected());
+    EXPECT_FALSE(server.compressing());
+    
+    close(client);
+}
+
+/* Test the hello from a client with raw data queued is answered without
+ * waiting for the client to catch up, and the ack lands after that data.
+*/
+TEST_F(TCPListenerTest, CompressionHandshakeBackedUp) {
+    char buffer[65536];
+    char line[1000];
+    string raw, data, received;
+    string::size_type ack;
+    int client, count, optval = 4096;
+    double start;
+    z_stream inflater;
+    
+    TCPCommListener server;
+    server.setPort(TEST_PORT + 1);
+    server.setCompression(6, 0);
+    server.initialize();
+    
+    client = connectClient(TEST_PORT + 1);
+    ASSERT_GT(client, 0);
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+    EXPECT_TRUE(server.acceptClient());
+    setsockopt(server.clientFD(), SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+    
+    // Raw data backs up before the hello is read
+    memset(line, 'r', sizeof(line));
+    for(int i = 0; i < 1000 && (! server.writePending() || i < 20); i++) {
+        EXPECT_EQ(server.writeData(line, sizeof(line)), sizeof(line));
+        raw.append(line, sizeof(line));
+    }
+    ASSERT_TRUE(server.writePending());
+    
+    ASSERT_EQ(write(client, TCP_COMPRESS_HELLO, strlen(TCP_COMPRESS_HELLO)), strlen(TCP_COMPRESS_HELLO));
+    usleep(100000);
+    
+    start = Timestamp().asDouble();
+    EXPECT_EQ(server.readData(buffer, sizeof(buffer)), 0);
+    EXPECT_LT(Timestamp().asDouble() - start, 0.1);
+    ASSERT_TRUE(server.compressing());
+    
+    data = "2013-01-01T00:00:00 #SBE37 temp 12.3456 cond 4.5678 press 100.00\r\n";
+    EXPECT_EQ(server.writeData(data.data(), data.size()), data.size());
+    
+    // Catch up
+    fcntl(client, F_SETFL, O_NONBLOCK);
+    for(int i = 0; i < 400 && (server.writePending() || i < 20); i++) {
+        server.flushWriteQueue();
+        while((count = read(client, buffer, sizeof(buffer))) > 0)
+            received.append(buffer, count);
+        usleep(5000);
+    }
+    
+    ack = received.find(TCP_COMPRESS_ACK);
+    ASSERT_EQ(ack, raw.size());
+    EXPECT_TRUE(received.substr(0, ack) == raw);
+    
+    memset(&inflater, 0, sizeof(inflater));
+    ASSERT_EQ(inflateInit(&inflater), Z_OK);
+    inflater.next_in = (Bytef *)received.data() + ack + strlen(TCP_COMPRESS_ACK);
+    inflater.avail_in = received.size() - ack - strlen(TCP_COMPRESS_ACK);
+    inflater.next_out = (Bytef *)buffer;
+    inflater.avail_out = sizeof(buffer);
+    ASSERT_NE(inflate(&inflater, Z_SYNC_FLUSH), Z_STREAM_ERROR);
+    EXPECT_EQ(string(buffer, sizeof(buffer) - inflater.avail_out), data);
+    inflateEnd(&inflater);
+    
+    close(client);
+}
+
 /////////////////////
 /* Test Exceptions */
 /////////////////////
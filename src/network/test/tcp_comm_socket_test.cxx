@@ -6,6 +6,10 @@
 #include "gtest/gtest.h"
 
 #include <string>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 using namespace logger;
 using namespace network;
@@ -379,3 +383,92 @@ TEST_F(TCPSocketTest, DISABLED_ExceptionReadFailure) {
     EXPECT_TRUE(exceptionRaised);
 }
 
+/*
+ * Socket profile tests connect to a plain listener on an ephemeral port so
+ * they don't depend on the echo server.
+ */
+class TCPSocketProfileTest : public testing::Test {
+    
+    protected:
+        virtual void SetUp() {
+            struct sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+            
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "       TCP Socket Profile Test Start Up";
+            LOG(INFO) << "************************************************";
+            
+            m_iListenFD = ::socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT_GT(m_iListenFD, 0);
+            
+            bzero(&addr, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            ASSERT_EQ(bind(m_iListenFD, (struct sockaddr *)&addr, sizeof(addr)), 0);
+            ASSERT_EQ(listen(m_iListenFD, 1), 0);
+            ASSERT_EQ(getsockname(m_iListenFD, (struct sockaddr *)&addr, &len), 0);
+            m_iPort = ntohs(addr.sin_port);
+        }
+        
+        void TearDown() {
+            if(m_iListenFD > 0)
+                close(m_iListenFD);
+        }
+        
+        int getOption(int fd, int level, int option) {
+            int value = 0;
+            socklen_t len = sizeof(value);
+            getsockopt(fd, level, option, &value, &len);
+            return value;
+        }
+        
+    protected:
+        int m_iListenFD;
+        uint16_t m_iPort;
+};
+
+/* Test sockets are left alone by default */
+TEST_F(TCPSocketProfileTest, DefaultProfile) {
+    TCPCommSocket socket;
+    
+    socket.setHostname(TEST_HOST);
+    socket.setPort(m_iPort);
+    ASSERT_TRUE(socket.initialize());
+    
+    EXPECT_EQ(socket.socketProfile(), SOCKET_PROFILE_DEFAULT);
+    EXPECT_EQ(getOption(socket.getSocketFD(), IPPROTO_TCP, TCP_NODELAY), 0);
+}
+
+/* Test the latency profile disables nagle */
+TEST_F(TCPSocketProfileTest, LatencyProfile) {
+    TCPCommSocket socket;
+    
+    socket.setHostname(TEST_HOST);
+    socket.setPort(m_iPort);
+    socket.setSocketProfile(SOCKET_PROFILE_LATENCY);
+    ASSERT_TRUE(socket.initialize());
+    
+    EXPECT_NE(getOption(socket.getSocketFD(), IPPROTO_TCP, TCP_NODELAY), 0);
+#ifdef TCP_NOTSENT_LOWAT
+    EXPECT_EQ(getOption(socket.getSocketFD(), IPPROTO_TCP, TCP_NOTSENT_LOWAT), LATENCY_NOTSENT_LOWAT);
+#endif
+}
+
+/* Test buffer sizing */
+TEST_F(TCPSocketProfileTest, BufferSize) {
+    TCPCommSocket socket;
+    
+    socket.setHostname(TEST_HOST);
+    socket.setPort(m_iPort);
+    socket.setSocketProfile(SOCKET_PROFILE_BULK);
+    socket.setSocketBufferSize(65536);
+    ASSERT_TRUE(socket.initialize());
+    
+    // The kernel doubles the requested size for bookkeeping
+    EXPECT_GE(getOption(socket.getSocketFD(), SOL_SOCKET, SO_RCVBUF), 65536);
+    EXPECT_GE(getOption(socket.getSocketFD(), SOL_SOCKET, SO_SNDBUF), 65536);
+    EXPECT_EQ(getOption(socket.getSocketFD(), IPPROTO_TCP, TCP_NODELAY), 0);
+}
@@ -133,6 +133,8 @@ bool UDPCommSocket::initialize() {
 	if(!newsock)
 		throw SocketCreateFailure("socket create failure");
 
+	applySocketProfile(newsock);
+
         LOG(DEBUG2) << "Looking up server name";
 	server = gethostbyname(m_sHostname.c_str());
 
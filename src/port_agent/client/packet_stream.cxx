@@ -0,0 +1,218 @@
+/*******************************************************************************
+ * Class: PacketStream
+ * Filename: packet_stream.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Zero copy packet parsing for port agent clients.  See packet_stream.h.
+ ******************************************************************************/
+
+#include "packet_stream.h"
+#include "port_agent/packet/archive_verifier.h"
+#include "common/logger.h"
+#include "common/exception.h"
+
+#include <string.h>
+
+using namespace logger;
+using namespace port_agent_client;
+
+static const uint8_t SYNC_BYTES[3] = { (SYNC >> 16) & 0xFF, (SYNC >> 8) & 0xFF, SYNC & 0xFF };
+
+/******************************************************************************
+ * Method: timestamp
+ * Description: The header timestamp, NTP seconds and fraction big-endian.
+ ******************************************************************************/
+Timestamp PacketView::timestamp() const {
+    uint32_t seconds = (m_pPacket[8] << 24) | (m_pPacket[9] << 16) |
+                       (m_pPacket[10] << 8) | m_pPacket[11];
+    uint32_t fraction = (m_pPacket[12] << 24) | (m_pPacket[13] << 16) |
+                        (m_pPacket[14] << 8) | m_pPacket[15];
+
+    return Timestamp(seconds, fraction);
+}
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Allocate the receive buffer.
+ *
+ * Parameters:
+ *   bufferSize - bytes, at least PACKET_STREAM_MIN_BUFFER
+ * Exceptions:
+ *   PacketParamOutOfRange
+ ******************************************************************************/
+PacketStream::PacketStream(uint32_t bufferSize) {
+    if(bufferSize < PACKET_STREAM_MIN_BUFFER)
+        throw PacketParamOutOfRange("packet stream buffer smaller than two packets");
+
+    m_iBufferSize = bufferSize;
+    m_pBuffer = new char[m_iBufferSize];
+    m_bVerifyChecksums = true;
+
+    m_iBytes = 0;
+    m_iPackets = 0;
+    m_iBadChecksums = 0;
+    m_iSkippedBytes = 0;
+    m_iCompactions = 0;
+
+    reset();
+}
+
+/******************************************************************************
+ * Method: Destructor
+ ******************************************************************************/
+PacketStream::~PacketStream() {
+    delete [] m_pBuffer;
+}
+
+/******************************************************************************
+ * Method: space
+ * Description: Where the next read should go.  There is always room for at
+ * least the largest packet.
+ ******************************************************************************/
+char * PacketStream::space() {
+    compact();
+    return m_pBuffer + m_iTail;
+}
+
+/******************************************************************************
+ * Method: freeSpace
+ * Description: Bytes the next read may put at space().
+ ******************************************************************************/
+uint32_t PacketStream::freeSpace() {
+    compact();
+    return m_iBufferSize - m_iTail;
+}
+
+/******************************************************************************
+ * Method: commit
+ * Description: Take bytes just read into space().
+ *
+ * Parameters:
+ *   size - bytes read, no more than freeSpace()
+ ******************************************************************************/
+void PacketStream::commit(uint32_t size) {
+    if(size > m_iBufferSize - m_iTail)
+        throw PacketOverflow("packet stream commit past the buffer");
+
+    m_iTail += size;
+    m_iBytes += size;
+}
+
+/******************************************************************************
+ * Method: append
+ * Description: Copy bytes into the stream.
+ *
+ * Return:
+ *   bytes taken, less than size if the buffer is full
+ ******************************************************************************/
+uint32_t PacketStream::append(const char *data, uint32_t size) {
+    uint32_t length = freeSpace();
+
+    if(size < length)
+        length = size;
+
+    memcpy(space(), data, length);
+    commit(length);
+
+    return length;
+}
+
+/******************************************************************************
+ * Method: dispatch
+ * Description: Walk the buffered bytes and call back with every complete
+ * packet.  A packet still arriving is left for the next read.
+ *
+ * Parameters:
+ *   callback - called with each packet, may be NULL to only count them
+ *   context - passed to the callback
+ * Return:
+ *   packets delivered
+ ******************************************************************************/
+uint32_t PacketStream::dispatch(PacketCallback callback, void *context) {
+    const uint8_t *buffer = (const uint8_t *)m_pBuffer;
+    uint32_t count = 0;
+
+    while(m_iTail - m_iHead >= (uint32_t)HEADER_SIZE) {
+        const uint8_t *data = buffer + m_iHead;
+        const uint8_t *end = buffer + m_iTail;
+        const uint8_t *next;
+
+        if(! memcmp(data, SYNC_BYTES, 3)) {
+            uint16_t length = (data[4] << 8) | data[5];
+            uint16_t stored = (data[6] << 8) | data[7];
+
+            if(length >= HEADER_SIZE) {
+                // Wait for the rest of it
+                if(length > end - data)
+                    break;
+
+                if(! m_bVerifyChecksums ||
+                   ArchiveVerifier::checksum((const char *)data, length) == stored) {
+                    m_iHead += length;
+                    m_iPackets++;
+                    count++;
+
+                    if(callback)
+                        callback(PacketView((const char *)data), context);
+                    continue;
+                }
+
+                m_iBadChecksums++;
+            }
+        }
+
+        // Not a good packet here, look for the next SYNC.  A partial SYNC at
+        // the end is kept until we can tell.
+        next = (const uint8_t *)memchr(data + 1, SYNC_BYTES[0], end - data - 1);
+        while(next && next + 3 <= end && memcmp(next, SYNC_BYTES, 3))
+            next = (const uint8_t *)memchr(next + 1, SYNC_BYTES[0], end - next - 1);
+
+        if(! next)
+            next = end;
+
+        LOG(DEBUG2) << "packet stream skipped bytes: " << next - data;
+        m_iSkippedBytes += next - data;
+        m_iHead = next - buffer;
+    }
+
+    if(m_iHead == m_iTail)
+        m_iHead = m_iTail = 0;
+
+    return count;
+}
+
+/******************************************************************************
+ * Method: reset
+ * Description: Drop buffered bytes, e.g. after a reconnect.  Totals stay.
+ ******************************************************************************/
+void PacketStream::reset() {
+    m_iHead = 0;
+    m_iTail = 0;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: compact
+ * Description: Move the unparsed bytes to the front once the end of the
+ * buffer can't take the largest packet.  After a dispatch that is at most
+ * one partial packet.
+ ******************************************************************************/
+void PacketStream::compact() {
+    uint32_t length = m_iTail - m_iHead;
+
+    if(! m_iHead || m_iBufferSize - m_iTail > PACKET_STREAM_MAX_PACKET)
+        return;
+
+    memmove(m_pBuffer, m_pBuffer + m_iHead, length);
+    m_iHead = 0;
+    m_iTail = length;
+    m_iCompactions++;
+}
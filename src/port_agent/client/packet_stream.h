@@ -0,0 +1,138 @@
+/*******************************************************************************
+ * Class: PacketStream
+ * Filename: packet_stream.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Split the byte stream from a port agent TCP port into packets for a
+ * driver.  Reads go straight into one large buffer, as many bytes as the
+ * socket has, and every complete packet in it is handed to a callback
+ * where it lies.  A packet is never copied: the callback sees a
+ * PacketView onto the buffer which is only good until it returns.
+ *
+ * Packets are checked the way the data log verifier checks them: SYNC, a
+ * size that covers the header and a good checksum.  Anything else is
+ * skipped up to the next SYNC.  When the free space at the end of the
+ * buffer can no longer take the largest packet the partial packet left
+ * over is moved to the front, so packets are always contiguous.
+ *
+ * Usage:
+ *
+ * void onPacket(const PacketView &packet, void *context) { ... }
+ *
+ * PacketStream stream;
+ * uint32_t bytes = socket.readData(stream.space(), stream.freeSpace());
+ * stream.commit(bytes);
+ * stream.dispatch(onPacket, this);
+ *
+ ******************************************************************************/
+
+#ifndef __PACKET_STREAM_H_
+#define __PACKET_STREAM_H_
+
+#include "common/timestamp.h"
+#include "port_agent/packet/packet.h"
+
+#include <stdint.h>
+
+using namespace packet;
+
+// Default size of the receive buffer
+#define PACKET_STREAM_BUFFER_SIZE 1048576
+
+// Largest packet the header can describe
+#define PACKET_STREAM_MAX_PACKET 65535
+
+// Smallest receive buffer, room for the largest packet and a read
+#define PACKET_STREAM_MIN_BUFFER (2 * (PACKET_STREAM_MAX_PACKET + 1))
+
+namespace port_agent_client {
+
+    /* A packet in the receive buffer, read in place */
+    class PacketView {
+        public:
+            PacketView(const char *packet) : m_pPacket((const uint8_t *)packet) {}
+
+            PacketType packetType() const { return (PacketType)m_pPacket[3]; }
+            uint16_t packetSize() const   { return (m_pPacket[4] << 8) | m_pPacket[5]; }
+            uint16_t payloadSize() const  { return packetSize() - HEADER_SIZE; }
+            uint16_t checksum() const     { return (m_pPacket[6] << 8) | m_pPacket[7]; }
+            Timestamp timestamp() const;
+
+            const char *packet() const    { return (const char *)m_pPacket; }
+            const char *payload() const   { return (const char *)m_pPacket + HEADER_SIZE; }
+
+        private:
+            const uint8_t *m_pPacket;
+    };
+
+    typedef void (*PacketCallback)(const PacketView &packet, void *context);
+
+    class PacketStream {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            PacketStream(uint32_t bufferSize = PACKET_STREAM_BUFFER_SIZE);
+            virtual ~PacketStream();
+
+            // Where the next read goes and how much it may take
+            char *space();
+            uint32_t freeSpace();
+
+            // Bytes just read into space()
+            void commit(uint32_t size);
+
+            // Copy bytes in, for data that wasn't read into space()
+            uint32_t append(const char *data, uint32_t size);
+
+            // Call back with every complete packet, returns the count
+            uint32_t dispatch(PacketCallback callback, void *context);
+
+            // Drop what is buffered, the stream starts over
+            void reset();
+
+            void setVerifyChecksums(bool verify) { m_bVerifyChecksums = verify; }
+
+            uint32_t bufferSize() { return m_iBufferSize; }
+            uint32_t buffered() { return m_iTail - m_iHead; }
+
+            /* Totals */
+            uint64_t bytes() { return m_iBytes; }
+            uint64_t packets() { return m_iPackets; }
+            uint64_t badChecksums() { return m_iBadChecksums; }
+            uint64_t skippedBytes() { return m_iSkippedBytes; }
+            uint64_t compactions() { return m_iCompactions; }
+
+        private:
+            PacketStream(const PacketStream &rhs);
+            PacketStream & operator=(const PacketStream &rhs);
+
+            void compact();
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            char *m_pBuffer;
+            uint32_t m_iBufferSize;
+
+            // Unparsed bytes are m_pBuffer[m_iHead, m_iTail)
+            uint32_t m_iHead;
+            uint32_t m_iTail;
+
+            bool m_bVerifyChecksums;
+
+            uint64_t m_iBytes;
+            uint64_t m_iPackets;
+            uint64_t m_iBadChecksums;
+            uint64_t m_iSkippedBytes;
+            uint64_t m_iCompactions;
+    };
+}
+
+#endif //__PACKET_STREAM_H_
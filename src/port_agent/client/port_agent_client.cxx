@@ -0,0 +1,574 @@
+/*******************************************************************************
+ * Class: PortAgentClient
+ * Filename: port_agent_client.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Driver side port agent connection.  See port_agent_client.h.
+ ******************************************************************************/
+
+#include "port_agent_client.h"
+#include "common/logger.h"
+#include "common/exception.h"
+#include "common/clock.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <vector>
+
+using namespace logger;
+using namespace port_agent_client;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Not connected, nothing configured.
+ ******************************************************************************/
+PortAgentClient::PortAgentClient() : m_oCommandStream(CLIENT_COMMAND_BUFFER_SIZE) {
+    m_iDataPort = 0;
+    m_iCommandPort = 0;
+    m_iDataTimeout = 0;
+
+    // Reads go straight into the packet stream
+    m_oData.setBlocking(false);
+    m_oData.setRingReads(false);
+    m_oCommand.setBlocking(false);
+    m_oCommand.setRingReads(false);
+
+    m_pDataStream = new PacketStream();
+    m_bConnected = false;
+
+    m_pDataCallback = NULL;
+    m_pDataContext = NULL;
+    m_pConnectCallback = NULL;
+    m_pConnectContext = NULL;
+
+    m_iNextConnect = 0;
+    m_iBackoff = CLIENT_RECONNECT_MIN_USEC;
+    m_iLastData = 0;
+
+    m_iNextId = 1;
+    pthread_mutex_init(&m_oLock, NULL);
+
+    if(pipe(m_iWakeFD) < 0)
+        throw SocketCreateFailure("client wake pipe");
+    fcntl(m_iWakeFD[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_iWakeFD[1], F_SETFL, O_NONBLOCK);
+
+    m_bRunning = false;
+    m_bStop = false;
+
+    m_iReads = 0;
+    m_iConnects = 0;
+    m_iConnectFailures = 0;
+    m_iCommandsTimedOut = 0;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: Stop the thread and close the connection.  Commands still
+ * waiting are failed.
+ ******************************************************************************/
+PortAgentClient::~PortAgentClient() {
+    stop();
+
+    m_oData.disconnect();
+    m_oCommand.disconnect();
+    failCommands();
+
+    close(m_iWakeFD[0]);
+    close(m_iWakeFD[1]);
+
+    delete m_pDataStream;
+    pthread_mutex_destroy(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: setBufferSize
+ * Description: Size of the data port receive buffer.  Larger buffers mean
+ * fewer reads when data arrives in bursts.
+ *
+ * Parameters:
+ *   size - bytes, at least PACKET_STREAM_MIN_BUFFER
+ ******************************************************************************/
+void PortAgentClient::setBufferSize(uint32_t size) {
+    PacketStream *stream = new PacketStream(size);
+
+    delete m_pDataStream;
+    m_pDataStream = stream;
+}
+
+/******************************************************************************
+ * Method: setDataCallback
+ * Description: Called with every packet from the data port.  The packet is
+ * only good until the callback returns.
+ ******************************************************************************/
+void PortAgentClient::setDataCallback(PacketCallback callback, void *context) {
+    m_pDataCallback = callback;
+    m_pDataContext = context;
+}
+
+/******************************************************************************
+ * Method: setConnectCallback
+ * Description: Called when the connection comes up or goes down.
+ ******************************************************************************/
+void PortAgentClient::setConnectCallback(ConnectCallback callback, void *context) {
+    m_pConnectCallback = callback;
+    m_pConnectContext = context;
+}
+
+/******************************************************************************
+ * Method: sendCommand
+ * Description: Queue a command for the agent.  It is written by the next
+ * poll that can.
+ *
+ * Parameters:
+ *   command - command line, a newline is added if missing
+ *   callback - called when the command completes, may be NULL
+ *   context - passed to the callback
+ * Return:
+ *   command id passed to the callback
+ ******************************************************************************/
+uint32_t PortAgentClient::sendCommand(const string &command, CommandCallback callback,
+                                      void *context) {
+    Command entry;
+
+    entry.text = command;
+    if(entry.text.empty() || entry.text[entry.text.length() - 1] != '\n')
+        entry.text += "\n";
+
+    entry.written = 0;
+    entry.reply = commandHasReply(command);
+    entry.deadline = 0;
+    entry.callback = callback;
+    entry.context = context;
+
+    pthread_mutex_lock(&m_oLock);
+    entry.id = m_iNextId++;
+    m_oQueue.push_back(entry);
+    pthread_mutex_unlock(&m_oLock);
+
+    LOG(DEBUG) << "queued command " << entry.id << ": " << command;
+
+    // Wake the poll, a full pipe means it is already awake
+    if(write(m_iWakeFD[1], "c", 1) < 0 && errno != EAGAIN)
+        LOG(ERROR) << "client wake: " << strerror(errno);
+
+    return entry.id;
+}
+
+/******************************************************************************
+ * Method: poll
+ * Description: Connect when the back off allows, then wait for data or
+ * room to write commands and handle it.  Returns early when sendCommand
+ * or stop is called.
+ *
+ * Parameters:
+ *   timeoutUsec - longest to wait, 0 to only handle what is ready
+ ******************************************************************************/
+void PortAgentClient::poll(uint64_t timeoutUsec) {
+    uint64_t now = Clock::MonotonicUsec();
+    uint64_t wait;
+    fd_set readFDs, writeFDs;
+    struct timeval timeout;
+    int dataFD, commandFD, maxFD;
+    char drain[64];
+
+    if(! m_bConnected && now >= m_iNextConnect)
+        connect(now);
+
+    timeoutCommands(now);
+
+    if(m_bConnected && m_iDataTimeout && now >= m_iLastData + m_iDataTimeout) {
+        LOG(WARNING) << "no data from port agent for ms: " << (now - m_iLastData) / 1000;
+        dropConnection(now);
+    }
+
+    FD_ZERO(&readFDs);
+    FD_ZERO(&writeFDs);
+
+    FD_SET(m_iWakeFD[0], &readFDs);
+    maxFD = m_iWakeFD[0];
+
+    dataFD = m_bConnected ? m_oData.getSocketFD() : 0;
+    commandFD = m_bConnected ? m_oCommand.getSocketFD() : 0;
+
+    if(dataFD) {
+        FD_SET(dataFD, &readFDs);
+        if(dataFD > maxFD) maxFD = dataFD;
+    }
+
+    if(commandFD) {
+        FD_SET(commandFD, &readFDs);
+        if(commandsQueued())
+            FD_SET(commandFD, &writeFDs);
+        if(commandFD > maxFD) maxFD = commandFD;
+    }
+
+    wait = nextDeadline(now, timeoutUsec);
+    timeout.tv_sec = wait / CLOCK_USEC_PER_SEC;
+    timeout.tv_usec = wait % CLOCK_USEC_PER_SEC;
+
+    if(select(maxFD + 1, &readFDs, &writeFDs, NULL, &timeout) < 0) {
+        if(errno != EINTR)
+            LOG(ERROR) << "client select: " << strerror(errno);
+        return;
+    }
+
+    if(FD_ISSET(m_iWakeFD[0], &readFDs))
+        while(read(m_iWakeFD[0], drain, sizeof(drain)) > 0) ;
+
+    now = Clock::MonotonicUsec();
+
+    try {
+        if(dataFD && FD_ISSET(dataFD, &readFDs)) {
+            if(! readStream(m_oData, *m_pDataStream, now)) {
+                dropConnection(now);
+                return;
+            }
+            m_pDataStream->dispatch(m_pDataCallback, m_pDataContext);
+        }
+
+        if(commandFD && FD_ISSET(commandFD, &readFDs)) {
+            if(! readStream(m_oCommand, m_oCommandStream, now)) {
+                dropConnection(now);
+                return;
+            }
+            m_oCommandStream.dispatch(commandPacket, this);
+        }
+
+        if(commandFD && FD_ISSET(commandFD, &writeFDs))
+            writeCommands(now);
+    }
+    catch(OOIException &e) {
+        LOG(ERROR) << "port agent client: " << e.what();
+        dropConnection(now);
+    }
+}
+
+/******************************************************************************
+ * Method: start
+ * Description: Poll on a thread until stop is called.
+ * Return:
+ *   false if the thread couldn't be started
+ ******************************************************************************/
+bool PortAgentClient::start() {
+    if(m_bRunning)
+        return true;
+
+    __atomic_store_n(&m_bStop, false, __ATOMIC_SEQ_CST);
+
+    if(pthread_create(&m_oThread, NULL, run, this)) {
+        LOG(ERROR) << "client thread: " << strerror(errno);
+        return false;
+    }
+
+    m_bRunning = true;
+    return true;
+}
+
+/******************************************************************************
+ * Method: stop
+ * Description: Stop the client thread.  The connection stays up.
+ ******************************************************************************/
+void PortAgentClient::stop() {
+    if(! m_bRunning)
+        return;
+
+    __atomic_store_n(&m_bStop, true, __ATOMIC_SEQ_CST);
+    if(write(m_iWakeFD[1], "s", 1) < 0 && errno != EAGAIN)
+        LOG(ERROR) << "client wake: " << strerror(errno);
+
+    pthread_join(m_oThread, NULL);
+    m_bRunning = false;
+}
+
+/******************************************************************************
+ * Method: commandsQueued
+ * Description: Commands not yet written.
+ ******************************************************************************/
+uint32_t PortAgentClient::commandsQueued() {
+    uint32_t result;
+
+    pthread_mutex_lock(&m_oLock);
+    result = m_oQueue.size();
+    pthread_mutex_unlock(&m_oLock);
+
+    return result;
+}
+
+/******************************************************************************
+ * Method: commandHasReply
+ * Description: Commands the agent answers with a status or fault packet.
+ ******************************************************************************/
+bool PortAgentClient::commandHasReply(const string &command) {
+    string name = command.substr(0, command.find_first_of(" \t\r\n"));
+
+    return name == "get_state" || name == "get_config" || name == "get_stats" ||
+           name == "ping" || name == "save_config" || name == "commit";
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: connect
+ * Description: Open the data and command ports.  If either fails both are
+ * closed and the next attempt waits out the back off.
+ * Return:
+ *   true if connected
+ ******************************************************************************/
+bool PortAgentClient::connect(uint64_t now) {
+    try {
+        m_oData.setHostname(m_sHost);
+        m_oData.setPort(m_iDataPort);
+        m_oData.initialize();
+
+        if(m_iCommandPort) {
+            m_oCommand.setHostname(m_sHost);
+            m_oCommand.setPort(m_iCommandPort);
+            m_oCommand.initialize();
+        }
+    }
+    catch(OOIException &e) {
+        LOG(WARNING) << "port agent connect failed: " << m_sHost << ":" << m_iDataPort
+                     << " " << e.what();
+        m_iConnectFailures++;
+        dropConnection(now);
+        return false;
+    }
+
+    LOG(INFO) << "connected to port agent " << m_sHost << " data port: " << m_iDataPort
+              << " command port: " << m_iCommandPort;
+
+    m_bConnected = true;
+    m_iConnects++;
+    m_iLastData = now;
+    m_pDataStream->reset();
+    m_oCommandStream.reset();
+
+    if(m_pConnectCallback)
+        m_pConnectCallback(true, m_pConnectContext);
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: dropConnection
+ * Description: Close both ports, fail the commands waiting on them and set
+ * when to try again.
+ ******************************************************************************/
+void PortAgentClient::dropConnection(uint64_t now) {
+    bool wasConnected = m_bConnected;
+
+    m_oData.disconnect();
+    m_oCommand.disconnect();
+    m_bConnected = false;
+
+    m_pDataStream->reset();
+    m_oCommandStream.reset();
+    failCommands();
+
+    m_iNextConnect = now + m_iBackoff;
+    LOG(INFO) << "port agent reconnect in ms: " << m_iBackoff / 1000;
+
+    m_iBackoff *= 2;
+    if(m_iBackoff > CLIENT_RECONNECT_MAX_USEC)
+        m_iBackoff = CLIENT_RECONNECT_MAX_USEC;
+
+    if(wasConnected && m_pConnectCallback)
+        m_pConnectCallback(false, m_pConnectContext);
+}
+
+/******************************************************************************
+ * Method: readStream
+ * Description: One read of everything the socket has into the stream.
+ * Return:
+ *   false if the agent closed the connection or the read failed
+ ******************************************************************************/
+bool PortAgentClient::readStream(TCPCommSocket &socket, PacketStream &stream, uint64_t now) {
+    ssize_t bytes = read(socket.getSocketFD(), stream.space(), stream.freeSpace());
+
+    m_iReads++;
+
+    if(bytes < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+
+    if(bytes < 0) {
+        LOG(ERROR) << "port agent read port: " << socket.port() << " " << strerror(errno);
+        return false;
+    }
+
+    if(bytes == 0) {
+        LOG(INFO) << "port agent closed port: " << socket.port();
+        return false;
+    }
+
+    stream.commit(bytes);
+    m_iLastData = now;
+
+    // The connection is good again
+    m_iBackoff = CLIENT_RECONNECT_MIN_USEC;
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: writeCommands
+ * Description: Write queued commands until the socket is full.  Commands
+ * with an answer move to the waiting list, the rest are done.
+ * Exceptions:
+ *   SocketWriteFailure
+ ******************************************************************************/
+void PortAgentClient::writeCommands(uint64_t now) {
+    vector<Command> done;
+    int error = 0;
+
+    pthread_mutex_lock(&m_oLock);
+
+    while(! m_oQueue.empty()) {
+        Command &command = m_oQueue.front();
+        ssize_t count = send(m_oCommand.getSocketFD(), command.text.data() + command.written,
+                             command.text.length() - command.written,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(count < 0) {
+            if(errno != EAGAIN && errno != EINTR)
+                error = errno;
+            break;
+        }
+
+        command.written += count;
+        if(command.written < command.text.length())
+            break;
+
+        LOG(DEBUG) << "wrote command " << command.id;
+
+        if(command.reply) {
+            command.deadline = now + CLIENT_COMMAND_TIMEOUT_USEC;
+            m_oAwaiting.push_back(command);
+        }
+        else {
+            done.push_back(command);
+        }
+
+        m_oQueue.pop_front();
+    }
+
+    pthread_mutex_unlock(&m_oLock);
+
+    for(uint32_t i = 0; i < done.size(); i++)
+        complete(done[i], COMMAND_OK, NULL);
+
+    if(error)
+        throw SocketWriteFailure(strerror(error));
+}
+
+/******************************************************************************
+ * Method: timeoutCommands
+ * Description: Give up on commands that have waited too long for an answer.
+ ******************************************************************************/
+void PortAgentClient::timeoutCommands(uint64_t now) {
+    while(! m_oAwaiting.empty() && now >= m_oAwaiting.front().deadline) {
+        Command command = m_oAwaiting.front();
+        m_oAwaiting.pop_front();
+
+        LOG(WARNING) << "command " << command.id << " timed out: " << command.text;
+        m_iCommandsTimedOut++;
+        complete(command, COMMAND_TIMEOUT, NULL);
+    }
+}
+
+/******************************************************************************
+ * Method: failCommands
+ * Description: The connection is gone.  Commands waiting for an answer
+ * fail, queued commands start over on the next connection.
+ ******************************************************************************/
+void PortAgentClient::failCommands() {
+    while(! m_oAwaiting.empty()) {
+        Command command = m_oAwaiting.front();
+        m_oAwaiting.pop_front();
+        complete(command, COMMAND_FAILED, NULL);
+    }
+
+    pthread_mutex_lock(&m_oLock);
+    for(deque<Command>::iterator i = m_oQueue.begin(); i != m_oQueue.end(); i++)
+        i->written = 0;
+    pthread_mutex_unlock(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: complete
+ * Description: Tell the sender how a command went.
+ ******************************************************************************/
+void PortAgentClient::complete(Command &command, CommandResult result, const PacketView *reply) {
+    LOG(DEBUG) << "command " << command.id << " complete: " << result;
+
+    if(command.callback)
+        command.callback(command.id, result, reply, command.context);
+}
+
+/******************************************************************************
+ * Method: nextDeadline
+ * Description: How long poll may wait before it has something to do.
+ ******************************************************************************/
+uint64_t PortAgentClient::nextDeadline(uint64_t now, uint64_t timeout) {
+    uint64_t deadline = now + timeout;
+
+    if(! m_bConnected && m_iNextConnect < deadline)
+        deadline = m_iNextConnect;
+
+    if(! m_oAwaiting.empty() && m_oAwaiting.front().deadline < deadline)
+        deadline = m_oAwaiting.front().deadline;
+
+    if(m_bConnected && m_iDataTimeout && m_iLastData + m_iDataTimeout < deadline)
+        deadline = m_iLastData + m_iDataTimeout;
+
+    return deadline > now ? deadline - now : 0;
+}
+
+/******************************************************************************
+ * Method: commandPacket
+ * Description: A packet from the command port.  Status and fault packets
+ * answer the oldest waiting command.  The rest are copies of what the data
+ * port sends.
+ ******************************************************************************/
+void PortAgentClient::commandPacket(const PacketView &packet, void *context) {
+    PortAgentClient *client = (PortAgentClient *)context;
+    PacketType type = packet.packetType();
+
+    if(type != PORT_AGENT_STATUS && type != PORT_AGENT_FAULT)
+        return;
+
+    if(client->m_oAwaiting.empty()) {
+        LOG(DEBUG) << "unsolicited " << (type == PORT_AGENT_FAULT ? "fault" : "status");
+        return;
+    }
+
+    Command command = client->m_oAwaiting.front();
+    client->m_oAwaiting.pop_front();
+
+    client->complete(command, type == PORT_AGENT_FAULT ? COMMAND_FAULT : COMMAND_OK, &packet);
+}
+
+/******************************************************************************
+ * Method: run
+ * Description: Client thread.
+ ******************************************************************************/
+void * PortAgentClient::run(void *arg) {
+    PortAgentClient *client = (PortAgentClient *)arg;
+
+    while(! __atomic_load_n(&client->m_bStop, __ATOMIC_SEQ_CST))
+        client->poll(CLIENT_POLL_USEC);
+
+    return NULL;
+}
@@ -0,0 +1,219 @@
+/*******************************************************************************
+ * Class: PortAgentClient
+ * Filename: port_agent_client.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Driver side connection to a port agent's observatory data and command
+ * ports.  Packets from the data port are parsed in place by a PacketStream
+ * and handed to the data callback, one read taking everything the socket
+ * has.
+ *
+ * Commands are queued and written when the command socket can take them,
+ * sendCommand never blocks.  The agent answers get_state, get_config,
+ * get_stats, ping, save_config and commit with a status or fault packet on
+ * the command port, in the order the commands arrived, so each answer goes to
+ * the oldest command still waiting for one.  Other commands complete once
+ * they are written.  A command without an answer after
+ * CLIENT_COMMAND_TIMEOUT_USEC times out, and one written to a connection
+ * that drops fails; neither is sent again.  Commands not yet written wait
+ * for the next connection.
+ *
+ * When either port fails or closes, or no data arrives for the data
+ * timeout, both are closed and reconnected after a back off that starts at
+ * CLIENT_RECONNECT_MIN_USEC and doubles up to CLIENT_RECONNECT_MAX_USEC.
+ * It starts over once data flows again.
+ *
+ * Everything happens in poll, either called by the driver's own loop or by
+ * the thread start() runs.  Callbacks are made from poll.  sendCommand may
+ * be called from any thread.
+ *
+ * Usage:
+ *
+ * void onData(const PacketView &packet, void *context) { ... }
+ * void onReply(uint32_t id, CommandResult result, const PacketView *reply,
+ *              void *context) { ... }
+ *
+ * PortAgentClient client;
+ * client.setHost("localhost");
+ * client.setDataPort(4001);
+ * client.setCommandPort(4002);
+ * client.setDataCallback(onData, this);
+ * client.start();
+ *
+ * client.sendCommand("get_state", onReply, this);
+ *
+ ******************************************************************************/
+
+#ifndef __PORT_AGENT_CLIENT_H_
+#define __PORT_AGENT_CLIENT_H_
+
+#include "packet_stream.h"
+#include "network/tcp_comm_socket.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+
+using namespace std;
+using namespace network;
+
+// First wait before reconnecting, doubled every failed attempt
+#define CLIENT_RECONNECT_MIN_USEC 100000
+
+// Longest wait before reconnecting
+#define CLIENT_RECONNECT_MAX_USEC 10000000
+
+// Longest a command waits for its answer
+#define CLIENT_COMMAND_TIMEOUT_USEC 10000000
+
+// Longest the client thread waits in one poll
+#define CLIENT_POLL_USEC 100000
+
+// Receive buffer for the command port.  The agent copies instrument data
+// there too.
+#define CLIENT_COMMAND_BUFFER_SIZE 262144
+
+namespace port_agent_client {
+
+    typedef enum {
+        COMMAND_OK      = 0,
+        COMMAND_FAULT   = 1,
+        COMMAND_TIMEOUT = 2,
+        COMMAND_FAILED  = 3
+    } CommandResult;
+
+    // reply is the status or fault packet, NULL for commands without one
+    typedef void (*CommandCallback)(uint32_t id, CommandResult result,
+                                    const PacketView *reply, void *context);
+
+    typedef void (*ConnectCallback)(bool connected, void *context);
+
+    class PortAgentClient {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            PortAgentClient();
+            virtual ~PortAgentClient();
+
+            /* Configuration, before the first poll */
+            void setHost(const string &host) { m_sHost = host; }
+            void setDataPort(uint16_t port) { m_iDataPort = port; }
+            void setCommandPort(uint16_t port) { m_iCommandPort = port; }
+            void setBufferSize(uint32_t size);
+            void setDataTimeout(uint64_t usec) { m_iDataTimeout = usec; }
+
+            void setDataCallback(PacketCallback callback, void *context);
+            void setConnectCallback(ConnectCallback callback, void *context);
+
+            // Queue a command, returns its id
+            uint32_t sendCommand(const string &command, CommandCallback callback = NULL,
+                                 void *context = NULL);
+
+            // Connect, read, write and time out commands, waiting at most
+            // timeoutUsec for something to do
+            void poll(uint64_t timeoutUsec);
+
+            // Poll on a thread of our own
+            bool start();
+            void stop();
+
+            bool connected() { return m_bConnected; }
+
+            /* Totals */
+            uint64_t bytes() { return m_pDataStream->bytes(); }
+            uint64_t packets() { return m_pDataStream->packets(); }
+            uint64_t badChecksums() { return m_pDataStream->badChecksums(); }
+            uint64_t skippedBytes() { return m_pDataStream->skippedBytes(); }
+            uint64_t reads() { return m_iReads; }
+            uint32_t connects() { return m_iConnects; }
+            uint32_t connectFailures() { return m_iConnectFailures; }
+            uint64_t reconnectDelay() { return m_iBackoff; }
+            uint32_t commandsQueued();
+            uint32_t commandsAwaiting() { return m_oAwaiting.size(); }
+            uint64_t commandsTimedOut() { return m_iCommandsTimedOut; }
+
+            // Does the agent answer this command
+            static bool commandHasReply(const string &command);
+
+        private:
+            /* A command on its way */
+            struct Command {
+                uint32_t id;
+                string text;
+                uint32_t written;
+                bool reply;
+                uint64_t deadline;
+                CommandCallback callback;
+                void *context;
+            };
+
+            PortAgentClient(const PortAgentClient &rhs);
+            PortAgentClient & operator=(const PortAgentClient &rhs);
+
+            bool connect(uint64_t now);
+            void dropConnection(uint64_t now);
+            bool readStream(TCPCommSocket &socket, PacketStream &stream, uint64_t now);
+            void writeCommands(uint64_t now);
+            void timeoutCommands(uint64_t now);
+            void failCommands();
+            void complete(Command &command, CommandResult result, const PacketView *reply);
+            uint64_t nextDeadline(uint64_t now, uint64_t timeout);
+
+            static void commandPacket(const PacketView &packet, void *context);
+            static void *run(void *arg);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            string m_sHost;
+            uint16_t m_iDataPort;
+            uint16_t m_iCommandPort;
+            uint64_t m_iDataTimeout;
+
+            TCPCommSocket m_oData;
+            TCPCommSocket m_oCommand;
+            PacketStream *m_pDataStream;
+            PacketStream m_oCommandStream;
+            bool m_bConnected;
+
+            PacketCallback m_pDataCallback;
+            void *m_pDataContext;
+            ConnectCallback m_pConnectCallback;
+            void *m_pConnectContext;
+
+            // Reconnect back off
+            uint64_t m_iNextConnect;
+            uint64_t m_iBackoff;
+            uint64_t m_iLastData;
+
+            // Commands not yet written, shared with sendCommand callers
+            deque<Command> m_oQueue;
+            uint32_t m_iNextId;
+            pthread_mutex_t m_oLock;
+
+            // Commands written and waiting for an answer, poll only
+            deque<Command> m_oAwaiting;
+
+            // sendCommand and stop wake poll through this pipe
+            int m_iWakeFD[2];
+
+            pthread_t m_oThread;
+            bool m_bRunning;
+            bool m_bStop;
+
+            uint64_t m_iReads;
+            uint32_t m_iConnects;
+            uint32_t m_iConnectFailures;
+            uint64_t m_iCommandsTimedOut;
+    };
+}
+
+#endif //__PORT_AGENT_CLIENT_H_
@@ -0,0 +1,209 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "port_agent/packet/port_agent_packet.h"
+#include "port_agent/client/packet_stream.h"
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <string.h>
+
+using namespace std;
+using namespace packet;
+using namespace logger;
+using namespace port_agent_client;
+
+/* What the callback saw */
+struct Received {
+    vector<string> payloads;
+    vector<PacketType> types;
+    vector<const char *> addresses;
+};
+
+static void onPacket(const PacketView &packet, void *context) {
+    Received *received = (Received *)context;
+
+    received->payloads.push_back(string(packet.payload(), packet.payloadSize()));
+    received->types.push_back(packet.packetType());
+    received->addresses.push_back(packet.packet());
+}
+
+class PacketStreamTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("MESG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "       Packet Stream Test Start Up";
+            LOG(INFO) << "************************************************";
+        }
+
+        // A packet as the agent sends it
+        string makePacket(PacketType type, const string &payload) {
+            PortAgentPacket packet(type, Timestamp(), (char *)payload.c_str(), payload.length());
+            return string(packet.packet(), packet.packetSize());
+        }
+
+        // count instrument samples back to back
+        string makeStream(int count, int size = 0) {
+            string stream;
+            for(int i = 0; i < count; i++) {
+                ostringstream payload;
+                payload << "sample " << i;
+                if(size)
+                    payload << string(size - payload.str().length(), 'x');
+                stream += makePacket(DATA_FROM_INSTRUMENT, payload.str());
+            }
+            return stream;
+        }
+};
+
+/* Packets are delivered in place, in order */
+TEST_F(PacketStreamTest, Dispatch) {
+    PacketStream stream;
+    Received received;
+    string data = makePacket(DATA_FROM_INSTRUMENT, "first") +
+                  makePacket(PORT_AGENT_STATUS, "second") +
+                  makePacket(PORT_AGENT_HEARTBEAT, "");
+    char *start = stream.space();
+
+    memcpy(start, data.data(), data.length());
+    stream.commit(data.length());
+
+    EXPECT_EQ(stream.dispatch(onPacket, &received), 3);
+    ASSERT_EQ(received.payloads.size(), 3);
+
+    EXPECT_EQ(received.payloads[0], "first");
+    EXPECT_EQ(received.payloads[1], "second");
+    EXPECT_EQ(received.payloads[2], "");
+    EXPECT_EQ(received.types[0], DATA_FROM_INSTRUMENT);
+    EXPECT_EQ(received.types[1], PORT_AGENT_STATUS);
+    EXPECT_EQ(received.types[2], PORT_AGENT_HEARTBEAT);
+
+    // Zero copy, the views point into the buffer
+    EXPECT_EQ(received.addresses[0], start);
+    EXPECT_EQ(received.addresses[1], start + HEADER_SIZE + 5);
+
+    EXPECT_EQ(stream.packets(), 3);
+    EXPECT_EQ(stream.bytes(), data.length());
+    EXPECT_EQ(stream.buffered(), 0);
+}
+
+/* The header is read in place */
+TEST_F(PacketStreamTest, View) {
+    string payload = "view";
+    PortAgentPacket packet(INSTRUMENT_COMMAND, Timestamp(), (char *)payload.c_str(), payload.length());
+    PacketView view(packet.packet());
+
+    EXPECT_EQ(view.packetType(), INSTRUMENT_COMMAND);
+    EXPECT_EQ(view.packetSize(), packet.packetSize());
+    EXPECT_EQ(view.payloadSize(), 4);
+    EXPECT_EQ(view.checksum(), packet.checksum());
+    EXPECT_EQ(view.timestamp().seconds(), packet.timestamp().seconds());
+    EXPECT_EQ(view.timestamp().fraction(), packet.timestamp().fraction());
+    EXPECT_EQ(string(view.payload(), view.payloadSize()), payload);
+}
+
+/* A packet split across reads waits for the rest */
+TEST_F(PacketStreamTest, Partial) {
+    PacketStream stream;
+    Received received;
+    string data = makeStream(3);
+
+    for(uint32_t i = 0; i < data.length(); i++) {
+        EXPECT_EQ(stream.append(data.data() + i, 1), 1);
+        stream.dispatch(onPacket, &received);
+    }
+
+    ASSERT_EQ(received.payloads.size(), 3);
+    EXPECT_EQ(received.payloads[2], "sample 2");
+    EXPECT_EQ(stream.skippedBytes(), 0);
+    EXPECT_EQ(stream.buffered(), 0);
+}
+
+/* Bytes that aren't a good packet are skipped to the next SYNC */
+TEST_F(PacketStreamTest, Resync) {
+    PacketStream stream;
+    Received received;
+    string bad = makePacket(DATA_FROM_INSTRUMENT, "corrupt");
+    string data;
+
+    bad[HEADER_SIZE] ^= 0xFF;
+
+    data = "noise" + makePacket(DATA_FROM_INSTRUMENT, "one") + bad +
+           makePacket(DATA_FROM_INSTRUMENT, "two");
+    stream.append(data.data(), data.length());
+
+    EXPECT_EQ(stream.dispatch(onPacket, &received), 2);
+    ASSERT_EQ(received.payloads.size(), 2);
+    EXPECT_EQ(received.payloads[0], "one");
+    EXPECT_EQ(received.payloads[1], "two");
+    EXPECT_EQ(stream.badChecksums(), 1);
+    EXPECT_EQ(stream.skippedBytes(), 5 + bad.length());
+
+    // Without checks the corrupt packet gets through
+    PacketStream trusting;
+    received.payloads.clear();
+    trusting.setVerifyChecksums(false);
+    trusting.append(bad.data(), bad.length());
+    EXPECT_EQ(trusting.dispatch(onPacket, &received), 1);
+}
+
+/* A SYNC cut off at the end of a read is kept */
+TEST_F(PacketStreamTest, PartialSync) {
+    PacketStream stream;
+    Received received;
+    string packet = makePacket(DATA_FROM_INSTRUMENT, "after");
+    string junk(20, 'j');
+    string data = junk + packet;
+
+    stream.append(data.data(), junk.length() + 2);
+    EXPECT_EQ(stream.dispatch(onPacket, &received), 0);
+    EXPECT_EQ(stream.skippedBytes(), junk.length());
+    EXPECT_EQ(stream.buffered(), 2);
+
+    stream.append(data.data() + junk.length() + 2, data.length() - junk.length() - 2);
+    EXPECT_EQ(stream.dispatch(onPacket, &received), 1);
+    ASSERT_EQ(received.payloads.size(), 1);
+    EXPECT_EQ(received.payloads[0], "after");
+}
+
+/* The leftover partial packet moves to the front as the buffer fills */
+TEST_F(PacketStreamTest, Compact) {
+    PacketStream stream(PACKET_STREAM_MIN_BUFFER);
+    Received received;
+    string data = makeStream(2000, 1000);
+    uint32_t offset = 0;
+
+    // Reads that end part way through packets
+    while(offset < data.length()) {
+        uint32_t length = stream.freeSpace();
+        if(length > 7777)
+            length = 7777;
+        if(length > data.length() - offset)
+            length = data.length() - offset;
+
+        memcpy(stream.space(), data.data() + offset, length);
+        stream.commit(length);
+        offset += length;
+
+        stream.dispatch(onPacket, &received);
+    }
+
+    ASSERT_EQ(received.payloads.size(), 2000);
+    EXPECT_EQ(received.payloads[1999].substr(0, 11), "sample 1999");
+    EXPECT_GT(stream.compactions(), 0);
+    EXPECT_EQ(stream.skippedBytes(), 0);
+    EXPECT_EQ(stream.badChecksums(), 0);
+}
+
+/* The buffer must take the largest packet */
+TEST_F(PacketStreamTest, BufferSize) {
+    EXPECT_THROW(PacketStream stream(PACKET_STREAM_MAX_PACKET), PacketParamOutOfRange);
+
+    PacketStream stream(PACKET_STREAM_MIN_BUFFER);
+    EXPECT_THROW(stream.commit(PACKET_STREAM_MIN_BUFFER + 1), PacketOverflow);
+}
@@ -0,0 +1,349 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/clock.h"
+#include "port_agent/packet/port_agent_packet.h"
+#include "port_agent/client/port_agent_client.h"
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace packet;
+using namespace logger;
+using namespace port_agent_client;
+
+const char* TEST_LOG="/tmp/gtest.log";
+const char* LOG_LEVEL="DEBUG";
+
+/* What the callbacks saw */
+struct Seen {
+    Seen() : connects(0), disconnects(0) {}
+
+    vector<string> data;
+
+    vector<uint32_t> ids;
+    vector<CommandResult> results;
+    vector<string> replies;
+
+    int connects;
+    int disconnects;
+};
+
+static void onData(const PacketView &packet, void *context) {
+    ((Seen *)context)->data.push_back(string(packet.payload(), packet.payloadSize()));
+}
+
+static void onReply(uint32_t id, CommandResult result, const PacketView *reply, void *context) {
+    Seen *seen = (Seen *)context;
+
+    seen->ids.push_back(id);
+    seen->results.push_back(result);
+    seen->replies.push_back(reply ? string(reply->payload(), reply->payloadSize()) : "NULL");
+}
+
+static void onConnect(bool connected, void *context) {
+    if(connected)
+        ((Seen *)context)->connects++;
+    else
+        ((Seen *)context)->disconnects++;
+}
+
+/*
+ * Loopback listeners stand in for the agent's data and command ports.  Time
+ * only moves when the test says so.
+ */
+class PortAgentClientTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile(TEST_LOG);
+            Logger::SetLogLevel(LOG_LEVEL);
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "       Port Agent Client Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            Clock::SetClock(&m_oClock);
+
+            m_iDataListener = listenLoopback(m_iDataPort);
+            m_iCommandListener = listenLoopback(m_iCommandPort);
+            m_iData = m_iCommand = -1;
+
+            m_oClient.setHost("127.0.0.1");
+            m_oClient.setDataPort(m_iDataPort);
+            m_oClient.setCommandPort(m_iCommandPort);
+            m_oClient.setDataCallback(onData, &m_oSeen);
+            m_oClient.setConnectCallback(onConnect, &m_oSeen);
+        }
+
+        virtual void TearDown() {
+            m_oClient.stop();
+            closeAgent();
+            if(m_iDataListener >= 0) close(m_iDataListener);
+            if(m_iCommandListener >= 0) close(m_iCommandListener);
+            Clock::SetClock(NULL);
+        }
+
+        int listenLoopback(uint16_t &port) {
+            struct sockaddr_in addr;
+            socklen_t length = sizeof(addr);
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            int optval = 1;
+
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+            listen(fd, 4);
+            getsockname(fd, (struct sockaddr *)&addr, &length);
+
+            port = ntohs(addr.sin_port);
+            return fd;
+        }
+
+        // Connect the client and take both connections
+        void connectAgent() {
+            m_oClient.poll(0);
+            ASSERT_TRUE(m_oClient.connected());
+
+            m_iData = accept(m_iDataListener, NULL, NULL);
+            m_iCommand = accept(m_iCommandListener, NULL, NULL);
+            ASSERT_GE(m_iData, 0);
+            ASSERT_GE(m_iCommand, 0);
+        }
+
+        void closeAgent() {
+            if(m_iData >= 0) close(m_iData);
+            if(m_iCommand >= 0) close(m_iCommand);
+            m_iData = m_iCommand = -1;
+        }
+
+        void sendPacket(int fd, PacketType type, const string &payload) {
+            PortAgentPacket packet(type, Timestamp(), (char *)payload.c_str(), payload.length());
+            ASSERT_EQ(write(fd, packet.packet(), packet.packetSize()), packet.packetSize());
+        }
+
+        // Poll until the agent has read a whole line from its command port
+        string readCommand() {
+            string line;
+            char c;
+
+            fcntl(m_iCommand, F_SETFL, O_NONBLOCK);
+
+            for(int i = 0; i < 200; i++) {
+                m_oClient.poll(10000);
+                while(read(m_iCommand, &c, 1) == 1) {
+                    if(c == '\n')
+                        return line;
+                    line += c;
+                }
+            }
+
+            return line;
+        }
+
+        // Poll until count callbacks of a kind arrive, or give up
+        void pollFor(const vector<string> &seen, uint32_t count) {
+            for(int i = 0; i < 200 && seen.size() < count; i++)
+                m_oClient.poll(10000);
+        }
+
+        void pollForResults(uint32_t count) {
+            for(int i = 0; i < 200 && m_oSeen.results.size() < count; i++)
+                m_oClient.poll(10000);
+        }
+
+        VirtualClock m_oClock;
+        PortAgentClient m_oClient;
+        Seen m_oSeen;
+
+        int m_iDataListener;
+        int m_iCommandListener;
+        uint16_t m_iDataPort;
+        uint16_t m_iCommandPort;
+
+        // The agent's side of the connections
+        int m_iData;
+        int m_iCommand;
+};
+
+/* Data port packets reach the data callback */
+TEST_F(PortAgentClientTest, Data) {
+    connectAgent();
+    EXPECT_EQ(m_oSeen.connects, 1);
+    EXPECT_EQ(m_oClient.connects(), 1);
+
+    sendPacket(m_iData, DATA_FROM_INSTRUMENT, "one");
+    sendPacket(m_iData, DATA_FROM_INSTRUMENT, "two");
+    sendPacket(m_iData, PORT_AGENT_HEARTBEAT, "");
+
+    pollFor(m_oSeen.data, 3);
+    ASSERT_EQ(m_oSeen.data.size(), 3);
+    EXPECT_EQ(m_oSeen.data[0], "one");
+    EXPECT_EQ(m_oSeen.data[1], "two");
+    EXPECT_EQ(m_oClient.packets(), 3);
+    EXPECT_GT(m_oClient.reads(), 0);
+}
+
+/* Answers go to the commands waiting for them, oldest first */
+TEST_F(PortAgentClientTest, CommandReply) {
+    uint32_t first, second;
+
+    connectAgent();
+
+    first = m_oClient.sendCommand("get_state", onReply, &m_oSeen);
+    second = m_oClient.sendCommand("ping", onReply, &m_oSeen);
+    EXPECT_NE(first, second);
+
+    EXPECT_EQ(readCommand(), "get_state");
+    EXPECT_EQ(readCommand(), "ping");
+    EXPECT_EQ(m_oClient.commandsAwaiting(), 2);
+    EXPECT_TRUE(m_oSeen.results.empty());
+
+    // Instrument data copied to the command port is not an answer
+    sendPacket(m_iCommand, DATA_FROM_INSTRUMENT, "sample");
+    sendPacket(m_iCommand, PORT_AGENT_STATUS, "CONNECTED");
+    sendPacket(m_iCommand, PORT_AGENT_FAULT, "no ping");
+
+    pollForResults(2);
+    ASSERT_EQ(m_oSeen.results.size(), 2);
+    EXPECT_EQ(m_oSeen.ids[0], first);
+    EXPECT_EQ(m_oSeen.results[0], COMMAND_OK);
+    EXPECT_EQ(m_oSeen.replies[0], "CONNECTED");
+    EXPECT_EQ(m_oSeen.ids[1], second);
+    EXPECT_EQ(m_oSeen.results[1], COMMAND_FAULT);
+    EXPECT_EQ(m_oSeen.replies[1], "no ping");
+    EXPECT_EQ(m_oClient.commandsAwaiting(), 0);
+}
+
+/* Commands without an answer are done once written */
+TEST_F(PortAgentClientTest, CommandNoReply) {
+    EXPECT_TRUE(PortAgentClient::commandHasReply("get_config"));
+    EXPECT_TRUE(PortAgentClient::commandHasReply("save_config"));
+    EXPECT_TRUE(PortAgentClient::commandHasReply("commit"));
+    EXPECT_FALSE(PortAgentClient::commandHasReply("begin"));
+    EXPECT_FALSE(PortAgentClient::commandHasReply("break 500"));
+
+    // Queued while disconnected, written on connect
+    m_oClient.sendCommand("break 500", onReply, &m_oSeen);
+    EXPECT_EQ(m_oClient.commandsQueued(), 1);
+
+    connectAgent();
+    EXPECT_EQ(readCommand(), "break 500");
+
+    ASSERT_EQ(m_oSeen.results.size(), 1);
+    EXPECT_EQ(m_oSeen.results[0], COMMAND_OK);
+    EXPECT_EQ(m_oSeen.replies[0], "NULL");
+    EXPECT_EQ(m_oClient.commandsQueued(), 0);
+    EXPECT_EQ(m_oClient.commandsAwaiting(), 0);
+}
+
+/* A command the agent never answers times out */
+TEST_F(PortAgentClientTest, CommandTimeout) {
+    connectAgent();
+
+    m_oClient.sendCommand("get_stats", onReply, &m_oSeen);
+    EXPECT_EQ(readCommand(), "get_stats");
+
+    m_oClock.advance(CLIENT_COMMAND_TIMEOUT_USEC - 1);
+    m_oClient.poll(0);
+    EXPECT_TRUE(m_oSeen.results.empty());
+
+    m_oClock.advance(1);
+    m_oClient.poll(0);
+    ASSERT_EQ(m_oSeen.results.size(), 1);
+    EXPECT_EQ(m_oSeen.results[0], COMMAND_TIMEOUT);
+    EXPECT_EQ(m_oClient.commandsTimedOut(), 1);
+}
+
+/* When the agent goes away waiting commands fail and we reconnect */
+TEST_F(PortAgentClientTest, Reconnect) {
+    connectAgent();
+
+    m_oClient.sendCommand("get_state", onReply, &m_oSeen);
+    EXPECT_EQ(readCommand(), "get_state");
+
+    closeAgent();
+    for(int i = 0; i < 200 && m_oClient.connected(); i++)
+        m_oClient.poll(10000);
+
+    EXPECT_FALSE(m_oClient.connected());
+    EXPECT_EQ(m_oSeen.disconnects, 1);
+    ASSERT_EQ(m_oSeen.results.size(), 1);
+    EXPECT_EQ(m_oSeen.results[0], COMMAND_FAILED);
+
+    // Not before the back off is up
+    m_oClient.poll(0);
+    EXPECT_FALSE(m_oClient.connected());
+
+    m_oClock.advance(CLIENT_RECONNECT_MIN_USEC);
+    connectAgent();
+    EXPECT_EQ(m_oSeen.connects, 2);
+
+    sendPacket(m_iData, DATA_FROM_INSTRUMENT, "again");
+    pollFor(m_oSeen.data, 1);
+    ASSERT_EQ(m_oSeen.data.size(), 1);
+    EXPECT_EQ(m_oSeen.data[0], "again");
+    EXPECT_EQ(m_oClient.reconnectDelay(), CLIENT_RECONNECT_MIN_USEC);
+}
+
+/* Failed connects back off up to the limit */
+TEST_F(PortAgentClientTest, Backoff) {
+    uint64_t delay = CLIENT_RECONNECT_MIN_USEC;
+
+    close(m_iDataListener);
+    m_iDataListener = -1;
+
+    m_oClient.poll(0);
+    EXPECT_FALSE(m_oClient.connected());
+    EXPECT_EQ(m_oClient.connectFailures(), 1);
+
+    for(int i = 0; i < 10; i++) {
+        delay *= 2;
+        if(delay > CLIENT_RECONNECT_MAX_USEC)
+            delay = CLIENT_RECONNECT_MAX_USEC;
+        EXPECT_EQ(m_oClient.reconnectDelay(), delay);
+
+        // Too soon
+        m_oClient.poll(0);
+        EXPECT_EQ(m_oClient.connectFailures(), i + 1);
+
+        m_oClock.advance(CLIENT_RECONNECT_MAX_USEC);
+        m_oClient.poll(0);
+        EXPECT_EQ(m_oClient.connectFailures(), i + 2);
+    }
+
+    EXPECT_EQ(m_oClient.reconnectDelay(), CLIENT_RECONNECT_MAX_USEC);
+    EXPECT_EQ(m_oSeen.connects, 0);
+    EXPECT_EQ(m_oSeen.disconnects, 0);
+}
+
+/* The client thread reads and sends while we wait */
+TEST_F(PortAgentClientTest, Thread) {
+    char c;
+    string line;
+
+    ASSERT_TRUE(m_oClient.start());
+
+    m_iData = accept(m_iDataListener, NULL, NULL);
+    m_iCommand = accept(m_iCommandListener, NULL, NULL);
+    ASSERT_GE(m_iData, 0);
+    ASSERT_GE(m_iCommand, 0);
+
+    m_oClient.sendCommand("break 100");
+    while(read(m_iCommand, &c, 1) == 1 && c != '\n')
+        line += c;
+    EXPECT_EQ(line, "break 100");
+
+    m_oClient.stop();
+    EXPECT_EQ(m_oClient.connects(), 1);
+}
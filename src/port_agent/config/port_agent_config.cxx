@@ -12,9 +12,19 @@
 #include "common/log_file.h"
 #include "common/exception.h"
 #include "common/util.h"
+#include "network/tcp_comm_listener.h"
+#include "port_agent/publisher/publisher_pool.h"
+#include "port_agent/packet/archive_verifier.h"
+#include "common/stall_watchdog.h"
+#include "network/client_monitor.h"
+#include "common/thread_tuning.h"
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
 
@@ -28,6 +38,7 @@
 using namespace std;
 using namespace logger;
 using namespace port_agent;
+using namespace packet;
 
 /******************************************************************************
  *   PUBLIC METHODS
@@ -59,10 +70,13 @@ PortAgentConfig::PortAgentConfig(int argc, char* argv[]) {
     m_outputThrottle = 0;
     m_maxPacketSize = DEFAULT_PACKET_SIZE;
     m_ppid = 0;
+    m_upgradeFD = 0;
     m_telnetSnifferPort = 0;
+    m_bTransaction = false;
     
     // For backward compatibility, observatory connection defaults to standard
     m_observatoryConnectionType = OBS_TYPE_STANDARD;
+    m_eRotationInterval = DAILY;
 
     m_instrumentConnectionType = TYPE_UNKNOWN;
     
@@ -74,10 +88,37 @@ PortAgentConfig::PortAgentConfig(int argc, char* argv[]) {
     m_databits = 8;
     m_parity = 0;
     m_flow = 0;
+    m_serialReadMode = 0;
+    m_serialCharDelay = 0;
+    m_serialLineDelay = 0;
     m_instrumentDataPort = 0;
     m_instrumentDataTxPort = 0;
     m_instrumentDataRxPort = 0;
     m_instrumentCommandPort = 0;
+    m_driverSplice = false;
+    m_instrumentSocketProfile = 0;
+    m_observatorySocketProfile = 0;
+    m_socketBufferSize = 0;
+    m_listenBacklog = TCP_LISTEN_BACKLOG;
+    m_listenReusePort = false;
+    m_listenTakeover = false;
+    m_ioBackend = IO_BACKEND_SELECT;
+    m_publisherThreads = 0;
+    m_observatoryCompression = 0;
+    m_compressionFlush = TCP_COMPRESS_FLUSH_USEC / 1000;
+    m_archiveRecovery = ARCHIVE_RECOVERY_QUARANTINE;
+    m_dataStallTimeout = 0;
+    m_instrumentKeepalive = 0;
+    m_slowClientQueue = 0;
+    m_slowClientPolicy = network::SLOW_CLIENT_DECIMATE;
+    m_cpuAffinity = "all";
+    m_publisherCpuAffinity = "all";
+    m_realtimePriority = 0;
+    m_memoryLock = false;
+    m_memoryBudget = 0;
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        m_memoryLimit[i] = 0;
+    m_memoryPolicy = MEMORY_POLICY_DROP;
     m_heartbeatInterval = DEFAULT_HEARTBEAT_INTERVAL;
     
     m_piddir = DEFAULT_PID_DIR;
@@ -86,7 +127,7 @@ PortAgentConfig::PortAgentConfig(int argc, char* argv[]) {
     m_datadir = DEFAULT_DATA_DIR;
             
     // the getopt string representing command line options.
-    string optstr = "y:u:c:vhsp:ki:I:";
+    string optstr = "y:u:c:vhsp:ki:I:U:";
         
     // Long option equiviant of getopt string.
     static struct option long_options[] = {
@@ -103,6 +144,7 @@ PortAgentConfig::PortAgentConfig(int argc, char* argv[]) {
         {"identity",  required_argument, 0,  'i' },
         
         {"command_port",  required_argument, 0,  'p' },
+        {"upgrade_fd",  required_argument, 0,  'U' },
         {NULL,         0,                 NULL,  0 }
     };
 
@@ -228,6 +270,9 @@ string PortAgentConfig::Usage() {
        << "\t" << " --ppid (-y) parent_process_id" 
                << "\t- Poison pill, if parent process is gone then shutdown " << endl
        
+       << "\t" << " --upgrade_fd (-U) fd" 
+               << "\t- Take over from a running port agent, set by the upgrade command " << endl
+       
        << "\t" << " --identity (-i) identity "
                << "\t- identifiction for the port agent process. Ignored in the port agent process." << endl
        
@@ -255,13 +300,83 @@ PortAgentCommand PortAgentConfig::getCommand() {
 
 /******************************************************************************
  * Method: saveConfig()
- * Description: Return a command from the FIFO command queue.
- * Return: The oldest command if there are any in the queue, otherwise return
- *         0.
+ * Description: Write a snapshot of the current configuration to the config
+ *              file.  The snapshot is written to a temp file, synced and then
+ *              renamed so a reader never sees a partial config.
+ * Return: true if the snapshot was written.
  ******************************************************************************/
-void PortAgentConfig::saveConfig() {
+bool PortAgentConfig::saveConfig() {
     string configFile = conffile();
+    string tmpFile = configFile + ".tmp";
+    string config = getConfig();
+    const char *buffer = config.c_str();
+    uint32_t written = 0;
+    int count, fd;
+    
+    if(! mkpath(configFile)) {
+        LOG(ERROR) << "failed to create config directory: " << configFile;
+        return false;
+    }
+    
+    fd = open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        LOG(ERROR) << "failed to open config snapshot: " << tmpFile << " " << strerror(errno);
+        return false;
+    }
+    
+    while(written < config.length()) {
+        count = write(fd, buffer + written, config.length() - written);
+        if(count < 0 && errno == EINTR)
+            continue;
+        
+        if(count <= 0) {
+            LOG(ERROR) << "failed to write config snapshot: " << strerror(errno);
+            close(fd);
+            unlink(tmpFile.c_str());
+            return false;
+        }
+        
+        written += count;
+    }
     
+    if(fsync(fd) || close(fd) || rename(tmpFile.c_str(), configFile.c_str())) {
+        LOG(ERROR) << "failed to save config snapshot: " << strerror(errno);
+        unlink(tmpFile.c_str());
+        return false;
+    }
+    
+    LOG(INFO) << "saved config snapshot: " << configFile;
+    return true;
+}
+
+/******************************************************************************
+ * Method: loadConfig()
+ * Description: Read the snapshot left by saveConfig so we can start
+ *              configured.  A config file given on the command line takes
+ *              precedence over the snapshot.  The commands queued while
+ *              reading are dropped, we are starting from this config.
+ * Return: true if a snapshot was loaded.
+ ******************************************************************************/
+bool PortAgentConfig::loadConfig() {
+    string configFile = conffile();
+    
+    if(m_conffile.length() || ! file_exists(configFile.c_str()))
+        return false;
+    
+    LOG(INFO) << "loading config snapshot: " << configFile;
+    
+    try {
+        if(! readConfig(configFile))
+            LOG(ERROR) << "config snapshot partially loaded: " << configFile;
+    }
+    catch(FileIOException &e) {
+        LOG(ERROR) << "failed to read config snapshot: " << configFile;
+        return false;
+    }
+    
+    while(getCommand()) {}
+    
+    return true;
 }
 
 /******************************************************************************
@@ -289,6 +404,76 @@ bool PortAgentConfig::parse(const string &commands) {
     return true;
 }
 
+/******************************************************************************
+ * Method: beginTransaction()
+ * Description: Hold the commands that follow until commit.
+ * Return: false if a transaction is already open.
+ ******************************************************************************/
+bool PortAgentConfig::beginTransaction() {
+    if(m_bTransaction) {
+        LOG(ERROR) << "transaction already open";
+        return false;
+    }
+    
+    LOG(DEBUG) << "begin transaction";
+    m_bTransaction = true;
+    m_transaction.clear();
+    return true;
+}
+
+/******************************************************************************
+ * Method: commitTransaction()
+ * Description: Apply the held commands in order.  Their update commands are
+ *              merged in the command queue so the port agent reconfigures
+ *              once.  A command that fails is skipped and the rest still
+ *              apply, some settings like data ports live outside this
+ *              object and can't be taken back.  The commit is answered
+ *              once the queued commands have been handled.
+ * Return: false if there was no transaction or a command failed.
+ ******************************************************************************/
+bool PortAgentConfig::commitTransaction() {
+    bool ok = true;
+    
+    m_sTransactionError.clear();
+    
+    if(! m_bTransaction) {
+        LOG(ERROR) << "commit without begin";
+        m_sTransactionError = "commit without begin\n";
+        addCommand(CMD_TRANSACTION_COMMIT);
+        return false;
+    }
+    
+    m_bTransaction = false;
+    
+    LOG(INFO) << "commit transaction, commands: " << m_transaction.size();
+    
+    for(list<string>::iterator i = m_transaction.begin(); i != m_transaction.end(); i++) {
+        if(! processCommand(*i)) {
+            LOG(ERROR) << "failed to parse: " << *i;
+            m_sTransactionError += *i + "\n";
+            ok = false;
+        }
+    }
+    
+    m_transaction.clear();
+    
+    // Answered after everything the transaction queued
+    addCommand(CMD_TRANSACTION_COMMIT);
+    return ok;
+}
+
+/******************************************************************************
+ * Method: rollbackTransaction()
+ * Description: Drop the held commands.  Nothing has been applied yet.
+ ******************************************************************************/
+void PortAgentConfig::rollbackTransaction() {
+    if(m_bTransaction)
+        LOG(INFO) << "rollback transaction, commands dropped: " << m_transaction.size();
+    
+    m_bTransaction = false;
+    m_transaction.clear();
+}
+
 /******************************************************************************
  * Method: isConfigured()
  * Description: determine if we have enough information to run the port agent.
@@ -390,6 +575,7 @@ bool PortAgentConfig::readConfig(const string & filename) {
 string PortAgentConfig::getConfig() {
     ostringstream out;
     const char *buffer;
+    const char *profiles[] = { "default", "latency", "bulk" };
     string loglevel = Logger::Instance()->levelToString(Logger::GetLogLevel());
 
     out << "pid_dir " << m_piddir << endl
@@ -399,8 +585,27 @@ string PortAgentConfig::getConfig() {
         
         << "log_level " << loglevel << endl
         
-        << "command_port " << m_observatoryCommandPort << endl
-        << "data_port " << m_observatoryDataPort << endl;
+        << "command_port " << m_observatoryCommandPort << endl;
+
+        // Only what has been set so the dump can be parsed back in.  Multi
+        // connections list their ports with add_data_port.
+        if(m_observatoryDataPort && m_observatoryConnectionType != OBS_TYPE_MULTI)
+            out << "data_port " << m_observatoryDataPort << endl;
+
+        if(m_observatoryConnectionType == OBS_TYPE_MULTI)
+            out << "observatory_type multi" << endl;
+        else if(m_observatoryConnectionType == OBS_TYPE_STANDARD)
+            out << "observatory_type standard" << endl;
+
+        if(m_observatoryConnectionType == OBS_TYPE_MULTI) {
+            const ObservatoryDataPorts_T &ports = ObservatoryDataPorts::instance()->ports();
+            for(ObservatoryDataPorts_T::const_iterator i = ports.begin(); i != ports.end(); i++) {
+                out << "add_data_port " << i->port;
+                if(i->routingKey.length())
+                    out << ":" << i->routingKey;
+                out << endl;
+            }
+        }
         
         if(m_instrumentConnectionType) {
             out << "instrument_type ";
@@ -417,6 +622,9 @@ string PortAgentConfig::getConfig() {
             out << endl;
         }
         
+        if(m_devicePath.length())
+            out << "device_path " << m_devicePath << endl;
+        
         out << "heartbeat_interval " << m_heartbeatInterval << endl;
         
         buffer = m_sentinleSequence.c_str(); 
@@ -432,20 +640,90 @@ string PortAgentConfig::getConfig() {
         out << "'" << endl;
         
         out << "output_throttle " << m_outputThrottle << endl
-            << "max_packet_size " << m_maxPacketSize << endl
-            << "baud " << m_baud << endl
-            << "stopbits " << m_stopbits << endl
+            << "max_packet_size " << m_maxPacketSize << endl;
+        
+        if(m_baud)
+            out << "baud " << m_baud << endl;
+        
+        out << "stopbits " << m_stopbits << endl
             << "databits " << m_databits << endl
             << "parity " << m_parity << endl
-            << "flow " << m_flow << endl
-            << "instrument_addr " << m_instrumentAddr << endl
-            << "instrument_data_port " << m_instrumentDataPort << endl
-            << "instrument_data_tx_port " << m_instrumentDataTxPort << endl
-            << "instrument_data_rx_port " << m_instrumentDataRxPort << endl
-            << "instrument_command_port " << m_instrumentCommandPort << endl;
+            << "flow " << m_flow << endl;
+
+        out << "serial_read_mode ";
+        if(m_serialReadMode == 1)
+            out << "throughput";
+        else if(m_serialReadMode == 2)
+            out << "record";
+        else
+            out << "low_latency";
+        out << endl;
+
+        out << "serial_char_delay " << m_serialCharDelay << endl
+            << "serial_line_delay " << m_serialLineDelay << endl;
+        
+        if(m_instrumentAddr.length())
+            out << "instrument_addr " << m_instrumentAddr << endl;
+        if(m_instrumentDataPort)
+            out << "instrument_data_port " << m_instrumentDataPort << endl;
+        if(m_instrumentDataTxPort)
+            out << "instrument_data_tx_port " << m_instrumentDataTxPort << endl;
+        if(m_instrumentDataRxPort)
+            out << "instrument_data_rx_port " << m_instrumentDataRxPort << endl;
+        if(m_instrumentCommandPort)
+            out << "instrument_command_port " << m_instrumentCommandPort << endl;
+        
+        out << "driver_splice " << m_driverSplice << endl
+            << "instrument_socket_profile " << profiles[m_instrumentSocketProfile % 3] << endl
+            << "observatory_socket_profile " << profiles[m_observatorySocketProfile % 3] << endl
+            << "socket_buffer_size " << m_socketBufferSize << endl
+            << "listen_backlog " << m_listenBacklog << endl
+            << "listen_reuse_port " << m_listenReusePort << endl
+            << "listen_takeover " << m_listenTakeover << endl
+            << "io_backend " << (m_ioBackend == IO_BACKEND_URING ? "uring" : "select") << endl
+            << "publisher_threads " << m_publisherThreads << endl
+            << "observatory_compression " << m_observatoryCompression << endl
+            << "compression_flush_ms " << m_compressionFlush << endl
+            << "archive_recovery " << (m_archiveRecovery == ARCHIVE_RECOVERY_OFF ? "off" :
+                                       m_archiveRecovery == ARCHIVE_RECOVERY_TRUNCATE ? "truncate" :
+                                       "quarantine") << endl
+            << "instrument_keepalive " << m_instrumentKeepalive << endl
+            << "slow_client_queue " << m_slowClientQueue << endl
+            << "slow_client_policy " << (m_slowClientPolicy == network::SLOW_CLIENT_EVICT ? "evict" : "decimate") << endl
+            << "cpu_affinity " << m_cpuAffinity << endl
+            << "publisher_cpu_affinity " << m_publisherCpuAffinity << endl
+            << "realtime_priority " << m_realtimePriority << endl
+            << "memory_lock " << m_memoryLock << endl
+            << "memory_budget " << m_memoryBudget << endl;
+
+        for(int i = 0; i < MEMORY_SUBSYSTEMS; i++)
+            out << MemoryBudget::SubsystemName((MemorySubsystem)i) << "_memory_limit "
+                << m_memoryLimit[i] << endl;
+
+        out << "memory_policy " << (m_memoryPolicy == MEMORY_POLICY_WARN ? "warn" : "drop") << endl;
+
+        out << "data_stall_timeout ";
+        if(m_dataStallTimeout == STALL_TIMEOUT_AUTO)
+            out << "auto";
+        else if(m_dataStallTimeout)
+            out << m_dataStallTimeout;
+        else
+            out << "off";
+        out << endl;
+
+        out << "rotation_interval ";
+        if(m_eRotationInterval == HOURLY)
+            out << "hourly";
+        else if(m_eRotationInterval == QUARTER_HOURLY)
+            out << "quarter_hourly";
+        else if(m_eRotationInterval == MINUTE)
+            out << "minute";
+        else
+            out << "daily";
+        out << endl;
             
         if(m_telnetSnifferPort) {
-            out << "telnet_niffer_port " << m_telnetSnifferPort << endl;
+            out << "telnet_sniffer_port " << m_telnetSnifferPort << endl;
             if(m_telnetSnifferPrefix.length()) 
                 out << "telnet_sniffer_prefix " << m_telnetSnifferPrefix << endl;
             if(m_telnetSnifferSuffix.length()) 
@@ -698,38 +976,39 @@ bool PortAgentConfig::setObservatoryDataPort(const string &param) {
 
 /******************************************************************************
  * Method: addObervatoryDataPort
- * Description: Add the given observatory data port
+ * Description: Add the given observatory data port with an optional routing
+ * key, i.e. "4001" or "4001:LILY".
  * Param:
  *     param - string represention of the value of the port.  If it is not
  *     a number the value will be set to 0.
  * Return:
  *     return true if the throttle was set correctly, otherwise false.
  *****************************************************************************/
-// DHE: there should be an object that encapsulates a list or map (or whatever)
-// of data port entries (which could include routing keys).  The object is
-// a singleton; the observatory data port container.
 bool PortAgentConfig::addObservatoryDataPort(const string &param) {
     const char* v = param.c_str();
+    string routingKey;
 
     int value = atoi(v);
     m_observatoryDataPort = 0;
 
+    string::size_type sep = param.find(':');
+    if(sep != string::npos)
+        routingKey = param.substr(sep + 1);
+
     if(value <= 0 || value > 65535) {
         LOG(ERROR) << "Invalid port specification, setting to 0";
         return false;
     }
 
-    LOG(INFO) << "adding observatory data port: " << value;
-    //m_pObservatoryDataPorts->add(value);
+    LOG(INFO) << "adding observatory data port: " << value << " routing key: " << routingKey;
 
     // DHE NEW: for now keep this
     m_observatoryDataPort = value;
 
-    if (false == ObservatoryDataPorts::instance()->addPort(value)) {
+    if (false == ObservatoryDataPorts::instance()->addPort(value, routingKey)) {
         return false;
     }
 
-    // DHE TEMPTEMP
     ObservatoryDataPorts::instance()->logPorts();
 
     return true;
@@ -1034,6 +1313,90 @@ bool PortAgentConfig::setFlow(const string &param) {
     return true;
 }
 
+/******************************************************************************
+ * Method: setSerialReadMode
+ * Description: Change how serial reads are batched.
+ *   low_latency - wake on every byte (0)
+ *   throughput  - let the driver collect bytes between wakeups (1)
+ *   record      - wake when the sentinle arrives (2)
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to low_latency
+ *****************************************************************************/
+bool PortAgentConfig::setSerialReadMode(const string &param) {
+    m_serialReadMode = 0;
+
+    if(param == "low_latency") {
+        LOG(INFO) << "serial read mode set to low latency";
+        m_serialReadMode = 0;
+    }
+
+    else if(param == "throughput") {
+        LOG(INFO) << "serial read mode set to throughput";
+        m_serialReadMode = 1;
+    }
+
+    else if(param == "record") {
+        LOG(INFO) << "serial read mode set to record";
+        m_serialReadMode = 2;
+    }
+
+    else {
+        LOG(ERROR) << "unknown serial read mode: " << param;
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: setSerialCharDelay
+ * Description: Set the delay between characters written to a serial device
+ * for instruments that can't handle bursts.
+ * Param:
+ *     param - delay in milliseconds
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setSerialCharDelay(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_serialCharDelay = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid serial char delay parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set serial char delay to " << value;
+    m_serialCharDelay = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setSerialLineDelay
+ * Description: Set the delay after each newline written to a serial device.
+ * Param:
+ *     param - delay in milliseconds
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setSerialLineDelay(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_serialLineDelay = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid serial line delay parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set serial line delay to " << value;
+    m_serialLineDelay = value;
+    return true;
+}
+
 /******************************************************************************
  * Method: setRotationInterval
  * Description: Set data log rotation interval
@@ -1097,6 +1460,528 @@ bool PortAgentConfig::setTelnetSnifferPort(const string &param) {
     return true;
 }
 
+/******************************************************************************
+ * Method: setDriverSplice
+ * Description: Enable or disable splicing driver data straight through to a
+ * TCP instrument.
+ * Param:
+ *     param - 1 to enable, 0 to disable
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setDriverSplice(const string &param) {
+    m_driverSplice = false;
+    
+    if(param != "0" && param != "1") {
+        LOG(ERROR) << "invalid driver splice parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set driver splice to " << param;
+    m_driverSplice = param == "1";
+    return true;
+}
+
+/******************************************************************************
+ * Method: setInstrumentSocketProfile
+ * Description: Set the socket profile for the instrument connection.
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to default
+ *****************************************************************************/
+bool PortAgentConfig::setInstrumentSocketProfile(const string &param) {
+    LOG(INFO) << "set instrument socket profile to " << param;
+    return parseSocketProfile(param, m_instrumentSocketProfile);
+}
+
+/******************************************************************************
+ * Method: setObservatorySocketProfile
+ * Description: Set the socket profile for the observatory connection.
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to default
+ *****************************************************************************/
+bool PortAgentConfig::setObservatorySocketProfile(const string &param) {
+    LOG(INFO) << "set observatory socket profile to " << param;
+    return parseSocketProfile(param, m_observatorySocketProfile);
+}
+
+/******************************************************************************
+ * Method: setSocketBufferSize
+ * Description: Override the socket send and receive buffer sizes.
+ * Param:
+ *     param - size in bytes, 0 to use the profile default
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setSocketBufferSize(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_socketBufferSize = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid socket buffer size parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set socket buffer size to " << value;
+    m_socketBufferSize = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setListenBacklog
+ * Description: Set the accept queue length for the TCP listeners.
+ * Param:
+ *     param - number of pending connections, must be positive
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     TCP_LISTEN_BACKLOG
+ *****************************************************************************/
+bool PortAgentConfig::setListenBacklog(const string &param) {
+    int value = atoi(param.c_str());
+    m_listenBacklog = TCP_LISTEN_BACKLOG;
+    
+    if(value <= 0) {
+        LOG(ERROR) << "invalid listen backlog parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set listen backlog to " << value;
+    m_listenBacklog = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setListenReusePort
+ * Description: Set SO_REUSEPORT on the TCP listeners so another port agent
+ * process can bind the same ports.
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setListenReusePort(const string &param) {
+    m_listenReusePort = false;
+    
+    if(param != "0" && param != "1") {
+        LOG(ERROR) << "invalid listen reuse port parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set listen reuse port to " << param;
+    m_listenReusePort = param == "1";
+    return true;
+}
+
+/******************************************************************************
+ * Method: setListenTakeover
+ * Description: Let a new client on a data or command listener replace the
+ * current one instead of being turned away.  Off by default so a port scan or
+ * health check never cuts off the driver.
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setListenTakeover(const string &param) {
+    m_listenTakeover = false;
+    
+    if(param != "0" && param != "1") {
+        LOG(ERROR) << "invalid listen takeover parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set listen takeover to " << param;
+    m_listenTakeover = param == "1";
+    return true;
+}
+
+/******************************************************************************
+ * Method: setIOBackend
+ * Description: Choose how sockets and the archive are read and written,
+ * select with read/write or io_uring.  io_uring falls back to select if the
+ * kernel doesn't support it.
+ * Param:
+ *     param - select or uring
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     IO_BACKEND_SELECT
+ *****************************************************************************/
+bool PortAgentConfig::setIOBackend(const string &param) {
+    m_ioBackend = IO_BACKEND_SELECT;
+    
+    if(param == "uring")
+        m_ioBackend = IO_BACKEND_URING;
+    else if(param != "select") {
+        LOG(ERROR) << "invalid io backend parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set io backend to " << param;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setPublisherThreads
+ * Description: Set the number of threads publishing packets in parallel.
+ * Param:
+ *     param - thread count, 0 publishes on the main thread
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to 0
+ *****************************************************************************/
+bool PortAgentConfig::setPublisherThreads(const string &param) {
+    int value = atoi(param.c_str());
+    m_publisherThreads = 0;
+    
+    if(! isdigit(param.c_str()[0]) || value > PUBLISHER_POOL_MAX_THREADS) {
+        LOG(ERROR) << "invalid publisher threads parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set publisher threads to " << value;
+    m_publisherThreads = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setObservatoryCompression
+ * Description: Set the zlib level of the compressed stream offered to
+ * observatory data clients.  Clients still have to ask for it.
+ * Param:
+ *     param - compression level 1-9, 0 sends raw data only
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to 0
+ *****************************************************************************/
+bool PortAgentConfig::setObservatoryCompression(const string &param) {
+    int value = atoi(param.c_str());
+    m_observatoryCompression = 0;
+    
+    if(! isdigit(param.c_str()[0]) || value > Z_BEST_COMPRESSION) {
+        LOG(ERROR) << "invalid observatory compression parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set observatory compression to " << value;
+    m_observatoryCompression = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setCompressionFlush
+ * Description: Set the longest compressed output waits before it is flushed
+ * to the client.
+ * Param:
+ *     param - milliseconds, 0 flushes every write
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     TCP_COMPRESS_FLUSH_USEC
+ *****************************************************************************/
+bool PortAgentConfig::setCompressionFlush(const string &param) {
+    int value = atoi(param.c_str());
+    m_compressionFlush = TCP_COMPRESS_FLUSH_USEC / 1000;
+    
+    if(! isdigit(param.c_str()[0]) || value > 60000) {
+        LOG(ERROR) << "invalid compression flush parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set compression flush to " << value << "ms";
+    m_compressionFlush = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setArchiveRecovery
+ * Description: Set what happens to a torn tail found in the newest data log
+ * at startup.
+ * Param:
+ *     param - off, truncate or quarantine (truncate, keeping the tail in a
+ *             file next to the log)
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     ARCHIVE_RECOVERY_QUARANTINE
+ *****************************************************************************/
+bool PortAgentConfig::setArchiveRecovery(const string &param) {
+    m_archiveRecovery = ARCHIVE_RECOVERY_QUARANTINE;
+    
+    if(param == "off")
+        m_archiveRecovery = ARCHIVE_RECOVERY_OFF;
+    else if(param == "truncate")
+        m_archiveRecovery = ARCHIVE_RECOVERY_TRUNCATE;
+    else if(param != "quarantine") {
+        LOG(ERROR) << "invalid archive recovery parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set archive recovery to " << param;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setDataStallTimeout
+ * Description: Set how long the instrument may go without sending data
+ * before we call it stalled and reconnect.
+ * Param:
+ *     param - off, auto to learn it from the data cadence, or seconds
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to off
+ *****************************************************************************/
+bool PortAgentConfig::setDataStallTimeout(const string &param) {
+    const char* v = param.c_str();
+    int value;
+    
+    m_dataStallTimeout = 0;
+    
+    if(param == "off")
+        value = 0;
+    else if(param == "auto")
+        value = STALL_TIMEOUT_AUTO;
+    else {
+        value = atoi(v);
+        if(value <= 0) {
+            LOG(ERROR) << "invalid data stall timeout parameter, " << param;
+            return false;
+        }
+    }
+    
+    LOG(INFO) << "set data stall timeout to " << param;
+    m_dataStallTimeout = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setInstrumentKeepalive
+ * Description: Set the TCP keepalive time for instrument connections.
+ * Param:
+ *     param - seconds of silence before the peer is probed, 0 for none
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setInstrumentKeepalive(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_instrumentKeepalive = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid instrument keepalive parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set instrument keepalive to " << value;
+    m_instrumentKeepalive = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setSlowClientQueue
+ * Description: Set how many bytes an observatory data client may leave
+ * unread before it is treated as slow.
+ * Param:
+ *     param - size in bytes, 0 to never act on a slow client
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setSlowClientQueue(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_slowClientQueue = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid slow client queue parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set slow client queue to " << value;
+    m_slowClientQueue = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setCpuAffinity
+ * Description: Set the CPUs the main loop thread runs on.  That thread reads
+ * the instrument, writes the data log and publishes unless publisher
+ * threads are configured.
+ * Param:
+ *     param - CPU list like 0-3,6 or all
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to all
+ *****************************************************************************/
+bool PortAgentConfig::setCpuAffinity(const string &param) {
+    cpu_set_t set;
+    m_cpuAffinity = "all";
+    
+    if(! ThreadTuning::ParseCpuList(param, set)) {
+        LOG(ERROR) << "invalid cpu affinity parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set cpu affinity to " << param;
+    m_cpuAffinity = param;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setPublisherCpuAffinity
+ * Description: Set the CPUs the publisher threads run on.
+ * Param:
+ *     param - CPU list like 0-3,6 or all
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to all
+ *****************************************************************************/
+bool PortAgentConfig::setPublisherCpuAffinity(const string &param) {
+    cpu_set_t set;
+    m_publisherCpuAffinity = "all";
+    
+    if(! ThreadTuning::ParseCpuList(param, set)) {
+        LOG(ERROR) << "invalid publisher cpu affinity parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set publisher cpu affinity to " << param;
+    m_publisherCpuAffinity = param;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setRealtimePriority
+ * Description: Set the SCHED_FIFO priority of the main loop thread, which
+ * does the instrument reads.
+ * Param:
+ *     param - priority up to THREAD_MAX_RT_PRIORITY, 0 for normal scheduling
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to 0
+ *****************************************************************************/
+bool PortAgentConfig::setRealtimePriority(const string &param) {
+    int value = atoi(param.c_str());
+    m_realtimePriority = 0;
+    
+    if(! isdigit(param.c_str()[0]) || value > THREAD_MAX_RT_PRIORITY) {
+        LOG(ERROR) << "invalid realtime priority parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set realtime priority to " << value;
+    m_realtimePriority = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setMemoryLock
+ * Description: Lock the main loop thread's stack and the io_uring receive
+ * buffers in memory.
+ * Return:
+ *     return true if set correctly, otherwise false.
+ *****************************************************************************/
+bool PortAgentConfig::setMemoryLock(const string &param) {
+    m_memoryLock = false;
+    
+    if(param != "0" && param != "1") {
+        LOG(ERROR) << "invalid memory lock parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set memory lock to " << param;
+    m_memoryLock = param == "1";
+    return true;
+}
+
+/******************************************************************************
+ * Method: setMemoryBudget
+ * Description: Set the most memory the packet, publisher and connection
+ * buffers may hold between them.
+ * Param:
+ *     param - size in bytes, 0 for no limit
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to 0
+ *****************************************************************************/
+bool PortAgentConfig::setMemoryBudget(const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_memoryBudget = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid memory budget parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set memory budget to " << value;
+    m_memoryBudget = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setMemoryLimit
+ * Description: Set the most memory one subsystem's buffers may hold.
+ * Param:
+ *     subsystem - packet, publisher or connection
+ *     param - size in bytes, 0 for no limit
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to 0
+ *****************************************************************************/
+bool PortAgentConfig::setMemoryLimit(MemorySubsystem subsystem, const string &param) {
+    const char* v = param.c_str();
+    
+    int value = atoi(v);
+    m_memoryLimit[subsystem] = 0;
+    
+    if((value == 0 && v[0] != '0') || value < 0) {
+        LOG(ERROR) << "invalid " << MemoryBudget::SubsystemName(subsystem)
+                   << " memory limit parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set " << MemoryBudget::SubsystemName(subsystem) << " memory limit to " << value;
+    m_memoryLimit[subsystem] = value;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setMemoryPolicy
+ * Description: Set what happens to a buffer that would go over budget.
+ * Param:
+ *     param - drop (refuse it, the data is shed) or warn (allow it and
+ *             count it)
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     MEMORY_POLICY_DROP
+ *****************************************************************************/
+bool PortAgentConfig::setMemoryPolicy(const string &param) {
+    m_memoryPolicy = MEMORY_POLICY_DROP;
+    
+    if(param == "warn")
+        m_memoryPolicy = MEMORY_POLICY_WARN;
+    else if(param != "drop") {
+        LOG(ERROR) << "invalid memory policy parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set memory policy to " << param;
+    return true;
+}
+
+/******************************************************************************
+ * Method: setSlowClientPolicy
+ * Description: Set what happens to a slow observatory data client.
+ * Param:
+ *     param - decimate (send some of the data, evict if it doesn't catch
+ *             up) or evict
+ * Return:
+ *     return true if set correctly, otherwise false.  Default to
+ *     SLOW_CLIENT_DECIMATE
+ *****************************************************************************/
+bool PortAgentConfig::setSlowClientPolicy(const string &param) {
+    m_slowClientPolicy = network::SLOW_CLIENT_DECIMATE;
+    
+    if(param == "evict")
+        m_slowClientPolicy = network::SLOW_CLIENT_EVICT;
+    else if(param != "decimate") {
+        LOG(ERROR) << "invalid slow client policy parameter, " << param;
+        return false;
+    }
+    
+    LOG(INFO) << "set slow client policy to " << param;
+    return true;
+}
+
 
 /******************************************************************************
  *   PRIVATE METHODS
@@ -1140,6 +2025,12 @@ void PortAgentConfig::setParameter(char option, char *value) {
             
             m_ppid = atoi(value);
             break;
+        case 'U':
+            if(!value)
+                throw ParameterRequired("upgrade_fd");
+            
+            m_upgradeFD = atoi(value);
+            break;
         case '?':
             throw ParameterRequired();
     };
@@ -1214,6 +2105,26 @@ bool PortAgentConfig::processCommand(const string & command) {
     string cmd, param;
     splitCommand(command, cmd, param);
     
+    ///////////////////////////
+    // Transactions hold everything else until the commit
+    ///////////////////////////
+    if( command == "begin" )
+        return beginTransaction();
+        
+    else if( command == "commit" )
+        return commitTransaction();
+        
+    else if( command == "rollback" ) {
+        rollbackTransaction();
+        return true;
+    }
+        
+    else if( m_bTransaction ) {
+        LOG(DEBUG) << "held for commit: " << command;
+        m_transaction.push_back(command);
+        return true;
+    }
+    
     ///////////////////////////
     // First look for commands
     ///////////////////////////
@@ -1232,6 +2143,9 @@ bool PortAgentConfig::processCommand(const string & command) {
     else if( command == "get_state" )
         addCommand(CMD_GET_STATE);
         
+    else if( command == "get_stats" )
+        addCommand(CMD_GET_STATS);
+        
     else if( command == "ping" )
         addCommand(CMD_PING);
         
@@ -1243,6 +2157,12 @@ bool PortAgentConfig::processCommand(const string & command) {
     // Check for parameters
     ///////////////////////////
     
+    else if(cmd == "upgrade" ) {
+        addCommand(CMD_UPGRADE);
+        m_upgradePath = param;
+        return true;
+    }
+
     else if(cmd == "break" ) {
         addCommand(CMD_BREAK);
         return setInstrumentBreakDuration(param);
@@ -1262,6 +2182,13 @@ bool PortAgentConfig::processCommand(const string & command) {
         // We pass the entire command string to this incase there are \n or \r
         // embedded in the sentinle string.
         addCommand(CMD_PUBLISHER_CONFIG_UPDATE);
+        
+        // The record read mode batches on the sentinle so the serial
+        // settings need to be reapplied.
+        if(m_serialReadMode == 2) {
+            m_bSerialSettingsChanged = true;
+            addCommand(CMD_COMM_CONFIG_UPDATE);
+        }
         return setSentinleSequence(command);
     }
     
@@ -1392,6 +2319,146 @@ bool PortAgentConfig::processCommand(const string & command) {
         return setFlow(param);
     }
     
+    else if(cmd == "serial_read_mode") {
+        m_bSerialSettingsChanged = true;
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSerialReadMode(param);
+    }
+    
+    else if(cmd == "serial_char_delay") {
+        m_bSerialSettingsChanged = true;
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSerialCharDelay(param);
+    }
+    
+    else if(cmd == "serial_line_delay") {
+        m_bSerialSettingsChanged = true;
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSerialLineDelay(param);
+    }
+    
+    else if(cmd == "instrument_socket_profile") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setInstrumentSocketProfile(param);
+    }
+    
+    else if(cmd == "observatory_socket_profile") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setObservatorySocketProfile(param);
+    }
+    
+    else if(cmd == "socket_buffer_size") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSocketBufferSize(param);
+    }
+    
+    else if(cmd == "listen_backlog") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setListenBacklog(param);
+    }
+    
+    else if(cmd == "listen_reuse_port") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setListenReusePort(param);
+    }
+    
+    else if(cmd == "listen_takeover") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setListenTakeover(param);
+    }
+    
+    else if(cmd == "io_backend") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setIOBackend(param);
+    }
+    
+    else if(cmd == "publisher_threads") {
+        addCommand(CMD_PUBLISHER_CONFIG_UPDATE);
+        return setPublisherThreads(param);
+    }
+    
+    else if(cmd == "observatory_compression") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setObservatoryCompression(param);
+    }
+    
+    else if(cmd == "compression_flush_ms") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setCompressionFlush(param);
+    }
+    
+    else if(cmd == "archive_recovery") {
+        return setArchiveRecovery(param);
+    }
+    
+    else if(cmd == "data_stall_timeout") {
+        return setDataStallTimeout(param);
+    }
+    
+    else if(cmd == "instrument_keepalive") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setInstrumentKeepalive(param);
+    }
+    
+    else if(cmd == "slow_client_queue") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSlowClientQueue(param);
+    }
+    
+    else if(cmd == "slow_client_policy") {
+        addCommand(CMD_COMM_CONFIG_UPDATE);
+        return setSlowClientPolicy(param);
+    }
+    
+    else if(cmd == "cpu_affinity") {
+        addCommand(CMD_THREAD_CONFIG_UPDATE);
+        return setCpuAffinity(param);
+    }
+    
+    else if(cmd == "publisher_cpu_affinity") {
+        addCommand(CMD_THREAD_CONFIG_UPDATE);
+        return setPublisherCpuAffinity(param);
+    }
+    
+    else if(cmd == "realtime_priority") {
+        addCommand(CMD_THREAD_CONFIG_UPDATE);
+        return setRealtimePriority(param);
+    }
+    
+    else if(cmd == "memory_lock") {
+        addCommand(CMD_THREAD_CONFIG_UPDATE);
+        return setMemoryLock(param);
+    }
+    
+    else if(cmd == "memory_budget") {
+        addCommand(CMD_MEMORY_CONFIG_UPDATE);
+        return setMemoryBudget(param);
+    }
+    
+    else if(cmd == "packet_memory_limit") {
+        addCommand(CMD_MEMORY_CONFIG_UPDATE);
+        return setMemoryLimit(MEMORY_PACKET, param);
+    }
+    
+    else if(cmd == "publisher_memory_limit") {
+        addCommand(CMD_MEMORY_CONFIG_UPDATE);
+        return setMemoryLimit(MEMORY_PUBLISHER, param);
+    }
+    
+    else if(cmd == "connection_memory_limit") {
+        addCommand(CMD_MEMORY_CONFIG_UPDATE);
+        return setMemoryLimit(MEMORY_CONNECTION, param);
+    }
+    
+    else if(cmd == "memory_policy") {
+        addCommand(CMD_MEMORY_CONFIG_UPDATE);
+        return setMemoryPolicy(param);
+    }
+    
+    else if(cmd == "driver_splice") {
+        return setDriverSplice(param);
+    }
+    
     else if(cmd == "rotation_interval") {
         addCommand(CMD_ROTATION_INTERVAL);
         return setRotationInterval(param);
@@ -1422,6 +2489,31 @@ bool PortAgentConfig::processCommand(const string & command) {
         
 }
 
+/******************************************************************************
+ * Method: parseSocketProfile()
+ * Description: Convert a socket profile name to its value.
+ *   default - kernel defaults (0)
+ *   latency - tuned for small command/response exchanges (1)
+ *   bulk    - tuned for streaming data (2)
+ * Return: return true if the profile name is known.
+ ******************************************************************************/
+bool PortAgentConfig::parseSocketProfile(const string &param, uint16_t &profile) {
+    profile = 0;
+    
+    if(param == "default")
+        profile = 0;
+    else if(param == "latency")
+        profile = 1;
+    else if(param == "bulk")
+        profile = 2;
+    else {
+        LOG(ERROR) << "unknown socket profile: " << param;
+        return false;
+    }
+    
+    return true;
+}
+
 /******************************************************************************
  * Method: splitCommand()
  * Description: Split a command string into a command and parameter.
@@ -1484,28 +2576,65 @@ void ObservatoryDataPorts::logPorts() {
     list<ObservatoryDataPortEntry_T>::iterator i = m_observatoryDataPorts.begin();
     int j = 0;
     for(i = m_observatoryDataPorts.begin(); i != m_observatoryDataPorts.end(); i++) {
-        LOG(DEBUG) << "Data port: " << j << ", " << *i;
+        LOG(DEBUG) << "Data port: " << j << ", " << i->port << " routing key: " << i->routingKey;
         j++;
     }
 }
 
 /******************************************************************************
- * Method: addPort(const int port)
+ * Method: addPort(const int port, const string &routingKey)
  * Description: Add the given port to the container of ports.
  * Return: return true if success, false if not.
  ******************************************************************************/
-bool ObservatoryDataPorts::addPort(const int port) {
+bool ObservatoryDataPorts::addPort(const int port, const string &routingKey) {
     bool bRetVal = true;
+    ObservatoryDataPortEntry_T entry;
 
     LOG(DEBUG) << "ObservatoryDataPorts::addPort: Adding port: " << port;
 
     // First remove any existing element with the same port value
-    m_observatoryDataPorts.remove(port);
-    m_observatoryDataPorts.push_back(port);
+    for(ObservatoryDataPorts_T::iterator i = m_observatoryDataPorts.begin(); i != m_observatoryDataPorts.end(); i++) {
+        if(i->port == port) {
+            m_observatoryDataPorts.erase(i);
+            break;
+        }
+    }
+
+    entry.port = port;
+    entry.routingKey = routingKey;
+    m_observatoryDataPorts.push_back(entry);
 
     return bRetVal;
 }
 
+/******************************************************************************
+ * Method: routingKey
+ * Description: Get the routing key configured for a port
+ * Return: the routing key, empty if the port has none or isn't configured
+ ******************************************************************************/
+string ObservatoryDataPorts::routingKey(const int port) {
+    for(ObservatoryDataPorts_T::iterator i = m_observatoryDataPorts.begin(); i != m_observatoryDataPorts.end(); i++) {
+        if(i->port == port)
+            return i->routingKey;
+    }
+
+    return "";
+}
+
+/******************************************************************************
+ * Method: routed
+ * Description: Does any of the ports have a routing key?
+ * Return: true if instrument data needs to be routed
+ ******************************************************************************/
+bool ObservatoryDataPorts::routed() {
+    for(ObservatoryDataPorts_T::iterator i = m_observatoryDataPorts.begin(); i != m_observatoryDataPorts.end(); i++) {
+        if(i->routingKey.length())
+            return true;
+    }
+
+    return false;
+}
+
 /******************************************************************************
  * Method: getFirstPort
  * Description: Get the first port from the container of ports.
@@ -1522,7 +2651,7 @@ const int ObservatoryDataPorts::getFirstPort()
       return 0;
    }
    else {
-      return *m_portIt;
+      return m_portIt->port;
    }
 }
 
@@ -1541,7 +2670,7 @@ const int ObservatoryDataPorts::getNextPort()
       return 0;
    }
    else {
-      return *m_portIt;
+      return m_portIt->port;
    }
 }
 
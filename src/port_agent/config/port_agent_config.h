@@ -11,6 +11,12 @@
  *     passed to the constructor using getopt_long.
  *   * parses options read from the observatory command interface
  *   * store configuration parameters
+ *
+ * Commands sent between "begin" and "commit" are held and applied together
+ * at the commit, so a driver pushing its whole configuration causes one
+ * reconfiguration instead of one per line.  "rollback" drops the held
+ * commands.  Nothing held is applied before the commit, including queries
+ * like get_config.  A commit is always answered, after anything it held.
  ******************************************************************************/
 
 #ifndef PORT_AGENT_CONFIG_H_
@@ -20,6 +26,7 @@
 #include <list>
 #include <stdint.h>
 #include "common/log_file.h"
+#include "common/memory_budget.h"
 
 using namespace std;
 using namespace logger;
@@ -29,6 +36,10 @@ using namespace logger;
 #define MAX_PACKET_SIZE       65472
 #define DEFAULT_HEARTBEAT_INTERVAL 120
 
+// I/O backends, io_uring is opt in
+#define IO_BACKEND_SELECT 0
+#define IO_BACKEND_URING  1
+
 #define BASE_FILENAME "port_agent"
 
 #define DEFAULT_LOG_DIR   "/tmp"
@@ -53,7 +64,12 @@ namespace port_agent {
         CMD_PING                    = 0x00000008,
         CMD_BREAK                   = 0x00000009,
         CMD_SHUTDOWN                = 0x00000010,
-        CMD_ROTATION_INTERVAL       = 0x00000011
+        CMD_ROTATION_INTERVAL       = 0x00000011,
+        CMD_GET_STATS               = 0x00000012,
+        CMD_UPGRADE                 = 0x00000013,
+        CMD_THREAD_CONFIG_UPDATE    = 0x00000014,
+        CMD_MEMORY_CONFIG_UPDATE    = 0x00000015,
+        CMD_TRANSACTION_COMMIT      = 0x00000016
     } PortAgentCommand;
     typedef list<PortAgentCommand>  CommandQueue;
     
@@ -73,11 +89,12 @@ namespace port_agent {
         TYPE_RSN               = 0x00000004
     } InstrumentConnectionType;
 
-    // DHE NEW: a list of data port entries; in the future the ObservatoryDataPortEntry_T
-    // can be extended to be a structure including a routing key.  Also, the fact that
-    // it's a list should be abstracted, so that we can change it to a map for faster
-    // lookup in the future.
-    typedef int ObservatoryDataPortEntry_T;
+    // A data port entry.  The routing key selects which instrument records
+    // are sent to clients of the port; an empty key gets everything.
+    typedef struct ObservatoryDataPortEntry {
+        int port;
+        string routingKey;
+    } ObservatoryDataPortEntry_T;
     typedef list<ObservatoryDataPortEntry_T> ObservatoryDataPorts_T;
     
     // A singleton class that contains observatory data ports, and provides operations
@@ -86,10 +103,18 @@ namespace port_agent {
         public:
             static  ObservatoryDataPorts* instance();
             void    logPorts();
-            bool    addPort(const int port);
+            bool    addPort(const int port, const string &routingKey = "");
             const int getFirstPort();
             const int getNextPort();
 
+            // Routing key for a port, empty if it has none
+            string  routingKey(const int port);
+
+            // Does any port have a routing key?
+            bool    routed();
+
+            const ObservatoryDataPorts_T & ports() { return m_observatoryDataPorts; }
+
         private:
             // CTOR
             ObservatoryDataPorts();
@@ -103,7 +128,7 @@ namespace port_agent {
         public:
             ///////////////////////
             // Constructors
-            PortAgentConfig() {}
+            PortAgentConfig() : m_bTransaction(false) {}
             PortAgentConfig(int argc, char *argv[]);
             
             ///////////////////////
@@ -115,7 +140,8 @@ namespace port_agent {
             PortAgentCommand getCommand();
             
             // Commands
-            void saveConfig();
+            bool saveConfig();
+            bool loadConfig();
             string getConfig();
             bool readConfig(const string & filename);
             
@@ -123,6 +149,15 @@ namespace port_agent {
             
             bool parse(const string &commands);
             
+            // Command transactions
+            bool beginTransaction();
+            bool commitTransaction();
+            void rollbackTransaction();
+            bool inTransaction() { return m_bTransaction; }
+            
+            // Commands that failed in the last commit
+            const string & transactionError() { return m_sTransactionError; }
+            
             // Set methods
             bool setObservatoryConnectionType(const string &param);
             bool setObservatoryDataPort(const string &param);
@@ -143,11 +178,37 @@ namespace port_agent {
             bool setDatabits(const string &param);
             bool setParity(const string &param);
             bool setFlow(const string &param);
+            bool setSerialReadMode(const string &param);
+            bool setSerialCharDelay(const string &param);
+            bool setSerialLineDelay(const string &param);
             bool setInstrumentDataPort(const string &param);
             bool setInstrumentDataTxPort(const string &param);
             bool setInstrumentDataRxPort(const string &param);
             bool setInstrumentCommandPort(const string &param);
             bool setRotationInterval(const string &param);
+            bool setDriverSplice(const string &param);
+            bool setInstrumentSocketProfile(const string &param);
+            bool setObservatorySocketProfile(const string &param);
+            bool setSocketBufferSize(const string &param);
+            bool setListenBacklog(const string &param);
+            bool setListenReusePort(const string &param);
+            bool setListenTakeover(const string &param);
+            bool setIOBackend(const string &param);
+            bool setPublisherThreads(const string &param);
+            bool setObservatoryCompression(const string &param);
+            bool setCompressionFlush(const string &param);
+            bool setArchiveRecovery(const string &param);
+            bool setDataStallTimeout(const string &param);
+            bool setInstrumentKeepalive(const string &param);
+            bool setSlowClientQueue(const string &param);
+            bool setSlowClientPolicy(const string &param);
+            bool setCpuAffinity(const string &param);
+            bool setPublisherCpuAffinity(const string &param);
+            bool setRealtimePriority(const string &param);
+            bool setMemoryLock(const string &param);
+            bool setMemoryBudget(const string &param);
+            bool setMemoryLimit(MemorySubsystem subsystem, const string &param);
+            bool setMemoryPolicy(const string &param);
 			bool setTelnetSnifferPort(const string &param);
             bool setTelnetSnifferPrefix(const string &param) { m_telnetSnifferPrefix = param; return true; }
             bool setTelnetSnifferSuffix(const string &param) { m_telnetSnifferSuffix = param; return true; }
@@ -159,6 +220,10 @@ namespace port_agent {
             bool version() { return m_version; }
             uint32_t ppid() { return m_ppid; }
             
+            // Live upgrade
+            int upgradeFD() { return m_upgradeFD; }
+            string upgradePath() { return m_upgradePath; }
+            
             string logfile();
             string pidfile();
             string conffile();
@@ -194,11 +259,37 @@ namespace port_agent {
             uint16_t databits() { return m_databits; }
             uint16_t parity() { return m_parity; }
             uint16_t flow() { return m_flow; }
+            uint16_t serialReadMode() { return m_serialReadMode; }
+            uint32_t serialCharDelay() { return m_serialCharDelay; }
+            uint32_t serialLineDelay() { return m_serialLineDelay; }
             const string & instrumentAddr() { return m_instrumentAddr; }
             uint16_t instrumentDataPort() { return m_instrumentDataPort; }
             uint16_t instrumentDataTxPort() { return m_instrumentDataTxPort; }
             uint16_t instrumentDataRxPort() { return m_instrumentDataRxPort; }
             uint16_t instrumentCommandPort() { return m_instrumentCommandPort; }
+            bool driverSplice() { return m_driverSplice; }
+            uint16_t instrumentSocketProfile() { return m_instrumentSocketProfile; }
+            uint16_t observatorySocketProfile() { return m_observatorySocketProfile; }
+            uint32_t socketBufferSize() { return m_socketBufferSize; }
+            uint32_t listenBacklog() { return m_listenBacklog; }
+            bool listenReusePort() { return m_listenReusePort; }
+            bool listenTakeover() { return m_listenTakeover; }
+            uint16_t ioBackend() { return m_ioBackend; }
+            uint32_t publisherThreads() { return m_publisherThreads; }
+            uint16_t observatoryCompression() { return m_observatoryCompression; }
+            uint32_t compressionFlush() { return m_compressionFlush; }
+            uint16_t archiveRecovery() { return m_archiveRecovery; }
+            uint32_t dataStallTimeout() { return m_dataStallTimeout; }
+            uint32_t instrumentKeepalive() { return m_instrumentKeepalive; }
+            uint32_t slowClientQueue() { return m_slowClientQueue; }
+            uint16_t slowClientPolicy() { return m_slowClientPolicy; }
+            const string & cpuAffinity() { return m_cpuAffinity; }
+            const string & publisherCpuAffinity() { return m_publisherCpuAffinity; }
+            uint32_t realtimePriority() { return m_realtimePriority; }
+            bool memoryLock() { return m_memoryLock; }
+            uint32_t memoryBudget() { return m_memoryBudget; }
+            uint32_t memoryLimit(MemorySubsystem subsystem) { return m_memoryLimit[subsystem]; }
+            uint16_t memoryPolicy() { return m_memoryPolicy; }
 			
 			// Telnet sniffer config
             uint16_t telnetSnifferPort() { return m_telnetSnifferPort; }
@@ -210,6 +301,7 @@ namespace port_agent {
             void addCommand(PortAgentCommand command);
             bool processCommand(const string & command);
             bool splitCommand(const string & raw, string & cmdResult, string & parameter);
+            bool parseSocketProfile(const string &param, uint16_t &profile);
             
             void verifyCommandLineParameters();
             
@@ -219,6 +311,11 @@ namespace port_agent {
             // storage for the commands processed by this object
             CommandQueue m_commands;
             
+            // Commands held until commit
+            bool m_bTransaction;
+            list<string> m_transaction;
+            string m_sTransactionError;
+            
             // Command line options, not all of these can be changed via
             // public methods post construction.
             bool m_help;
@@ -227,6 +324,11 @@ namespace port_agent {
             string m_programName;
 			uint32_t m_ppid;
             
+            // Handoff socket when we were started by a live upgrade and the
+            // binary to start when we are asked to upgrade.
+            int m_upgradeFD;
+            string m_upgradePath;
+            
             string m_pidfile;
             string m_logfile;
             string m_conffile;
@@ -261,11 +363,37 @@ namespace port_agent {
             uint16_t m_databits;
             uint16_t m_parity;
             uint16_t m_flow;
+            uint16_t m_serialReadMode;
+            uint32_t m_serialCharDelay;
+            uint32_t m_serialLineDelay;
             string m_instrumentAddr;
             uint16_t m_instrumentDataPort;
             uint16_t m_instrumentDataTxPort;
             uint16_t m_instrumentDataRxPort;
             uint16_t m_instrumentCommandPort;
+            bool m_driverSplice;
+            uint16_t m_instrumentSocketProfile;
+            uint16_t m_observatorySocketProfile;
+            uint32_t m_socketBufferSize;
+            uint32_t m_listenBacklog;
+            bool m_listenReusePort;
+            bool m_listenTakeover;
+            uint16_t m_ioBackend;
+            uint32_t m_publisherThreads;
+            uint16_t m_observatoryCompression;
+            uint32_t m_compressionFlush;
+            uint16_t m_archiveRecovery;
+            uint32_t m_dataStallTimeout;
+            uint32_t m_instrumentKeepalive;
+            uint32_t m_slowClientQueue;
+            uint16_t m_slowClientPolicy;
+            string m_cpuAffinity;
+            string m_publisherCpuAffinity;
+            uint32_t m_realtimePriority;
+            bool m_memoryLock;
+            uint32_t m_memoryBudget;
+            uint32_t m_memoryLimit[MEMORY_SUBSYSTEMS];
+            uint16_t m_memoryPolicy;
 			
 			// Telnet sniffer config
 			uint16_t m_telnetSnifferPort;
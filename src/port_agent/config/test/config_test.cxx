@@ -5,9 +5,14 @@
 #include "gtest/gtest.h"
 
 #include "port_agent/config/port_agent_config.h"
+#include "network/tcp_comm_listener.h"
+#include "port_agent/packet/archive_verifier.h"
+#include "common/stall_watchdog.h"
+#include "network/client_monitor.h"
 
 using namespace logger;
 using namespace port_agent;
+using namespace packet;
 
 #define TEST_PORT "4001"
 #define CONFIG_PATH "/tmp/port_agent_test.cfg"
@@ -780,6 +785,511 @@ TEST_F(CommonTest, SetFlowControl) {
     EXPECT_EQ(config.flow(), 0);
 }
 
+/* Test serial read mode parameter */
+TEST_F(CommonTest, SetSerialReadMode) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.serialReadMode(), 0);
+    
+    config.clearSerialSettingsChanged();
+    EXPECT_TRUE(config.parse("serial_read_mode throughput"));
+    EXPECT_EQ(config.serialReadMode(), 1);
+    EXPECT_TRUE(config.serialSettingsChanged());
+    EXPECT_EQ(config.getCommand(), CMD_COMM_CONFIG_UPDATE);
+    
+    EXPECT_TRUE(config.parse("serial_read_mode record"));
+    EXPECT_EQ(config.serialReadMode(), 2);
+    
+    // In record mode a new sentinle means new serial settings
+    config.clearSerialSettingsChanged();
+    while(config.getCommand()) {}
+    EXPECT_TRUE(config.parse("sentinle '\\r\\n'"));
+    EXPECT_TRUE(config.serialSettingsChanged());
+    EXPECT_EQ(config.getCommand(), CMD_PUBLISHER_CONFIG_UPDATE);
+    EXPECT_EQ(config.getCommand(), CMD_COMM_CONFIG_UPDATE);
+    
+    EXPECT_TRUE(config.parse("serial_read_mode low_latency"));
+    EXPECT_EQ(config.serialReadMode(), 0);
+    
+    EXPECT_FALSE(config.parse("serial_read_mode fast"));
+    EXPECT_EQ(config.serialReadMode(), 0);
+    
+    EXPECT_TRUE(config.parse("get_stats"));
+    EXPECT_EQ(config.getCommand(), CMD_COMM_CONFIG_UPDATE);
+    EXPECT_EQ(config.getCommand(), CMD_GET_STATS);
+}
+
+/* Test serial write pacing parameters */
+TEST_F(CommonTest, SetSerialWriteDelay) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.serialCharDelay(), 0);
+    EXPECT_EQ(config.serialLineDelay(), 0);
+    
+    config.clearSerialSettingsChanged();
+    EXPECT_TRUE(config.parse("serial_char_delay 10"));
+    EXPECT_EQ(config.serialCharDelay(), 10);
+    EXPECT_TRUE(config.serialSettingsChanged());
+    
+    EXPECT_TRUE(config.parse("serial_line_delay 250"));
+    EXPECT_EQ(config.serialLineDelay(), 250);
+    
+    EXPECT_FALSE(config.parse("serial_char_delay -1"));
+    EXPECT_EQ(config.serialCharDelay(), 0);
+    
+    EXPECT_FALSE(config.parse("serial_line_delay foo"));
+    EXPECT_EQ(config.serialLineDelay(), 0);
+}
+
+/* Test driver splice option */
+TEST_F(CommonTest, SetDriverSplice) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_FALSE(config.driverSplice());
+    
+    EXPECT_TRUE(config.parse("driver_splice 1"));
+    EXPECT_TRUE(config.driverSplice());
+    
+    EXPECT_TRUE(config.parse("driver_splice 0"));
+    EXPECT_FALSE(config.driverSplice());
+    
+    EXPECT_FALSE(config.parse("driver_splice yes"));
+    EXPECT_FALSE(config.driverSplice());
+}
+
+/* Test data port routing keys */
+TEST_F(CommonTest, AddDataPortRoutingKey) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_TRUE(config.parse("observatory_type multi"));
+    EXPECT_TRUE(config.parse("add_data_port 4101:LILY"));
+    EXPECT_TRUE(config.parse("add_data_port 4102"));
+    
+    EXPECT_EQ(ObservatoryDataPorts::instance()->routingKey(4101), "LILY");
+    EXPECT_EQ(ObservatoryDataPorts::instance()->routingKey(4102), "");
+    EXPECT_TRUE(ObservatoryDataPorts::instance()->routed());
+    
+    // Re-adding a port replaces its key
+    EXPECT_TRUE(config.parse("add_data_port 4101:NANO"));
+    EXPECT_EQ(ObservatoryDataPorts::instance()->routingKey(4101), "NANO");
+    
+    string cfg = config.getConfig();
+    EXPECT_NE(cfg.find("add_data_port 4101:NANO\n"), string::npos);
+    EXPECT_NE(cfg.find("add_data_port 4102\n"), string::npos);
+}
+
+/* Test socket profiles */
+TEST_F(CommonTest, SetSocketProfile) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.instrumentSocketProfile(), 0);
+    EXPECT_EQ(config.observatorySocketProfile(), 0);
+    EXPECT_EQ(config.socketBufferSize(), 0);
+    
+    EXPECT_TRUE(config.parse("instrument_socket_profile latency"));
+    EXPECT_EQ(config.instrumentSocketProfile(), 1);
+    
+    EXPECT_TRUE(config.parse("observatory_socket_profile bulk"));
+    EXPECT_EQ(config.observatorySocketProfile(), 2);
+    
+    EXPECT_TRUE(config.parse("socket_buffer_size 262144"));
+    EXPECT_EQ(config.socketBufferSize(), 262144);
+    
+    EXPECT_FALSE(config.parse("instrument_socket_profile fast"));
+    EXPECT_EQ(config.instrumentSocketProfile(), 0);
+    
+    EXPECT_FALSE(config.parse("socket_buffer_size -1"));
+    EXPECT_EQ(config.socketBufferSize(), 0);
+}
+
+/* Test listener options */
+TEST_F(CommonTest, SetListenOptions) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.listenBacklog(), TCP_LISTEN_BACKLOG);
+    EXPECT_FALSE(config.listenReusePort());
+    EXPECT_FALSE(config.listenTakeover());
+    
+    EXPECT_TRUE(config.parse("listen_backlog 1024"));
+    EXPECT_EQ(config.listenBacklog(), 1024);
+    
+    EXPECT_TRUE(config.parse("listen_reuse_port 1"));
+    EXPECT_TRUE(config.listenReusePort());
+    
+    EXPECT_TRUE(config.parse("listen_takeover 1"));
+    EXPECT_TRUE(config.listenTakeover());
+    
+    string cfg = config.getConfig();
+    EXPECT_NE(cfg.find("listen_backlog 1024\n"), string::npos);
+    EXPECT_NE(cfg.find("listen_reuse_port 1\n"), string::npos);
+    EXPECT_NE(cfg.find("listen_takeover 1\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("listen_backlog 0"));
+    EXPECT_EQ(config.listenBacklog(), TCP_LISTEN_BACKLOG);
+    
+    EXPECT_FALSE(config.parse("listen_reuse_port yes"));
+    EXPECT_FALSE(config.listenReusePort());
+    
+    EXPECT_FALSE(config.parse("listen_takeover yes"));
+    EXPECT_FALSE(config.listenTakeover());
+}
+
+/* Test the io backend option */
+TEST_F(CommonTest, SetIOBackend) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.ioBackend(), IO_BACKEND_SELECT);
+    EXPECT_NE(config.getConfig().find("io_backend select\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("io_backend uring"));
+    EXPECT_EQ(config.ioBackend(), IO_BACKEND_URING);
+    EXPECT_NE(config.getConfig().find("io_backend uring\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("io_backend epoll"));
+    EXPECT_EQ(config.ioBackend(), IO_BACKEND_SELECT);
+}
+
+/* Test the publisher thread count */
+TEST_F(CommonTest, SetPublisherThreads) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.publisherThreads(), 0);
+    EXPECT_NE(config.getConfig().find("publisher_threads 0\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("publisher_threads 4"));
+    EXPECT_EQ(config.publisherThreads(), 4);
+    EXPECT_NE(config.getConfig().find("publisher_threads 4\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("publisher_threads 1000"));
+    EXPECT_EQ(config.publisherThreads(), 0);
+    
+    EXPECT_FALSE(config.parse("publisher_threads many"));
+    EXPECT_EQ(config.publisherThreads(), 0);
+}
+
+/* Test the compressed stream options */
+TEST_F(CommonTest, SetCompression) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.observatoryCompression(), 0);
+    EXPECT_EQ(config.compressionFlush(), TCP_COMPRESS_FLUSH_USEC / 1000);
+    
+    EXPECT_TRUE(config.parse("observatory_compression 6"));
+    EXPECT_EQ(config.observatoryCompression(), 6);
+    
+    EXPECT_TRUE(config.parse("compression_flush_ms 0"));
+    EXPECT_EQ(config.compressionFlush(), 0);
+    
+    string cfg = config.getConfig();
+    EXPECT_NE(cfg.find("observatory_compression 6\n"), string::npos);
+    EXPECT_NE(cfg.find("compression_flush_ms 0\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("observatory_compression 10"));
+    EXPECT_EQ(config.observatoryCompression(), 0);
+    
+    EXPECT_FALSE(config.parse("compression_flush_ms soon"));
+    EXPECT_EQ(config.compressionFlush(), TCP_COMPRESS_FLUSH_USEC / 1000);
+}
+
+/* Test the torn tail recovery option */
+TEST_F(CommonTest, SetArchiveRecovery) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.archiveRecovery(), ARCHIVE_RECOVERY_QUARANTINE);
+    
+    EXPECT_TRUE(config.parse("archive_recovery truncate"));
+    EXPECT_EQ(config.archiveRecovery(), ARCHIVE_RECOVERY_TRUNCATE);
+    EXPECT_NE(config.getConfig().find("archive_recovery truncate\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("archive_recovery off"));
+    EXPECT_EQ(config.archiveRecovery(), ARCHIVE_RECOVERY_OFF);
+    
+    EXPECT_FALSE(config.parse("archive_recovery delete"));
+    EXPECT_EQ(config.archiveRecovery(), ARCHIVE_RECOVERY_QUARANTINE);
+}
+
+/* Test the data stall watchdog and keepalive options */
+TEST_F(CommonTest, SetDataStall) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.dataStallTimeout(), 0);
+    EXPECT_EQ(config.instrumentKeepalive(), 0);
+    EXPECT_NE(config.getConfig().find("data_stall_timeout off\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("data_stall_timeout auto"));
+    EXPECT_EQ(config.dataStallTimeout(), STALL_TIMEOUT_AUTO);
+    EXPECT_NE(config.getConfig().find("data_stall_timeout auto\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("data_stall_timeout 45"));
+    EXPECT_EQ(config.dataStallTimeout(), 45);
+    EXPECT_NE(config.getConfig().find("data_stall_timeout 45\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("data_stall_timeout soon"));
+    EXPECT_EQ(config.dataStallTimeout(), 0);
+    
+    EXPECT_TRUE(config.parse("instrument_keepalive 30"));
+    EXPECT_EQ(config.instrumentKeepalive(), 30);
+    EXPECT_NE(config.getConfig().find("instrument_keepalive 30\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("instrument_keepalive -5"));
+    EXPECT_EQ(config.instrumentKeepalive(), 0);
+}
+
+/* Test the slow observatory client options */
+TEST_F(CommonTest, SetSlowClient) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.slowClientQueue(), 0);
+    EXPECT_EQ(config.slowClientPolicy(), network::SLOW_CLIENT_DECIMATE);
+    
+    EXPECT_TRUE(config.parse("slow_client_queue 262144"));
+    EXPECT_EQ(config.slowClientQueue(), 262144);
+    EXPECT_NE(config.getConfig().find("slow_client_queue 262144\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("slow_client_policy evict"));
+    EXPECT_EQ(config.slowClientPolicy(), network::SLOW_CLIENT_EVICT);
+    EXPECT_NE(config.getConfig().find("slow_client_policy evict\n"), string::npos);
+    
+    EXPECT_FALSE(config.parse("slow_client_policy ignore"));
+    EXPECT_EQ(config.slowClientPolicy(), network::SLOW_CLIENT_DECIMATE);
+    
+    EXPECT_FALSE(config.parse("slow_client_queue lots"));
+    EXPECT_EQ(config.slowClientQueue(), 0);
+}
+
+/* Test the thread placement and scheduling options */
+TEST_F(CommonTest, SetThreadTuning) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.cpuAffinity(), "all");
+    EXPECT_EQ(config.publisherCpuAffinity(), "all");
+    EXPECT_EQ(config.realtimePriority(), 0);
+    EXPECT_FALSE(config.memoryLock());
+    
+    EXPECT_TRUE(config.parse("cpu_affinity 0-3,6"));
+    EXPECT_EQ(config.cpuAffinity(), "0-3,6");
+    EXPECT_EQ(config.getCommand(), CMD_THREAD_CONFIG_UPDATE);
+    EXPECT_NE(config.getConfig().find("cpu_affinity 0-3,6\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("publisher_cpu_affinity 4"));
+    EXPECT_EQ(config.publisherCpuAffinity(), "4");
+    
+    EXPECT_TRUE(config.parse("realtime_priority 20"));
+    EXPECT_EQ(config.realtimePriority(), 20);
+    EXPECT_NE(config.getConfig().find("realtime_priority 20\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("memory_lock 1"));
+    EXPECT_TRUE(config.memoryLock());
+    
+    // Bad values go back to the defaults
+    EXPECT_FALSE(config.parse("cpu_affinity 3-1"));
+    EXPECT_EQ(config.cpuAffinity(), "all");
+    
+    EXPECT_FALSE(config.parse("publisher_cpu_affinity some"));
+    EXPECT_EQ(config.publisherCpuAffinity(), "all");
+    
+    EXPECT_FALSE(config.parse("realtime_priority 99"));
+    EXPECT_EQ(config.realtimePriority(), 0);
+    
+    EXPECT_FALSE(config.parse("memory_lock yes"));
+    EXPECT_FALSE(config.memoryLock());
+}
+
+/* Commands between begin and commit apply together at the commit */
+TEST_F(CommonTest, Transaction) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_FALSE(config.inTransaction());
+    EXPECT_TRUE(config.parse("begin"));
+    EXPECT_TRUE(config.inTransaction());
+    EXPECT_FALSE(config.parse("begin"));
+    
+    // Held, nothing applied or queued yet
+    EXPECT_TRUE(config.parse("heartbeat_interval 7\ninstrument_type tcp\ninstrument_addr localhost\n"
+                             "instrument_data_port 4001\nget_state"));
+    EXPECT_EQ(config.heartbeatInterval(), DEFAULT_HEARTBEAT_INTERVAL);
+    EXPECT_EQ(config.getCommand(), CMD_UNKNOWN);
+    
+    // One comm update for the lot, the answer to the commit last
+    EXPECT_TRUE(config.parse("commit"));
+    EXPECT_FALSE(config.inTransaction());
+    EXPECT_EQ(config.heartbeatInterval(), 7);
+    EXPECT_EQ(config.instrumentDataPort(), 4001);
+    EXPECT_EQ(config.getCommand(), CMD_COMM_CONFIG_UPDATE);
+    EXPECT_EQ(config.getCommand(), CMD_GET_STATE);
+    EXPECT_EQ(config.getCommand(), CMD_TRANSACTION_COMMIT);
+    EXPECT_EQ(config.getCommand(), CMD_UNKNOWN);
+    EXPECT_EQ(config.transactionError(), "");
+    
+    // Rolled back commands are never applied
+    EXPECT_TRUE(config.parse("begin\nheartbeat_interval 9\nrollback"));
+    EXPECT_FALSE(config.inTransaction());
+    EXPECT_EQ(config.heartbeatInterval(), 7);
+    EXPECT_EQ(config.getCommand(), CMD_UNKNOWN);
+    
+    // A bad command is reported, the others still apply
+    EXPECT_TRUE(config.parse("begin\nheartbeat_interval 3\nbogus_command 1"));
+    EXPECT_FALSE(config.parse("commit"));
+    EXPECT_EQ(config.heartbeatInterval(), 3);
+    EXPECT_EQ(config.transactionError(), "bogus_command 1\n");
+    EXPECT_EQ(config.getCommand(), CMD_TRANSACTION_COMMIT);
+    
+    EXPECT_FALSE(config.parse("commit"));
+    EXPECT_EQ(config.transactionError(), "commit without begin\n");
+}
+
+/* Test the memory budget, subsystem limits and shedding policy */
+TEST_F(CommonTest, SetMemoryBudget) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.memoryBudget(), 0);
+    EXPECT_EQ(config.memoryLimit(MEMORY_CONNECTION), 0);
+    EXPECT_EQ(config.memoryPolicy(), MEMORY_POLICY_DROP);
+    
+    EXPECT_TRUE(config.parse("memory_budget 16777216"));
+    EXPECT_EQ(config.memoryBudget(), 16777216);
+    EXPECT_EQ(config.getCommand(), CMD_MEMORY_CONFIG_UPDATE);
+    EXPECT_NE(config.getConfig().find("memory_budget 16777216\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("packet_memory_limit 1024"));
+    EXPECT_TRUE(config.parse("publisher_memory_limit 2048"));
+    EXPECT_TRUE(config.parse("connection_memory_limit 4096"));
+    EXPECT_EQ(config.memoryLimit(MEMORY_PACKET), 1024);
+    EXPECT_EQ(config.memoryLimit(MEMORY_PUBLISHER), 2048);
+    EXPECT_EQ(config.memoryLimit(MEMORY_CONNECTION), 4096);
+    EXPECT_NE(config.getConfig().find("connection_memory_limit 4096\n"), string::npos);
+    
+    EXPECT_TRUE(config.parse("memory_policy warn"));
+    EXPECT_EQ(config.memoryPolicy(), MEMORY_POLICY_WARN);
+    EXPECT_NE(config.getConfig().find("memory_policy warn\n"), string::npos);
+    
+    // Bad values go back to the defaults
+    EXPECT_FALSE(config.parse("memory_budget lots"));
+    EXPECT_EQ(config.memoryBudget(), 0);
+    
+    EXPECT_FALSE(config.parse("connection_memory_limit -1"));
+    EXPECT_EQ(config.memoryLimit(MEMORY_CONNECTION), 0);
+    
+    EXPECT_FALSE(config.parse("memory_policy ignore"));
+    EXPECT_EQ(config.memoryPolicy(), MEMORY_POLICY_DROP);
+}
+
+/* Test live upgrade options and that the handed over config round trips */
+TEST_F(CommonTest, Upgrade) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT, "--upgrade_fd", "3" };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    
+    EXPECT_EQ(config.upgradeFD(), 3);
+    EXPECT_EQ(config.upgradePath(), "");
+    
+    EXPECT_TRUE(config.parse("upgrade"));
+    EXPECT_EQ(config.getCommand(), CMD_UPGRADE);
+    EXPECT_EQ(config.upgradePath(), "");
+    
+    EXPECT_TRUE(config.parse("upgrade /usr/local/bin/port_agent"));
+    EXPECT_EQ(config.getCommand(), CMD_UPGRADE);
+    EXPECT_EQ(config.upgradePath(), "/usr/local/bin/port_agent");
+    
+    EXPECT_TRUE(config.parse("observatory_type multi"));
+    EXPECT_TRUE(config.parse("device_path /dev/ttyS0"));
+    EXPECT_TRUE(config.parse("rotation_interval hourly"));
+    EXPECT_TRUE(config.parse("telnet_sniffer_port 4010"));
+    
+    char* newArgv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    PortAgentConfig copy(sizeof(newArgv) / sizeof(char*), newArgv);
+    
+    EXPECT_EQ(copy.upgradeFD(), 0);
+    EXPECT_TRUE(copy.parse(config.getConfig()));
+    EXPECT_EQ(copy.getConfig(), config.getConfig());
+    EXPECT_EQ(copy.observatoryConnectionType(), OBS_TYPE_MULTI);
+    EXPECT_EQ(copy.devicePath(), "/dev/ttyS0");
+    EXPECT_EQ(copy.rotation_interval(), HOURLY);
+    EXPECT_EQ(copy.telnetSnifferPort(), 4010);
+}
+
+/* Test config snapshots are saved atomically and loaded back */
+TEST_F(CommonTest, SaveConfig) {
+    char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
+    int argc = sizeof(argv) / sizeof(char*);
+    
+    PortAgentConfig config(argc, argv);
+    string snapshot = config.conffile();
+    
+    remove_file(snapshot.c_str());
+    EXPECT_FALSE(config.loadConfig());
+    
+    EXPECT_TRUE(config.parse("instrument_type tcp"));
+    EXPECT_TRUE(config.parse("instrument_addr 127.0.0.1"));
+    EXPECT_TRUE(config.parse("instrument_data_port 1270"));
+    EXPECT_TRUE(config.parse("data_port 1271"));
+    
+    EXPECT_TRUE(config.saveConfig());
+    EXPECT_TRUE(file_exists(snapshot.c_str()));
+    EXPECT_FALSE(file_exists((snapshot + ".tmp").c_str()));
+    
+    PortAgentConfig warm(argc, argv);
+    EXPECT_FALSE(warm.isConfigured());
+    EXPECT_TRUE(warm.loadConfig());
+    EXPECT_TRUE(warm.isConfigured());
+    EXPECT_EQ(warm.getConfig(), config.getConfig());
+    EXPECT_EQ(warm.getCommand(), CMD_UNKNOWN);
+    
+    // A config file on the command line wins over the snapshot
+    create_file(CONFIG_PATH, "instrument_type tcp\n");
+    char* fileArgv[] = { "port_agent_config_test", "-p", TEST_PORT, "-c", CONFIG_PATH };
+    PortAgentConfig explicitConfig(sizeof(fileArgv) / sizeof(char*), fileArgv);
+    EXPECT_FALSE(explicitConfig.loadConfig());
+    
+    remove_file(snapshot.c_str());
+}
+
 /* Test Unknown Command */
 TEST_F(CommonTest, UnknownCommand) {
     char* argv[] = { "port_agent_config_test", "-p", TEST_PORT };
@@ -15,6 +15,7 @@
 #include "common/logger.h"
 #include "common/exception.h"
 #include "network/comm_base.h"
+#include "network/tcp_comm_listener.h"
 
 using namespace std;
 using namespace logger;
@@ -30,6 +31,16 @@ using namespace port_agent;
  *              define it explicitly.
  ******************************************************************************/
 Connection::Connection() {
+    m_eSocketProfile = SOCKET_PROFILE_DEFAULT;
+    m_iSocketBufferSize = 0;
+    m_iListenBacklog = TCP_LISTEN_BACKLOG;
+    m_bListenReusePort = false;
+    m_bListenTakeover = false;
+    m_iKeepalive = 0;
+    m_iCompressLevel = 0;
+    m_iCompressFlush = TCP_COMPRESS_FLUSH_USEC;
+    m_iSlowClientQueue = 0;
+    m_eSlowClientPolicy = SLOW_CLIENT_DECIMATE;
 }
 
 /******************************************************************************
@@ -40,6 +51,16 @@ Connection::Connection() {
  *   copy - rhs object to copy
  ******************************************************************************/
 Connection::Connection(const Connection& rhs) {
+    m_eSocketProfile = rhs.m_eSocketProfile;
+    m_iSocketBufferSize = rhs.m_iSocketBufferSize;
+    m_iListenBacklog = rhs.m_iListenBacklog;
+    m_bListenReusePort = rhs.m_bListenReusePort;
+    m_bListenTakeover = rhs.m_bListenTakeover;
+    m_iKeepalive = rhs.m_iKeepalive;
+    m_iCompressLevel = rhs.m_iCompressLevel;
+    m_iCompressFlush = rhs.m_iCompressFlush;
+    m_iSlowClientQueue = rhs.m_iSlowClientQueue;
+    m_eSlowClientPolicy = rhs.m_eSlowClientPolicy;
 }
 
 /******************************************************************************
@@ -78,4 +99,132 @@ void Connection::initialize() {
         initializeCommandSocket();
 }
 
+/******************************************************************************
+ * Method: setSocketProfile
+ * Description: Set the socket profile used by the data and command sockets.
+ * The options are applied the next time the sockets are created.
+ *
+ * Parameters:
+ *   profile - socket option set to use
+ *   bufferSize - send/receive buffer size, 0 for the profile default
+ ******************************************************************************/
+void Connection::setSocketProfile(SocketProfile profile, uint32_t bufferSize) {
+    CommBase *pSocket;
+    
+    m_eSocketProfile = profile;
+    m_iSocketBufferSize = bufferSize;
+    
+    if((pSocket = dataConnectionObject())) {
+        pSocket->setSocketProfile(profile);
+        pSocket->setSocketBufferSize(bufferSize);
+    }
+    
+    if((pSocket = commandConnectionObject())) {
+        pSocket->setSocketProfile(profile);
+        pSocket->setSocketBufferSize(bufferSize);
+    }
+}
+
+/******************************************************************************
+ * Method: handoffFDs
+ * Description: Add the descriptors of the data and command sockets to a live
+ * upgrade handoff.
+ ******************************************************************************/
+void Connection::handoffFDs(FDHandoff &handoff) {
+    CommBase *pSocket;
+    
+    if((pSocket = dataConnectionObject()))
+        pSocket->handoffFDs(handoff);
+    
+    if((pSocket = commandConnectionObject()))
+        pSocket->handoffFDs(handoff);
+}
+
+/******************************************************************************
+ * Method: setListenOptions
+ * Description: Set the accept queue length, SO_REUSEPORT and client takeover
+ * on the data and command sockets that are TCP listeners.  The options are applied the next
+ * time the listeners are created.
+ *
+ * Parameters:
+ *   backlog - length of the kernel accept queue
+ *   reusePort - allow other processes to bind the same port
+ *   takeover - a new client replaces the current one
+ ******************************************************************************/
+void Connection::setListenOptions(uint32_t backlog, bool reusePort, bool takeover) {
+    CommBase *pSocket;
+    
+    m_iListenBacklog = backlog;
+    m_bListenReusePort = reusePort;
+    m_bListenTakeover = takeover;
+    
+    if((pSocket = dataConnectionObject()) && pSocket->type() == COMM_TCP_LISTENER) {
+        ((TCPCommListener *)pSocket)->setBacklog(backlog);
+        ((TCPCommListener *)pSocket)->setReusePort(reusePort);
+        ((TCPCommListener *)pSocket)->setTakeover(takeover);
+    }
+    
+    if((pSocket = commandConnectionObject()) && pSocket->type() == COMM_TCP_LISTENER) {
+        ((TCPCommListener *)pSocket)->setBacklog(backlog);
+        ((TCPCommListener *)pSocket)->setReusePort(reusePort);
+        ((TCPCommListener *)pSocket)->setTakeover(takeover);
+    }
+}
 
+/******************************************************************************
+ * Method: setKeepalive
+ * Description: Set the TCP keepalive time on the data and command sockets.
+ * Like the socket profile it is applied the next time they connect.
+ *
+ * Parameters:
+ *   seconds - silence before the peer is probed, 0 for no keepalive
+ ******************************************************************************/
+void Connection::setKeepalive(uint32_t seconds) {
+    CommBase *pSocket;
+    
+    m_iKeepalive = seconds;
+    
+    if((pSocket = dataConnectionObject()))
+        pSocket->setKeepalive(seconds);
+    
+    if((pSocket = commandConnectionObject()))
+        pSocket->setKeepalive(seconds);
+}
+
+/******************************************************************************
+ * Method: setCompression
+ * Description: Offer a compressed stream to clients of the data socket if it
+ * is a TCP listener.  Command sockets always speak the raw protocol.
+ *
+ * Parameters:
+ *   level - zlib compression level, 0 for raw data only
+ *   flushUsec - longest compressed output waits before a sync flush
+ ******************************************************************************/
+void Connection::setCompression(int level, uint32_t flushUsec) {
+    CommBase *pSocket;
+    
+    m_iCompressLevel = level;
+    m_iCompressFlush = flushUsec;
+    
+    if((pSocket = dataConnectionObject()) && pSocket->type() == COMM_TCP_LISTENER)
+        ((TCPCommListener *)pSocket)->setCompression(level, flushUsec);
+}
+
+/******************************************************************************
+ * Method: setSlowClientPolicy
+ * Description: Set when a client of the data socket, if it is a TCP
+ * listener, has fallen too far behind and what to do about it.
+ *
+ * Parameters:
+ *   queueLimit - bytes a client may leave unread, 0 to only sample clients
+ *   policy - decimate or evict a slow client
+ ******************************************************************************/
+void Connection::setSlowClientPolicy(uint32_t queueLimit, SlowClientPolicy policy) {
+    CommBase *pSocket;
+    
+    m_iSlowClientQueue = queueLimit;
+    m_eSlowClientPolicy = policy;
+    
+    if((pSocket = dataConnectionObject()) && pSocket->type() == COMM_TCP_LISTENER)
+        ((TCPCommListener *)pSocket)->setSlowClientPolicy(queueLimit, policy);
+}
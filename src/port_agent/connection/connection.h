@@ -14,6 +14,7 @@
 #define __CONNECTION_H_
 
 #include "network/comm_base.h"
+#include "network/client_monitor.h"
 
 using namespace std;
 using namespace network;
@@ -79,6 +80,25 @@ namespace port_agent {
 
             // Send break condition for duration (milliseconds)
             virtual bool sendBreak(uint32_t duration) { return false; }
+            
+            // Socket options applied to this connection's sockets
+            virtual void setSocketProfile(SocketProfile profile, uint32_t bufferSize = 0);
+            
+            // Accept queue length, SO_REUSEPORT and client takeover for this
+            // connection's listeners
+            virtual void setListenOptions(uint32_t backlog, bool reusePort, bool takeover = false);
+            
+            // TCP keepalive time in seconds for this connection's sockets
+            virtual void setKeepalive(uint32_t seconds);
+            
+            // Compressed stream offered to clients of our data listeners
+            virtual void setCompression(int level, uint32_t flushUsec);
+            
+            // What to do with clients of our data listeners that fall behind
+            virtual void setSlowClientPolicy(uint32_t queueLimit, SlowClientPolicy policy);
+            
+            // Add our open descriptors to a live upgrade handoff
+            virtual void handoffFDs(FDHandoff &handoff);
         
         protected:
 
@@ -89,6 +109,16 @@ namespace port_agent {
          ********************/
         
         protected:
+            SocketProfile m_eSocketProfile;
+            uint32_t m_iSocketBufferSize;
+            uint32_t m_iListenBacklog;
+            bool m_bListenReusePort;
+            bool m_bListenTakeover;
+            uint32_t m_iKeepalive;
+            int m_iCompressLevel;
+            uint32_t m_iCompressFlush;
+            uint32_t m_iSlowClientQueue;
+            SlowClientPolicy m_eSlowClientPolicy;
         
         private:
             
@@ -100,8 +100,7 @@ InstrumentBOTPTConnection & InstrumentBOTPTConnection::operator=(const Instrumen
  *   copy - rhs object to copy
  ******************************************************************************/
 void InstrumentBOTPTConnection::copy(const InstrumentBOTPTConnection &copy) {
-    m_oDataTxSocket = copy.m_oDataTxSocket;
-    m_oDataRxSocket = copy.m_oDataRxSocket;
+    m_oDataSocket = copy.m_oDataSocket;
 }
 
 /******************************************************************************
@@ -110,11 +109,12 @@ void InstrumentBOTPTConnection::copy(const InstrumentBOTPTConnection &copy) {
  * disconnect and reconnect to the new port.
  ******************************************************************************/
 void InstrumentBOTPTConnection::setDataTxPort(uint16_t port) {
-    uint16_t oldPort = m_oDataTxSocket.port();
-    m_oDataTxSocket.setPort(port);
+    uint16_t oldPort = m_oDataSocket.txPort();
+    m_oDataSocket.setTxPort(port);
     
-    if(m_oDataTxSocket.connected() && m_oDataTxSocket.port() != oldPort) {
-	m_oDataTxSocket.initialize();
+    if(m_oDataSocket.connected() && m_oDataSocket.txPort() != oldPort) {
+        m_oDataSocket.disconnect();
+        m_oDataSocket.initialize();
     }
 }
 
@@ -124,11 +124,12 @@ void InstrumentBOTPTConnection::setDataTxPort(uint16_t port) {
  * disconnect and reconnect to the new port.
  ******************************************************************************/
 void InstrumentBOTPTConnection::setDataRxPort(uint16_t port) {
-    uint16_t oldPort = m_oDataRxSocket.port();
-    m_oDataRxSocket.setPort(port);
+    uint16_t oldPort = m_oDataSocket.rxPort();
+    m_oDataSocket.setRxPort(port);
 
-    if(m_oDataRxSocket.connected() && m_oDataRxSocket.port() != oldPort) {
-    m_oDataRxSocket.initialize();
+    if(m_oDataSocket.connected() && m_oDataSocket.rxPort() != oldPort) {
+        m_oDataSocket.disconnect();
+        m_oDataSocket.initialize();
     }
 }
 
@@ -138,18 +139,12 @@ void InstrumentBOTPTConnection::setDataRxPort(uint16_t port) {
  * disconnect and reconnect to the new port.
  ******************************************************************************/
 void InstrumentBOTPTConnection::setDataHost(const string & host) {
-    string oldhost = m_oDataTxSocket.hostname();
-    m_oDataTxSocket.setHostname(host);
+    string oldhost = m_oDataSocket.hostname();
+    m_oDataSocket.setHostname(host);
 
-    if (m_oDataTxSocket.connected() && m_oDataTxSocket.hostname() != oldhost) {
-        m_oDataTxSocket.initialize();
-    }
-
-    oldhost = m_oDataRxSocket.hostname();
-    m_oDataRxSocket.setHostname(host);
-    
-    if (m_oDataRxSocket.connected() && m_oDataRxSocket.hostname() != oldhost) {
-        m_oDataRxSocket.initialize();
+    if (m_oDataSocket.connected() && m_oDataSocket.hostname() != oldhost) {
+        m_oDataSocket.disconnect();
+        m_oDataSocket.initialize();
     }
 }
 
@@ -162,7 +157,7 @@ void InstrumentBOTPTConnection::setDataHost(const string & host) {
  *   True if we have enough configuration information
  ******************************************************************************/
 bool InstrumentBOTPTConnection::dataConfigured() {
-    return m_oDataTxSocket.isConfigured() && m_oDataRxSocket.isConfigured();
+    return m_oDataSocket.isConfigured();
 }
 
 /******************************************************************************
@@ -209,7 +204,7 @@ bool InstrumentBOTPTConnection::commandInitialized() {
  *   True if the data socket is connected
  ******************************************************************************/
 bool InstrumentBOTPTConnection::dataConnected() {
-    return m_oDataTxSocket.connected() && m_oDataRxSocket.connected();
+    return m_oDataSocket.connected();
 }
 
 /******************************************************************************
@@ -226,11 +221,11 @@ bool InstrumentBOTPTConnection::commandConnected() {
 
 /******************************************************************************
  * Method: initializeDataSocket
- * Description: Initialize the data socket
+ * Description: Connect whichever side of the data socket is down.  This
+ * doesn't block, a side that just failed waits for its retry interval.
  ******************************************************************************/
 void InstrumentBOTPTConnection::initializeDataSocket() {
-    m_oDataTxSocket.initialize();
-    m_oDataRxSocket.initialize();
+    m_oDataSocket.initialize();
 }
 
 /******************************************************************************
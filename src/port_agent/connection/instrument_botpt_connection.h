@@ -42,7 +42,7 @@
 #define __INSTRUMENT_BOTPT_CONNECTION_H_
 
 #include "port_agent/connection/connection.h"
-#include "network/tcp_comm_socket.h"
+#include "network/duplex_comm_socket.h"
 
 using namespace std;
 using namespace network;
@@ -68,13 +68,8 @@ namespace port_agent {
 
             /* Accessors */
 
-            // DHE: this isn't right; the dataConnectionObject is a pure virtual so it's
-            // needed here, but it doesn't make sense for the connection because there are
-            // two connections, one for receive and one for send.  Neet to think more but
-            // moving on for now.
-            CommBase *dataConnectionObject() { return NULL; }
-            CommBase *dataTxConnectionObject() { return &m_oDataTxSocket; }
-            CommBase *dataRxConnectionObject() { return &m_oDataRxSocket; }
+            // The tx and rx sockets are presented as one full-duplex channel
+            CommBase *dataConnectionObject() { return &m_oDataSocket; }
             CommBase *commandConnectionObject() { return NULL; }
             
             PortAgentConnectionType connectionType() { return PACONN_INSTRUMENT_BOTPT; }
@@ -84,11 +79,11 @@ namespace port_agent {
             void setDataRxPort(uint16_t port);
             void setDataHost(const string &host);
             
-            const string & dataHost() { return m_oDataRxSocket.hostname(); }
-            uint16_t dataTxPort() { return m_oDataTxSocket.port(); }
-            uint16_t dataRxPort() { return m_oDataRxSocket.port(); }
-            bool connected() { return m_oDataTxSocket.connected() && m_oDataRxSocket.connected(); }
-            bool disconnect() { return m_oDataTxSocket.disconnect() && m_oDataRxSocket.disconnect(); }
+            const string & dataHost() { return m_oDataSocket.hostname(); }
+            uint16_t dataTxPort() { return m_oDataSocket.txPort(); }
+            uint16_t dataRxPort() { return m_oDataSocket.rxPort(); }
+            bool connected() { return m_oDataSocket.connected(); }
+            bool disconnect() { return m_oDataSocket.disconnect(); }
             
             /* Query Methods */
             
@@ -122,8 +117,7 @@ namespace port_agent {
         protected:
             
         private:
-            TCPCommSocket m_oDataTxSocket;
-            TCPCommSocket m_oDataRxSocket;
+            DuplexCommSocket m_oDataSocket;
             
     };
 }
@@ -155,6 +155,39 @@ void InstrumentSerialConnection::setParity(const uint16_t &iParity) {
     m_oDataSocket.setParity(iParity);
 }
 
+/******************************************************************************
+ * Method: setReadMode
+ * Description: Set the read batching mode.
+ ******************************************************************************/
+void InstrumentSerialConnection::setReadMode(const uint16_t &iReadMode) {
+    LOG(INFO) << "setReadMode: " << iReadMode;
+    m_oDataSocket.setReadMode(iReadMode);
+}
+
+/******************************************************************************
+ * Method: setSentinle
+ * Description: Set the record terminator for the record read mode.
+ ******************************************************************************/
+void InstrumentSerialConnection::setSentinle(const string &sSentinle) {
+    m_oDataSocket.setSentinle(sSentinle);
+}
+
+/******************************************************************************
+ * Method: setCharDelay
+ * Description: Set the pacing delay between characters (milliseconds).
+ ******************************************************************************/
+void InstrumentSerialConnection::setCharDelay(const uint32_t &iCharDelay) {
+    m_oDataSocket.setCharDelay(iCharDelay);
+}
+
+/******************************************************************************
+ * Method: setLineDelay
+ * Description: Set the pacing delay after each line (milliseconds).
+ ******************************************************************************/
+void InstrumentSerialConnection::setLineDelay(const uint32_t &iLineDelay) {
+    m_oDataSocket.setLineDelay(iLineDelay);
+}
+
 /******************************************************************************
  * Method: dataConfigured
  * Description: Do we have enough configuration information to initialize the
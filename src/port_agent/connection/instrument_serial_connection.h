@@ -79,11 +79,20 @@ namespace port_agent {
             void setStopBits(const uint16_t &iStopBits);
             void setDataBits(const uint16_t &iDataBits);
             void setParity(const uint16_t &iParity);
+            void setReadMode(const uint16_t &iReadMode);
+            void setSentinle(const string &sSentinle);
+            void setCharDelay(const uint32_t &iCharDelay);
+            void setLineDelay(const uint32_t &iLineDelay);
             bool initializeSerialSettings();
             
             const string & devicePath() { return m_oDataSocket.devicePath(); }
             bool connected() { return m_oDataSocket.connected(); }
             bool disconnect() { return m_oDataSocket.disconnect(); }
+
+            uint16_t readMode() { return m_oDataSocket.readMode(); }
+            uint32_t readCount() { return m_oDataSocket.readCount(); }
+            uint32_t bytesRead() { return m_oDataSocket.bytesRead(); }
+            uint32_t writeQueueSize() { return m_oDataSocket.writeQueueSize(); }
             
             /* Query Methods */
             
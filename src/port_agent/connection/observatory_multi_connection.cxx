@@ -12,7 +12,8 @@
  *
  * ObservatoryMultiConnection connection;
  *
- * connection.setDataPort(4001);
+ * connection.addListener(4001);
+ * connection.addListener(4002);
  * connection.setCommandPort(4000);
  *
  * // Sets up listeners if they are configured
@@ -44,6 +45,13 @@
 #include "common/exception.h"
 #include "network/tcp_comm_listener.h"
 
+#include <sstream>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
 using namespace std;
 using namespace logger;
 using namespace network;
@@ -105,40 +113,60 @@ void ObservatoryMultiConnection::copy(const ObservatoryMultiConnection &copy) {
 }
 
 /******************************************************************************
- * Method: addDataPort
- * Description: Set the data socket listener port.  First we want to see if the
- * port is bound and is listening on a port other than the target port we are
- * setting up.  If it is different, then we need to disconnect so it can be
- * bound to a new port.
-void ObservatoryMultiConnection::setDataPort(uint16_t port) {
-
-    // DHE: this needs multiple sockets.
-    m_oDataSocket.setPort(port);
+ * Method: handoffFDs
+ * Description: Add the command listener and all the data listeners to a
+ * live upgrade handoff.
+ ******************************************************************************/
+void ObservatoryMultiConnection::handoffFDs(FDHandoff &handoff) {
+    vector<TCPCommListener*> sockets;
     
-    if(m_oDataSocket.listening() && m_oDataSocket.port() != m_oDataSocket.getListenPort()) {
-	m_oDataSocket.initialize();
-    }
+    Connection::handoffFDs(handoff);
+    
+    m_oDataSockets.getSockets(sockets);
+    for(vector<TCPCommListener*>::iterator i = sockets.begin(); i != sockets.end(); i++)
+        (*i)->handoffFDs(handoff);
 }
- ******************************************************************************/
 
 /******************************************************************************
  * Method: addListener
- * Description: Add a listener for the given port.
+ * Description: Add a listener for the given port.  If we already have a
+ * listener on that port it is reused.
  ******************************************************************************/
 void ObservatoryMultiConnection::addListener(uint16_t port) {
+    TCPCommListener *listener = m_oDataSockets.findSocket(port);
+
+    if(listener) {
+        LOG(DEBUG) << "data listener already exists for port: " << port;
+        listener->setSocketProfile(m_eSocketProfile);
+        listener->setSocketBufferSize(m_iSocketBufferSize);
+        listener->setBacklog(m_iListenBacklog);
+        listener->setReusePort(m_bListenReusePort);
+        listener->setTakeover(m_bListenTakeover);
+        listener->setCompression(m_iCompressLevel, m_iCompressFlush);
+        listener->setSlowClientPolicy(m_iSlowClientQueue, m_eSlowClientPolicy);
+        return;
+    }
+
+    // The registry watches its own fds, the low ones are left for select
 
-    // DHE: this needs multiple sockets.
-    TCPCommListener *listener = new TCPCommListener();
+    listener = new TCPCommListener();
     listener->setPort(port);
+    listener->setSocketProfile(m_eSocketProfile);
+    listener->setSocketBufferSize(m_iSocketBufferSize);
+    listener->setBacklog(m_iListenBacklog);
+    listener->setReusePort(m_bListenReusePort);
+    listener->setTakeover(m_bListenTakeover);
+    listener->setCompression(m_iCompressLevel, m_iCompressFlush);
+    listener->setSlowClientPolicy(m_iSlowClientQueue, m_eSlowClientPolicy);
+    listener->setFDFloor(FD_SETSIZE);
     listener->initialize();
-    ObservatoryDataSockets::instance()->addSocket(listener);
-    //m_poDataSockets.setPort(port);
 
-    /***
-    if(m_oDataSocket.listening() && m_oDataSocket.port() != m_oDataSocket.getListenPort()) {
-    m_oDataSocket.initialize();
+    if(! m_oDataSockets.addSocket(listener)) {
+        ostringstream msg;
+        msg << "data port " << port << " can't be watched, not listening";
+        delete listener;
+        throw SocketSelectFailure(msg.str());
     }
-    ***/
 }
 
 /******************************************************************************
@@ -160,19 +188,15 @@ void ObservatoryMultiConnection::setCommandPort(uint16_t port) {
  *   True if we have enough configuration information
  ******************************************************************************/
 bool ObservatoryMultiConnection::dataConfigured() {
-    TCPCommListener* pListener = 0;
-    bool bConfigured = true;
-
-    pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pListener) {
-        if (!pListener->isConfigured()) {
-            bConfigured = false;
-            break;
-        }
-        pListener = ObservatoryDataSockets::instance()->getNextSocket();
+    vector<TCPCommListener*> listeners;
+
+    m_oDataSockets.getSockets(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        if (!(*i)->isConfigured())
+            return false;
     }
 
-    return bConfigured;
+    return true;
 }
 
 /******************************************************************************
@@ -197,19 +221,15 @@ bool ObservatoryMultiConnection::commandConfigured() {
  *   True if the socket has been configured and is bound to a port listening
  ******************************************************************************/
 bool ObservatoryMultiConnection::isDataInitialized() {
-    TCPCommListener* pListener = 0;
-    bool bListening = true;
-
-    pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pListener) {
-        if (!pListener->listening()) {
-            bListening = false;
-            break;
-        }
-        pListener = ObservatoryDataSockets::instance()->getNextSocket();
+    vector<TCPCommListener*> listeners;
+
+    m_oDataSockets.getSockets(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        if (!(*i)->listening())
+            return false;
     }
 
-    return bListening;
+    return true;
 }
 
 /******************************************************************************
@@ -233,19 +253,15 @@ bool ObservatoryMultiConnection::commandInitialized() {
  *   True if the data socket is connected
  ******************************************************************************/
 bool ObservatoryMultiConnection::dataConnected() {
-    TCPCommListener* pListener = 0;
-    bool bConnected = true;
-
-    pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pListener) {
-        if (!pListener->listening()) {
-            bConnected = false;
-            break;
-        }
-        pListener = ObservatoryDataSockets::instance()->getNextSocket();
+    vector<TCPCommListener*> listeners;
+
+    m_oDataSockets.getSockets(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        if (!(*i)->listening())
+            return false;
     }
 
-    return bConnected;
+    return true;
 }
 
 /******************************************************************************
@@ -261,15 +277,15 @@ bool ObservatoryMultiConnection::commandConnected() {
 
 /******************************************************************************
  * Method: initializeDataSocket
- * Description: Initialize the data socket
+ * Description: Initialize the data sockets
  ******************************************************************************/
 void ObservatoryMultiConnection::initializeDataSocket() {
-    TCPCommListener* pListener = 0;
+    vector<TCPCommListener*> listeners;
 
-    pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pListener) {
-        pListener->initialize();
-        pListener = ObservatoryDataSockets::instance()->getNextSocket();
+    m_oDataSockets.getSockets(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        (*i)->initialize();
+        m_oDataSockets.update(*i);
     }
 }
 
@@ -281,100 +297,465 @@ void ObservatoryMultiConnection::initializeCommandSocket() {
     m_oCommandSocket.initialize();
 }
 
-ObservatoryDataSockets* ObservatoryDataSockets::m_pInstance = 0;
 
-ObservatoryDataSockets::ObservatoryDataSockets() {
+/******************************************************************************
+ *   OBSERVATORY DATA SOCKETS
+ ******************************************************************************/
 
+/******************************************************************************
+ * Method: Constructor
+ * Description: Empty registry with no handlers.  The epoll set is opened
+ * now, before any data port, so it gets a low fd select can watch.
+ ******************************************************************************/
+ObservatoryDataSockets::ObservatoryDataSockets() {
+    m_pAcceptHandler = NULL;
+    m_pAcceptContext = NULL;
+    m_pReadHandler = NULL;
+    m_pReadContext = NULL;
+    m_iDispatchDepth = 0;
+    m_iPollFD = -1;
+
+    openPoll();
 }
 
 /******************************************************************************
- * Method: instance()
- * Description: Return a pointer to the singleton instance of the
- * ObservatoryDataSockets container.  If the singleton does not yet exist, create
- * it.
- * Return: return a pointer to the instance.
+ * Method: Destructor
+ * Description: Delete all of the listeners we own.
  ******************************************************************************/
-ObservatoryDataSockets* ObservatoryDataSockets::instance() {
+ObservatoryDataSockets::~ObservatoryDataSockets() {
+    for(ObservatoryDataSockets_T::iterator i = m_oSockets.begin(); i != m_oSockets.end(); i++)
+        delete i->second.listener;
+    m_oSockets.clear();
 
-    if (0 == m_pInstance) {
-       m_pInstance = new ObservatoryDataSockets();
-    }
+    m_iDispatchDepth = 0;
+    purge();
 
-    return m_pInstance;
+    if(m_iPollFD >= 0)
+        close(m_iPollFD);
 }
 
 /******************************************************************************
- * Method: logPorts()
- * Description: Log the ports
+ * Method: logSockets()
+ * Description: Log the ports and fds
  * Return: void
  ******************************************************************************/
 void ObservatoryDataSockets::logSockets() {
-
-    list<TCPCommListener*>::iterator i = m_observatoryDataSockets.begin();
-    int j = 0;
-    for (i = m_observatoryDataSockets.begin(); i != m_observatoryDataSockets.end(); i++) {
-        LOG(DEBUG) << "Data port: " << j << ", " << (*i)->clientFD();
-        j++;
+    for(ObservatoryDataSockets_T::iterator i = m_oSockets.begin(); i != m_oSockets.end(); i++) {
+        LOG(DEBUG) << "Data port: " << i->first << ", server FD: " << i->second.serverFD
+                   << ", client FD: " << i->second.clientFD;
     }
 }
 
 /******************************************************************************
  * Method: addSocket(TCPCommListener* pSocket)
- * Description: Add the given socket to the container of listener objects.
+ * Description: Add the given listener to the registry.  The registry takes
+ * ownership of the listener.  If there is already a listener on the same
+ * port it is replaced.  If the epoll set can't be opened the listener is
+ * refused and stays with the caller.
  * Return: return true if success, false if not.
  ******************************************************************************/
 bool ObservatoryDataSockets::addSocket(TCPCommListener* pSocket) {
-    bool bRetVal = true;
+    ObservatoryDataSocket socket;
+
+    if(! pSocket)
+        return false;
+
+    if(! openPoll())
+        return false;
 
     LOG(DEBUG) << "ObservatoryDataSockets::addSocket: Adding socket: " << pSocket->serverFD();
 
-    // First remove any existing element with the same port value
-    m_observatoryDataSockets.remove(pSocket);
-    m_observatoryDataSockets.push_back(pSocket);
+    ObservatoryDataSockets_T::iterator i = m_oSockets.find(pSocket->port());
+    if(i != m_oSockets.end()) {
+        if(i->second.listener == pSocket) {
+            update(pSocket);
+            return true;
+        }
+        removeSocket(pSocket->port());
+    }
+
+    socket.listener = pSocket;
+    socket.serverFD = 0;
+    socket.clientFD = 0;
+    socket.writing = false;
+
+    index(m_oSockets[pSocket->port()] = socket);
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: removeSocket
+ * Description: Remove the listener on a port from the registry and delete it.
+ * If we are in the middle of a dispatch the delete is deferred until the
+ * dispatch has finished.
+ * Return: return true if a listener was removed.
+ ******************************************************************************/
+bool ObservatoryDataSockets::removeSocket(uint16_t port) {
+    ObservatoryDataSockets_T::iterator i = m_oSockets.find(port);
+
+    if(i == m_oSockets.end())
+        return false;
+
+    LOG(DEBUG) << "ObservatoryDataSockets::removeSocket: Removing port: " << port;
+
+    unindex(i->second);
+    m_oRemoved.push_back(i->second.listener);
+    m_oSockets.erase(i);
 
-    return bRetVal;
+    purge();
+    return true;
 }
 
 /******************************************************************************
- * Method: getFirstPort
- * Description: Get the first port from the container of socket objects.
- * Return: value of first port if there is one, otherwise 0
+ * Method: findSocket
+ * Description: Find the listener for a port.
+ * Return: the listener or NULL
  ******************************************************************************/
-TCPCommListener* ObservatoryDataSockets::getFirstSocket()
-{
+TCPCommListener* ObservatoryDataSockets::findSocket(uint16_t port) {
+    ObservatoryDataSockets_T::iterator i = m_oSockets.find(port);
+    return i == m_oSockets.end() ? NULL : i->second.listener;
+}
+
+/******************************************************************************
+ * Method: findFD
+ * Description: Find the listener that owns a server or client fd.
+ * Return: the listener or NULL
+ ******************************************************************************/
+TCPCommListener* ObservatoryDataSockets::findFD(int fd) {
+    ObservatoryDataFDs_T::iterator i = m_oClientFDs.find(fd);
+    if(i != m_oClientFDs.end())
+        return i->second;
+
+    i = m_oServerFDs.find(fd);
+    return i == m_oServerFDs.end() ? NULL : i->second;
+}
+
+/******************************************************************************
+ * Method: getSockets
+ * Description: Copy the listeners, in port order, into a vector.
+ ******************************************************************************/
+void ObservatoryDataSockets::getSockets(vector<TCPCommListener*> &sockets) {
+    sockets.clear();
+    sockets.reserve(m_oSockets.size());
+
+    for(ObservatoryDataSockets_T::iterator i = m_oSockets.begin(); i != m_oSockets.end(); i++)
+        sockets.push_back(i->second.listener);
+}
+
+/******************************************************************************
+ * Method: setAcceptHandler
+ * Description: Set the handler called when a listener has a connection
+ * waiting.
+ ******************************************************************************/
+void ObservatoryDataSockets::setAcceptHandler(ObservatoryDataHandler handler, void *context) {
+    m_pAcceptHandler = handler;
+    m_pAcceptContext = context;
+}
+
+/******************************************************************************
+ * Method: setReadHandler
+ * Description: Set the handler called when a client has data waiting.
+ ******************************************************************************/
+void ObservatoryDataSockets::setReadHandler(ObservatoryDataHandler handler, void *context) {
+    m_pReadHandler = handler;
+    m_pReadContext = context;
+}
 
-   // get the first cam agent
-   m_socketIt = m_observatoryDataSockets.begin();
+/******************************************************************************
+ * Method: update
+ * Description: Re-index a listener under its current fds.  Call this after
+ * anything that may have connected or disconnected it.
+ ******************************************************************************/
+void ObservatoryDataSockets::update(TCPCommListener *listener) {
+    ObservatoryDataSockets_T::iterator i;
+
+    if(! listener)
+        return;
 
-   // if the first is the end, there are no ports in the list
-   if (m_socketIt == m_observatoryDataSockets.end()) {
-      return 0;
-   }
-   else {
-      return *m_socketIt;
-   }
+    i = m_oSockets.find(listener->port());
+    if(i == m_oSockets.end() || i->second.listener != listener)
+        return;
+
+    if(i->second.serverFD != listener->serverFD() ||
+       i->second.clientFD != listener->clientFD()) {
+        unindex(i->second);
+        index(i->second);
+    }
 }
 
 /******************************************************************************
- * Method: getNextPort
- * Description: Get the next port from the container of socket objects.
- * Return: value of next port if there is one, otherwise 0
+ * Method: addPollFD
+ * Description: Add the epoll fd to the fd_set and update the max fd.  Clients
+ * with writes queued are watched for room to write, the rest only for
+ * reads.
  ******************************************************************************/
-TCPCommListener* ObservatoryDataSockets::getNextSocket()
-{
+void ObservatoryDataSockets::addPollFD(int &maxFD, fd_set &readFDs) {
+    for(ObservatoryDataSockets_T::iterator i = m_oSockets.begin(); i != m_oSockets.end(); i++) {
+        ObservatoryDataSocket &socket = i->second;
+        bool pending;
 
-   m_socketIt++;
+        update(socket.listener);
 
-   // if the next is the end, there are no more ports in the list
-   if (m_socketIt == m_observatoryDataSockets.end()) {
-      return 0;
-   }
-   else {
-      return *m_socketIt;
-   }
+        pending = socket.clientFD > 0 && socket.listener->writePending();
+        if(pending != socket.writing) {
+            watch(socket.clientFD, pending ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+            socket.writing = pending;
+        }
+    }
+
+    if(m_iPollFD < 0 || m_oSockets.empty())
+        return;
+
+    // Opened before the data ports so it is always low, but never corrupt
+    // the fd_set
+    if(m_iPollFD >= FD_SETSIZE) {
+        LOG(ERROR) << "data socket epoll fd too large for select: " << m_iPollFD;
+        return;
+    }
+
+    LOG(DEBUG2) << "adding observatory multi data epoll FD: " << m_iPollFD;
+    maxFD = m_iPollFD > maxFD ? m_iPollFD : maxFD;
+    FD_SET(m_iPollFD, &readFDs);
 }
 
+/******************************************************************************
+ * Method: collect
+ * Description: Read the ready fds from the epoll set if select says there are
+ * any.  Each one is kept with the listener it belonged to so a handler that
+ * changes the registry can't have us call the wrong listener.
+ ******************************************************************************/
+void ObservatoryDataSockets::collect(const fd_set &readFDs) {
+    ObservatoryDataFDs_T::iterator listener;
+    int count;
+
+    m_oAcceptReady.clear();
+    m_oReadReady.clear();
+    m_oWriteReady.clear();
+
+    if(m_iPollFD < 0 || m_iPollFD >= FD_SETSIZE || ! FD_ISSET(m_iPollFD, &readFDs))
+        return;
 
+    m_oEvents.resize(m_oServerFDs.size() + m_oClientFDs.size() + 1);
 
+    count = epoll_wait(m_iPollFD, &m_oEvents[0], m_oEvents.size(), 0);
+    if(count < 0) {
+        if(errno != EINTR)
+            LOG(ERROR) << "data socket epoll_wait: " << strerror(errno);
+        return;
+    }
+
+    for(int i = 0; i < count; i++) {
+        int fd = m_oEvents[i].data.fd;
+        uint32_t events = m_oEvents[i].events;
+
+        if((listener = m_oServerFDs.find(fd)) != m_oServerFDs.end()) {
+            m_oAcceptReady.push_back(*listener);
+            continue;
+        }
 
+        if((listener = m_oClientFDs.find(fd)) == m_oClientFDs.end())
+            continue;
 
+        // A hang up or error is found by the read
+        if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            m_oReadReady.push_back(*listener);
+        if(events & EPOLLOUT)
+            m_oWriteReady.push_back(*listener);
+    }
+}
+
+/******************************************************************************
+ * Method: dispatchAccept
+ * Description: Call the accept handler for each listener with a connection
+ * waiting.
+ ******************************************************************************/
+void ObservatoryDataSockets::dispatchAccept() {
+    dispatch(m_oServerFDs, m_oAcceptReady, m_pAcceptHandler, m_pAcceptContext);
+}
+
+/******************************************************************************
+ * Method: dispatchRead
+ * Description: Call the read handler for each client with data waiting.
+ ******************************************************************************/
+void ObservatoryDataSockets::dispatchRead() {
+    dispatch(m_oClientFDs, m_oReadReady, m_pReadHandler, m_pReadContext);
+}
+
+/******************************************************************************
+ * Method: flushWrites
+ * Description: Send queued writes to each client with room for them.
+ ******************************************************************************/
+void ObservatoryDataSockets::flushWrites() {
+    ObservatoryDataReady_T ready;
+
+    ready.swap(m_oWriteReady);
+
+    for(ObservatoryDataReady_T::iterator i = ready.begin(); i != ready.end(); i++) {
+        ObservatoryDataFDs_T::iterator current = m_oClientFDs.find(i->first);
+        if(current == m_oClientFDs.end() || current->second != i->second)
+            continue;
+
+        LOG(DEBUG) << "Write queued data to observatory client FD: " << i->first;
+        i->second->flushWriteQueue();
+    }
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: openPoll
+ * Description: Open the epoll set if it isn't already.  Thousands of data
+ * ports need more fds than the usual soft limit, so it is raised to the
+ * hard limit.
+ * Return:
+ *   false if the epoll set couldn't be opened
+ ******************************************************************************/
+bool ObservatoryDataSockets::openPoll() {
+    struct rlimit limit;
+
+    if(m_iPollFD >= 0)
+        return true;
+
+    m_iPollFD = epoll_create1(EPOLL_CLOEXEC);
+    if(m_iPollFD < 0) {
+        LOG(ERROR) << "failed to open data socket epoll set: " << strerror(errno);
+        return false;
+    }
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE, &limit))
+            LOG(WARNING) << "failed to raise the fd limit: " << strerror(errno);
+        else
+            LOG(INFO) << "fd limit raised to: " << limit.rlim_cur;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: watch
+ * Description: Add, change or drop an fd in the epoll set.  An fd that was
+ * closed has already left the set, so a failed drop is ignored.
+ ******************************************************************************/
+void ObservatoryDataSockets::watch(int fd, uint32_t events, int op) {
+    struct epoll_event event;
+
+    if(m_iPollFD < 0 || fd <= 0)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+
+    if(epoll_ctl(m_iPollFD, op, fd, &event) == 0 || op == EPOLL_CTL_DEL)
+        return;
+
+    // Still registered from before the fd number was reused
+    if(op == EPOLL_CTL_ADD && errno == EEXIST &&
+       epoll_ctl(m_iPollFD, EPOLL_CTL_MOD, fd, &event) == 0)
+        return;
+
+    LOG(ERROR) << "failed to watch data socket FD: " << fd << ": " << strerror(errno);
+}
+
+/******************************************************************************
+ * Method: index
+ * Description: Record the listener under its current fds and watch them for
+ * reads.
+ ******************************************************************************/
+void ObservatoryDataSockets::index(ObservatoryDataSocket &socket) {
+    socket.serverFD = socket.listener->serverFD();
+    socket.clientFD = socket.listener->clientFD();
+    socket.writing = false;
+
+    if(socket.serverFD > 0) {
+        m_oServerFDs[socket.serverFD] = socket.listener;
+        watch(socket.serverFD, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    if(socket.clientFD > 0) {
+        m_oClientFDs[socket.clientFD] = socket.listener;
+        watch(socket.clientFD, EPOLLIN, EPOLL_CTL_ADD);
+    }
+}
+
+/******************************************************************************
+ * Method: unindex
+ * Description: Drop the fd entries recorded for a listener.  An fd that now
+ * belongs to another listener is left alone.
+ ******************************************************************************/
+void ObservatoryDataSockets::unindex(ObservatoryDataSocket &socket) {
+    ObservatoryDataFDs_T::iterator i;
+
+    i = m_oServerFDs.find(socket.serverFD);
+    if(i != m_oServerFDs.end() && i->second == socket.listener) {
+        m_oServerFDs.erase(i);
+        watch(socket.serverFD, 0, EPOLL_CTL_DEL);
+    }
+
+    i = m_oClientFDs.find(socket.clientFD);
+    if(i != m_oClientFDs.end() && i->second == socket.listener) {
+        m_oClientFDs.erase(i);
+        watch(socket.clientFD, 0, EPOLL_CTL_DEL);
+    }
+
+    socket.serverFD = 0;
+    socket.clientFD = 0;
+    socket.writing = false;
+}
+
+/******************************************************************************
+ * Method: dispatch
+ * Description: Call the handler for each collected fd that is still
+ * registered to the same listener.  Handlers are free to add or remove
+ * listeners; removed listeners live until we are done.  The collected fds
+ * are used up.
+ ******************************************************************************/
+void ObservatoryDataSockets::dispatch(ObservatoryDataFDs_T &fds, ObservatoryDataReady_T &collected,
+                                      ObservatoryDataHandler handler, void *context) {
+    ObservatoryDataReady_T ready;
+
+    ready.swap(collected);
+
+    if(! handler)
+        return;
+
+    m_iDispatchDepth++;
+
+    try {
+        for(ObservatoryDataReady_T::iterator i = ready.begin(); i != ready.end(); i++) {
+            ObservatoryDataFDs_T::iterator current = fds.find(i->first);
+            if(current == fds.end() || current->second != i->second)
+                continue;
+
+            handler(i->second, context);
+            update(i->second);
+        }
+    }
+    catch(...) {
+        m_iDispatchDepth--;
+        purge();
+        throw;
+    }
+
+    m_iDispatchDepth--;
+    purge();
+}
+
+/******************************************************************************
+ * Method: purge
+ * Description: Delete listeners that were removed, unless a dispatch is still
+ * running.
+ ******************************************************************************/
+void ObservatoryDataSockets::purge() {
+    if(m_iDispatchDepth)
+        return;
+
+    for(vector<TCPCommListener*>::iterator i = m_oRemoved.begin(); i != m_oRemoved.end(); i++)
+        delete *i;
+    m_oRemoved.clear();
+}
@@ -12,7 +12,8 @@
  *
  * ObservatoryMultiConnection connection;
  *
- * connection.setDataPort(4001);
+ * connection.addListener(4001);
+ * connection.addListener(4002);
  * connection.setCommandPort(4000);
  *
  * // Is the data port configured
@@ -48,7 +49,10 @@
 #ifndef __OBSERVATORY_MULTI_CONNECTION_H_
 #define __OBSERVATORY_MULTI_CONNECTION_H_
 
-#include <list>
+#include <map>
+#include <vector>
+#include <sys/select.h>
+#include <sys/epoll.h>
 #include "port_agent/connection/connection.h"
 #include "network/tcp_comm_listener.h"
 
@@ -56,32 +60,114 @@ using namespace std;
 using namespace network;
 
 namespace port_agent {
-    // Forward reference in order to define the typedefs that follow this.
-    class ObservatoryDataSockets;
+    // Called by the registry when a data listener or client fd is ready.
+    typedef void (*ObservatoryDataHandler)(TCPCommListener *listener, void *context);
 
-    // DHE NEW: a list of pointers to TCPCommListener objects; The fact that
-    // it's a list be abstracted, so that we can change it to a map for faster
-    // lookup in the future.
-    //typedef TCPCommListener* ObservatoryDataSocket_T;
-    //typedef list<ObservatoryDataSocket_T> ObservatoryDataSockets_T;
-    typedef list<TCPCommListener*> ObservatoryDataSockets_T;
+    // Registry entry.  Remembers the fds we last indexed the listener under
+    // so we can drop stale entries when a client connects or goes away, and
+    // whether we are waiting for the client to take queued writes.
+    typedef struct ObservatoryDataSocket {
+        TCPCommListener *listener;
+        int serverFD;
+        int clientFD;
+        bool writing;
+    } ObservatoryDataSocket;
 
-    // A singleton class that contains sockets
+    typedef map<uint16_t, ObservatoryDataSocket> ObservatoryDataSockets_T;
+    typedef map<int, TCPCommListener*> ObservatoryDataFDs_T;
+    typedef vector< pair<int, TCPCommListener*> > ObservatoryDataReady_T;
+
+    // Owns the data listeners of a multi connection.  Listeners are stored by
+    // port and indexed by server and client fd so a ready fd can be mapped
+    // straight to its listener.  Listeners may be added or removed from inside
+    // a handler; removed listeners are deleted once dispatch is finished.
+    //
+    // The fds are watched with an epoll set of our own, so there is no limit
+    // on how many there are or how large they get.  The main loop selects on
+    // the epoll fd, collects what is ready after the select and then has us
+    // dispatch it.  Listeners keep their fds at FD_SETSIZE or above when the
+    // fd limit allows, leaving the fds below for the sockets select watches.
+    //
+    // Usage:
+    //
+    // sockets.addPollFD(maxFD, readFDs);
+    // select(maxFD + 1, &readFDs, ...);
+    // sockets.collect(readFDs);
+    // sockets.dispatchAccept();
+    // sockets.dispatchRead();
+    // sockets.flushWrites();
     class ObservatoryDataSockets {
         public:
-            static  ObservatoryDataSockets* instance();
+            ObservatoryDataSockets();
+            virtual ~ObservatoryDataSockets();
+
             void    logSockets();
             bool    addSocket(TCPCommListener*);
-            TCPCommListener* getFirstSocket();
-            TCPCommListener* getNextSocket();
+            bool    removeSocket(uint16_t port);
+
+            TCPCommListener* findSocket(uint16_t port);
+            TCPCommListener* findFD(int fd);
+
+            // Copy of the current listeners, safe to hold across mutation
+            void    getSockets(vector<TCPCommListener*> &sockets);
+            uint32_t size() { return m_oSockets.size(); }
+
+            void    setAcceptHandler(ObservatoryDataHandler handler, void *context);
+            void    setReadHandler(ObservatoryDataHandler handler, void *context);
+
+            // Re-index a listener after its fds may have changed
+            void    update(TCPCommListener *listener);
+
+            // Add the epoll fd to a select fd_set, watching for writes to
+            // clients with writes queued
+            void    addPollFD(int &maxFD, fd_set &readFDs);
+            int     pollFD() { return m_iPollFD; }
+
+            // Note which fds are ready if select found the epoll fd ready.
+            // Anything not dispatched before the next collect is dropped,
+            // it is reported again while it stays ready.
+            void    collect(const fd_set &readFDs);
+
+            // Call the handlers for the fds that are ready
+            void    dispatchAccept();
+            void    dispatchRead();
+
+            // Send queued writes to the clients that can take them
+            void    flushWrites();
 
         private:
-            // CTOR
-            ObservatoryDataSockets();
+            // Not copyable, we own the listeners
+            ObservatoryDataSockets(const ObservatoryDataSockets &rhs);
+            ObservatoryDataSockets & operator=(const ObservatoryDataSockets &rhs);
+
+            bool    openPoll();
+            void    watch(int fd, uint32_t events, int op);
+            void    index(ObservatoryDataSocket &socket);
+            void    unindex(ObservatoryDataSocket &socket);
+            void    dispatch(ObservatoryDataFDs_T &fds, ObservatoryDataReady_T &collected,
+                             ObservatoryDataHandler handler, void *context);
+            void    purge();
+
+            ObservatoryDataSockets_T m_oSockets;
+            ObservatoryDataFDs_T     m_oServerFDs;
+            ObservatoryDataFDs_T     m_oClientFDs;
 
-            static ObservatoryDataSockets* m_pInstance;
-            ObservatoryDataSockets_T        m_observatoryDataSockets;
-            ObservatoryDataSockets_T::iterator m_socketIt;
+            // epoll set of every server and client fd and the fds it found
+            // ready at the last collect
+            int                      m_iPollFD;
+            vector<struct epoll_event> m_oEvents;
+            ObservatoryDataReady_T   m_oAcceptReady;
+            ObservatoryDataReady_T   m_oReadReady;
+            ObservatoryDataReady_T   m_oWriteReady;
+
+            ObservatoryDataHandler   m_pAcceptHandler;
+            void                    *m_pAcceptContext;
+            ObservatoryDataHandler   m_pReadHandler;
+            void                    *m_pReadContext;
+
+            // Non zero while handlers are running
+            uint32_t m_iDispatchDepth;
+            vector<TCPCommListener*> m_oRemoved;
     };
 
     class ObservatoryMultiConnection : public Connection {
@@ -111,10 +197,15 @@ namespace port_agent {
             PortAgentConnectionType connectionType() { return PACONN_OBSERVATORY_MULTI; }
             
             // Custom configurations for the observatory connection
-            void setDataPort(uint16_t port);
             void setCommandPort(uint16_t port);
 
             void addListener(uint16_t port);
+
+            // The command listener and every data listener
+            void handoffFDs(FDHandoff &handoff);
+
+            // Registry of the data listeners
+            ObservatoryDataSockets *dataSockets() { return &m_oDataSockets; }
             
             /* Query Methods */
             
@@ -149,10 +240,7 @@ namespace port_agent {
         protected:
             
         private:
-            // DHE: should have a multiSocketObject here that abstracts the
-            // type of data structure holding the sockets.
-            //TCPCommListener m_oDataSocket;
-            ObservatoryDataSockets* m_poDataSockets;
+            ObservatoryDataSockets m_oDataSockets;
             TCPCommListener m_oCommandSocket;
             
     };
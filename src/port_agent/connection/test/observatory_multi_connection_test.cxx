@@ -7,6 +7,12 @@
 #include <sstream>
 #include <string>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 using namespace std;
 using namespace logger;
@@ -55,9 +61,9 @@ TEST_F(ObservatoryMultiConnectionTest, DISABLED_NormalConnection) {
         
         EXPECT_EQ(connection.commandConnectionObject()->getListenPort(), TEST_COMMAND_PORT);
         
-        EXPECT_NE(connection.dataConnectionObject()->getListenPort(), TEST_DATA_PORT_01);
-        connection.setDataPort(TEST_DATA_PORT_01);
-        EXPECT_EQ(connection.dataConnectionObject()->getListenPort(), TEST_DATA_PORT_01);
+        connection.addListener(TEST_DATA_PORT_01);
+        ASSERT_TRUE(connection.dataSockets()->findSocket(TEST_DATA_PORT_01));
+        EXPECT_EQ(connection.dataSockets()->findSocket(TEST_DATA_PORT_01)->getListenPort(), TEST_DATA_PORT_01);
     }
     catch(OOIException &e) {
 		string err = e.what();
@@ -66,3 +72,225 @@ TEST_F(ObservatoryMultiConnectionTest, DISABLED_NormalConnection) {
 	}
 }
 
+/* Handler used by the registry tests.  Accepts the client and drops the
+ * other data listener to show the registry can be changed mid dispatch. */
+static ObservatoryDataSockets *g_pSockets = NULL;
+static int g_iAccepted = 0;
+
+static void acceptAndRemove(TCPCommListener *listener, void *context) {
+    listener->acceptClient();
+    g_iAccepted++;
+
+    uint16_t other = listener->port() == TEST_DATA_PORT_01 ? TEST_DATA_PORT_02 : TEST_DATA_PORT_01;
+    g_pSockets->removeSocket(other);
+}
+
+/* Connect a plain client socket to a local port */
+static int connectClient(uint16_t port) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Test adding, finding and replacing listeners in the registry */
+TEST_F(ObservatoryMultiConnectionTest, DataSocketRegistry) {
+    ObservatoryDataSockets sockets;
+    vector<TCPCommListener*> listeners;
+
+    TCPCommListener *first = new TCPCommListener();
+    first->setPort(TEST_DATA_PORT_02);
+    TCPCommListener *second = new TCPCommListener();
+    second->setPort(TEST_DATA_PORT_01);
+
+    EXPECT_TRUE(sockets.addSocket(first));
+    EXPECT_TRUE(sockets.addSocket(second));
+    EXPECT_EQ(sockets.size(), 2);
+
+    // Listeners come back in port order
+    sockets.getSockets(listeners);
+    ASSERT_EQ(listeners.size(), 2);
+    EXPECT_EQ(listeners[0], second);
+    EXPECT_EQ(listeners[1], first);
+
+    EXPECT_EQ(sockets.findSocket(TEST_DATA_PORT_01), second);
+    EXPECT_EQ(sockets.findSocket(TEST_DATA_PORT_02), first);
+    EXPECT_FALSE(sockets.findSocket(TEST_COMMAND_PORT));
+
+    // Replacing a port drops the old listener
+    TCPCommListener *replace = new TCPCommListener();
+    replace->setPort(TEST_DATA_PORT_02);
+    EXPECT_TRUE(sockets.addSocket(replace));
+    EXPECT_EQ(sockets.size(), 2);
+    EXPECT_EQ(sockets.findSocket(TEST_DATA_PORT_02), replace);
+
+    EXPECT_TRUE(sockets.removeSocket(TEST_DATA_PORT_01));
+    EXPECT_FALSE(sockets.removeSocket(TEST_DATA_PORT_01));
+    EXPECT_EQ(sockets.size(), 1);
+}
+
+/* Wait for the registry's fds and collect the ready ones */
+static bool waitSockets(ObservatoryDataSockets &sockets) {
+    struct timeval timeout;
+    fd_set readFDs;
+    int maxFD = 0;
+
+    FD_ZERO(&readFDs);
+    sockets.addPollFD(maxFD, readFDs);
+    if(! FD_ISSET(sockets.pollFD(), &readFDs))
+        return false;
+
+    timeout.tv_sec = 2;
+    timeout.tv_usec = 0;
+    if(select(maxFD + 1, &readFDs, NULL, NULL, &timeout) != 1)
+        return false;
+
+    sockets.collect(readFDs);
+    return true;
+}
+
+/* Read handler for the registry tests, keeps what it reads */
+static string g_sRead;
+
+static void readData(TCPCommListener *listener, void *context) {
+    char buffer[128];
+    int count = listener->readData(buffer, sizeof(buffer));
+    g_sRead.append(buffer, count);
+}
+
+static void acceptOnly(TCPCommListener *listener, void *context) {
+    listener->acceptClient();
+    g_iAccepted++;
+}
+
+/* Test dispatching ready fds while the handler changes the registry */
+TEST_F(ObservatoryMultiConnectionTest, DataSocketDispatch) {
+    ObservatoryDataSockets sockets;
+    int client;
+
+    try {
+        TCPCommListener *first = new TCPCommListener();
+        first->setPort(TEST_DATA_PORT_01);
+        first->initialize();
+        sockets.addSocket(first);
+
+        TCPCommListener *second = new TCPCommListener();
+        second->setPort(TEST_DATA_PORT_02);
+        second->initialize();
+        sockets.addSocket(second);
+
+        ASSERT_TRUE(first->listening());
+        ASSERT_TRUE(second->listening());
+        EXPECT_EQ(sockets.findFD(first->serverFD()), first);
+        EXPECT_EQ(sockets.findFD(second->serverFD()), second);
+
+        g_pSockets = &sockets;
+        g_iAccepted = 0;
+        sockets.setAcceptHandler(acceptAndRemove, NULL);
+        sockets.setReadHandler(readData, NULL);
+
+        client = connectClient(TEST_DATA_PORT_01);
+        ASSERT_GT(client, 0);
+        ASSERT_TRUE(waitSockets(sockets));
+
+        // The handler removes the second listener mid dispatch
+        sockets.dispatchAccept();
+        EXPECT_EQ(g_iAccepted, 1);
+        EXPECT_EQ(sockets.size(), 1);
+        EXPECT_FALSE(sockets.findSocket(TEST_DATA_PORT_02));
+
+        // Collected fds are only dispatched once
+        sockets.dispatchAccept();
+        EXPECT_EQ(g_iAccepted, 1);
+
+        // The accepted client is indexed and watched for reads
+        ASSERT_TRUE(first->connected());
+        EXPECT_EQ(sockets.findFD(first->clientFD()), first);
+
+        g_sRead.clear();
+        ASSERT_EQ(write(client, "data", 4), 4);
+        ASSERT_TRUE(waitSockets(sockets));
+        sockets.dispatchAccept();
+        sockets.dispatchRead();
+        EXPECT_EQ(g_iAccepted, 1);
+        EXPECT_EQ(g_sRead, "data");
+
+        close(client);
+    }
+    catch(OOIException &e) {
+        string err = e.what();
+        LOG(ERROR) << "EXCEPTION: " << err;
+        ASSERT_FALSE(true);
+    }
+}
+
+/* Test data listeners and clients are served on fds select can't watch, and
+ * kept out of select's range when the fd limit allows */
+TEST_F(ObservatoryMultiConnectionTest, DataSocketHighFDs) {
+    ObservatoryMultiConnection connection;
+    ObservatoryDataSockets *sockets = connection.dataSockets();
+    TCPCommListener *listener;
+    struct rlimit limit;
+    vector<int> fds;
+    int fd = 0, client;
+
+    // The registry raised the soft limit as far as it goes
+    getrlimit(RLIMIT_NOFILE, &limit);
+    EXPECT_EQ(limit.rlim_cur, limit.rlim_max);
+    if(limit.rlim_cur < FD_SETSIZE + 16) {
+        LOG(INFO) << "fd limit too low to test, skipping";
+        return;
+    }
+
+    ASSERT_GT(sockets->pollFD(), 0);
+    EXPECT_LT(sockets->pollFD(), FD_SETSIZE);
+
+    // Use up every fd select can watch so nothing lands below it by luck
+    while(fd >= 0 && fd < FD_SETSIZE - 1) {
+        fd = open("/dev/null", O_RDONLY);
+        if(fd >= 0)
+            fds.push_back(fd);
+    }
+
+    connection.addListener(TEST_DATA_PORT_01);
+    listener = sockets->findSocket(TEST_DATA_PORT_01);
+    ASSERT_TRUE(listener);
+    EXPECT_GE(listener->serverFD(), FD_SETSIZE);
+
+    g_iAccepted = 0;
+    g_sRead.clear();
+    sockets->setAcceptHandler(acceptOnly, NULL);
+    sockets->setReadHandler(readData, NULL);
+
+    client = connectClient(TEST_DATA_PORT_01);
+    ASSERT_GT(client, 0);
+    ASSERT_TRUE(waitSockets(*sockets));
+    sockets->dispatchAccept();
+    EXPECT_EQ(g_iAccepted, 1);
+    ASSERT_TRUE(listener->connected());
+    EXPECT_GE(listener->clientFD(), FD_SETSIZE);
+
+    ASSERT_EQ(write(client, "data", 4), 4);
+    ASSERT_TRUE(waitSockets(*sockets));
+    sockets->dispatchRead();
+    EXPECT_EQ(g_sRead, "data");
+
+    // Replies go out through the registry too
+    EXPECT_EQ(listener->writeData("reply", 5), 5);
+    char buffer[16];
+    EXPECT_EQ(read(client, buffer, sizeof(buffer)), 5);
+
+    close(client);
+    for(vector<int>::iterator i = fds.begin(); i != fds.end(); i++)
+        close(*i);
+}
@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * Class: ArchiveVerifier
+ * Filename: archive_verifier.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Check and repair binary data logs.  See archive_verifier.h.
+ ******************************************************************************/
+
+#include "archive_verifier.h"
+#include "packet.h"
+#include "common/logger.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+
+#include <sstream>
+
+using namespace std;
+using namespace logger;
+using namespace packet;
+
+// 16 byte lanes, SSE2 or NEON depending on the target
+typedef uint8_t ChecksumLanes __attribute__((vector_size(16)));
+
+// SYNC as it appears in a file
+static const uint8_t SYNC_BYTES[3] = { (SYNC >> 16) & 0xFF, (SYNC >> 8) & 0xFF, SYNC & 0xFF };
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor, files are verified on the calling thread.
+ ******************************************************************************/
+ArchiveVerifier::ArchiveVerifier() {
+    m_iThreads = 1;
+    m_pPaths = NULL;
+    m_pResults = NULL;
+    m_iNext = 0;
+}
+
+/******************************************************************************
+ * Method: setThreads
+ * Description: Number of files verified at once.  Clamped to
+ * 1 - ARCHIVE_VERIFIER_MAX_THREADS.
+ ******************************************************************************/
+void ArchiveVerifier::setThreads(uint32_t threads) {
+    if(threads < 1)
+        threads = 1;
+
+    if(threads > ARCHIVE_VERIFIER_MAX_THREADS)
+        threads = ARCHIVE_VERIFIER_MAX_THREADS;
+
+    m_iThreads = threads;
+}
+
+/******************************************************************************
+ * Method: verify
+ * Description: Verify files in parallel.  Each thread takes the next file
+ * not yet started until there are none left.
+ *
+ * Parameters:
+ *   paths - files to verify
+ *   results - one result per path, in the same order
+ ******************************************************************************/
+void ArchiveVerifier::verify(const vector<string> &paths, vector<ArchiveFileResult> &results) {
+    vector<pthread_t> threads;
+    uint32_t count = m_iThreads < paths.size() ? m_iThreads : paths.size();
+
+    results.clear();
+    results.resize(paths.size());
+
+    m_pPaths = &paths;
+    m_pResults = &results;
+    m_iNext = 0;
+
+    // The calling thread is one of the workers
+    for(uint32_t i = 1; i < count; i++) {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, worker, this)) {
+            LOG(ERROR) << "failed to start verifier thread: " << strerror(errno);
+            break;
+        }
+
+        threads.push_back(thread);
+    }
+
+    worker(this);
+
+    for(vector<pthread_t>::iterator i = threads.begin(); i != threads.end(); i++)
+        pthread_join(*i, NULL);
+
+    m_pPaths = NULL;
+    m_pResults = NULL;
+}
+
+/******************************************************************************
+ * Method: verifyFile
+ * Description: Map a file and verify it.  A file we can't read is reported
+ * in the result's error.
+ ******************************************************************************/
+void ArchiveVerifier::verifyFile(const string &path, ArchiveFileResult &result) {
+    struct stat info;
+    void *data;
+    int fd;
+
+    result = ArchiveFileResult();
+    result.path = path;
+
+    if((fd = open(path.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+        result.error = strerror(errno);
+        return;
+    }
+
+    if(fstat(fd, &info)) {
+        result.error = strerror(errno);
+        close(fd);
+        return;
+    }
+
+    if(! info.st_size) {
+        close(fd);
+        return;
+    }
+
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED) {
+        result.error = strerror(errno);
+        return;
+    }
+
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    verifyBuffer((const char *)data, info.st_size, result);
+    munmap(data, info.st_size);
+}
+
+/******************************************************************************
+ * Method: verifyBuffer
+ * Description: Walk the packets in a buffer.  A packet is good if it starts
+ * with SYNC, its size covers at least a header and fits in the buffer and its
+ * checksum matches.  Anything else is skipped up to the next SYNC.
+ *
+ * Parameters:
+ *   buffer - file contents
+ *   size - bytes in buffer
+ *   result - counts are added, validLength is the end of the last good packet
+ ******************************************************************************/
+void ArchiveVerifier::verifyBuffer(const char *buffer, uint64_t size, ArchiveFileResult &result) {
+    const uint8_t *data = (const uint8_t *)buffer;
+    uint64_t offset = 0;
+
+    result.bytes = size;
+    result.validLength = 0;
+
+    while(offset < size) {
+        uint64_t remaining = size - offset;
+        const uint8_t *next;
+
+        if(remaining >= (uint64_t)HEADER_SIZE && ! memcmp(data + offset, SYNC_BYTES, 3)) {
+            uint16_t length = (data[offset + 4] << 8) | data[offset + 5];
+            uint16_t stored = (data[offset + 6] << 8) | data[offset + 7];
+
+            if(length >= HEADER_SIZE && length <= remaining) {
+                if(checksum(buffer + offset, length) == stored) {
+                    result.packets++;
+                    offset += length;
+                    result.validLength = offset;
+                    continue;
+                }
+
+                result.badChecksums++;
+            }
+        }
+
+        // Not a good packet here, look for the next SYNC
+        next = (const uint8_t *)memchr(data + offset + 1, SYNC_BYTES[0], size - offset - 1);
+        while(next && (uint64_t)(next - data) + 3 <= size && memcmp(next, SYNC_BYTES, 3))
+            next = (const uint8_t *)memchr(next + 1, SYNC_BYTES[0], size - (next + 1 - data));
+
+        if(! next || (uint64_t)(next - data) + 3 > size) {
+            result.skippedBytes += size - offset;
+            break;
+        }
+
+        result.skippedBytes += next - data - offset;
+        offset = next - data;
+    }
+
+    LOG(DEBUG2) << "verified bytes: " << size << " packets: " << result.packets
+                << " bad checksums: " << result.badChecksums
+                << " skipped: " << result.skippedBytes
+                << " valid length: " << result.validLength;
+}
+
+/******************************************************************************
+ * Method: recoverTail
+ * Description: Verify a segment and cut off everything after its last good
+ * packet.  Quarantine copies the tail to <path>.torn.<offset> first.
+ *
+ * Parameters:
+ *   path - segment to check
+ *   mode - what to do with a torn tail
+ *   result - what was found
+ * Return:
+ *   true if the segment is now clean at the end, false if it is still torn
+ ******************************************************************************/
+bool ArchiveVerifier::recoverTail(const string &path, ArchiveRecovery mode, ArchiveFileResult &result) {
+    verifyFile(path, result);
+
+    if(result.error.length()) {
+        LOG(ERROR) << "archive verify failed: " << path << ": " << result.error;
+        return false;
+    }
+
+    if(! result.torn())
+        return true;
+
+    LOG(WARNING) << "torn tail in " << path << ": " << result.bytes - result.validLength
+                 << " bytes after offset " << result.validLength;
+
+    if(mode == ARCHIVE_RECOVERY_OFF)
+        return false;
+
+    if(mode == ARCHIVE_RECOVERY_QUARANTINE) {
+        ostringstream quarantine;
+        vector<char> tail(result.bytes - result.validLength);
+        int in, out;
+        bool copied = false;
+
+        quarantine << path << ARCHIVE_QUARANTINE_SUFFIX << "." << result.validLength;
+
+        if((in = open(path.c_str(), O_RDONLY | O_CLOEXEC)) >= 0) {
+            if(pread(in, &tail[0], tail.size(), result.validLength) == (ssize_t)tail.size() &&
+               (out = open(quarantine.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+                copied = write(out, &tail[0], tail.size()) == (ssize_t)tail.size() && ! fsync(out);
+                close(out);
+            }
+            close(in);
+        }
+
+        if(! copied) {
+            LOG(ERROR) << "failed to quarantine torn tail to " << quarantine.str() << ": " << strerror(errno);
+            return false;
+        }
+
+        LOG(WARNING) << "torn tail quarantined in " << quarantine.str();
+    }
+
+    if(truncate(path.c_str(), result.validLength)) {
+        LOG(ERROR) << "failed to truncate " << path << ": " << strerror(errno);
+        return false;
+    }
+
+    LOG(WARNING) << "truncated " << path << " to " << result.validLength << " bytes";
+    return true;
+}
+
+/******************************************************************************
+ * Method: newestSegment
+ * Description: Find the most recently modified segment of a rolled log,
+ * named <base>.<date>[_<time>].<ext> by LogFile.
+ ******************************************************************************/
+string ArchiveVerifier::newestSegment(const string &base, const string &ext) {
+    string pattern = base + ".*." + ext;
+    string newest;
+    struct stat info;
+    time_t newestTime = 0;
+    glob_t files;
+
+    if(glob(pattern.c_str(), 0, NULL, &files))
+        return "";
+
+    for(size_t i = 0; i < files.gl_pathc; i++) {
+        if(stat(files.gl_pathv[i], &info) || ! S_ISREG(info.st_mode))
+            continue;
+
+        if(newest.empty() || info.st_mtime >= newestTime) {
+            newest = files.gl_pathv[i];
+            newestTime = info.st_mtime;
+        }
+    }
+
+    globfree(&files);
+    return newest;
+}
+
+/******************************************************************************
+ * Method: checksum
+ * Description: XOR of every byte of the packet except the checksum field,
+ * the same value PortAgentPacket stores.
+ ******************************************************************************/
+uint16_t ArchiveVerifier::checksum(const char *packet, uint16_t size) {
+    const uint8_t *data = (const uint8_t *)packet;
+    ChecksumLanes lanes, block;
+    uint8_t result = 0;
+    uint32_t i = 0;
+
+    memset(&lanes, 0, sizeof(lanes));
+
+    for(; i + sizeof(block) <= size; i += sizeof(block)) {
+        memcpy(&block, data + i, sizeof(block));
+        lanes ^= block;
+    }
+
+    for(uint32_t lane = 0; lane < sizeof(lanes); lane++)
+        result ^= lanes[lane];
+
+    for(; i < size; i++)
+        result ^= data[i];
+
+    // Take the checksum field back out
+    if(size > 7)
+        result ^= data[6] ^ data[7];
+
+    return result;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: worker
+ * Description: Verify files until every one has been taken.
+ ******************************************************************************/
+void * ArchiveVerifier::worker(void *arg) {
+    ArchiveVerifier *verifier = (ArchiveVerifier *)arg;
+    uint32_t index;
+
+    while((index = __atomic_fetch_add(&verifier->m_iNext, 1, __ATOMIC_SEQ_CST)) < verifier->m_pPaths->size())
+        verifyFile((*verifier->m_pPaths)[index], (*verifier->m_pResults)[index]);
+
+    return NULL;
+}
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Class: ArchiveVerifier
+ * Filename: archive_verifier.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Check binary data logs written by the file publisher.  Every packet must
+ * start with SYNC, have a size that fits in the file and a good checksum.
+ * Bytes that don't belong to a good packet are skipped by searching for the
+ * next SYNC.
+ *
+ * If the node loses power the last packet written may only be partly on
+ * disk, or the file may end in a block of zeros.  Everything after the last
+ * good packet is the torn tail.  recoverTail cuts it off so the file parses
+ * cleanly again, optionally keeping the bytes in a quarantine file next to
+ * the segment.
+ *
+ * Files are verified in parallel, one file per thread.  Within a file the
+ * SYNC search uses memchr and the checksum XORs 16 bytes at a time, both of
+ * which compile to vector instructions.
+ *
+ * Usage:
+ *
+ * ArchiveVerifier verifier;
+ * vector<string> files;
+ * vector<ArchiveFileResult> results;
+ *
+ * verifier.setThreads(4);
+ * verifier.verify(files, results);
+ *
+ * // Startup check of the segment the file publisher was last writing
+ * string segment = ArchiveVerifier::newestSegment("/data/port_agent", "data");
+ * ArchiveVerifier::recoverTail(segment, ARCHIVE_RECOVERY_QUARANTINE, result);
+ *
+ ******************************************************************************/
+
+#ifndef __ARCHIVE_VERIFIER_H_
+#define __ARCHIVE_VERIFIER_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// Most threads used to verify files in parallel
+#define ARCHIVE_VERIFIER_MAX_THREADS 64
+
+// Suffix of the file holding a torn tail cut off a segment
+#define ARCHIVE_QUARANTINE_SUFFIX ".torn"
+
+namespace packet {
+
+    /* What to do with a torn tail */
+    enum ArchiveRecovery {
+        ARCHIVE_RECOVERY_OFF,
+        ARCHIVE_RECOVERY_TRUNCATE,
+        ARCHIVE_RECOVERY_QUARANTINE
+    };
+
+    /* What we found in one file */
+    struct ArchiveFileResult {
+        ArchiveFileResult() : bytes(0), packets(0), badChecksums(0),
+                              skippedBytes(0), validLength(0) {}
+
+        // The file ends part way through a packet or in bytes that aren't one
+        bool torn() { return validLength < bytes; }
+
+        // Nothing wrong anywhere in the file
+        bool clean() { return error.empty() && ! skippedBytes; }
+
+        string path;
+        string error;
+        uint64_t bytes;
+        uint64_t packets;
+        uint64_t badChecksums;
+        uint64_t skippedBytes;
+
+        // End of the last good packet
+        uint64_t validLength;
+    };
+
+    class ArchiveVerifier {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            ArchiveVerifier();
+
+            void setThreads(uint32_t threads);
+            uint32_t threads() { return m_iThreads; }
+
+            // Verify files in parallel.  results are in the order of paths.
+            void verify(const vector<string> &paths, vector<ArchiveFileResult> &results);
+
+            // Verify a single file or a buffer holding one
+            static void verifyFile(const string &path, ArchiveFileResult &result);
+            static void verifyBuffer(const char *buffer, uint64_t size, ArchiveFileResult &result);
+
+            // Cut off a torn tail.  result holds what was found before.
+            static bool recoverTail(const string &path, ArchiveRecovery mode, ArchiveFileResult &result);
+
+            // The most recently written segment of a rolled log, empty if none
+            static string newestSegment(const string &base, const string &ext);
+
+            // Packet checksum, XOR of every byte but the checksum field
+            static uint16_t checksum(const char *packet, uint16_t size);
+
+        private:
+            static void *worker(void *arg);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            uint32_t m_iThreads;
+
+            // Work shared with the threads of one verify call
+            const vector<string> *m_pPaths;
+            vector<ArchiveFileResult> *m_pResults;
+            uint32_t m_iNext;
+    };
+}
+
+#endif //__ARCHIVE_VERIFIER_H_
@@ -26,6 +26,7 @@
 #include "common/util.h"
 #include "common/exception.h"
 #include "common/timestamp.h"
+#include "common/clock.h"
 
 #include <iostream>
 #include <iomanip>
@@ -56,6 +57,7 @@ BufferedSingleCharPacket::BufferedSingleCharPacket() : PortAgentPacket::PortAgen
     m_iSentinleIndex = 0;
 
     m_fQuiescentTime = 0;
+    m_iLastAddUsec = 0;
     m_iMaxPayloadSize = 0;
 }
 
@@ -210,9 +212,10 @@ void BufferedSingleCharPacket::add( char input, const Timestamp &timestamp ) {
     m_pPacket[m_iPacketSize] = input;
     m_iPacketSize++;
 
-    // If we are triggering on time then set the last seen timestamp
+    // If we are triggering on time then note when we last saw data.  The
+    // quiescent time is an interval so it is timed on the monotonic clock.
     if(m_fQuiescentTime)
-        m_oLastAddTimestamp = timestamp;
+        m_iLastAddUsec = Clock::MonotonicUsec();
 
     // Check for a sentinle character match
     if(m_pSentinleSequence) {
@@ -246,7 +249,8 @@ bool BufferedSingleCharPacket::readyToSend() {
         return true;
     
     // Check the timestamp of last read elapse time
-    if(m_fQuiescentTime && m_oLastAddTimestamp.elapseTime() >= m_fQuiescentTime)
+    if(m_fQuiescentTime &&
+       Clock::MonotonicUsec() - m_iLastAddUsec >= m_fQuiescentTime * CLOCK_USEC_PER_SEC)
         return true;
     
     if(m_iSentinleSize && m_iSentinleIndex == m_iSentinleSize)
@@ -351,8 +355,5 @@ void BufferedSingleCharPacket::setMaxPayloadSize(uint16_t maxPayloadSize) {
     m_iMaxPayloadSize = maxPayloadSize;
     m_iPacketSize = HEADER_SIZE;
     
-    if(m_pPacket)
-        delete [] m_pPacket;
-        
-    m_pPacket = new char[m_iPacketSize + maxPayloadSize];
+    allocatePacket(m_iPacketSize + maxPayloadSize);
 }
@@ -135,7 +135,7 @@ class BufferedSingleCharPacket : public PortAgentPacket {
         
         // members for quiescent triggering
         float m_fQuiescentTime;
-        Timestamp m_oLastAddTimestamp;
+        uint64_t m_iLastAddUsec;
         
         // member for max payload size triggering
         uint16_t m_iMaxPayloadSize;
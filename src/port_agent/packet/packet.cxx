@@ -20,6 +20,7 @@
 #include "common/logger.h"
 #include "common/exception.h"
 #include "common/timestamp.h"
+#include "common/memory_budget.h"
 
 #include <netinet/in.h>
 #include <iostream>
@@ -49,6 +50,7 @@ Packet::Packet() {
     m_tPacketType = UNKNOWN;
     m_iPacketSize = 0;
     m_pPacket = NULL;
+    m_iAllocated = 0;
 }
 
 /******************************************************************************
@@ -57,10 +59,7 @@ Packet::Packet() {
  ******************************************************************************/
 Packet::~Packet() {
 	LOG(DEBUG) << "Packet DTOR";
-    if( m_pPacket ) {
-        delete [] m_pPacket;
-        m_pPacket = NULL;
-    }
+    freePacket();
 	LOG(DEBUG) << "Packet DTOR exit";
 }
 
@@ -116,4 +115,54 @@ string Packet::typeToString(PacketType type) {
     return "OUT_OF_RANGE";
 }
 
+/******************************************************************************
+ * Method: typePriority
+ * Description: How urgently a packet type is written.  Only the data read
+ * from the instrument is bulk.  Driver data is what the driver commands the
+ * instrument with so it is control like the agent's own packets.
+ ******************************************************************************/
+PacketPriority Packet::typePriority(PacketType type) {
+    switch(type) {
+        case DATA_FROM_INSTRUMENT:
+        case DATA_FROM_RSN:
+            return PRIORITY_BULK;
+        default:
+            return PRIORITY_CONTROL;
+    };
+}
+
+
+
+/******************************************************************************
+ *   PROTECTED METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: allocatePacket
+ * Description: Replace the packet buffer with one of size bytes and charge
+ * it to the packet memory budget.  A packet can't be shed once its data has
+ * arrived so the charge is never refused, but it counts against the total
+ * the admitted buffers are held to.
+ ******************************************************************************/
+void Packet::allocatePacket(uint32_t size) {
+    freePacket();
+
+    m_pPacket = new char[size];
+    m_iAllocated = size;
+    MemoryBudget::Instance().charge(MEMORY_PACKET, size);
+}
+
+/******************************************************************************
+ * Method: freePacket
+ ******************************************************************************/
+void Packet::freePacket() {
+    if(m_pPacket) {
+        delete [] m_pPacket;
+        m_pPacket = NULL;
+    }
 
+    if(m_iAllocated) {
+        MemoryBudget::Instance().release(MEMORY_PACKET, m_iAllocated);
+        m_iAllocated = 0;
+    }
+}
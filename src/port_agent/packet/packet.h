@@ -46,6 +46,13 @@ namespace packet {
         PORT_AGENT_HEARTBEAT
     };
 
+    /* How urgently a packet is written.  Control packets go ahead of bulk
+     * data queued for a slow client. */
+    enum PacketPriority {
+        PRIORITY_CONTROL,
+        PRIORITY_BULK
+    };
+
     const uint32_t SYNC = 0xA39D7A;
     const short    HEADER_SIZE = 16;
 
@@ -78,14 +85,23 @@ namespace packet {
             // overloaded for buffered packets.
             virtual bool readyToSend() { return true; }
 
+            // Instrument data is bulk, commands, status, faults and
+            // heartbeats are control
+            PacketPriority priority() { return typePriority(m_tPacketType); }
+
             // Convert a PacketType to a string representation
             string typeToString(PacketType type);
+            static PacketPriority typePriority(PacketType type);
         protected:
 
              string asciiPacketLabel() { return "packet"; }
             virtual string asciiPacketTimestamp() = 0; // must be implemented by subclasses.
             string asciiPacketType() { return typeToString(m_tPacketType); }
 
+            // Packet data buffer charged to the packet memory budget
+            void allocatePacket(uint32_t size);
+            void freePacket();
+
 
         private:
         
@@ -98,6 +114,7 @@ namespace packet {
             PacketType m_tPacketType;
             uint16_t m_iPacketSize;
             char *m_pPacket;
+            uint32_t m_iAllocated;
 
     };
 }
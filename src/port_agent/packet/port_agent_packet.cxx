@@ -35,6 +35,7 @@
 #include "common/logger.h"
 #include "common/exception.h"
 #include "common/timestamp.h"
+#include "common/probe.h"
 
 #include <netinet/in.h>
 #include <iostream>
@@ -98,7 +99,7 @@ PortAgentPacket::PortAgentPacket(PacketType packetType, Timestamp timestamp,
     //m_oTimestamp = timestamp;
     m_tPacketType = packetType;
     m_iPacketSize = HEADER_SIZE + payloadSize;
-    m_pPacket = new char[m_iPacketSize];
+    allocatePacket(m_iPacketSize);
     
     LOG(DEBUG1) << "Setting packet header info";
     
@@ -112,6 +113,8 @@ PortAgentPacket::PortAgentPacket(PacketType packetType, Timestamp timestamp,
     LOG(DEBUG1) << "Deep copy complete";
     
     m_iChecksum = calculateChecksum();
+    
+    PROBE2(packet__create, packetType, m_iPacketSize);
 }
 
 /******************************************************************************
@@ -135,10 +138,7 @@ PortAgentPacket::PortAgentPacket(const PortAgentPacket& rhs) {
  ******************************************************************************/
 PortAgentPacket::~PortAgentPacket() {
 	LOG(DEBUG) << "PortAgentPacket DTOR";
-    if( m_pPacket ) {
-        delete [] m_pPacket;
-        m_pPacket = NULL;
-    }
+    freePacket();
 	LOG(DEBUG) << "PortAgentPacket DTOR exit";
 }
 
@@ -152,10 +152,7 @@ PortAgentPacket::~PortAgentPacket() {
  ******************************************************************************/
 PortAgentPacket & PortAgentPacket::operator=(const PortAgentPacket &rhs) {
 
-	if(m_pPacket) {
-		delete m_pPacket;
-		m_pPacket = NULL;
-	}
+	freePacket();
 
 	copy(rhs);
 	return *this;
@@ -178,7 +175,7 @@ void PortAgentPacket::copy(const PortAgentPacket &copy) {
 
     // Deep copy the payload
     if(copy.m_pPacket) {
-        m_pPacket = new char[packetSize()];
+        allocatePacket(packetSize());
         for(int i = HEADER_SIZE; i < packetSize(); i++)
             m_pPacket[i] = copy.m_pPacket[i];
     } else {
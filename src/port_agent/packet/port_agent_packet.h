@@ -107,11 +107,10 @@ class PortAgentPacket : public Packet {
 
     protected:
         
-        PacketType m_tPacketType;
-        uint16_t m_iPacketSize;
+        // Packet type, size and buffer live in the Packet base class so
+        // publishers working through a Packet* see the same values.
         uint16_t m_iChecksum;
         Timestamp m_oTimestamp;
-        char *m_pPacket;
 
 };
 
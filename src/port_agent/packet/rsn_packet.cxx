@@ -102,7 +102,7 @@ RSNPacket::RSNPacket(PacketType packetType, char *pPacket, uint16_t iPacketSize)
      */
     m_tPacketType = packetType;
     m_iPacketSize = iPacketSize;
-    m_pPacket = new char[m_iPacketSize];
+    allocatePacket(m_iPacketSize);
     
     LOG(DEBUG1) << "Setting packet header info";
     
@@ -138,10 +138,7 @@ RSNPacket::RSNPacket(const RSNPacket& rhs) {
  ******************************************************************************/
 RSNPacket::~RSNPacket() {
 	LOG(DEBUG) << "RSNPacket DTOR";
-    if( m_pPacket ) {
-        delete [] m_pPacket;
-        m_pPacket = NULL;
-    }
+    freePacket();
 	LOG(DEBUG) << "RSNPacket DTOR exit";
 }
 
@@ -155,10 +152,7 @@ RSNPacket::~RSNPacket() {
  ******************************************************************************/
 RSNPacket & RSNPacket::operator=(const RSNPacket &rhs) {
 
-	if(m_pPacket) {
-		delete m_pPacket;
-		m_pPacket = NULL;
-	}
+	freePacket();
 
 	copy(rhs);
 	return *this;
@@ -179,7 +173,7 @@ void RSNPacket::copy(const RSNPacket &copy) {
 
     // Deep copy the payload
     if(copy.m_pPacket) {
-        m_pPacket = new char[packetSize()];
+        allocatePacket(packetSize());
         for(int i = 0; i < packetSize(); i++)
             m_pPacket[i] = copy.m_pPacket[i];
     } else {
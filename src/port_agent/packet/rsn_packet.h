@@ -96,11 +96,9 @@ class RSNPacket : public Packet {
 
     protected:
         
-        packet::PacketType m_tPacketType;
-        uint16_t m_iPacketSize;
+        // Packet type, size and buffer live in the Packet base class.
         uint16_t m_iChecksum;
         Timestamp m_oTimestamp;
-        char *m_pPacket;
 
 };
 
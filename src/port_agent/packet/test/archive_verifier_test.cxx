@@ -0,0 +1,220 @@
+#include "common/exception.h"
+#include "common/logger.h"
+#include "common/util.h"
+#include "port_agent/packet/port_agent_packet.h"
+#include "port_agent/packet/archive_verifier.h"
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace packet;
+using namespace logger;
+
+#define TEST_DIR "/tmp/archive_verifier_test"
+
+class ArchiveVerifierTest : public testing::Test {
+
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("MESG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "    Archive Verifier Test Start Up";
+            LOG(INFO) << "************************************************";
+
+            system("rm -rf " TEST_DIR);
+            mkdir(TEST_DIR, 0755);
+        }
+
+        // Append count packets to a string the way the file publisher does
+        void addPackets(string &archive, int count) {
+            for(int i = 0; i < count; i++) {
+                ostringstream payload;
+                payload << "sample " << i << " 12.345,67.890";
+                string data = payload.str();
+
+                PortAgentPacket packet(DATA_FROM_INSTRUMENT, Timestamp(), (char *)data.c_str(), data.length());
+                archive.append(packet.packet(), packet.packetSize());
+            }
+        }
+
+        void writeFile(const string &path, const string &contents) {
+            ofstream out(path.c_str(), ios::binary);
+            out.write(contents.data(), contents.length());
+        }
+
+        string readFile(const string &path) {
+            ifstream in(path.c_str(), ios::binary);
+            ostringstream contents;
+            contents << in.rdbuf();
+            return contents.str();
+        }
+};
+
+/* The checksum must agree with the one PortAgentPacket stores */
+TEST_F(ArchiveVerifierTest, Checksum) {
+    for(int size = 0; size < 100; size += 7) {
+        string data(size, 'x');
+        for(int i = 0; i < size; i++)
+            data[i] = (char)(i * 31 + size);
+
+        PortAgentPacket packet(DATA_FROM_DRIVER, Timestamp(), (char *)data.data(), data.length());
+        EXPECT_EQ(packet.checksum(), ArchiveVerifier::checksum(packet.packet(), packet.packetSize()));
+    }
+}
+
+/* A file of good packets */
+TEST_F(ArchiveVerifierTest, CleanFile) {
+    ArchiveFileResult result;
+    string archive;
+
+    addPackets(archive, 100);
+    writeFile(TEST_DIR "/clean.data", archive);
+
+    ArchiveVerifier::verifyFile(TEST_DIR "/clean.data", result);
+    EXPECT_EQ(result.error, "");
+    EXPECT_EQ(result.packets, 100);
+    EXPECT_EQ(result.bytes, archive.length());
+    EXPECT_EQ(result.validLength, archive.length());
+    EXPECT_EQ(result.badChecksums, 0);
+    EXPECT_TRUE(result.clean());
+    EXPECT_FALSE(result.torn());
+
+    // An empty file is clean too
+    writeFile(TEST_DIR "/empty.data", "");
+    ArchiveVerifier::verifyFile(TEST_DIR "/empty.data", result);
+    EXPECT_TRUE(result.clean());
+    EXPECT_EQ(result.packets, 0);
+
+    // A missing file is an error
+    ArchiveVerifier::verifyFile(TEST_DIR "/missing.data", result);
+    EXPECT_NE(result.error, "");
+}
+
+/* A bad packet in the middle is skipped and we pick up at the next SYNC */
+TEST_F(ArchiveVerifierTest, BadChecksum) {
+    ArchiveFileResult result;
+    string first, second;
+
+    addPackets(first, 10);
+    addPackets(second, 10);
+
+    // corrupt a payload byte in the last packet of the first run
+    first[first.length() - 1] ^= 0x55;
+
+    ArchiveVerifier::verifyBuffer((first + second).data(), first.length() + second.length(), result);
+    EXPECT_EQ(result.packets, 19);
+    EXPECT_EQ(result.badChecksums, 1);
+    EXPECT_GT(result.skippedBytes, 0);
+    EXPECT_FALSE(result.clean());
+    EXPECT_FALSE(result.torn());
+}
+
+/* A partial packet at the end is cut off */
+TEST_F(ArchiveVerifierTest, TruncateTornTail) {
+    ArchiveFileResult result;
+    string archive, good;
+
+    addPackets(good, 20);
+    archive = good;
+    addPackets(archive, 1);
+    archive.resize(archive.length() - 5);
+    writeFile(TEST_DIR "/torn.data", archive);
+
+    EXPECT_TRUE(ArchiveVerifier::recoverTail(TEST_DIR "/torn.data", ARCHIVE_RECOVERY_TRUNCATE, result));
+    EXPECT_TRUE(result.torn());
+    EXPECT_EQ(result.validLength, good.length());
+    EXPECT_EQ(readFile(TEST_DIR "/torn.data"), good);
+
+    // No quarantine file when truncating
+    struct stat info;
+    ostringstream quarantine;
+    quarantine << TEST_DIR "/torn.data" ARCHIVE_QUARANTINE_SUFFIX "." << good.length();
+    EXPECT_NE(stat(quarantine.str().c_str(), &info), 0);
+
+    // Now it's clean
+    ArchiveVerifier::verifyFile(TEST_DIR "/torn.data", result);
+    EXPECT_TRUE(result.clean());
+    EXPECT_FALSE(result.torn());
+}
+
+/* A block of zeros at the end is kept in a quarantine file */
+TEST_F(ArchiveVerifierTest, QuarantineTornTail) {
+    ArchiveFileResult result;
+    string archive, zeros(4096, '\0');
+
+    addPackets(archive, 20);
+    writeFile(TEST_DIR "/zeros.data", archive + zeros);
+
+    EXPECT_TRUE(ArchiveVerifier::recoverTail(TEST_DIR "/zeros.data", ARCHIVE_RECOVERY_QUARANTINE, result));
+    EXPECT_EQ(result.validLength, archive.length());
+    EXPECT_EQ(readFile(TEST_DIR "/zeros.data"), archive);
+
+    ostringstream quarantine;
+    quarantine << TEST_DIR "/zeros.data" ARCHIVE_QUARANTINE_SUFFIX "." << archive.length();
+    EXPECT_EQ(readFile(quarantine.str()), zeros);
+
+    // Off only reports
+    writeFile(TEST_DIR "/zeros.data", archive + zeros);
+    EXPECT_FALSE(ArchiveVerifier::recoverTail(TEST_DIR "/zeros.data", ARCHIVE_RECOVERY_OFF, result));
+    EXPECT_EQ(readFile(TEST_DIR "/zeros.data").length(), archive.length() + zeros.length());
+}
+
+/* Many files checked on several threads come back in order */
+TEST_F(ArchiveVerifierTest, Parallel) {
+    ArchiveVerifier verifier;
+    vector<string> paths;
+    vector<ArchiveFileResult> results;
+
+    for(int i = 0; i < 12; i++) {
+        ostringstream path;
+        string archive;
+
+        path << TEST_DIR "/segment" << i << ".data";
+        addPackets(archive, i + 1);
+        if(i % 3 == 0)
+            archive.append(3, 'z');
+
+        writeFile(path.str(), archive);
+        paths.push_back(path.str());
+    }
+
+    verifier.setThreads(4);
+    EXPECT_EQ(verifier.threads(), 4);
+    verifier.verify(paths, results);
+
+    ASSERT_EQ(results.size(), paths.size());
+    for(int i = 0; i < 12; i++) {
+        EXPECT_EQ(results[i].path, paths[i]);
+        EXPECT_EQ(results[i].packets, i + 1);
+        EXPECT_EQ(results[i].torn(), i % 3 == 0);
+    }
+
+    verifier.setThreads(0);
+    EXPECT_EQ(verifier.threads(), 1);
+    verifier.setThreads(1000);
+    EXPECT_EQ(verifier.threads(), ARCHIVE_VERIFIER_MAX_THREADS);
+}
+
+/* The segment last written by the file publisher */
+TEST_F(ArchiveVerifierTest, NewestSegment) {
+    EXPECT_EQ(ArchiveVerifier::newestSegment(TEST_DIR "/port_agent", "data"), "");
+
+    writeFile(TEST_DIR "/port_agent.20260101.data", "a");
+    writeFile(TEST_DIR "/port_agent.20260102.data", "b");
+    writeFile(TEST_DIR "/port_agent.20260102.log", "c");
+
+    // make the first one newer
+    sleep(1);
+    writeFile(TEST_DIR "/port_agent.20260101.data", "a");
+
+    EXPECT_EQ(ArchiveVerifier::newestSegment(TEST_DIR "/port_agent", "data"), TEST_DIR "/port_agent.20260101.data");
+}
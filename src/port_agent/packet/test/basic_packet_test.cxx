@@ -200,6 +200,22 @@ TEST_F(PortAgentPacketTest, PacketTypeToText) {
     EXPECT_EQ(packet.typeToString(PORT_AGENT_HEARTBEAT), "PORT_AGENT_HEARTBEAT");
 }
 
+/* Only instrument data is bulk */
+TEST_F(PortAgentPacketTest, Priority) {
+    Timestamp timestamp;
+    PortAgentPacket data(DATA_FROM_INSTRUMENT, timestamp, (char *)"ad", 2);
+    PortAgentPacket fault(PORT_AGENT_FAULT, timestamp, (char *)"ad", 2);
+
+    EXPECT_EQ(data.priority(), PRIORITY_BULK);
+    EXPECT_EQ(fault.priority(), PRIORITY_CONTROL);
+
+    EXPECT_EQ(Packet::typePriority(DATA_FROM_RSN), PRIORITY_BULK);
+    EXPECT_EQ(Packet::typePriority(DATA_FROM_DRIVER), PRIORITY_CONTROL);
+    EXPECT_EQ(Packet::typePriority(INSTRUMENT_COMMAND), PRIORITY_CONTROL);
+    EXPECT_EQ(Packet::typePriority(PORT_AGENT_STATUS), PRIORITY_CONTROL);
+    EXPECT_EQ(Packet::typePriority(PORT_AGENT_HEARTBEAT), PRIORITY_CONTROL);
+}
+
 /* Test the ascii output */
 TEST_F(PortAgentPacketTest, AsciiOutput) {
 	// Set time to 1.5 seconds past the epoch
@@ -1,6 +1,8 @@
 #include "common/exception.h"
 #include "common/logger.h"
 #include "common/util.h"
+#include "common/clock.h"
+#include "common/memory_budget.h"
 #include "port_agent/packet/buffered_single_char.h"
 #include "gtest/gtest.h"
 
@@ -22,7 +24,16 @@ class BufferedPacketTest : public testing::Test {
             LOG(INFO) << "************************************************";
             LOG(INFO) << "    Port Agent Buffered Packet Test Start Up";
             LOG(INFO) << "************************************************";
+            
+            // Quiescent time is measured on a clock we move by hand
+            Clock::SetClock(&m_oClock);
+        }
+        
+        virtual void TearDown() {
+            Clock::SetClock(NULL);
         }
+        
+        VirtualClock m_oClock;
 };
 
 /* Test Basic Creation.  Not testing any of the read to send  rules, just
@@ -48,7 +59,7 @@ TEST_F(BufferedPacketTest, CTOR) {
     EXPECT_EQ(myPacket.timestamp().seconds(), firstTimestamp.seconds());
     EXPECT_EQ(myPacket.timestamp().fraction(), firstTimestamp.fraction());
 
-    sleep(1);
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
 
     // check the packet size, adding 16 bytes for the header
     EXPECT_EQ(myPacket.packetSize(), 16 + 1);
@@ -85,8 +96,8 @@ TEST_F(BufferedPacketTest, CopyCTORWithDataAndSentinle) {
 	LOG(INFO) << "Testing the copy constructor";
     BufferedSingleCharPacket myPacket(DATA_FROM_INSTRUMENT, 2, 3, "FOOBAR", 6);
 
-    // Sleep for a second so we can ensure timestamps are being copied, not just set to now
-    sleep(1);
+    // Move a second on so we can ensure timestamps are being copied, not just set to now
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
 
     // Explicitly calling a copy constructor
     BufferedSingleCharPacket copy(myPacket);
@@ -122,8 +133,8 @@ TEST_F(BufferedPacketTest, CopyCTORWithoutSentinle) {
 	LOG(INFO) << "Testing the copy constructor";
     BufferedSingleCharPacket myPacket(DATA_FROM_INSTRUMENT, 2, 3);
 
-    // Sleep for a second so we can ensure timestamps are being copied, not just set to now
-    sleep(1);
+    // Move a second on so we can ensure timestamps are being copied, not just set to now
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
 
     // Explicitly calling a copy constructor
     BufferedSingleCharPacket copy(myPacket);
@@ -157,8 +168,8 @@ TEST_F(BufferedPacketTest, PacketAssignment) {
 	LOG(INFO) << "Testing the assignment operator";
     BufferedSingleCharPacket myPacket(DATA_FROM_INSTRUMENT, 2, 3, "FOOBAR", 6);
 
-    // Sleep for a second so we can ensure timestamps are being copied, not just set to now
-    sleep(1);
+    // Move a second on so we can ensure timestamps are being copied, not just set to now
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
 
     // Explicitly calling a copy constructor
     BufferedSingleCharPacket copy = myPacket;
@@ -246,20 +257,28 @@ TEST_F(BufferedPacketTest, QuiescentTimeTrigger) {
     
     LOG(DEBUG) << "Ensure empty packets are never ready to send";
     EXPECT_FALSE(myPacket.readyToSend());
-    sleep(1);
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
     EXPECT_FALSE(myPacket.readyToSend());
     
     LOG(DEBUG) << "Add some data and wait for a trigger";
     myPacket.add('a');
     EXPECT_FALSE(myPacket.readyToSend());
-    sleep(1);
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
     EXPECT_TRUE(myPacket.readyToSend());
     
     LOG(DEBUG) << "Check that the ready to send resets on add";
     myPacket.add('b');
     EXPECT_FALSE(myPacket.readyToSend());
-    sleep(1);
+    m_oClock.advance(CLOCK_USEC_PER_SEC);
     EXPECT_TRUE(myPacket.readyToSend());
+    
+    LOG(DEBUG) << "Check the trigger fires on the quiescent time, not before";
+    BufferedSingleCharPacket exactPacket(DATA_FROM_INSTRUMENT, 3, 0.5);
+    exactPacket.add('c');
+    m_oClock.advance(499000);
+    EXPECT_FALSE(exactPacket.readyToSend());
+    m_oClock.advance(2000);
+    EXPECT_TRUE(exactPacket.readyToSend());
 }
     
 /* Constructor Throw Tests */
@@ -329,6 +348,26 @@ TEST_F(BufferedPacketTest, CTORThrowTests) {
     EXPECT_TRUE(exceptionCaught);
 }
 
+/* Packet buffers are charged to the packet memory budget while they live */
+TEST_F(BufferedPacketTest, MemoryCharge) {
+    uint64_t before = MemoryBudget::Instance().used(MEMORY_PACKET);
+
+    {
+        BufferedSingleCharPacket myPacket(DATA_FROM_INSTRUMENT, 100, 0, "ff", 2);
+        EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_PACKET), before + HEADER_SIZE + 100);
+
+        BufferedSingleCharPacket copy(myPacket);
+        EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_PACKET), before + 2 * (HEADER_SIZE + 100));
+
+        // Assignment replaces the buffer
+        BufferedSingleCharPacket small(DATA_FROM_INSTRUMENT, 10, 0, "ff", 2);
+        copy = small;
+        EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_PACKET), before + 3 * HEADER_SIZE + 120);
+    }
+
+    EXPECT_EQ(MemoryBudget::Instance().used(MEMORY_PACKET), before);
+}
+
 /* Test for data overflow */
 // Ensure we throw an exception when we try to write past our max packet size.
 TEST_F(BufferedPacketTest, OverflowTest) {
@@ -19,6 +19,7 @@
 #include "packet/rsn_packet.h"
 
 #include "packet/buffered_single_char.h"
+#include "packet/archive_verifier.h"
 
 #include "publisher/log_publisher.h"
 #include "publisher/driver_command_publisher.h"
@@ -28,6 +29,10 @@
 #include "publisher/telnet_sniffer_publisher.h"
 #include "publisher/udp_publisher.h"
 #include "publisher/tcp_publisher.h"
+#include "network/fd_handoff.h"
+#include "common/io_ring.h"
+#include "common/clock.h"
+#include "common/probe.h"
 
 #include <iostream>
 #include <sstream>
@@ -38,8 +43,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/fcntl.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <spawn.h>
+#include <poll.h>
+#include <limits.h>
+#include <vector>
+
+extern char **environ;
 
 using namespace std;
 using namespace packet;
@@ -53,12 +66,14 @@ using namespace port_agent;
 /******************************************************************************
  * Method: Default Constructor
  ******************************************************************************/
-PortAgent::PortAgent() {
+PortAgent::PortAgent()
+    : m_oRoutingCharge(MEMORY_PUBLISHER), m_oCommandLines(COMMAND_LINE_MAX) {
     m_pObservatoryConnection = NULL;
     m_pInstrumentConnection = NULL;
     
     m_pConfig = NULL;
     m_oState = STATE_UNKNOWN;
+    m_lLastHeartbeat = 0;
 }
 
 /******************************************************************************
@@ -66,7 +81,8 @@ PortAgent::PortAgent() {
  * Description: Construct a configuration object from command line parameters
  *              passed in from the command line using (argv).
  ******************************************************************************/
-PortAgent::PortAgent(int argc, char *argv[]) {
+PortAgent::PortAgent(int argc, char *argv[])
+    : m_oRoutingCharge(MEMORY_PUBLISHER), m_oCommandLines(COMMAND_LINE_MAX) {
     // Setup the log file if we are running as a daemon
     LOG(DEBUG) << "Initialize port agent with args";
     
@@ -76,6 +92,21 @@ PortAgent::PortAgent(int argc, char *argv[]) {
     m_pInstrumentConnection = NULL;
     m_pObservatoryConnection = NULL;
     m_pTelnetSnifferConnection = NULL;
+    m_pDriverSplice = NULL;
+    m_iArchiveTornBytes = 0;
+    m_lLastHeartbeat = 0;
+    
+    // Remember where we were started from in case we are asked to upgrade
+    // after the binary has been replaced.
+    char path[PATH_MAX];
+    int length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if(length > 0) {
+        m_sExecutable = string(path, length);
+        
+        size_t deleted = m_sExecutable.rfind(" (deleted)");
+        if(deleted != string::npos && deleted + 10 == m_sExecutable.length())
+            m_sExecutable.erase(deleted);
+    }
 }
 
 /******************************************************************************
@@ -92,6 +123,9 @@ PortAgent::~PortAgent() {
     if(m_pTelnetSnifferConnection)
         delete m_pTelnetSnifferConnection;
         
+    if(m_pDriverSplice)
+        delete m_pDriverSplice;
+        
     if(m_pConfig)
         delete m_pConfig;
         
@@ -113,9 +147,76 @@ const string PortAgent::daemon_command() {
  * Returns true if we want to run in signle thread mode
  ******************************************************************************/
 bool PortAgent::no_daemon() {
+    if(m_pConfig && m_pConfig->upgradeFD())
+        return true;
+    
     return m_pConfig ? m_pConfig->noDetatch() : true;
 }
 
+/******************************************************************************
+ * Method: duplicate_check
+ * Description: During a live upgrade the process we are replacing is still
+ * running and owns the pid file until we take over.
+ ******************************************************************************/
+void PortAgent::duplicate_check() {
+    if(m_pConfig && m_pConfig->upgradeFD()) {
+        LOG(INFO) << "live upgrade, skipping duplicate process check";
+        return;
+    }
+    
+    DaemonProcess::duplicate_check();
+}
+
+/******************************************************************************
+ * Method: initialize
+ * Description: If we were started by a live upgrade then read the handoff
+ * from the process we are replacing.  Its configuration is loaded here and
+ * the inherited descriptors are adopted by the comm objects as they are
+ * initialized.  Once we have everything the old process is told to exit.
+ *
+ * Otherwise load the last saved config snapshot, if there is one, so we can
+ * connect without waiting for the driver to configure us.
+ ******************************************************************************/
+void PortAgent::initialize() {
+    FDHandoff *handoff = FDHandoff::instance();
+    int fd = m_pConfig->upgradeFD();
+    char ack = 1;
+    
+    if(!fd) {
+        if(m_pConfig->loadConfig())
+            LOG(INFO) << "warm start from config snapshot";
+        return;
+    }
+    
+    LOG(INFO) << "live upgrade, reading handoff from fd: " << fd;
+    
+    if(! handoff->receive(fd)) {
+        close(fd);
+        throw DaemonStartupException("live upgrade handoff failed");
+    }
+    
+    if(! m_pConfig->parse(handoff->value("config"))) {
+        handoff->closeAll();
+        close(fd);
+        throw DaemonStartupException("live upgrade config rejected");
+    }
+    
+    // We start from the configuration, not the commands that built it
+    while(m_pConfig->getCommand()) {}
+    
+    m_sRoutingBuffer = handoff->value("routing_buffer");
+    m_oRoutingCharge.set(m_sRoutingBuffer.length());
+    
+    if(write(fd, &ack, 1) != 1) {
+        handoff->closeAll();
+        close(fd);
+        throw DaemonStartupException("live upgrade ack failed");
+    }
+    
+    close(fd);
+    LOG(INFO) << "live upgrade, took over " << handoff->size() << " descriptors";
+}
+
 /******************************************************************************
  * Method: ppid
  * Description: Tell the parent class the parent process id for a poison pill
@@ -164,6 +265,146 @@ void PortAgent::displayVersion() {
     cout << PORT_AGENT_VERSION << endl;
 }
 
+/******************************************************************************
+ * Method: upgrade
+ * Description: Live upgrade.  Start a new port agent and hand it our
+ * listeners, clients and instrument connection along with our configuration.
+ * When it confirms it has them we exit without closing anything.  If it
+ * doesn't we kill it and carry on.
+ *
+ * Writes we are still holding for the instrument would be lost so we refuse
+ * to upgrade until they are flushed.
+ ******************************************************************************/
+void PortAgent::upgrade() {
+    FDHandoff handoff;
+    CommBase *instrument = NULL;
+    string path = m_pConfig->upgradePath().length() ? m_pConfig->upgradePath() : m_sExecutable;
+    posix_spawn_file_actions_t actions;
+    vector<string> args;
+    vector<char *> argv;
+    struct pollfd pfd;
+    int sockets[2];
+    pid_t pid;
+    char ack = 0;
+    ostringstream out;
+    
+    if(m_pInstrumentConnection)
+        instrument = m_pInstrumentConnection->dataConnectionObject();
+    
+    if((instrument && instrument->writePending()) ||
+       (m_pDriverSplice && m_pDriverSplice->pending())) {
+        publishFault("upgrade deferred, instrument writes pending");
+        return;
+    }
+    
+    if(! path.length()) {
+        publishFault("upgrade failed, binary path unknown");
+        return;
+    }
+    
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets)) {
+        LOG(ERROR) << "upgrade socketpair failed: " << strerror(errno);
+        publishFault("upgrade failed, socketpair");
+        return;
+    }
+    
+    // The new process gets its end of the pair as UPGRADE_HANDOFF_FD and
+    // nothing else that wasn't already open without close on exec.
+    posix_spawn_file_actions_init(&actions);
+    
+    if(sockets[1] == UPGRADE_HANDOFF_FD)
+        fcntl(sockets[1], F_SETFD, 0);
+    else
+        posix_spawn_file_actions_adddup2(&actions, sockets[1], UPGRADE_HANDOFF_FD);
+    
+    // A daemon has closed stdio, don't let the new process log into a socket
+    for(int i = 0; i < UPGRADE_HANDOFF_FD; i++)
+        if(fcntl(i, F_GETFD) < 0)
+            posix_spawn_file_actions_addopen(&actions, i, "/dev/null", O_RDWR, 0);
+    
+    args.push_back(path);
+    args.push_back("-s");
+    out << m_pConfig->observatoryCommandPort();
+    args.push_back("-p");
+    args.push_back(out.str());
+    out.str("");
+    out << UPGRADE_HANDOFF_FD;
+    args.push_back("--upgrade_fd");
+    args.push_back(out.str());
+    
+    if(ppid()) {
+        out.str("");
+        out << ppid();
+        args.push_back("-y");
+        args.push_back(out.str());
+    }
+    
+    for(vector<string>::iterator i = args.begin(); i != args.end(); i++)
+        argv.push_back((char *)i->c_str());
+    argv.push_back(NULL);
+    
+    LOG(INFO) << "upgrade, starting " << path;
+    
+    int result = posix_spawn(&pid, path.c_str(), &actions, NULL, &argv[0], environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(sockets[1]);
+    
+    if(result) {
+        LOG(ERROR) << "upgrade spawn failed: " << strerror(result);
+        close(sockets[0]);
+        publishFault("upgrade failed, could not start " + path);
+        return;
+    }
+    
+    // Publish what an io_uring receive already took off the instrument
+    // socket, the new process only gets what's still in the kernel.
+    if(instrument) {
+        instrument->stopReadAhead();
+        
+        while(instrument->readPending()) {
+            fd_set readFDs;
+            FD_ZERO(&readFDs);
+            FD_SET(getInstrumentDataRxClientFD(), &readFDs);
+            handleInstrumentDataRead(readFDs);
+        }
+    }
+    
+    if(m_pObservatoryConnection)
+        m_pObservatoryConnection->handoffFDs(handoff);
+    
+    if(m_pInstrumentConnection)
+        m_pInstrumentConnection->handoffFDs(handoff);
+    
+    if(m_pTelnetSnifferConnection)
+        m_pTelnetSnifferConnection->handoffFDs(handoff);
+    
+    handoff.setValue("config", m_pConfig->getConfig());
+    handoff.setValue("routing_buffer", m_sRoutingBuffer);
+    
+    pfd.fd = sockets[0];
+    pfd.events = POLLIN;
+    
+    if(handoff.send(sockets[0]) &&
+       ::poll(&pfd, 1, UPGRADE_ACK_TIMEOUT * 1000) == 1 &&
+       read(sockets[0], &ack, 1) == 1 && ack) {
+        LOG(INFO) << "upgrade complete, handed off to pid: " << pid;
+        
+        // Exit without shutting down the sockets the new process now owns
+        // or removing its pid file.
+        exit(EXIT_SUCCESS);
+    }
+    
+    LOG(ERROR) << "upgrade not confirmed, stopping pid: " << pid;
+    close(sockets[0]);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    
+    // The new process may have claimed the pid file
+    init_pidfile();
+    
+    publishFault("upgrade failed, new process did not take over");
+}
+
 /******************************************************************************
  * Method: initializeObservatoryDataConnection
  * Description: Initialize the observatory data connection depending upon the
@@ -210,6 +451,9 @@ void PortAgent::initializeObservatoryStandardDataConnection() {
     
     // Initialize!
     connection->setDataPort(m_pConfig->observatoryDataPort());
+    applySocketProfile(connection, m_pConfig->observatorySocketProfile());
+    applyCompression(connection);
+    applySlowClientPolicy(connection);
     
     if (!connection->dataInitialized())
         connection->initializeDataSocket();
@@ -235,12 +479,24 @@ void PortAgent::initializeObservatoryMultiDataConnection() {
         pConnection = (ObservatoryMultiConnection*) m_pObservatoryConnection;
     }
 
+    applySocketProfile(pConnection, m_pConfig->observatorySocketProfile());
+    applyCompression(pConnection);
+    applySlowClientPolicy(pConnection);
+
+    pConnection->dataSockets()->setAcceptHandler(observatoryMultiDataAccept, this);
+    pConnection->dataSockets()->setReadHandler(observatoryMultiDataRead, this);
+
     // Iterate through the configured data ports and
     // add TCPCommListener objects for each port
     port = ObservatoryDataPorts::instance()->getFirstPort();
     while (port) {
         LOG(DEBUG) << "initializeObservatoryMultiDataConnection: adding listener for port: " << port;
-        pConnection->addListener(port);
+        try {
+            pConnection->addListener(port);
+        }
+        catch(SocketSelectFailure &e) {
+            publishFault(e.what());
+        }
 
         port = ObservatoryDataPorts::instance()->getNextPort();
     }
@@ -303,6 +559,7 @@ void PortAgent::initializeObservatoryCommandConnection() {
             m_pObservatoryConnection = new ObservatoryConnection();
             ObservatoryConnection* pConnection = (ObservatoryConnection*) m_pObservatoryConnection;
             pConnection->setCommandPort(m_pConfig->observatoryCommandPort());
+            applySocketProfile(pConnection, m_pConfig->observatorySocketProfile());
 
             if (!pConnection->commandInitialized())
                 m_pObservatoryConnection->initializeCommandSocket();
@@ -313,6 +570,7 @@ void PortAgent::initializeObservatoryCommandConnection() {
             m_pObservatoryConnection = new ObservatoryMultiConnection();
             ObservatoryMultiConnection* pConnection = (ObservatoryMultiConnection*) m_pObservatoryConnection;
             pConnection->setCommandPort(m_pConfig->observatoryCommandPort());
+            applySocketProfile(pConnection, m_pConfig->observatorySocketProfile());
 
             if (!pConnection->commandInitialized())
                 m_pObservatoryConnection->initializeCommandSocket();
@@ -324,6 +582,46 @@ void PortAgent::initializeObservatoryCommandConnection() {
     
 }
 
+/******************************************************************************
+ * Method: applySocketProfile
+ * Description: Set the configured socket profile, buffer size, listener
+ * options and I/O backend on a connection before its sockets are created.
+ * Instrument connections also get the configured TCP keepalive.
+ ******************************************************************************/
+void PortAgent::applySocketProfile(Connection *connection, uint16_t profile) {
+    if(! connection)
+        return;
+    
+    IORing::setEnabled(m_pConfig->ioBackend() == IO_BACKEND_URING);
+    
+    LOG(DEBUG2) << "socket profile: " << profile
+                << " buffer size: " << m_pConfig->socketBufferSize()
+                << " listen backlog: " << m_pConfig->listenBacklog()
+                << " reuse port: " << m_pConfig->listenReusePort()
+                << " takeover: " << m_pConfig->listenTakeover();
+    connection->setSocketProfile((SocketProfile)profile, m_pConfig->socketBufferSize());
+    connection->setListenOptions(m_pConfig->listenBacklog(), m_pConfig->listenReusePort(),
+                                 m_pConfig->listenTakeover());
+    
+    if(connection == m_pInstrumentConnection)
+        connection->setKeepalive(m_pConfig->instrumentKeepalive());
+}
+
+/******************************************************************************
+ * Method: applyCompression
+ * Description: Offer the configured compressed stream to clients of an
+ * observatory connection's data listeners.
+ ******************************************************************************/
+void PortAgent::applyCompression(Connection *connection) {
+    if(! connection)
+        return;
+    
+    LOG(DEBUG2) << "observatory compression: " << m_pConfig->observatoryCompression()
+                << " flush ms: " << m_pConfig->compressionFlush();
+    connection->setCompression(m_pConfig->observatoryCompression(),
+                               m_pConfig->compressionFlush() * 1000);
+}
+
 /******************************************************************************
  * Method: initializeInstrumentConnection
  * Description: Attempt to connect to the instrument.  This class will attempt
@@ -393,6 +691,8 @@ void PortAgent::initializeTCPInstrumentConnection() {
 
         setState(STATE_DISCONNECTED);
 
+        applySocketProfile(connection, m_pConfig->instrumentSocketProfile());
+
         try {
             connection->initialize();
         }
@@ -402,8 +702,10 @@ void PortAgent::initializeTCPInstrumentConnection() {
             LOG(ERROR) << msg;
         };
 
-        // Let everything connect
-        sleep(SELECT_SLEEP_TIME);
+        // The connect blocks so there is nothing to wait for once we are
+        // connected.  Only back off when the instrument isn't there.
+        if(!connection->connected())
+            sleep(SELECT_SLEEP_TIME);
     }
 
 
@@ -460,6 +762,8 @@ void PortAgent::initializeRSNInstrumentConnection() {
 
         setState(STATE_DISCONNECTED);
 
+        applySocketProfile(connection, m_pConfig->instrumentSocketProfile());
+
         try {
             connection->initialize();
         }
@@ -469,8 +773,10 @@ void PortAgent::initializeRSNInstrumentConnection() {
             LOG(ERROR) << msg;
         };
 
-        // Let everything connect
-        sleep(SELECT_SLEEP_TIME);
+        // The connect blocks so there is nothing to wait for once we are
+        // connected.  Only back off when the instrument isn't there.
+        if(!connection->connected())
+            sleep(SELECT_SLEEP_TIME);
     }
 
 
@@ -523,20 +829,14 @@ void PortAgent::initialize_BOTPT_InstrumentConnection() {
         
         setState(STATE_DISCONNECTED);
         
-        try {
-            connection->initialize();
-        }
-        catch(SocketConnectFailure &e) {
-            connection->disconnect();
-            string msg = e.what();
-            LOG(ERROR) << msg;
-        };
-        
-        // Let everything connect
-        sleep(SELECT_SLEEP_TIME);
+        applySocketProfile(connection, m_pConfig->instrumentSocketProfile());
+
+        // Each side reconnects on its own and a side that just failed is
+        // held off, so this doesn't block the main loop or drop the side
+        // that is still up.
+        connection->initialize();
     }
     
-    
     if(connection->connected())
         setState(STATE_CONNECTED);
 }
@@ -593,6 +893,98 @@ void PortAgent::initializeSerialInstrumentConnection() {
 }
 
 
+/******************************************************************************
+ * Method: applySlowClientPolicy
+ * Description: Set what happens to observatory data clients that fall behind.
+ ******************************************************************************/
+void PortAgent::applySlowClientPolicy(Connection *connection) {
+    if(! connection)
+        return;
+    
+    LOG(DEBUG2) << "slow client queue: " << m_pConfig->slowClientQueue()
+                << " policy: " << m_pConfig->slowClientPolicy();
+    connection->setSlowClientPolicy(m_pConfig->slowClientQueue(),
+                                    (SlowClientPolicy)m_pConfig->slowClientPolicy());
+}
+
+/******************************************************************************
+ * Method: applyThreadTuning
+ * Description: Place the main loop and publisher threads on their CPUs, set
+ * the main loop's scheduling and lock its memory.  The main loop reads the
+ * instrument, so that's the thread that gets real time priority.  It waits
+ * on the publisher threads for every packet, so they run at the same
+ * priority rather than leave it stuck behind normal processes.  A
+ * setting the system refuses, usually for want of privileges, is reported
+ * as a fault and the rest still apply.
+ ******************************************************************************/
+void PortAgent::applyThreadTuning() {
+    pthread_t self = pthread_self();
+    bool applied = true;
+    
+    applied = ThreadTuning::SetAffinity(self, m_pConfig->cpuAffinity()) && applied;
+    applied = m_oPublishers.setThreadAffinity(m_pConfig->publisherCpuAffinity()) && applied;
+    
+    if(ThreadTuning::RealtimePriority(self) != m_pConfig->realtimePriority())
+        applied = ThreadTuning::SetRealtime(self, m_pConfig->realtimePriority()) && applied;
+    applied = m_oPublishers.setThreadRealtime(m_pConfig->realtimePriority()) && applied;
+    
+    IORing::setLockMemory(m_pConfig->memoryLock());
+    if(! m_pConfig->memoryLock())
+        ThreadTuning::UnlockStack();
+    else if(! ThreadTuning::LockedStack())
+        applied = ThreadTuning::LockStack(THREAD_LOCK_STACK_SIZE) && applied;
+    
+    // Start measuring again under the new settings
+    m_oWakeLatency.reset();
+    
+    if(! applied)
+        publishFault("failed to apply thread settings");
+}
+
+/******************************************************************************
+ * Method: applyMemoryBudget
+ * Description: Hand the configured budget, subsystem limits and policy to
+ * the process wide memory accountant.  Buffers already over a new limit
+ * are left alone, they are held to it as they grow.
+ ******************************************************************************/
+void PortAgent::applyMemoryBudget() {
+    MemoryBudget &budget = MemoryBudget::Instance();
+    
+    budget.setBudget(m_pConfig->memoryBudget());
+    for(int i = 0; i < MEMORY_SUBSYSTEMS; i++)
+        budget.setLimit((MemorySubsystem)i, m_pConfig->memoryLimit((MemorySubsystem)i));
+    budget.setPolicy((MemoryPolicy)m_pConfig->memoryPolicy());
+    
+    LOG(DEBUG) << "memory budget: " << budget.budget() << " used: " << budget.used();
+}
+
+/******************************************************************************
+ * Method: disconnectInstrument
+ * Description: Close the instrument data connection so the next pass through
+ * the state machine opens it again.
+ ******************************************************************************/
+void PortAgent::disconnectInstrument() {
+    if(! m_pInstrumentConnection)
+        return;
+    
+    switch(m_pInstrumentConnection->connectionType()) {
+        case PACONN_INSTRUMENT_TCP:
+            ((InstrumentTCPConnection *)m_pInstrumentConnection)->disconnect();
+            break;
+        case PACONN_INSTRUMENT_RSN:
+            ((InstrumentRSNConnection *)m_pInstrumentConnection)->disconnect();
+            break;
+        case PACONN_INSTRUMENT_BOTPT:
+            ((InstrumentBOTPTConnection *)m_pInstrumentConnection)->disconnect();
+            break;
+        case PACONN_INSTRUMENT_SERIAL:
+            ((InstrumentSerialConnection *)m_pInstrumentConnection)->disconnect();
+            break;
+        default:
+            LOG(ERROR) << "Instrument connection type not recognized.";
+    }
+}
+
 /******************************************************************************
  * Method: initializeSerialSettings
  * Description: initialize serial settings; can be done independently of opening
@@ -607,6 +999,10 @@ bool PortAgent::initializeSerialSettings() {
     pConnection->setStopBits(m_pConfig->stopbits());
     pConnection->setDataBits(m_pConfig->databits());
     pConnection->setParity(m_pConfig->parity());
+    pConnection->setReadMode(m_pConfig->serialReadMode());
+    pConnection->setSentinle(m_pConfig->sentinleSequence());
+    pConnection->setCharDelay(m_pConfig->serialCharDelay());
+    pConnection->setLineDelay(m_pConfig->serialLineDelay());
     return pConnection->initializeSerialSettings();
 
 }
@@ -625,6 +1021,9 @@ void PortAgent::initializePublishers() {
     initializePublisherTCP();    
     initializePublisherUDP();    
     initializePublisherTelnetSniffer();    
+
+    if(m_pConfig && m_oPublishers.threads() != m_pConfig->publisherThreads())
+        m_oPublishers.setThreads(m_pConfig->publisherThreads());
 }
 
 /******************************************************************************
@@ -641,13 +1040,50 @@ void PortAgent::initializePublisherFile() {
     
     LOG(DEBUG) << "Setup data log initial file: " << m_pConfig->datafile();
     
+    recoverArchiveTail();
+    
     LogPublisher publisher;
     publisher.setFilebase(m_pConfig->datafile(), "data");
     publisher.setAsciiMode(false);
+    publisher.setRotationInterval(m_pConfig->rotation_interval());
     
     m_oPublishers.add(&publisher);
 }
 
+/******************************************************************************
+ * Method: recoverArchiveTail
+ * Description: Before we append to the data log, check the segment written
+ * last for a packet cut short by a power loss and cut it off so the archive
+ * parses cleanly.  Only done once for each data file base.  Skipped on a
+ * live upgrade, the process we replace may still be writing the segment.
+ ******************************************************************************/
+void PortAgent::recoverArchiveTail() {
+    ArchiveFileResult result;
+    Timestamp start;
+    string segment;
+    
+    if(m_sArchiveChecked == m_pConfig->datafile())
+        return;
+    
+    m_sArchiveChecked = m_pConfig->datafile();
+    
+    if(m_pConfig->upgradeFD())
+        return;
+    
+    segment = ArchiveVerifier::newestSegment(m_pConfig->datafile(), "data");
+    if(! segment.length())
+        return;
+    
+    ArchiveVerifier::recoverTail(segment, (ArchiveRecovery)m_pConfig->archiveRecovery(), result);
+    
+    if(result.torn())
+        m_iArchiveTornBytes += result.bytes - result.validLength;
+    
+    LOG(INFO) << "verified " << segment << " packets: " << result.packets
+              << " bytes: " << result.bytes << " torn: " << result.torn()
+              << " seconds: " << start.elapseTime();
+}
+
 /******************************************************************************
  * Method: initializePublisherObservatoryData
  * Description: Depending upon the observatory connection type, setup the
@@ -706,8 +1142,7 @@ void PortAgent::initializePublisherObservatoryStandardData() {
  * Description: setup the observatory data publisher
  ******************************************************************************/
 void PortAgent::initializePublisherObservatoryMultiData() {
-    CommBase *pConnection = 0;
-    //TCPCommListener* pListener = 0;
+    vector<TCPCommListener*> listeners;
 
     LOG(INFO) << "Initialize Observatory Multi Data Publisher";
     if( ! m_pObservatoryConnection ) {
@@ -716,14 +1151,21 @@ void PortAgent::initializePublisherObservatoryMultiData() {
         return;
     }
 
-    // Iterate through the listeners adding the clientFDs
-    pConnection = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pConnection) {
-        LOG(DEBUG) << "Create new publisher";
-        DriverDataPublisher publisher(pConnection);
+    ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->getSockets(listeners);
+    m_oRoutingKeys.clear();
+    m_sRoutingBuffer.clear();
+    m_oRoutingCharge.set(0);
+
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        string routingKey = ObservatoryDataPorts::instance()->routingKey((*i)->port());
+
+        LOG(DEBUG) << "Create new publisher, routing key: " << routingKey;
+        DriverDataPublisher publisher(*i);
+        publisher.setRoutingKey(routingKey);
         m_oPublishers.add(&publisher);
 
-        pConnection = ObservatoryDataSockets::instance()->getNextSocket();
+        if(routingKey.length())
+            m_oRoutingKeys.insert(routingKey);
     }
 }
 
@@ -768,12 +1210,7 @@ void PortAgent::initializePublisherInstrumentData() {
         return;
     }
     
-    if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_BOTPT) {
-        connection = ((InstrumentBOTPTConnection*) m_pInstrumentConnection)->dataTxConnectionObject();
-    }
-    else {
-        connection = m_pInstrumentConnection->dataConnectionObject();
-    }
+    connection = m_pInstrumentConnection->dataConnectionObject();
 
     if( ! connection ) {
         LOG(INFO) << "Instrument data connection not set. " 
@@ -879,12 +1316,15 @@ void PortAgent::initializePublisherUDP() {
  * process to affect change on the port agent from port agnet commands passed
  * in via the observatory command port.
  *
- * This method can accept multiple commands at once delimeted by newlines
+ * This method can accept multiple commands at once delimeted by newlines.
+ * Parsing stops at the first command that fails.
  * Parameter:
  *   commands - newline delimeted string of port agent commands.
  ******************************************************************************/
 void PortAgent::handlePortAgentCommand(const char * commands) {
     PortAgentCommand cmd;
+    istringstream lines(commands);
+    string line;
     LOG(DEBUG2) << "COMMAND DATA: " << commands;
     
     if(!m_pConfig)
@@ -894,7 +1334,9 @@ void PortAgent::handlePortAgentCommand(const char * commands) {
     while(cmd = m_pConfig->getCommand()) {
     }
     
-    m_pConfig->parse(commands);
+    while(getline(lines, line))
+        if(! m_pConfig->parse(line))
+            break;
     
     processPortAgentCommands();
     // TODO: Add code for commands. i.e. Configuration Update, shutdown, etc...
@@ -913,31 +1355,42 @@ void PortAgent::handlePortAgentCommand(const char * commands) {
 void PortAgent::processPortAgentCommands() {
     PortAgentCommand cmd;
     ostringstream msg;
+    bool configChanged = false;
 
     while(cmd = m_pConfig->getCommand()) {
         switch (cmd) {
             case CMD_COMM_CONFIG_UPDATE:
                 LOG(DEBUG) << "communication config update command";
                 setState(STATE_UNCONFIGURED);
+                configChanged = true;
                 break;
             case CMD_PUBLISHER_CONFIG_UPDATE:
                 LOG(DEBUG) << "publisher config update command";
+                configChanged = true;
                 break;
             case CMD_PATH_CONFIG_UPDATE:
                 LOG(DEBUG) << "path config update command";
+                configChanged = true;
                 break;
             case CMD_SAVE_CONFIG:
-                LOG(DEBUG) << "same config command";
-                publishFault("not implemented");
+                LOG(DEBUG) << "save config command";
+                if(m_pConfig->saveConfig())
+                    publishStatus("config saved");
+                else
+                    publishFault("failed to save config");
                 break;
             case CMD_GET_CONFIG:
                 LOG(DEBUG) << "get config command";
-                publishFault("not implemented");
+                publishStatus(m_pConfig->getConfig());
                 break;
             case CMD_GET_STATE:
                 LOG(DEBUG) << "get state command";
                 publishStatus(getCurrentStateAsString());
                 break;
+            case CMD_GET_STATS:
+                LOG(DEBUG) << "get stats command";
+                publishStatus(getStats());
+                break;
             case CMD_PING:
                 msg << "pong. version: " << PORT_AGENT_VERSION;
                 LOG(DEBUG) << "ping command. logger version: " << PORT_AGENT_VERSION;
@@ -955,13 +1408,39 @@ void PortAgent::processPortAgentCommands() {
             case CMD_ROTATION_INTERVAL:
                 LOG(DEBUG) << "set rotation interval";
                 setRotationInterval();
+                configChanged = true;
                 break;
             case CMD_SHUTDOWN:
                 LOG(DEBUG) << "shutdown command";
                 shutdown();
                 break;
+            case CMD_UPGRADE:
+                LOG(DEBUG) << "upgrade command";
+                upgrade();
+                break;
+            case CMD_THREAD_CONFIG_UPDATE:
+                LOG(DEBUG) << "thread config update command";
+                applyThreadTuning();
+                configChanged = true;
+                break;
+            case CMD_MEMORY_CONFIG_UPDATE:
+                LOG(DEBUG) << "memory config update command";
+                applyMemoryBudget();
+                configChanged = true;
+                break;
+            case CMD_TRANSACTION_COMMIT:
+                LOG(DEBUG) << "transaction commit command";
+                if(m_pConfig->transactionError().empty())
+                    publishStatus("transaction committed");
+                else
+                    publishFault("transaction commit failed: " + m_pConfig->transactionError());
+                break;
         };
     }
+    
+    // Keep a snapshot of every change so a restart can come up configured
+    if(configChanged)
+        m_pConfig->saveConfig();
 }
 
 
@@ -971,16 +1450,32 @@ void PortAgent::processPortAgentCommands() {
  * listener.
  * Parameter:
  *   listener - TCP listener object for managing the tcp connection.
+ *   selected - the client is watched by the main select, so its fd has to
+ *              fit in an fd_set
+ * Return:
+ *   true if a new client replaced the listener's last one
  ******************************************************************************/
-void PortAgent::handleTCPConnect(TCPCommListener &listener, bool persistent) {
+bool PortAgent::handleTCPConnect(TCPCommListener &listener, bool persistent, bool selected) {
+    bool accepted;
 
     LOG(DEBUG) << "persistent: " << persistent;
-    listener.acceptClient(persistent);
+    accepted = listener.acceptClient(persistent);
     LOG(DEBUG) << "new client FD: " << listener.clientFD();
     
     if(! listener.connected()) {
         throw SocketConnectFailure("tcp client connect");
     }
+    
+    // The main loop can't select on it
+    if(selected && listener.clientFD() >= FD_SETSIZE) {
+        ostringstream msg;
+        msg << "client fd " << listener.clientFD() << " on port " << listener.port()
+            << " is too large for select, disconnecting";
+        listener.disconnectClient();
+        publishFault(msg.str());
+    }
+
+    return accepted;
 }
 
 /******************************************************************************
@@ -1011,6 +1506,9 @@ void PortAgent::handleStateConfigured(const fd_set &readFDs) {
     initializeObservatoryDataConnection();
     initializeInstrumentConnection();
     initializePublishers();
+    
+    // Anything left from a live upgrade is no longer part of our config
+    FDHandoff::instance()->closeAll();
 }
 
 /******************************************************************************
@@ -1069,6 +1567,8 @@ void PortAgent::handleStateStartup() {
         
     LOG(DEBUG) << "start up state handler";
     
+    applyThreadTuning();
+    applyMemoryBudget();
     initializeObservatoryCommandConnection();
     setState(STATE_UNCONFIGURED);
 }
@@ -1088,16 +1588,38 @@ void PortAgent::handleCommon(const fd_set &readFDs) {
  ******************************************************************************/
 void PortAgent::poll() {
     fd_set readFDs;
+    fd_set writeFDs;
     struct timeval tv;
+    struct timeval *timeout;
     int readyCount;
     int maxFD = buildFDSet(readFDs);
+    int maxWriteFD = buildWriteFDSet(writeFDs);
+    CommBase *pInstrument = NULL;
+    vector<TCPCommListener*> listeners;
+    uint64_t wakeDeadline = 0;
+    
+    maxFD = maxWriteFD > maxFD ? maxWriteFD : maxFD;
+    
+    if(m_pInstrumentConnection)
+        pInstrument = m_pInstrumentConnection->dataConnectionObject();
     
-    tv.tv_sec = SELECT_SLEEP_TIME;
-    tv.tv_usec = 0;
+    // Block until a descriptor is ready or the next deadline, forever if
+    // nothing is scheduled.
+    timeout = selectTimeout(tv) ? &tv : NULL;
+    
+    if(timeout && (tv.tv_sec || tv.tv_usec))
+        wakeDeadline = ThreadTuning::MonotonicUsec() + tv.tv_sec * 1000000ULL + tv.tv_usec;
     
     // Main select to see if any incoming pipes have data.
     LOG(DEBUG) << "Start select process";
-    readyCount = select(maxFD+1, &readFDs, NULL, NULL, &tv);
+    readyCount = select(maxFD+1, &readFDs, &writeFDs, NULL, timeout);
+    
+    // A timed out select shows how long we waited for the CPU after the
+    // deadline
+    if(readyCount == 0 && wakeDeadline) {
+        uint64_t now = ThreadTuning::MonotonicUsec();
+        m_oWakeLatency.record(now > wakeDeadline ? now - wakeDeadline : 0);
+    }
     if(readyCount < 0) {
         if (errno != EINTR) 
             LOG(ERROR) << "Socket select error: " << strerror(errno);
@@ -1109,13 +1631,33 @@ void PortAgent::poll() {
 
     LOG(DEBUG) << "On select: ready to read on " << readyCount << " connections";
     
+    collectObservatoryEvents(readFDs);
+    
     LOG(DEBUG) << "Port Agent Version: " << PORT_AGENT_VERSION;
     LOG(DEBUG) << "CURRENT STATE: " << getCurrentStateAsString();
     
     try {
+        // Fire any instrument timers that are due and finish connects in
+        // progress before the state handlers look at the connection.
+        if(pInstrument) {
+            pInstrument->runTimers();
+            pInstrument->handleConnectFDs(writeFDs);
+        }
+        
+        checkDataStall();
+        
+        // Flush compressed observatory data that has waited long enough
+        getObservatoryDataListeners(listeners);
+        for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++)
+            (*i)->runTimers();
+        
         // We don't use else if here so that the work in one state handler
         // can change the state can call a subsiquent handler without having
-        // to iterate.
+        // to iterate.  Startup goes first so a saved config can take us
+        // straight through to configured.
+        if(getCurrentState() == STATE_STARTUP)
+            handleStateStartup();
+        
         if(getCurrentState() == STATE_UNCONFIGURED)
             handleStateUnconfigured(readFDs);
         
@@ -1128,11 +1670,13 @@ void PortAgent::poll() {
         if(getCurrentState() == STATE_DISCONNECTED)
             handleStateDisconnected(readFDs);
         
-        if(getCurrentState() == STATE_STARTUP)
-            handleStateStartup();
-        
         if(getCurrentState() == STATE_UNKNOWN)
             handleStateUnknown();
+        
+        if(getCurrentState() == STATE_CONNECTED)
+            handleInstrumentDataWrite(writeFDs);
+        
+        handleObservatoryWrite(writeFDs);
             
         handleCommon(readFDs);
             
@@ -1149,6 +1693,81 @@ void PortAgent::poll() {
     }
 }
 
+/******************************************************************************
+ * Method: selectTimeout
+ * Description: Work out how long the main select can block.  Each thing with
+ * a deadline offers a delay and we take the soonest:
+ *  * Start up, run right away
+ *  * Instrument reconnect while disconnected
+ *  * Parent process check if we can't be told when it goes away
+ *  * Paced instrument writes and instrument timers (e.g. end of a break)
+ *  * Compressed observatory data waiting for a flush
+ *  * Instrument data stall check
+ *  * Next heartbeat
+ *
+ * Return:
+ *  false if there is no deadline and we can wait indefinitely, otherwise
+ *  true with tv set to the delay.
+ ******************************************************************************/
+bool PortAgent::selectTimeout(struct timeval &tv) {
+    vector<TCPCommListener*> listeners;
+    uint64_t delay = 0;
+    CommBase *pInstrument = NULL;
+    
+    if(getCurrentState() == STATE_STARTUP) {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        return true;
+    }
+    
+    if(m_pInstrumentConnection)
+        pInstrument = m_pInstrumentConnection->dataConnectionObject();
+    
+    // Retry the instrument, unless it schedules its own retries
+    if((getCurrentState() == STATE_DISCONNECTED || (pInstrument && ! pInstrument->connected())) &&
+       ! (pInstrument && pInstrument->timerDelay()))
+        nextDeadline(delay, SELECT_SLEEP_TIME * 1000000);
+    
+    if(parent_polled())
+        nextDeadline(delay, SELECT_SLEEP_TIME * 1000000);
+    
+    if(pInstrument) {
+        nextDeadline(delay, pInstrument->writeDelay());
+        nextDeadline(delay, pInstrument->timerDelay());
+    }
+    
+    getObservatoryDataListeners(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++)
+        nextDeadline(delay, (*i)->timerDelay());
+    
+    nextDeadline(delay, m_oStallWatchdog.timerDelay());
+    
+    if(m_pConfig->heartbeatInterval()) {
+        time_t due = m_lLastHeartbeat + m_pConfig->heartbeatInterval() + 1;
+        time_t now = Clock::MonotonicSeconds();
+        nextDeadline(delay, due > now ? (uint64_t)(due - now) * 1000000 : 1);
+    }
+    
+    if(! delay) {
+        LOG(DEBUG) << "nothing scheduled, waiting for activity";
+        return false;
+    }
+    
+    tv.tv_sec = delay / 1000000;
+    tv.tv_usec = delay % 1000000;
+    return true;
+}
+
+/******************************************************************************
+ * Method: nextDeadline
+ * Description: Keep the soonest of two delays in microseconds.  0 means no
+ * deadline.
+ ******************************************************************************/
+void PortAgent::nextDeadline(uint64_t &delay, uint64_t candidate) {
+    if(candidate && (! delay || candidate < delay))
+        delay = candidate;
+}
+
 /******************************************************************************
  * Method: buildFDSet
  * Description: Build a fd_set of file descriptors of all of our read lines and
@@ -1160,7 +1779,9 @@ void PortAgent::poll() {
  *  * Observatory Data Connection (Listener)
  *  * Observatory Data Connection (Client)
  *  * Instrument Data Connection (Client)
+ *  * Instrument Event (e.g. waiting for a serial device)
  *  * Telnet Sniffer Connection (Listener)
+ *  * Signals and parent process exit
  * 
  * Return:
  *  the maximum file descriptor value.
@@ -1176,8 +1797,31 @@ int PortAgent::buildFDSet(fd_set &readFDs) {
     addObservatoryDataListenerFD(maxFD, readFDs);
     addObservatoryDataClientFD(maxFD, readFDs);
     addInstrumentDataClientFD(maxFD, readFDs);
+    addInstrumentEventFD(maxFD, readFDs);
     addTelnetSnifferListenerFD(maxFD, readFDs);
     addTelnetSnifferClientFD(maxFD, readFDs);
+    addProcessWatchFDs(maxFD, readFDs);
+    
+    return maxFD;
+}
+
+/******************************************************************************
+ * Method: buildWriteFDSet
+ * Description: Build a fd_set of file descriptors that have queued data
+ * waiting to be written or a connect in progress.
+ *
+ * Return:
+ *  the maximum file descriptor value.
+ *  writeFDs populated with all FDs waiting to write
+ ******************************************************************************/
+int PortAgent::buildWriteFDSet(fd_set &writeFDs) {
+    int maxFD = 0;
+    
+    FD_ZERO(&writeFDs);
+    
+    addInstrumentDataWriteFD(maxFD, writeFDs);
+    addInstrumentConnectFDs(maxFD, writeFDs);
+    addObservatoryWriteFDs(maxFD, writeFDs);
     
     return maxFD;
 }
@@ -1302,7 +1946,7 @@ void PortAgent::addObservatoryDataListenerFD(int &maxFD, fd_set &readFDs) {
             addObservatoryStandardDataListenerFD(maxFD, readFDs);
         }
         else if (PACONN_OBSERVATORY_MULTI == connectionType) {
-            addObservatoryMultiDataListenerFDs(maxFD, readFDs);
+            addObservatoryMultiDataPollFD(maxFD, readFDs);
         }
         else {
             LOG(ERROR) << "PortAgent::addObservatoryDataListenerFD: unknown observatory type: " << connectionType;
@@ -1339,29 +1983,14 @@ void PortAgent::addObservatoryStandardDataListenerFD(int &maxFD, fd_set &readFDs
 }
 
 /******************************************************************************
- * Method: addObservatoryMultiDataListenerFDs
- * Description: Iterate through the listeners, adding their fds to the fd_set.
- * Also update the max file descriptor.
- *
- * If the connection isn't initialized then do nothing.
+ * Method: addObservatoryMultiDataPollFD
+ * Description: Add the data socket registry's epoll fd to the fd_set.  It
+ * is ready when any data listener or client is, see
+ * collectObservatoryEvents.  Also update the max file descriptor.
  ******************************************************************************/
-void PortAgent::addObservatoryMultiDataListenerFDs(int &maxFD, fd_set &readFDs) {
-    TCPCommListener* pListener = 0;
-
-    if (m_pObservatoryConnection) {
-        pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-        while (pListener) {
-            if (pListener->listening()) {
-                int fd = pListener->serverFD();
-                if (fd) {
-                    LOG(DEBUG2) << "adding observatory multi data listener FD: " << fd;
-                    maxFD = fd > maxFD ? fd : maxFD;
-                    FD_SET(fd, &readFDs);
-                }
-            }
-            pListener = ObservatoryDataSockets::instance()->getNextSocket();
-        }
-    }
+void PortAgent::addObservatoryMultiDataPollFD(int &maxFD, fd_set &readFDs) {
+    if (m_pObservatoryConnection)
+        ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->addPollFD(maxFD, readFDs);
 }
 
 /******************************************************************************
@@ -1381,7 +2010,7 @@ void PortAgent::addObservatoryDataClientFD(int &maxFD, fd_set &readFDs) {
             addObservatoryStandardDataClientFD(maxFD, readFDs);
         }
         else if (PACONN_OBSERVATORY_MULTI == connectionType) {
-            addObservatoryMultiDataClientFDs(maxFD, readFDs);
+            // Watched through the registry's epoll fd with the listeners
         }
         else {
             LOG(ERROR) << "PortAgent::addObservatoryDataClientFD: unknown observatory type: " << connectionType;
@@ -1405,6 +2034,16 @@ void PortAgent::addObservatoryStandardDataClientFD(int &maxFD, fd_set &readFDs)
 
         fd = getObservatoryDataClientFD();
 
+        // Hold off reading more driver data until the spliced data has
+        // been taken by the instrument.
+        if(m_pDriverSplice && m_pDriverSplice->pending()) {
+            if(canSpliceDriverData()) {
+                LOG(DEBUG2) << "observatory data client blocked on splice";
+                return;
+            }
+            m_pDriverSplice->reset();
+        }
+
         if(fd) {
             LOG(DEBUG2) << "add observatory data client FD";
             maxFD = fd > maxFD ? fd : maxFD;
@@ -1416,32 +2055,6 @@ void PortAgent::addObservatoryStandardDataClientFD(int &maxFD, fd_set &readFDs)
     }
 }
 
-/******************************************************************************
- * Method: addObservatoryMultiDataClientFD
- * Description: Iterate through the connections, adding their fds to the fd_set.
- * Also update the max file descriptor.
- *
- * If the connection isn't initialized then do nothing.
- ******************************************************************************/
-void PortAgent::addObservatoryMultiDataClientFDs(int &maxFD, fd_set &readFDs) {
-    TCPCommListener* pListener = 0;
-    
-    if (m_pObservatoryConnection) {
-        pListener = ObservatoryDataSockets::instance()->getFirstSocket();
-        while (pListener) {
-            if (pListener->connected()) {
-                int fd = pListener->clientFD();
-                if (fd) {
-                    LOG(DEBUG2) << "adding observatory multi data client FD: " << fd;
-                    maxFD = fd > maxFD ? fd : maxFD;
-                    FD_SET(fd, &readFDs);
-                }
-            }
-            pListener = ObservatoryDataSockets::instance()->getNextSocket();
-        }
-    }
-}
-
 /******************************************************************************
  * Method: addInstrumentDataClientFD
  * Description: Add the instrument client fd to the fd_set.  Also update
@@ -1450,16 +2063,7 @@ void PortAgent::addObservatoryMultiDataClientFDs(int &maxFD, fd_set &readFDs) {
  * If the connection isn't initialized then do nothing.
  ******************************************************************************/
 void PortAgent::addInstrumentDataClientFD(int &maxFD, fd_set &readFDs) {
-    CommBase *pConnection;
-    
-
     if(m_pInstrumentConnection) {
-        if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_BOTPT) {
-            pConnection = ((InstrumentBOTPTConnection*) m_pInstrumentConnection)->dataTxConnectionObject();
-        }
-        else {
-            pConnection = m_pInstrumentConnection->dataConnectionObject();
-        }
         int fd = 0;
         
         fd = getInstrumentDataRxClientFD();
@@ -1475,6 +2079,106 @@ void PortAgent::addInstrumentDataClientFD(int &maxFD, fd_set &readFDs) {
     }
 }
 
+/******************************************************************************
+ * Method: addInstrumentEventFD
+ * Description: Add the instrument connection's event fd, if it has one, so
+ * we wake up to run its timers.  e.g. a serial device being plugged in.
+ ******************************************************************************/
+void PortAgent::addInstrumentEventFD(int &maxFD, fd_set &readFDs) {
+    CommBase *pConnection;
+    int fd;
+    
+    if(! m_pInstrumentConnection)
+        return;
+    
+    pConnection = m_pInstrumentConnection->dataConnectionObject();
+    
+    if(pConnection && (fd = pConnection->eventFD()) > 0) {
+        LOG(DEBUG2) << "add instrument event FD";
+        maxFD = fd > maxFD ? fd : maxFD;
+        FD_SET(fd, &readFDs);
+    }
+}
+
+/******************************************************************************
+ * Method: addProcessWatchFDs
+ * Description: Add the signal and parent watch fds from the daemon process so
+ * a signal or our parent exiting wakes up the select.
+ ******************************************************************************/
+void PortAgent::addProcessWatchFDs(int &maxFD, fd_set &readFDs) {
+    int fds[2] = { signal_fd(), parent_fd() };
+    
+    for(int i = 0; i < 2; i++) {
+        if(fds[i] > 0) {
+            maxFD = fds[i] > maxFD ? fds[i] : maxFD;
+            FD_SET(fds[i], &readFDs);
+        }
+    }
+}
+
+/******************************************************************************
+ * Method: addInstrumentDataWriteFD
+ * Description: Add the instrument data fd to the write fd_set if there is
+ * queued data and the write isn't being held back by pacing.
+ ******************************************************************************/
+void PortAgent::addInstrumentDataWriteFD(int &maxFD, fd_set &writeFDs) {
+    CommBase *pConnection;
+    
+    if(! m_pInstrumentConnection)
+        return;
+    
+    pConnection = m_pInstrumentConnection->dataConnectionObject();
+    
+    if(pConnection && pConnection->connected() &&
+       ((pConnection->writePending() && ! pConnection->writeDelay()) ||
+        (m_pDriverSplice && m_pDriverSplice->pending()))) {
+        int fd = getInstrumentDataTxClientFD();
+        
+        if (fd) {
+            LOG(DEBUG2) << "add instrument data write FD";
+            maxFD = fd > maxFD ? fd : maxFD;
+            FD_SET(fd, &writeFDs);
+        }
+    }
+}
+
+/******************************************************************************
+ * Method: addInstrumentConnectFDs
+ * Description: Add instrument sockets with a connect in progress to the
+ * write fd_set so we wake when they finish.
+ ******************************************************************************/
+void PortAgent::addInstrumentConnectFDs(int &maxFD, fd_set &writeFDs) {
+    CommBase *pConnection;
+    
+    if(! m_pInstrumentConnection)
+        return;
+    
+    pConnection = m_pInstrumentConnection->dataConnectionObject();
+    
+    if(pConnection)
+        pConnection->addConnectFDs(maxFD, writeFDs);
+}
+
+/******************************************************************************
+ * Method: addObservatoryWriteFDs
+ * Description: Add the observatory clients with queued writes to the write
+ * fd_set.  The data socket registry watches its own clients.
+ ******************************************************************************/
+void PortAgent::addObservatoryWriteFDs(int &maxFD, fd_set &writeFDs) {
+    vector<TCPCommListener*> listeners;
+    
+    getObservatoryListeners(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        int fd = (*i)->clientFD();
+        
+        if(fd && (*i)->writePending() && ! observatoryPolled(*i)) {
+            LOG(DEBUG2) << "add observatory write FD: " << fd;
+            maxFD = fd > maxFD ? fd : maxFD;
+            FD_SET(fd, &writeFDs);
+        }
+    }
+}
+
 /******************************************************************************
  * Method: getTelnetSnifferListenerFD
  * Description: Get the file descriptor
@@ -1487,6 +2191,64 @@ int PortAgent::getTelnetSnifferListenerFD() {
     return 0;
 }
 
+/******************************************************************************
+ * Method: getObservatoryDataListeners
+ * Description: Get the observatory data listeners, one for a standard
+ * connection or one per port for a multi connection.
+ ******************************************************************************/
+void PortAgent::getObservatoryDataListeners(vector<TCPCommListener*> &listeners) {
+    CommBase *pSocket;
+    
+    listeners.clear();
+    
+    if(! m_pObservatoryConnection)
+        return;
+    
+    if(m_pObservatoryConnection->connectionType() == PACONN_OBSERVATORY_MULTI)
+        ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->getSockets(listeners);
+    else if((pSocket = m_pObservatoryConnection->dataConnectionObject()) &&
+            pSocket->type() == COMM_TCP_LISTENER)
+        listeners.push_back((TCPCommListener*)pSocket);
+}
+
+/******************************************************************************
+ * Method: getObservatoryListeners
+ * Description: The data listeners and the command listener.  All of them
+ * are written to by publishers.
+ ******************************************************************************/
+void PortAgent::getObservatoryListeners(vector<TCPCommListener*> &listeners) {
+    CommBase *pSocket;
+    
+    getObservatoryDataListeners(listeners);
+    
+    if(m_pObservatoryConnection && m_pObservatoryConnection->commandInitialized() &&
+       (pSocket = m_pObservatoryConnection->commandConnectionObject()) &&
+       pSocket->type() == COMM_TCP_LISTENER)
+        listeners.push_back((TCPCommListener*)pSocket);
+}
+
+/******************************************************************************
+ * Method: observatoryPolled
+ * Description: Is this listener one of the data socket registry's?  Those
+ * are watched through the registry's epoll set rather than select.
+ ******************************************************************************/
+bool PortAgent::observatoryPolled(TCPCommListener *listener) {
+    return m_pObservatoryConnection &&
+           m_pObservatoryConnection->connectionType() == PACONN_OBSERVATORY_MULTI &&
+           ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->findSocket(listener->port()) == listener;
+}
+
+/******************************************************************************
+ * Method: collectObservatoryEvents
+ * Description: After the select, have the data socket registry read which of
+ * its fds are ready.  The state handlers dispatch them.
+ ******************************************************************************/
+void PortAgent::collectObservatoryEvents(const fd_set &readFDs) {
+    if(m_pObservatoryConnection &&
+       m_pObservatoryConnection->connectionType() == PACONN_OBSERVATORY_MULTI)
+        ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->collect(readFDs);
+}
+
 /******************************************************************************
  * Method: getObservatoryCommandListenerFD
  * Description: Get the file descriptor
@@ -1551,20 +2313,11 @@ int PortAgent::getObservatoryDataClientFD() {
  * Description: Get the Tx file descriptor
  ******************************************************************************/
 int PortAgent::getInstrumentDataTxClientFD() {
-    CommBase *pConnection;;
-    TCPCommSocket *socket;
-
-    if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_BOTPT) {
-        pConnection = ((InstrumentBOTPTConnection*) m_pInstrumentConnection)->dataTxConnectionObject();
-    }
-    else {
-        pConnection = m_pInstrumentConnection->dataConnectionObject();
-    }
+    CommBase *pConnection = m_pInstrumentConnection->dataConnectionObject();
 
     if (m_pInstrumentConnection->dataConnected()) {
-        socket = (TCPCommSocket*)pConnection;
-        if(socket && socket->connected())
-            return socket->getSocketFD();
+        if(pConnection && pConnection->connected())
+            return pConnection->writeFD();
     }
     else {
         LOG(ERROR) << "Instrument data client not connected";
@@ -1578,26 +2331,17 @@ int PortAgent::getInstrumentDataTxClientFD() {
  * Description: Get the Rx file descriptor
  ******************************************************************************/
 int PortAgent::getInstrumentDataRxClientFD() {
-    CommBase *pConnection;;
-    TCPCommSocket *socket;
-
-    if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_BOTPT) {
-        pConnection = ((InstrumentBOTPTConnection*) m_pInstrumentConnection)->dataRxConnectionObject();
-    }
-    else {
-        pConnection = m_pInstrumentConnection->dataConnectionObject();
-    }
+    CommBase *pConnection = m_pInstrumentConnection->dataConnectionObject();
 
     if (m_pInstrumentConnection->dataConnected()) {
-        socket = (TCPCommSocket*)pConnection;
-        if(socket && socket->connected())
-            return socket->getSocketFD();
+        if(pConnection && pConnection->connected())
+            return pConnection->readFD();
     }
     else {
         LOG(ERROR) << "Instrument data client not connected";
     }
-    
-    return 0;    
+
+    return 0;
 }
 
 /******************************************************************************
@@ -1607,7 +2351,7 @@ int PortAgent::getInstrumentDataRxClientFD() {
  ******************************************************************************/
 void PortAgent::publishHeartbeat() {
     Timestamp ts;
-    time_t now = time(NULL);
+    time_t now = Clock::MonotonicSeconds();
     
     // if we have specificed a heartbeat interval and we need to send a heartbeat
     if(m_pConfig->heartbeatInterval() && now - m_lLastHeartbeat > m_pConfig->heartbeatInterval() ) {
@@ -1631,6 +2375,30 @@ void PortAgent::publishFault(const string &msg) {
     publishPacket(&packet);
 }
 
+/******************************************************************************
+ * Method: checkDataStall
+ * Description: Reconnect to the instrument if it has stopped sending data.
+ * A TCP peer that vanished without a FIN or a wedged serial converter never
+ * shows up as an error, so the only sign is the data stopping.  Closing the
+ * connection lets the disconnected state connect again right away.
+ ******************************************************************************/
+void PortAgent::checkDataStall() {
+    ostringstream msg;
+    
+    m_oStallWatchdog.setTimeout(m_pConfig->dataStallTimeout());
+    
+    if(! m_pInstrumentConnection || ! m_oStallWatchdog.check())
+        return;
+    
+    msg << "instrument data stalled, no data for "
+        << (Clock::MonotonicUsec() - m_oStallWatchdog.lastDataUsec()) / 1000
+        << "ms, reconnecting";
+    publishFault(msg.str());
+    
+    disconnectInstrument();
+    setState(STATE_DISCONNECTED);
+}
+
 /******************************************************************************
  * Method: publishStatus
  * Description: Generate a status packet and send it to the publishers.
@@ -1661,7 +2429,7 @@ void PortAgent::publishPacket(char *payload, uint16_t size, PacketType type) {
     Timestamp ts;
 
      // Create a packet based upon the type
-    if (DATA_FROM_INSTRUMENT == type) {
+    if (DATA_FROM_INSTRUMENT == type || DATA_FROM_DRIVER == type) {
         PortAgentPacket packet(type, ts, payload, size);
         publishPacket(&packet);
     }
@@ -1676,6 +2444,58 @@ void PortAgent::publishPacket(char *payload, uint16_t size, PacketType type) {
     }
 }
 
+/******************************************************************************
+ * Method: publishRoutedInstrumentData
+ * Description: Split instrument data into newline terminated records and
+ * publish each one to the data ports whose routing key it starts with.  A
+ * trailing partial record is held until the rest of it arrives, unless the
+ * publisher memory budget won't take it.  Then it goes out unrouted rather
+ * than being held.
+ ******************************************************************************/
+void PortAgent::publishRoutedInstrumentData(const char *payload, uint16_t size) {
+    Timestamp ts;
+    string::size_type end;
+    bool admitted = m_oRoutingCharge.resize(m_sRoutingBuffer.length() + size);
+
+    m_sRoutingBuffer.append(payload, size);
+
+    while((end = m_sRoutingBuffer.find('\n')) != string::npos) {
+        string record = m_sRoutingBuffer.substr(0, end + 1);
+        m_sRoutingBuffer.erase(0, end + 1);
+
+        PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, (char *)record.data(), record.length());
+        m_oPublishers.publish(&packet, matchRoutingKey(record));
+    }
+
+    if(m_sRoutingBuffer.length() && (! admitted || m_sRoutingBuffer.length() > ROUTING_BUFFER_SIZE)) {
+        LOG(DEBUG) << "routing buffer " << (admitted ? "full" : "over budget")
+                   << ", publishing unrouted: " << m_sRoutingBuffer.length();
+        PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, (char *)m_sRoutingBuffer.data(), m_sRoutingBuffer.length());
+        m_oPublishers.publish(&packet, string());
+        m_sRoutingBuffer.clear();
+    }
+
+    m_oRoutingCharge.set(m_sRoutingBuffer.length());
+}
+
+/******************************************************************************
+ * Method: matchRoutingKey
+ * Description: Find the longest routing key that a record starts with.
+ * Return:
+ *   the routing key or an empty string if none match
+ ******************************************************************************/
+const string & PortAgent::matchRoutingKey(const string &record) {
+    static const string none;
+    const string *match = &none;
+
+    for(set<string>::iterator i = m_oRoutingKeys.begin(); i != m_oRoutingKeys.end(); i++) {
+        if(i->length() > match->length() && record.compare(0, i->length(), *i) == 0)
+            match = &(*i);
+    }
+
+    return *match;
+}
+
 /******************************************************************************
  * Method: handleTelnetSnifferAccept
  * Description: Accept connection to the telnet sniffer connection.
@@ -1739,19 +2559,27 @@ void PortAgent::handleObservatoryCommandAccept(const fd_set &readFDs) {
         // pass the connection type here, because the
         // handleTCPConnect will call acceptClient(), which has been modified
         // to disconnect after the client is successfully accepted.
-        handleTCPConnect(*((TCPCommListener*)pConnection), true);
+        // A partial line or open transaction belonged to the last client
+        if(handleTCPConnect(*((TCPCommListener*)pConnection), true)) {
+            m_oCommandLines.clear();
+            if(m_pConfig->inTransaction())
+                m_pConfig->rollbackTransaction();
+        }
     }
 }
 
 /******************************************************************************
  * Method: handleObservatoryCommandRead
- * Description: Read from the observatory command port
+ * Description: Read from the observatory command port.  Commands are
+ * handled once their whole line has arrived, a read can end part way
+ * through one.  Every whole line from a read is handled as one batch.
  ******************************************************************************/
 void PortAgent::handleObservatoryCommandRead(const fd_set &readFDs) {
     CommBase *pConnection = m_pObservatoryConnection->commandConnectionObject();
     int clientFD = getObservatoryCommandClientFD();
     int bytesRead = 0;
     char buffer[1024];
+    string commands, line;
     
     LOG(DEBUG) << "handleObservatoryCommandRead - do we need to read from the observatory command";
     LOG(DEBUG) << "Observatory Command Client FD: " << clientFD;
@@ -1763,7 +2591,17 @@ void PortAgent::handleObservatoryCommandRead(const fd_set &readFDs) {
         
         if (bytesRead) {
             LOG(DEBUG2) << "Bytes read: " << bytesRead;
-            handlePortAgentCommand(buffer);
+            
+            if(! m_oCommandLines.append(buffer, bytesRead))
+                publishFault("command line too long, dropped");
+            
+            while(m_oCommandLines.nextLine(line))
+                if(line.length())
+                    commands += line + "\n";
+            
+            if(commands.length())
+                handlePortAgentCommand(commands.c_str());
+            
             publishPacket(buffer, bytesRead, PORT_AGENT_COMMAND);
         }
     }
@@ -1806,28 +2644,24 @@ void PortAgent::handleObservatoryStandardDataAccept(const fd_set &readFDs) {
 }
 
 /******************************************************************************
- * Method: handleObservatoryDataAccept
- * Description: Iterate through the observatory data connections accepting
- * those that are ready.
+ * Method: handleObservatoryMultiDataAccept
+ * Description: Have the data socket registry accept connections on the
+ * listeners its epoll set reported ready this pass.
  ******************************************************************************/
 void PortAgent::handleObservatoryMultiDataAccept(const fd_set &readFDs) {
-    CommBase *pConnection = 0;
-    int serverFD = 0;
-    
     LOG(DEBUG) << "handleObservatoryMultiDataAccept - checking for new connections";
 
-    // Iterate through the listeners adding the clientFDs
-    pConnection = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pConnection) {
-        // Accept a new observatory command client
-        serverFD = ((TCPCommListener*)pConnection)->serverFD();
-        if(serverFD && FD_ISSET(serverFD, &readFDs)) {
-            LOG(DEBUG) << "Observatory data listener has new connection request";
-            handleTCPConnect(*((TCPCommListener*)pConnection));
-        }
+    ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->dispatchAccept();
+}
 
-        pConnection = ObservatoryDataSockets::instance()->getNextSocket();
-    }
+/******************************************************************************
+ * Method: observatoryMultiDataAccept
+ * Description: Registry callback for a data listener with a connection
+ * waiting.
+ ******************************************************************************/
+void PortAgent::observatoryMultiDataAccept(TCPCommListener *listener, void *context) {
+    LOG(DEBUG) << "Observatory data listener has new connection request";
+    ((PortAgent*)context)->handleTCPConnect(*listener, false, false);
 }
 
 /******************************************************************************
@@ -1862,6 +2696,9 @@ void PortAgent::handleObservatoryStandardDataRead(const fd_set &readFDs) {
     LOG(DEBUG2) << "Observatory Data Client FD: " << clientFD;
 
     if(clientFD && FD_ISSET(clientFD, &readFDs)) {
+        if(canSpliceDriverData() && spliceDriverData((TCPCommListener*)pConnection))
+            return;
+        
         LOG(DEBUG2) << "Read data from Observatory Data Client FD: " << clientFD;
         bytesRead = ((TCPCommListener*)pConnection)->readData(buffer, 1023);
         buffer[bytesRead] = '\0';
@@ -1873,35 +2710,123 @@ void PortAgent::handleObservatoryStandardDataRead(const fd_set &readFDs) {
     }
 }
 
+/******************************************************************************
+ * Method: canSpliceDriverData
+ * Description: Driver data can be spliced straight to the instrument when
+ * it's enabled and we have a single driver talking to a TCP instrument.
+ ******************************************************************************/
+bool PortAgent::canSpliceDriverData() {
+    if(! m_pConfig->driverSplice())
+        return false;
+    
+    if(! m_pObservatoryConnection ||
+       m_pObservatoryConnection->connectionType() != PACONN_OBSERVATORY_STANDARD)
+        return false;
+    
+    // The driver's first bytes may be a compression hello, read them ourselves
+    if(((TCPCommListener*)m_pObservatoryConnection->dataConnectionObject())->handshakePending())
+        return false;
+    
+    if(! m_pInstrumentConnection ||
+       m_pInstrumentConnection->connectionType() != PACONN_INSTRUMENT_TCP ||
+       ! m_pInstrumentConnection->dataConnected())
+        return false;
+    
+    return true;
+}
+
+/******************************************************************************
+ * Method: spliceDriverData
+ * Description: Move driver data to the instrument without copying it through
+ * user space.  A tee'd copy is published to everything but the instrument
+ * so the archive and other observers still see the data.  The archive
+ * packets are checksummed so they need the bytes; the copy is still one
+ * less than reading the data in and writing it back out.  If the copy
+ * fails the data is taken back out of the pipe and published the buffered
+ * way, so nothing reaches the instrument without being archived.
+ *
+ * Return:
+ *   false if the splice pipe isn't available, or data published the buffered
+ *   way is still queued for the instrument, and the data should be read the
+ *   normal way.
+ ******************************************************************************/
+bool PortAgent::spliceDriverData(TCPCommListener *pConnection) {
+    char buffer[SPLICE_CHUNK_SIZE];
+    bool closed = false;
+    uint32_t bytesRead;
+    
+    if(! m_pDriverSplice)
+        m_pDriverSplice = new SplicePipe();
+    
+    if(! m_pDriverSplice->initialized() && ! m_pDriverSplice->initialize()) {
+        LOG(ERROR) << "splice unavailable, falling back to buffered reads";
+        return false;
+    }
+    
+    // Queued data has to reach the instrument ahead of anything we splice
+    if(! m_pDriverSplice->pending() &&
+       m_pInstrumentConnection->dataConnectionObject()->writePending())
+        return false;
+    
+    LOG(DEBUG2) << "Splice data from Observatory Data Client FD: " << pConnection->clientFD();
+    
+    if(! m_pDriverSplice->pending()) {
+        if(m_pDriverSplice->fill(pConnection->clientFD(), closed)) {
+            bytesRead = m_pDriverSplice->peek(buffer, sizeof(buffer));
+            
+            if(bytesRead) {
+                Timestamp ts;
+                PortAgentPacket packet(DATA_FROM_DRIVER, ts, buffer, bytesRead);
+                m_oPublishers.publish(&packet, PUBLISHER_INSTRUMENT_DATA);
+            }
+            else {
+                ostringstream msg;
+                msg << "driver data tee failed, published by copy. failures: "
+                    << m_pDriverSplice->teeFailures();
+                publishFault(msg.str());
+                
+                bytesRead = m_pDriverSplice->consume(buffer, sizeof(buffer));
+                if(bytesRead)
+                    publishPacket(buffer, bytesRead, DATA_FROM_DRIVER);
+            }
+        }
+        
+        if(closed) {
+            LOG(INFO) << "Observatory data client closed";
+            pConnection->disconnectClient();
+        }
+    }
+    
+    m_pDriverSplice->drain(getInstrumentDataTxClientFD());
+    return true;
+}
+
 /******************************************************************************
  * Method: handleObservatoryMultiDataRead
- * Description: Iterate through the observatory data connections reading
- * those that are ready.
+ * Description: Have the data socket registry read from the clients its
+ * epoll set reported ready this pass.
  ******************************************************************************/
 void PortAgent::handleObservatoryMultiDataRead(const fd_set &readFDs) {
-    CommBase *pConnection = 0;
-    int bytesRead = 0;
-    char buffer[1024];
-
     LOG(DEBUG) << "handleObservatoryDataRead - checking for observatory multi data";
 
-    // Iterate through the listeners checking the clientFDs
-    pConnection = ObservatoryDataSockets::instance()->getFirstSocket();
-    while (pConnection) {
-        int clientFD = ((TCPCommListener*) pConnection)->clientFD();
-        LOG(DEBUG2) << "Observatory Data Client FD: " << clientFD;
+    ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->dispatchRead();
+}
 
-        if (clientFD && FD_ISSET(clientFD, &readFDs)) {
-            LOG(DEBUG2) << "Read data from Observatory Data Client FD: " << clientFD;
-            bytesRead = ((TCPCommListener*)pConnection)->readData(buffer, 1023);
-            buffer[bytesRead] = '\0';
+/******************************************************************************
+ * Method: observatoryMultiDataRead
+ * Description: Registry callback for a data client with data waiting.
+ ******************************************************************************/
+void PortAgent::observatoryMultiDataRead(TCPCommListener *listener, void *context) {
+    int bytesRead = 0;
+    char buffer[1024];
 
-            if(bytesRead) {
-                LOG(DEBUG2) << "Bytes read: " << bytesRead;
-                publishPacket(buffer, bytesRead, DATA_FROM_DRIVER);
-            }
-        }
-        pConnection = ObservatoryDataSockets::instance()->getNextSocket();
+    LOG(DEBUG2) << "Read data from Observatory Data Client FD: " << listener->clientFD();
+    bytesRead = listener->readData(buffer, 1023);
+    buffer[bytesRead] = '\0';
+
+    if(bytesRead) {
+        LOG(DEBUG2) << "Bytes read: " << bytesRead;
+        ((PortAgent*)context)->publishPacket(buffer, bytesRead, DATA_FROM_DRIVER);
     }
 }
 
@@ -1910,14 +2835,7 @@ void PortAgent::handleObservatoryMultiDataRead(const fd_set &readFDs) {
  * Description: Read from the instrument data port
  ******************************************************************************/
 void PortAgent::handleInstrumentDataRead(const fd_set &readFDs) {
-    CommBase *pConnection;
-
-    if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_BOTPT) {
-        pConnection = ((InstrumentBOTPTConnection*) m_pInstrumentConnection)->dataRxConnectionObject();
-    }
-    else {
-        pConnection = m_pInstrumentConnection->dataConnectionObject();
-    }
+    CommBase *pConnection = m_pInstrumentConnection->dataConnectionObject();
 
     int clientFD = getInstrumentDataRxClientFD();
     int bytesRead = 0;
@@ -1936,21 +2854,76 @@ void PortAgent::handleInstrumentDataRead(const fd_set &readFDs) {
     if(clientFD && FD_ISSET(clientFD, &readFDs)) {
         LOG(DEBUG) << "Read data from Instrument Data Client FD: " << clientFD;
         bytesRead = pConnection->readData(buffer, 1023);
+        PROBE2(instrument__read, clientFD, bytesRead);
         
         if(bytesRead) {
+            m_oStallWatchdog.dataReceived();
+            
             if (m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_RSN) {
                 LOG(DEBUG) << "Bytes read from RSN DIGI: " << bytesRead;
                 publishPacket(buffer, bytesRead, DATA_FROM_RSN);
             }
             else {
                 LOG(DEBUG2) << "Bytes read: " << bytesRead;
-                publishPacket(buffer, bytesRead, DATA_FROM_INSTRUMENT);
-                //buffer[bytesRead] = '\0';
+                if(m_oRoutingKeys.empty())
+                    publishPacket(buffer, bytesRead, DATA_FROM_INSTRUMENT);
+                else
+                    publishRoutedInstrumentData(buffer, bytesRead);
             }
         }
     }
 }
 
+/******************************************************************************
+ * Method: handleInstrumentDataWrite
+ * Description: Drain queued data to the instrument when it can take more.
+ ******************************************************************************/
+void PortAgent::handleInstrumentDataWrite(const fd_set &writeFDs) {
+    CommBase *pConnection = m_pInstrumentConnection->dataConnectionObject();
+    bool splicePending = m_pDriverSplice && m_pDriverSplice->pending();
+    int clientFD;
+    
+    if(! pConnection || ! (pConnection->writePending() || splicePending))
+        return;
+    
+    clientFD = getInstrumentDataTxClientFD();
+    
+    if(clientFD && FD_ISSET(clientFD, &writeFDs)) {
+        if(splicePending) {
+            LOG(DEBUG) << "Write spliced data to Instrument Data Client FD: " << clientFD;
+            m_pDriverSplice->drain(clientFD);
+        }
+        
+        if(pConnection->writePending()) {
+            LOG(DEBUG) << "Write queued data to Instrument Data Client FD: " << clientFD;
+            pConnection->flushWriteQueue();
+        }
+    }
+}
+
+/******************************************************************************
+ * Method: handleObservatoryWrite
+ * Description: Drain writes queued for observatory clients that can take
+ * more.  Control packets queued since go first.
+ ******************************************************************************/
+void PortAgent::handleObservatoryWrite(const fd_set &writeFDs) {
+    vector<TCPCommListener*> listeners;
+    
+    getObservatoryListeners(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        int fd = (*i)->clientFD();
+        
+        if(fd && ! observatoryPolled(*i) && FD_ISSET(fd, &writeFDs)) {
+            LOG(DEBUG) << "Write queued data to observatory client FD: " << fd;
+            (*i)->flushWriteQueue();
+        }
+    }
+    
+    if(m_pObservatoryConnection &&
+       m_pObservatoryConnection->connectionType() == PACONN_OBSERVATORY_MULTI)
+        ((ObservatoryMultiConnection*)m_pObservatoryConnection)->dataSockets()->flushWrites();
+}
+
 /******************************************************************************
  * Method: getCurrentStateAsString
  * Description: return the current state as a string object
@@ -1970,6 +2943,123 @@ const string PortAgent::getCurrentStateAsString() {
         return "UNKNOWN";
 }
 
+/******************************************************************************
+ * Method: getStats
+ * Description: return runtime statistics as a newline delimited list of
+ * name/value pairs.
+ ******************************************************************************/
+const string PortAgent::getStats() {
+    vector<TCPCommListener*> listeners;
+    ostringstream out;
+
+    out << "state " << getCurrentStateAsString() << endl;
+
+    if(m_pInstrumentConnection &&
+       m_pInstrumentConnection->connectionType() == PACONN_INSTRUMENT_SERIAL) {
+        InstrumentSerialConnection *pConnection = (InstrumentSerialConnection *) m_pInstrumentConnection;
+        uint32_t reads = pConnection->readCount();
+        uint32_t bytes = pConnection->bytesRead();
+
+        out << "serial_read_mode " << pConnection->readMode() << endl
+            << "serial_reads " << reads << endl
+            << "serial_bytes_read " << bytes << endl
+            << "serial_bytes_per_read " << (reads ? (float)bytes / reads : 0) << endl
+            << "serial_write_queue " << pConnection->writeQueueSize() << endl;
+    }
+
+    if(m_pDriverSplice)
+        out << "driver_bytes_spliced " << m_pDriverSplice->bytesSpliced() << endl
+            << "driver_splice_pending " << m_pDriverSplice->pending() << endl
+            << "driver_tee_failures " << m_pDriverSplice->teeFailures() << endl;
+
+    if(m_iArchiveTornBytes)
+        out << "archive_torn_bytes " << m_iArchiveTornBytes << endl;
+
+    // Data stalls seen on the instrument and how long they took to clear
+    if(m_oStallWatchdog.configuredTimeout()) {
+        uint32_t recoveries = m_oStallWatchdog.recoveries();
+
+        out << "stall_timeout_ms " << m_oStallWatchdog.timeoutUsec() / 1000 << endl
+            << "stalls " << m_oStallWatchdog.stalls() << endl
+            << "stall_recoveries " << recoveries << endl
+            << "stall_last_recovery_ms " << m_oStallWatchdog.lastRecoveryUsec() / 1000 << endl
+            << "stall_mean_recovery_ms "
+            << (recoveries ? m_oStallWatchdog.totalRecoveryUsec() / recoveries / 1000 : 0) << endl
+            << "stall_last_gap_ms " << m_oStallWatchdog.lastGapUsec() / 1000 << endl;
+    }
+
+    // Where the main loop runs and how long it waits for a CPU
+    out << "cpu_affinity " << ThreadTuning::Affinity(pthread_self()) << endl
+        << "realtime_priority " << ThreadTuning::RealtimePriority(pthread_self()) << endl
+        << "memory_locked_stack " << ThreadTuning::LockedStack() << endl
+        << "sched_wakeups " << m_oWakeLatency.wakeups() << endl
+        << "sched_late_wakeups " << m_oWakeLatency.late() << endl
+        << "sched_wake_latency_last_usec " << m_oWakeLatency.lastUsec() << endl
+        << "sched_wake_latency_mean_usec " << m_oWakeLatency.meanUsec() << endl
+        << "sched_wake_latency_max_usec " << m_oWakeLatency.maxUsec() << endl
+        << "sched_run_delay_usec " << ThreadTuning::RunDelayUsec(ThreadTuning::ThreadId()) << endl
+        << "sched_involuntary_switches " << ThreadTuning::InvoluntarySwitches() << endl;
+
+    if(m_oPublishers.threads())
+        out << "publisher_run_delay_usec " << m_oPublishers.threadRunDelayUsec() << endl;
+
+    // What the packet, publisher and connection buffers hold and what was
+    // shed to stay inside the budget
+    out << MemoryBudget::Instance().stats();
+
+    // Compression on each observatory data port, totals for every client
+    getObservatoryDataListeners(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        uint64_t in = (*i)->compressedBytesIn();
+        uint64_t bytesOut = (*i)->compressedBytesOut();
+
+        if(! (*i)->compressionLevel() && ! in)
+            continue;
+
+        out << "compress_" << (*i)->port() << "_active " << (*i)->compressing() << endl
+            << "compress_" << (*i)->port() << "_bytes_in " << in << endl
+            << "compress_" << (*i)->port() << "_bytes_out " << bytesOut << endl
+            << "compress_" << (*i)->port() << "_ratio " << (bytesOut ? (float)in / bytesOut : 0) << endl
+            << "compress_" << (*i)->port() << "_cpu_usec " << (*i)->compressionCpuUsec() << endl;
+    }
+
+    // Last socket sample of each observatory data client and what was done
+    // about slow ones
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        ClientMonitor &monitor = (*i)->clientMonitor();
+
+        if(! monitor.samples())
+            continue;
+
+        out << "client_" << (*i)->port() << "_rtt_usec " << monitor.rttUsec() << endl
+            << "client_" << (*i)->port() << "_unacked " << monitor.unacked() << endl
+            << "client_" << (*i)->port() << "_queued " << monitor.queued() << endl
+            << "client_" << (*i)->port() << "_peak_queued " << monitor.peakQueued() << endl
+            << "client_" << (*i)->port() << "_slow " << monitor.slow() << endl
+            << "client_" << (*i)->port() << "_slow_episodes " << monitor.slowEpisodes() << endl
+            << "client_" << (*i)->port() << "_dropped " << monitor.dropped() << endl
+            << "client_" << (*i)->port() << "_evictions " << monitor.evictions() << endl;
+    }
+
+    // Control and bulk writes to each observatory client and how often
+    // control went ahead of queued data
+    getObservatoryListeners(listeners);
+    for(vector<TCPCommListener*>::iterator i = listeners.begin(); i != listeners.end(); i++) {
+        PriorityLanes &lanes = (*i)->lanes();
+
+        if(! lanes.writes(LANE_CONTROL) && ! lanes.writes(LANE_BULK))
+            continue;
+
+        out << "lane_" << (*i)->port() << "_control_writes " << lanes.writes(LANE_CONTROL) << endl
+            << "lane_" << (*i)->port() << "_bulk_writes " << lanes.writes(LANE_BULK) << endl
+            << "lane_" << (*i)->port() << "_bypassed " << lanes.bypassed() << endl
+            << "lane_" << (*i)->port() << "_dropped " << lanes.dropped() << endl
+            << "lane_" << (*i)->port() << "_peak_queued " << lanes.peakQueued() << endl;
+    }
+
+    return out.str();
+}
+
 /******************************************************************************
  * Method: setState
  * Description: State the port agent intrument connection state
@@ -1979,6 +3069,7 @@ void PortAgent::setState(const PortAgentState &state) {
     if(state != getCurrentState()) {
         const string previousState = getCurrentStateAsString();
     
+        PROBE2(state__change, m_oState, state);
         m_oState = state;
 
         LOG(DEBUG) << "***********************************************";
@@ -2,8 +2,13 @@
 #define PORT_AGENT_H_
 
 #include "common/daemon_process.h"
+#include "common/memory_budget.h"
+#include "common/line_buffer.h"
+#include "common/stall_watchdog.h"
+#include "common/thread_tuning.h"
 #include "network/tcp_comm_listener.h"
 #include "network/tcp_comm_socket.h"
+#include "network/splice_pipe.h"
 #include "connection/connection.h"
 #include "config/port_agent_config.h"
 #include "packet/packet.h"
@@ -11,6 +16,8 @@
 
 #include <sys/select.h>
 #include <time.h>
+#include <set>
+#include <string>
 
 using namespace std;
 using namespace packet;
@@ -19,6 +26,19 @@ using namespace publisher;
 
 #define SELECT_SLEEP_TIME 1
 
+// Most instrument data we hold waiting for the end of a routed record.  If a
+// record gets longer than this it is published without a routing key.
+#define ROUTING_BUFFER_SIZE 4096
+
+// Longest command line we'll hold waiting for its newline
+#define COMMAND_LINE_MAX 1024
+
+// Seconds to wait for a new process to take over during a live upgrade
+#define UPGRADE_ACK_TIMEOUT 10
+
+// Descriptor the new process reads the handoff from
+#define UPGRADE_HANDOFF_FD 3
+
 namespace port_agent {
     
     //////////////////////////////
@@ -45,6 +65,7 @@ namespace port_agent {
             // Accessors
             const PortAgentState & getCurrentState() { return m_oState; };
             const string getCurrentStateAsString();
+            const string getStats();
             
             bool start();
             void poll();
@@ -55,25 +76,35 @@ namespace port_agent {
             const string pid_file();
             bool no_daemon();
             uint32_t ppid();
+            void duplicate_check();
+            void initialize();
             float sleep_time() { return 0; }
             
         private:
             void setState(const PortAgentState &state);
             
+            bool selectTimeout(struct timeval &tv);
+            void nextDeadline(uint64_t &delay, uint64_t candidate);
+            
             int buildFDSet(fd_set &readFDs);
+            int buildWriteFDSet(fd_set &writeFDs);
             void processPortAgentCommands();
     
             void addObservatoryCommandListenerFD(int &maxFD, fd_set &readFDs);
             void addObservatoryCommandClientFD(int &maxFD, fd_set &readFDs);
             void addObservatoryDataListenerFD(int &maxFD, fd_set &readFDs);
             void addObservatoryStandardDataListenerFD(int &maxFD, fd_set &readFDs);
-            void addObservatoryMultiDataListenerFDs(int &maxFD, fd_set &readFDs);
+            void addObservatoryMultiDataPollFD(int &maxFD, fd_set &readFDs);
             void addObservatoryDataClientFD(int &maxFD, fd_set &readFDs);
             void addObservatoryStandardDataClientFD(int &maxFD, fd_set &readFDs);
-            void addObservatoryMultiDataClientFDs(int &maxFD, fd_set &readFDs);
             void addInstrumentDataClientFD(int &maxFD, fd_set &readFDs);
+            void addInstrumentEventFD(int &maxFD, fd_set &readFDs);
+            void addProcessWatchFDs(int &maxFD, fd_set &readFDs);
             void addTelnetSnifferListenerFD(int &maxFD, fd_set &readFDs);
             void addTelnetSnifferClientFD(int &maxFD, fd_set &readFDs);
+            void addInstrumentDataWriteFD(int &maxFD, fd_set &writeFDs);
+            void addInstrumentConnectFDs(int &maxFD, fd_set &writeFDs);
+            void addObservatoryWriteFDs(int &maxFD, fd_set &writeFDs);
             
             int getObservatoryCommandListenerFD();
             int getObservatoryCommandClientFD();
@@ -82,21 +113,32 @@ namespace port_agent {
             int getInstrumentDataRxClientFD();
             int getInstrumentDataTxClientFD();
             int getTelnetSnifferListenerFD();
+            void getObservatoryDataListeners(vector<TCPCommListener*> &listeners);
+            void getObservatoryListeners(vector<TCPCommListener*> &listeners);
+            bool observatoryPolled(TCPCommListener *listener);
+            void collectObservatoryEvents(const fd_set &readFDs);
             
             void initializeObservatoryDataConnection();
             void initializeObservatoryStandardDataConnection();
             void initializeObservatoryMultiDataConnection();
             void initializeObservatoryCommandConnection();
             void initializeInstrumentConnection();
+            void applySocketProfile(Connection *connection, uint16_t profile);
+            void applySlowClientPolicy(Connection *connection);
+            void applyCompression(Connection *connection);
             void initializeTCPInstrumentConnection();
             void initializeRSNInstrumentConnection();
             void initialize_BOTPT_InstrumentConnection();
             void initializeSerialInstrumentConnection();
             bool initializeSerialSettings();
+            void disconnectInstrument();
+            void applyThreadTuning();
+            void applyMemoryBudget();
             
             // Publisher initializers
             void initializePublishers();
             void initializePublisherFile();
+            void recoverArchiveTail();
             void initializePublisherObservatoryData();    
             void initializePublisherObservatoryStandardData();
             void initializePublisherObservatoryMultiData();
@@ -118,7 +160,7 @@ namespace port_agent {
             
             // Other handlers
             void handlePortAgentCommand(const char *commands);
-            void handleTCPConnect(TCPCommListener &listener, bool persistent = false);
+            bool handleTCPConnect(TCPCommListener &listener, bool persistent = false, bool selected = true);
             
             void handleTelnetSnifferAccept(const fd_set &readFDs);
             void handleTelnetSnifferRead(const fd_set &readFDs);
@@ -130,15 +172,26 @@ namespace port_agent {
             void handleObservatoryDataRead(const fd_set &readFDs);
             void handleObservatoryStandardDataRead(const fd_set &readFDs);
             void handleObservatoryMultiDataRead(const fd_set &readFDs);
+            static void observatoryMultiDataAccept(TCPCommListener *listener, void *context);
+            static void observatoryMultiDataRead(TCPCommListener *listener, void *context);
             void handleInstrumentDataRead(const fd_set &readFDs);
+            void handleInstrumentDataWrite(const fd_set &writeFDs);
+            void handleObservatoryWrite(const fd_set &writeFDs);
+            
+            bool canSpliceDriverData();
+            bool spliceDriverData(TCPCommListener *pConnection);
             
             void publishHeartbeat();
             void publishFault(const string &msg);
+            void checkDataStall();
             void publishStatus(const string &msg);
             void publishPacket(Packet *packet);
             void publishPacket(char *payload, uint16_t size, PacketType type);
+            void publishRoutedInstrumentData(const char *payload, uint16_t size);
+            const string & matchRoutingKey(const string &record);
 
             void displayVersion();
+            void upgrade();
             void setRotationInterval();
             
         /////
@@ -161,6 +214,32 @@ namespace port_agent {
             // Publisher Connections
             TCPCommListener *m_pTelnetSnifferConnection;
             
+            // Driver to instrument fast path
+            SplicePipe *m_pDriverSplice;
+            
+            // Data log base whose newest segment has been checked for a torn
+            // tail, and how many bytes were cut off it
+            string m_sArchiveChecked;
+            uint64_t m_iArchiveTornBytes;
+            
+            // Notices when the instrument stops sending data
+            StallWatchdog m_oStallWatchdog;
+            
+            // How late the main loop wakes from timed selects
+            WakeLatency m_oWakeLatency;
+            
+            // Routing keys of the multi data ports and the partial record
+            // waiting to be routed
+            set<string> m_oRoutingKeys;
+            string m_sRoutingBuffer;
+            MemoryCharge m_oRoutingCharge;
+            
+            // Command port bytes waiting for the end of their line
+            LineBuffer m_oCommandLines;
+            
+            // Our own binary, started again for a live upgrade
+            string m_sExecutable;
+            
     };
 }
 
@@ -0,0 +1,282 @@
+/*******************************************************************************
+ * Program: port_agent_bench
+ * Filename: port_agent_bench_main.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Measure how fast a driver can take packets from a running port agent.
+ * By default the data port is read with PortAgentClient and, given a
+ * command port, the agent is pinged every 100 ms to time command round
+ * trips.  -n reads the way most drivers do, one read for a header and one
+ * for its payload, for comparison.
+ *
+ * Usage:
+ *
+ * port_agent_bench [-H host] -d data_port [-c command_port] [-s seconds]
+ *                  [-b buffer_bytes] [-n]
+ *
+ *   -H  agent host, default localhost
+ *   -s  how long to read, default 10 seconds
+ *   -b  client receive buffer, default PACKET_STREAM_BUFFER_SIZE
+ *   -n  read each header and payload separately
+ ******************************************************************************/
+
+#include "port_agent/client/port_agent_client.h"
+#include "network/tcp_comm_socket.h"
+#include "common/logger.h"
+#include "common/exception.h"
+
+#include <iostream>
+#include <string>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace logger;
+using namespace network;
+using namespace port_agent_client;
+
+// Time between pings when a command port is given
+#define BENCH_PING_USEC 100000
+
+/* What one run saw */
+struct BenchStats {
+    BenchStats() : packets(0), bytes(0), reads(0), pings(0), pingTotal(0),
+                   pingMin(0), pingMax(0), pingSent(0) {}
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t reads;
+
+    uint64_t pings;
+    uint64_t pingTotal;
+    uint64_t pingMin;
+    uint64_t pingMax;
+
+    // When the outstanding ping went out, 0 if none
+    uint64_t pingSent;
+};
+
+/******************************************************************************
+ * Method: nowUsec
+ ******************************************************************************/
+static uint64_t nowUsec() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/******************************************************************************
+ * Method: onData
+ * Description: Count a packet.
+ ******************************************************************************/
+static void onData(const PacketView &packet, void *context) {
+    BenchStats *stats = (BenchStats *)context;
+
+    stats->packets++;
+    stats->bytes += packet.packetSize();
+}
+
+/******************************************************************************
+ * Method: onPing
+ * Description: Time a ping round trip.
+ ******************************************************************************/
+static void onPing(uint32_t id, CommandResult result, const PacketView *reply, void *context) {
+    BenchStats *stats = (BenchStats *)context;
+    uint64_t elapsed = nowUsec() - stats->pingSent;
+
+    stats->pingSent = 0;
+
+    if(result != COMMAND_OK)
+        return;
+
+    if(! stats->pings || elapsed < stats->pingMin)
+        stats->pingMin = elapsed;
+    if(elapsed > stats->pingMax)
+        stats->pingMax = elapsed;
+
+    stats->pingTotal += elapsed;
+    stats->pings++;
+}
+
+/******************************************************************************
+ * Method: runClient
+ * Description: Read with PortAgentClient on this thread.
+ ******************************************************************************/
+static void runClient(const string &host, uint16_t dataPort, uint16_t commandPort,
+                      uint32_t bufferSize, uint64_t usec, BenchStats &stats) {
+    PortAgentClient client;
+    uint64_t end = nowUsec() + usec;
+    uint64_t nextPing = 0;
+    uint64_t now;
+
+    client.setHost(host);
+    client.setDataPort(dataPort);
+    client.setCommandPort(commandPort);
+    if(bufferSize)
+        client.setBufferSize(bufferSize);
+    client.setDataCallback(onData, &stats);
+
+    while((now = nowUsec()) < end) {
+        if(commandPort && client.connected() && ! stats.pingSent && now >= nextPing) {
+            stats.pingSent = now;
+            nextPing = now + BENCH_PING_USEC;
+            client.sendCommand("ping", onPing, &stats);
+        }
+
+        client.poll(end - now < 10000 ? end - now : 10000);
+    }
+
+    stats.reads = client.reads();
+
+    if(client.badChecksums() || client.skippedBytes())
+        cout << "bad_checksums " << client.badChecksums()
+             << " skipped_bytes " << client.skippedBytes() << endl;
+}
+
+/******************************************************************************
+ * Method: readFully
+ * Description: Blocking read of exactly size bytes.
+ ******************************************************************************/
+static bool readFully(int fd, char *buffer, uint32_t size, BenchStats &stats) {
+    uint32_t total = 0;
+
+    while(total < size) {
+        ssize_t bytes = recv(fd, buffer + total, size - total, 0);
+        stats.reads++;
+
+        if(bytes <= 0) {
+            if(bytes < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+
+        total += bytes;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: runNaive
+ * Description: Read one header and then its payload, packet by packet.
+ ******************************************************************************/
+static void runNaive(const string &host, uint16_t dataPort, uint64_t usec, BenchStats &stats) {
+    TCPCommSocket socket;
+    char buffer[PACKET_STREAM_MAX_PACKET + 1];
+    struct timeval timeout;
+    uint64_t end = nowUsec() + usec;
+
+    socket.setHostname(host);
+    socket.setPort(dataPort);
+    socket.setBlocking(true);
+    socket.setRingReads(false);
+    socket.initialize();
+
+    // Let a quiet agent end the run on time
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    setsockopt(socket.getSocketFD(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while(nowUsec() < end) {
+        uint16_t length;
+
+        if(! readFully(socket.getSocketFD(), buffer, HEADER_SIZE, stats)) {
+            if(errno == EAGAIN)
+                continue;
+            break;
+        }
+
+        length = ((uint8_t)buffer[4] << 8) | (uint8_t)buffer[5];
+        if(length > HEADER_SIZE &&
+           ! readFully(socket.getSocketFD(), buffer + HEADER_SIZE, length - HEADER_SIZE, stats))
+            break;
+
+        stats.packets++;
+        stats.bytes += length;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    string host = "localhost";
+    uint16_t dataPort = 0, commandPort = 0;
+    uint32_t bufferSize = 0;
+    double seconds = 10;
+    bool naive = false;
+    BenchStats stats;
+    uint64_t start, elapsed;
+    int option;
+
+    Logger::SetLogLevel("ERROR");
+
+    while((option = getopt(argc, argv, "H:d:c:s:b:n")) != -1) {
+        switch(option) {
+            case 'H':
+                host = optarg;
+                break;
+            case 'd':
+                dataPort = atoi(optarg);
+                break;
+            case 'c':
+                commandPort = atoi(optarg);
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'b':
+                bufferSize = atoi(optarg);
+                break;
+            case 'n':
+                naive = true;
+                break;
+            default:
+                dataPort = 0;
+                break;
+        }
+    }
+
+    if(! dataPort || seconds <= 0) {
+        cerr << "USAGE: " << argv[0] << " [-H host] -d data_port [-c command_port]"
+             << " [-s seconds] [-b buffer_bytes] [-n]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    start = nowUsec();
+
+    try {
+        if(naive)
+            runNaive(host, dataPort, seconds * 1000000, stats);
+        else
+            runClient(host, dataPort, commandPort, bufferSize, seconds * 1000000, stats);
+    }
+    catch(OOIException &e) {
+        cerr << "port_agent_bench: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    elapsed = nowUsec() - start;
+
+    cout << "mode " << (naive ? "naive" : "client")
+         << " packets " << stats.packets
+         << " bytes " << stats.bytes
+         << " seconds " << elapsed / 1e6
+         << " MB/s " << stats.bytes / (elapsed / 1e6) / 1e6
+         << " packets/s " << (uint64_t)(stats.packets / (elapsed / 1e6))
+         << " reads " << stats.reads
+         << " bytes/read " << (stats.reads ? stats.bytes / stats.reads : 0);
+
+    if(stats.pings)
+        cout << " ping_ms min " << stats.pingMin / 1000.0
+             << " avg " << stats.pingTotal / stats.pings / 1000.0
+             << " max " << stats.pingMax / 1000.0;
+
+    cout << endl;
+
+    return stats.packets ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,166 @@
+/*******************************************************************************
+ * Program: port_agent_verify
+ * Filename: port_agent_verify_main.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Check binary data logs written by the port agent and report throughput.
+ * Directories are searched for *.data files.  Exits non-zero if any file has
+ * bad packets or a torn tail.
+ *
+ * Usage:
+ *
+ * port_agent_verify [-t threads] [-r truncate|quarantine] [-v] path ...
+ *
+ *   -t  files verified at once, default one per CPU
+ *   -r  cut off torn tails, keeping them in a quarantine file if asked
+ *   -v  report every file, not just the ones with problems
+ ******************************************************************************/
+
+#include "port_agent/packet/archive_verifier.h"
+#include "common/logger.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace logger;
+using namespace packet;
+
+/******************************************************************************
+ * Method: addPath
+ * Description: Add a file, or the data logs under a directory.
+ ******************************************************************************/
+static void addPath(const string &path, vector<string> &files) {
+    struct stat info;
+    struct dirent *entry;
+    DIR *dir;
+
+    if(stat(path.c_str(), &info)) {
+        cerr << path << ": " << strerror(errno) << endl;
+        return;
+    }
+
+    if(! S_ISDIR(info.st_mode)) {
+        files.push_back(path);
+        return;
+    }
+
+    if(! (dir = opendir(path.c_str())))
+        return;
+
+    while((entry = readdir(dir))) {
+        string name = entry->d_name;
+
+        if(name == "." || name == "..")
+            continue;
+
+        if(entry->d_type == DT_DIR ||
+           (name.size() > 5 && name.compare(name.size() - 5, 5, ".data") == 0))
+            addPath(path + "/" + name, files);
+    }
+
+    closedir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    ArchiveRecovery recovery = ARCHIVE_RECOVERY_OFF;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool verbose = false;
+    vector<string> files;
+    vector<ArchiveFileResult> results;
+    ArchiveVerifier verifier;
+    struct timeval start, end;
+    uint64_t total = 0;
+    int problems = 0;
+    int option;
+
+    Logger::SetLogLevel("ERROR");
+
+    while((option = getopt(argc, argv, "t:r:v")) != -1) {
+        switch(option) {
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'r':
+                if(string(optarg) == "truncate")
+                    recovery = ARCHIVE_RECOVERY_TRUNCATE;
+                else if(string(optarg) == "quarantine")
+                    recovery = ARCHIVE_RECOVERY_QUARANTINE;
+                else {
+                    cerr << "unknown recovery: " << optarg << endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                cerr << "USAGE: " << argv[0] << " [-t threads] [-r truncate|quarantine] [-v] path ..." << endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    for(int i = optind; i < argc; i++)
+        addPath(argv[i], files);
+
+    if(files.empty()) {
+        cerr << "no data files found" << endl;
+        return EXIT_FAILURE;
+    }
+
+    verifier.setThreads(threads > 0 ? threads : 1);
+
+    gettimeofday(&start, NULL);
+    verifier.verify(files, results);
+    gettimeofday(&end, NULL);
+
+    for(vector<ArchiveFileResult>::iterator i = results.begin(); i != results.end(); i++) {
+        total += i->bytes;
+
+        if(i->error.length()) {
+            cout << i->path << ": " << i->error << endl;
+            problems++;
+            continue;
+        }
+
+        if(verbose || ! i->clean())
+            cout << i->path << ": bytes " << i->bytes
+                 << " packets " << i->packets
+                 << " bad_checksums " << i->badChecksums
+                 << " skipped_bytes " << i->skippedBytes
+                 << (i->torn() ? " torn_tail" : "") << endl;
+
+        if(! i->clean())
+            problems++;
+
+        if(i->torn() && recovery != ARCHIVE_RECOVERY_OFF) {
+            ArchiveFileResult recovered;
+            if(ArchiveVerifier::recoverTail(i->path, recovery, recovered))
+                cout << i->path << ": truncated to " << recovered.validLength << endl;
+            else
+                cout << i->path << ": recovery failed" << endl;
+        }
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    cout << "files " << results.size()
+         << " bytes " << total
+         << " threads " << verifier.threads()
+         << " seconds " << seconds
+         << " GB/s " << (seconds > 0 ? total / seconds / 1e9 : 0)
+         << " problems " << problems << endl;
+
+    return problems ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -42,14 +42,15 @@ DriverCommandPublisher::DriverCommandPublisher() : DriverPublisher() { }
  * Parameter:
  *    char* - the buffer that we are writting.
  *    size - how many bytes?
+ *    priority - control or bulk
  *
  * Exceptions:
  *    FileDescriptorNULL
  *    PacketPublishFailure
  ******************************************************************************/
-bool DriverCommandPublisher::write(const char *buffer, uint32_t size) {
+bool DriverCommandPublisher::write(const char *buffer, uint32_t size, PacketPriority priority) {
     if(m_pCommSocket && m_pCommSocket->connected()) 
-        DriverPublisher::write(buffer, size);
+        DriverPublisher::write(buffer, size, priority);
     else
         LOG(DEBUG) << "Command port not connected, not writing packets";
 }
\ No newline at end of file
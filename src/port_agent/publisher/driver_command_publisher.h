@@ -27,7 +27,7 @@ namespace publisher {
            DriverCommandPublisher();
            DriverCommandPublisher(CommBase *socket) : DriverPublisher(socket) {}
 
-           bool write(const char *buffer, uint32_t size);
+           bool write(const char *buffer, uint32_t size, PacketPriority priority = PRIORITY_BULK);
 
 	   const PublisherType publisherType() { return PUBLISHER_DRIVER_COMMAND; }
 	   
@@ -186,11 +186,11 @@ bool FilePointerPublisher::logPacket(Packet *packet) {
 
 	if(m_bAsciiOut) {
         output = packet->asAscii();
-        return write(output.c_str(), output.length());
+        return write(output.c_str(), output.length(), packet->priority());
     }
 
 	// Must be binary
-	return write(packet->packet(), packet->packetSize());
+	return write(packet->packet(), packet->packetSize(), packet->priority());
 }
 
 /******************************************************************************
@@ -202,12 +202,13 @@ bool FilePointerPublisher::logPacket(Packet *packet) {
  * Parameter:
  *    char* - the buffer that we are writing.
  *    size - how many bytes?
+ *    priority - control writes go ahead of data the socket has queued
  *
  * Exceptions:
  *    FileDescriptorNULL
  *    PacketPublishFailure
  ******************************************************************************/
-bool FilePointerPublisher::write(const char *buffer, uint32_t size) {
+bool FilePointerPublisher::write(const char *buffer, uint32_t size, PacketPriority priority) {
 	int count;
 	int total = 0;
 
@@ -232,7 +233,10 @@ bool FilePointerPublisher::write(const char *buffer, uint32_t size) {
 		
 		if(m_pCommSocket) {
 			LOG(DEBUG2) << "write with comm socket.";
-		    total += m_pCommSocket->writeData(buffer + total, size - total);
+		    if(priority == PRIORITY_CONTROL)
+		        total += m_pCommSocket->writeControl(buffer + total, size - total);
+		    else
+		        total += m_pCommSocket->writeData(buffer + total, size - total);
 		}
 		else if(m_pFilePointer) {
 			LOG(DEBUG2) << "write with file pointer";
@@ -59,7 +59,8 @@ namespace publisher {
             virtual bool handleHeartbeat(Packet *packet)         { return logPacket(packet); }
 
             bool logPacket(Packet *packet);
-            virtual bool write(const char *buffer, uint32_t size);
+            virtual bool write(const char *buffer, uint32_t size,
+                               PacketPriority priority = PRIORITY_BULK);
 
         private:
 			bool compareCommSocket(CommBase *rhs);
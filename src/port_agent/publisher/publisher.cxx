@@ -15,6 +15,7 @@
 #include "common/util.h"
 #include "common/logger.h"
 #include "common/exception.h"
+#include "common/probe.h"
 #include "port_agent/packet/packet.h"
 
 #include <sstream>
@@ -51,6 +52,7 @@ Publisher::Publisher(const Publisher& rhs) {
 	
 	m_oError = rhs.m_oError;
 	m_bAsciiOut = rhs.m_bAsciiOut;
+	m_sRoutingKey = rhs.m_sRoutingKey;
 }
 
 /******************************************************************************
@@ -91,15 +93,19 @@ bool Publisher::operator==(Publisher &rhs) {
 
 /******************************************************************************
  * Method: publish
- * Description: publish a packet (run it throgh all known handlers.
+ * Description: publish a packet (run it throgh all known handlers.  The
+ * publish__entry and publish__return probes bracket the handler.
  *
  * Parameters:
  *   packet - a Packet object or one of it's derivatives
  *
  ******************************************************************************/
 bool Publisher::publish(Packet *packet) {
+	bool result = true;
+
 	clearError();
 
+	PROBE3(publish__entry, publisherType(), packet->packetType(), packet->packetSize());
 
     // We want to check log level here because we don't want to actually call
     // the pretty method unless we have too.
@@ -111,25 +117,32 @@ bool Publisher::publish(Packet *packet) {
 	try {
 		switch(packet->packetType()) {
 		case DATA_FROM_INSTRUMENT:
-		    return handleInstrumentData(packet);
+		    result = handleInstrumentData(packet);
+		    break;
 
 		case DATA_FROM_DRIVER:
-            return handleDriverData(packet);
+            result = handleDriverData(packet);
+            break;
 
 		case PORT_AGENT_COMMAND:
-            return handleCommand(packet);
+            result = handleCommand(packet);
+            break;
 
 		case PORT_AGENT_STATUS:
-            return handleStatus(packet);
+            result = handleStatus(packet);
+            break;
 
 		case PORT_AGENT_FAULT:
-            return handleFault(packet);
+            result = handleFault(packet);
+            break;
 
 		case INSTRUMENT_COMMAND:
-            return handleInstrumentCommand(packet);
+            result = handleInstrumentCommand(packet);
+            break;
 
 		case PORT_AGENT_HEARTBEAT:
-            return handleHeartbeat(packet);
+            result = handleHeartbeat(packet);
+            break;
 
 		default:
 			throw UnknownPacketType();
@@ -138,10 +151,12 @@ bool Publisher::publish(Packet *packet) {
 	catch(OOIException & e) {
 		clearError(); // better safe than sorry.
 		m_oError = new OOIException(e);
-		return false;
+		result = false;
 	}
 
-	return true;
+	PROBE2(publish__return, publisherType(), result);
+
+	return result;
 }
 
 
@@ -99,6 +99,10 @@ namespace publisher {
             // Enable/Disable ascii output mode
             void setAsciiMode(bool enabled = true);
 
+            // Only receive routed instrument data carrying this key
+            void setRoutingKey(const string &key) { m_sRoutingKey = key; }
+            const string & routingKey() { return m_sRoutingKey; }
+
         protected:
             // Clear all errors out of the error list.
             void clearError();
@@ -125,6 +129,7 @@ namespace publisher {
         
         protected:
             bool m_bAsciiOut;
+            string m_sRoutingKey;
 
             
         private:
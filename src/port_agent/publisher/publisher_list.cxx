@@ -27,6 +27,7 @@
 #include "common/util.h"
 #include "common/logger.h"
 #include "common/exception.h"
+#include "common/io_ring.h"
 #include "port_agent/packet/packet.h"
 #include "port_agent/publisher/driver_command_publisher.h"
 #include "port_agent/publisher/driver_data_publisher.h"
@@ -70,26 +71,30 @@ PublisherList::~PublisherList() {
 
 /******************************************************************************
  * Method: publish
- * Description: publish a packet to all publishers
+ * Description: publish a packet to all publishers.  With the io_uring
+ * backend the socket and archive writes are collected and submitted together.
+ * With publisher threads the publishers are written to in parallel.
  *
  * Parameters:
  *   packet - a Packet object or one of it's derivatives
+ *   exclude - skip publishers of this type
  *
  ******************************************************************************/
-bool PublisherList::publish(Packet *packet) {
+bool PublisherList::publish(Packet *packet, PublisherType exclude) {
     PublisherObjectList::iterator i = m_oPublishers.begin();
+    vector<Publisher *> publishers;
+    IORingBatch batch;
     string error;
 	
-    for(i = m_oPublishers.begin(); i != m_oPublishers.end(); i++)
-        try {
-			LOG(DEBUG2) << "publish with publisher type: " << (*i)->publisherType();
-    		(*i)->publish(packet);
-		}
-		catch(OOIException &e) {
-			ostringstream err;
-			err << "<Publish Type> error: " << e.what() << endl;
-			error += err.str();
-		};
+    for(i = m_oPublishers.begin(); i != m_oPublishers.end(); i++) {
+        if(exclude != UNKNOWN && (*i)->publisherType() == exclude)
+            continue;
+        
+        publishers.push_back(*i);
+    }
+
+    publishAll(publishers, packet, error);
+    error += batch.flush();
 		
 	if(error.length())
 	    throw PacketPublishFailure(error.c_str());
@@ -97,6 +102,48 @@ bool PublisherList::publish(Packet *packet) {
     return true;
 }
 
+/******************************************************************************
+ * Method: publish
+ * Description: publish a routed packet.  Publishers without a routing key
+ * get everything, routed publishers are looked up by key so only the clients
+ * that asked for this key are written to.
+ *
+ * Parameters:
+ *   packet - a Packet object or one of it's derivatives
+ *   routingKey - routing key of the packet, empty if it matched no route
+ *
+ ******************************************************************************/
+bool PublisherList::publish(Packet *packet, const string &routingKey) {
+    PublisherObjectList::iterator i;
+    PublisherRouteMap::iterator route;
+    vector<Publisher *> publishers;
+    IORingBatch batch;
+    string error;
+
+    for(i = m_oPublishers.begin(); i != m_oPublishers.end(); i++) {
+        if((*i)->routingKey().length())
+            continue;
+
+        publishers.push_back(*i);
+    }
+
+    if(routingKey.length()) {
+        route = m_oRoutes.find(routingKey);
+        if(route != m_oRoutes.end()) {
+            for(i = route->second.begin(); i != route->second.end(); i++)
+                publishers.push_back(*i);
+        }
+    }
+
+    publishAll(publishers, packet, error);
+    error += batch.flush();
+
+	if(error.length())
+	    throw PacketPublishFailure(error.c_str());
+
+    return true;
+}
+
 /******************************************************************************
  * Method: searchByType
  * Description: search for the first occurance of a publisher with passed type
@@ -156,7 +203,7 @@ void PublisherList::addUnique(Publisher *publisher) {
 	for(i = m_oPublishers.begin(); i != m_oPublishers.end(); i++) {
     	if(publisher->publisherType() == (*i)->publisherType()) {
 			LOG(DEBUG2) << "Found duplicate type, removing old publisher";
-	        m_oPublishers.remove(*i);
+	        removePublisher(*i);
 	        // break out here to avoid crashing; list iterator gets mixed up
 	        // if we continue looping here.
 	        break;
@@ -214,7 +261,55 @@ void PublisherList::addPublisher(Publisher *publisher) {
 	} else {
         m_oPublishers.push_back(newPublisher);
 	}
+
+    if(newPublisher->routingKey().length())
+        m_oRoutes[newPublisher->routingKey()].push_back(newPublisher);
+}
+
+/******************************************************************************
+ * Method: removePublisher
+ * Description: Remove a publisher from the list and the route table.
+ ******************************************************************************/
+void PublisherList::removePublisher(Publisher *publisher) {
+    PublisherRouteMap::iterator route = m_oRoutes.find(publisher->routingKey());
+
+    if(route != m_oRoutes.end()) {
+        route->second.remove(publisher);
+        if(route->second.empty())
+            m_oRoutes.erase(route);
+    }
+
+    m_oPublishers.remove(publisher);
 }
 
+/******************************************************************************
+ * Method: publishTo
+ * Description: publish a packet to one publisher, collecting any error.
+ ******************************************************************************/
+void PublisherList::publishTo(Publisher *publisher, Packet *packet, string &error) {
+    try {
+        LOG(DEBUG2) << "publish with publisher type: " << publisher->publisherType();
+        publisher->publish(packet);
+    }
+    catch(OOIException &e) {
+        ostringstream err;
+        err << "<Publish Type> error: " << e.what() << endl;
+        error += err.str();
+    };
+}
 
+/******************************************************************************
+ * Method: publishAll
+ * Description: publish a packet to a set of publishers, on the publisher
+ * threads if there are any and more than one publisher to keep them busy.
+ * File publishers are at the front so they are still started first.
+ ******************************************************************************/
+void PublisherList::publishAll(const vector<Publisher *> &publishers, Packet *packet, string &error) {
+    if(m_oPool.threads() && publishers.size() > 1) {
+        m_oPool.publish(publishers, packet, error);
+        return;
+    }
 
+    for(uint32_t i = 0; i < publishers.size(); i++)
+        publishTo(publishers[i], packet, error);
+}
@@ -29,9 +29,12 @@
 #include "common/exception.h"
 #include "common/timestamp.h"
 #include "port_agent/publisher/publisher.h"
+#include "port_agent/publisher/publisher_pool.h"
 
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
 
 
 using namespace std;
@@ -40,6 +43,7 @@ using namespace packet;
 
 namespace publisher {
     typedef list<Publisher *> PublisherObjectList;
+    typedef map<string, PublisherObjectList> PublisherRouteMap;
     
     class PublisherList {
         /********************
@@ -55,10 +59,21 @@ namespace publisher {
             virtual ~PublisherList();
             
             /*  Commands */
-            bool publish(Packet *packet);
+            bool publish(Packet *packet, PublisherType exclude = UNKNOWN);
+
+            // Publish to the publishers without a routing key and those
+            // routed to the given key.
+            bool publish(Packet *packet, const string &routingKey);
             
 	    void add(Publisher *publisher);
 
+            // Publish on this many worker threads, 0 publishes inline
+            bool setThreads(uint32_t count) { return m_oPool.start(count); }
+            uint32_t threads() { return m_oPool.threads(); }
+            bool setThreadAffinity(const string &cpus) { return m_oPool.setAffinity(cpus); }
+            bool setThreadRealtime(uint32_t priority) { return m_oPool.setRealtime(priority); }
+            uint64_t threadRunDelayUsec() { return m_oPool.runDelayUsec(); }
+
             /* Accessors */
 			uint32_t size() const { return m_oPublishers.size(); }
 			Publisher * front() { return m_oPublishers.front(); }
@@ -72,6 +87,9 @@ namespace publisher {
 	    
 	    void addUnique(Publisher *publisher);
 	    void addPublisher(Publisher *publisher);
+	    void removePublisher(Publisher *publisher);
+	    void publishTo(Publisher *publisher, Packet *packet, string &error);
+	    void publishAll(const vector<Publisher *> &publishers, Packet *packet, string &error);
         
         /********************
          *      MEMBERS     *
@@ -82,6 +100,12 @@ namespace publisher {
         private:
             PublisherObjectList m_oPublishers;
 
+            // Publishers with a routing key, by key
+            PublisherRouteMap m_oRoutes;
+
+            // Workers for publishing to many publishers at once
+            PublisherPool m_oPool;
+
     };
 }
 
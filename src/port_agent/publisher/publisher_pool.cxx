@@ -0,0 +1,387 @@
+/*******************************************************************************
+ * Class: PublisherPool
+ * Filename: publisher_pool.cxx
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Worker threads that publish one packet to many publishers in parallel.
+ *
+ * Every worker has its own task queue.  A packet's tasks are spread over
+ * the queues, the owner takes from the front of its queue and an idle
+ * worker takes from the back of someone else's.  The thread that called
+ * publish does the same while it waits so a slow publisher doesn't leave
+ * it sitting idle.
+ *
+ * All of the tasks share the caller's packet.  PortAgentPacket::packet()
+ * rewrites the header on every call, but each call writes the same bytes
+ * so publishers reading the buffer at the same time see a whole packet.
+ *
+ ******************************************************************************/
+
+#include "publisher_pool.h"
+#include "common/thread_tuning.h"
+#include "common/logger.h"
+#include "common/exception.h"
+
+#include <sstream>
+#include <string>
+#include <string.h>
+
+using namespace std;
+using namespace packet;
+using namespace logger;
+using namespace publisher;
+
+/******************************************************************************
+ *   PUBLIC METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: Constructor
+ * Description: Default constructor, no workers are running.
+ ******************************************************************************/
+PublisherPool::PublisherPool() {
+    pthread_mutex_init(&m_oLock, NULL);
+    pthread_cond_init(&m_oWork, NULL);
+    pthread_cond_init(&m_oDone, NULL);
+
+    m_iQueued = 0;
+    m_bStopping = false;
+    m_iSteals = 0;
+    m_iRealtime = 0;
+}
+
+/******************************************************************************
+ * Method: Destructor
+ * Description: stop the workers.
+ ******************************************************************************/
+PublisherPool::~PublisherPool() {
+    stop();
+
+    pthread_cond_destroy(&m_oDone);
+    pthread_cond_destroy(&m_oWork);
+    pthread_mutex_destroy(&m_oLock);
+}
+
+/******************************************************************************
+ * Method: start
+ * Description: start worker threads, replacing any already running.
+ *
+ * Parameters:
+ *   count - number of workers, 0 stops the pool
+ *
+ * Return:
+ *   false if the count is too large or a thread couldn't be started
+ ******************************************************************************/
+bool PublisherPool::start(uint32_t count) {
+    stop();
+
+    if(count > PUBLISHER_POOL_MAX_THREADS) {
+        LOG(ERROR) << "publisher pool size " << count << " larger than " << PUBLISHER_POOL_MAX_THREADS;
+        return false;
+    }
+
+    // Workers start at normal priority and are raised to the pool's real
+    // time priority once running, see setRealtime
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+
+    for(uint32_t i = 0; i < count; i++) {
+        Worker *worker = new Worker;
+        worker->pool = this;
+        worker->index = i;
+        worker->tid = 0;
+        pthread_mutex_init(&worker->lock, NULL);
+
+        int result = pthread_create(&worker->thread, &attr, run, worker);
+        if(result) {
+            LOG(ERROR) << "failed to start publisher thread: " << strerror(result);
+            pthread_mutex_destroy(&worker->lock);
+            delete worker;
+            pthread_attr_destroy(&attr);
+            stop();
+            return false;
+        }
+
+        m_oWorkers.push_back(worker);
+
+        if(m_sAffinity.length())
+            ThreadTuning::SetAffinity(worker->thread, m_sAffinity);
+        if(m_iRealtime)
+            ThreadTuning::SetRealtime(worker->thread, m_iRealtime);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if(count)
+        LOG(INFO) << "started " << count << " publisher threads";
+
+    return true;
+}
+
+/******************************************************************************
+ * Method: stop
+ * Description: stop and join the worker threads.  Nothing is queued between
+ * publish calls so there's no work to drain.
+ ******************************************************************************/
+void PublisherPool::stop() {
+    if(m_oWorkers.empty())
+        return;
+
+    pthread_mutex_lock(&m_oLock);
+    m_bStopping = true;
+    pthread_cond_broadcast(&m_oWork);
+    pthread_mutex_unlock(&m_oLock);
+
+    for(uint32_t i = 0; i < m_oWorkers.size(); i++) {
+        pthread_join(m_oWorkers[i]->thread, NULL);
+        pthread_mutex_destroy(&m_oWorkers[i]->lock);
+        delete m_oWorkers[i];
+    }
+
+    m_oWorkers.clear();
+    m_bStopping = false;
+
+    LOG(INFO) << "stopped publisher threads";
+}
+
+/******************************************************************************
+ * Method: setAffinity
+ * Description: Move the running workers to a set of CPUs and start new
+ * ones there.
+ *
+ * Return:
+ *   false if the list is bad or a worker couldn't be moved
+ ******************************************************************************/
+bool PublisherPool::setAffinity(const string &cpus) {
+    bool result = true;
+    cpu_set_t set;
+
+    if(! ThreadTuning::ParseCpuList(cpus, set))
+        return false;
+
+    m_sAffinity = cpus;
+
+    for(uint32_t i = 0; i < m_oWorkers.size(); i++)
+        result = ThreadTuning::SetAffinity(m_oWorkers[i]->thread, cpus) && result;
+
+    return result;
+}
+
+/******************************************************************************
+ * Method: setRealtime
+ * Description: Run the workers under SCHED_FIFO, including ones started
+ * later.  The publishing thread waits on the workers, so when it is real
+ * time they need to be too or a busy normal process can hold it off by
+ * starving them.
+ *
+ * Parameters:
+ *   priority - 1 to THREAD_MAX_RT_PRIORITY, 0 for SCHED_OTHER
+ *
+ * Return:
+ *   false if the priority is too high or a worker couldn't be changed
+ ******************************************************************************/
+bool PublisherPool::setRealtime(uint32_t priority) {
+    bool result = true;
+
+    if(priority > THREAD_MAX_RT_PRIORITY) {
+        LOG(ERROR) << "publisher real time priority " << priority << " above " << THREAD_MAX_RT_PRIORITY;
+        return false;
+    }
+
+    m_iRealtime = priority;
+
+    for(uint32_t i = 0; i < m_oWorkers.size(); i++) {
+        if(ThreadTuning::RealtimePriority(m_oWorkers[i]->thread) != priority)
+            result = ThreadTuning::SetRealtime(m_oWorkers[i]->thread, priority) && result;
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Method: runDelayUsec
+ * Description: Total time the running workers have sat runnable waiting for
+ * a CPU.
+ ******************************************************************************/
+uint64_t PublisherPool::runDelayUsec() {
+    uint64_t total = 0;
+
+    for(uint32_t i = 0; i < m_oWorkers.size(); i++) {
+        pid_t tid = __atomic_load_n(&m_oWorkers[i]->tid, __ATOMIC_ACQUIRE);
+        if(tid)
+            total += ThreadTuning::RunDelayUsec(tid);
+    }
+
+    return total;
+}
+
+/******************************************************************************
+ * Method: publish
+ * Description: publish a packet to a set of publishers on the workers and
+ * wait for all of them to finish.
+ *
+ * Parameters:
+ *   publishers - publishers to write to, each at most once
+ *   packet - packet shared by all of the publishers
+ *   error - failures are appended here
+ ******************************************************************************/
+void PublisherPool::publish(const vector<Publisher *> &publishers, Packet *packet, string &error) {
+    Dispatch dispatch;
+    Task task;
+
+    if(publishers.empty())
+        return;
+
+    dispatch.packet = packet;
+    dispatch.remaining = publishers.size();
+    pthread_mutex_init(&dispatch.lock, NULL);
+
+    // Fill in the header once before anyone reads it
+    packet->packet();
+
+    if(m_oWorkers.empty()) {
+        for(uint32_t i = 0; i < publishers.size(); i++) {
+            task.publisher = publishers[i];
+            task.dispatch = &dispatch;
+            runTask(task);
+        }
+    }
+    else {
+        for(uint32_t i = 0; i < publishers.size(); i++) {
+            Worker *worker = m_oWorkers[i % m_oWorkers.size()];
+
+            task.publisher = publishers[i];
+            task.dispatch = &dispatch;
+
+            pthread_mutex_lock(&worker->lock);
+            worker->tasks.push_back(task);
+            pthread_mutex_unlock(&worker->lock);
+        }
+
+        pthread_mutex_lock(&m_oLock);
+        __atomic_add_fetch(&m_iQueued, publishers.size(), __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&m_oWork);
+        pthread_mutex_unlock(&m_oLock);
+
+        // Help out, then wait for the tasks still running
+        while(nextTask(NULL, task))
+            runTask(task);
+
+        pthread_mutex_lock(&m_oLock);
+        while(__atomic_load_n(&dispatch.remaining, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&m_oDone, &m_oLock);
+        pthread_mutex_unlock(&m_oLock);
+    }
+
+    pthread_mutex_destroy(&dispatch.lock);
+    error += dispatch.error;
+}
+
+/******************************************************************************
+ *   PRIVATE METHODS
+ ******************************************************************************/
+
+/******************************************************************************
+ * Method: run
+ * Description: worker thread main loop.
+ ******************************************************************************/
+void * PublisherPool::run(void *arg) {
+    Worker *self = (Worker *)arg;
+    PublisherPool *pool = self->pool;
+    Task task;
+
+    __atomic_store_n(&self->tid, ThreadTuning::ThreadId(), __ATOMIC_RELEASE);
+
+    while(true) {
+        while(pool->nextTask(self, task))
+            pool->runTask(task);
+
+        pthread_mutex_lock(&pool->m_oLock);
+        while(! pool->m_bStopping && (int32_t)__atomic_load_n(&pool->m_iQueued, __ATOMIC_SEQ_CST) <= 0)
+            pthread_cond_wait(&pool->m_oWork, &pool->m_oLock);
+
+        if(pool->m_bStopping) {
+            pthread_mutex_unlock(&pool->m_oLock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->m_oLock);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Method: nextTask
+ * Description: take a task from our own queue or steal one from another.
+ *
+ * Parameters:
+ *   self - the worker looking for work, NULL for the publishing thread
+ *   task - set to the task taken
+ *
+ * Return:
+ *   true if a task was taken
+ ******************************************************************************/
+bool PublisherPool::nextTask(Worker *self, Task &task) {
+    uint32_t count = m_oWorkers.size();
+    uint32_t start = self ? self->index : 0;
+
+    for(uint32_t i = 0; i < count; i++) {
+        Worker *worker = m_oWorkers[(start + i) % count];
+        bool found = false;
+
+        pthread_mutex_lock(&worker->lock);
+        if(! worker->tasks.empty()) {
+            if(worker == self) {
+                task = worker->tasks.front();
+                worker->tasks.pop_front();
+            }
+            else {
+                task = worker->tasks.back();
+                worker->tasks.pop_back();
+            }
+            found = true;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        if(found) {
+            __atomic_sub_fetch(&m_iQueued, 1, __ATOMIC_SEQ_CST);
+            if(worker != self)
+                __atomic_add_fetch(&m_iSteals, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Method: runTask
+ * Description: publish to one publisher and wake the caller if this was the
+ * last task for the packet.
+ ******************************************************************************/
+void PublisherPool::runTask(Task &task) {
+    Dispatch *dispatch = task.dispatch;
+
+    try {
+        LOG(DEBUG2) << "publish with publisher type: " << task.publisher->publisherType();
+        task.publisher->publish(dispatch->packet);
+    }
+    catch(OOIException &e) {
+        ostringstream err;
+        err << "<Publish Type> error: " << e.what() << endl;
+
+        pthread_mutex_lock(&dispatch->lock);
+        dispatch->error += err.str();
+        pthread_mutex_unlock(&dispatch->lock);
+    }
+
+    // The dispatch belongs to the caller and may be gone once this hits zero
+    if(__atomic_sub_fetch(&dispatch->remaining, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&m_oLock);
+        pthread_cond_broadcast(&m_oDone);
+        pthread_mutex_unlock(&m_oLock);
+    }
+}
@@ -0,0 +1,136 @@
+/*******************************************************************************
+ * Class: PublisherPool
+ * Filename: publisher_pool.h
+ * Author: Bill French (wfrench@ucsd.edu)
+ * License: Apache 2.0
+ *
+ * Worker threads that publish one packet to many publishers in parallel.
+ * Each publisher is a task queued on a home worker picked by its position
+ * in the list.  Workers that run out of tasks steal from the others and
+ * the calling thread steals too while it waits.
+ *
+ * publish returns once every publisher has the packet, so a publisher
+ * never sees packets out of order and never runs on two threads at once.
+ * The packet is shared between the tasks rather than copied and the last
+ * one to finish wakes the caller.
+ *
+ * Workers can be kept to a set of CPUs with setAffinity and run real time
+ * with setRealtime, both of which also hold for workers started later.
+ * The caller waits on the workers, so a real time caller should give them
+ * its priority.
+ *
+ * Usage:
+ *
+ * PublisherPool pool;
+ * pool.start(4);
+ *
+ * string error;
+ * pool.publish(publishers, packet, error);
+ *
+ * pool.stop();
+ *
+ ******************************************************************************/
+
+#ifndef __PUBLISHER_POOL_H_
+#define __PUBLISHER_POOL_H_
+
+#include "port_agent/publisher/publisher.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace packet;
+
+// Most worker threads we'll start
+#define PUBLISHER_POOL_MAX_THREADS 16
+
+namespace publisher {
+    class PublisherPool {
+        /********************
+         *      METHODS     *
+         ********************/
+
+        public:
+            ///////////////////////
+            // Public Methods
+            PublisherPool();
+            virtual ~PublisherPool();
+
+            // Start count workers, stopping any running now.  0 just stops.
+            bool start(uint32_t count);
+            void stop();
+
+            uint32_t threads() { return m_oWorkers.size(); }
+
+            // Keep the workers on these CPUs, "" or "all" for any
+            bool setAffinity(const string &cpus);
+
+            // SCHED_FIFO priority for the workers, 0 for normal scheduling
+            bool setRealtime(uint32_t priority);
+            uint32_t realtimePriority() { return m_iRealtime; }
+
+            // Time the workers have waited for a CPU, see ThreadTuning
+            uint64_t runDelayUsec();
+
+            // Publish to all publishers and wait for them.  Failures are
+            // appended to error.
+            void publish(const vector<Publisher *> &publishers, Packet *packet, string &error);
+
+            // Tasks taken from another worker's queue, for tuning
+            uint64_t steals() { return __atomic_load_n(&m_iSteals, __ATOMIC_RELAXED); }
+
+        private:
+            // One packet going out to a set of publishers
+            struct Dispatch {
+                Packet *packet;
+                uint32_t remaining;
+                string error;
+                pthread_mutex_t lock;
+            };
+
+            struct Task {
+                Publisher *publisher;
+                Dispatch *dispatch;
+            };
+
+            struct Worker {
+                PublisherPool *pool;
+                uint32_t index;
+                pthread_t thread;
+                pid_t tid;
+                pthread_mutex_t lock;
+                deque<Task> tasks;
+            };
+
+            static void * run(void *arg);
+            bool nextTask(Worker *self, Task &task);
+            void runTask(Task &task);
+
+        /********************
+         *      MEMBERS     *
+         ********************/
+
+        private:
+            vector<Worker *> m_oWorkers;
+
+            // Guards the sleeping workers and the caller waiting on a dispatch
+            pthread_mutex_t m_oLock;
+            pthread_cond_t m_oWork;
+            pthread_cond_t m_oDone;
+
+            uint32_t m_iQueued;
+            bool m_bStopping;
+            uint64_t m_iSteals;
+
+            string m_sAffinity;
+            uint32_t m_iRealtime;
+    };
+}
+
+#endif //__PUBLISHER_POOL_H_
@@ -9,6 +9,7 @@
 #include "port_agent/publisher/tcp_publisher.h"
 #include "port_agent/publisher/udp_publisher.h"
 #include "port_agent/publisher/log_publisher.h"
+#include "port_agent/publisher/driver_data_publisher.h"
 
 #include "network/udp_comm_socket.h"
 #include "network/tcp_comm_socket.h"
@@ -19,6 +20,10 @@
 #include <sstream>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 using namespace std;
 using namespace logger;
@@ -248,3 +253,76 @@ TEST_F(PublisherListTest, SearchAndSetRotation) {
 	
 	((FilePublisher*)found)->setRotationInterval(HOURLY);
 }
+
+/* Bind a UDP socket to an ephemeral loopback port to catch published packets */
+static int udpReceiver(uint16_t &port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* Count the datagrams waiting on a receiver */
+static int udpCount(int fd) {
+    char buffer[1024];
+    int count = 0;
+
+    usleep(50000);
+    while(recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+        count++;
+
+    return count;
+}
+
+TEST_F(PublisherListTest, RoutedPublish) {
+    PublisherList list;
+    UDPCommSocket sockets[3];
+    int receivers[3];
+    const char *keys[3] = { "LILY", "NANO", "" };
+
+    for(int i = 0; i < 3; i++) {
+        uint16_t port;
+        receivers[i] = udpReceiver(port);
+
+        sockets[i].setHostname("localhost");
+        sockets[i].setPort(port);
+        sockets[i].initialize();
+
+        DriverDataPublisher publisher(&sockets[i]);
+        publisher.setRoutingKey(keys[i]);
+        list.add(&publisher);
+    }
+    EXPECT_EQ(list.size(), 3);
+
+    Timestamp ts(1, 0x80000000);
+    PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "LILY,data\n", 10);
+
+    // Routed to LILY and the port without a key
+    list.publish(&packet, string("LILY"));
+    EXPECT_EQ(udpCount(receivers[0]), 1);
+    EXPECT_EQ(udpCount(receivers[1]), 0);
+    EXPECT_EQ(udpCount(receivers[2]), 1);
+
+    // No match only goes to the port without a key
+    list.publish(&packet, string());
+    EXPECT_EQ(udpCount(receivers[0]), 0);
+    EXPECT_EQ(udpCount(receivers[1]), 0);
+    EXPECT_EQ(udpCount(receivers[2]), 1);
+
+    // Unrouted publish still goes to everyone
+    list.publish(&packet);
+    EXPECT_EQ(udpCount(receivers[0]), 1);
+    EXPECT_EQ(udpCount(receivers[1]), 1);
+    EXPECT_EQ(udpCount(receivers[2]), 1);
+
+    for(int i = 0; i < 3; i++)
+        close(receivers[i]);
+}
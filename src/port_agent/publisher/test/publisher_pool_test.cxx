@@ -0,0 +1,384 @@
+#include "common/logger.h"
+#include "common/exception.h"
+#include "port_agent/packet/port_agent_packet.h"
+#include "port_agent/publisher/publisher_pool.h"
+#include "port_agent/publisher/publisher_list.h"
+#include "common/thread_tuning.h"
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace logger;
+using namespace publisher;
+using namespace packet;
+
+// Scaling benchmark size
+#define BENCHMARK_PACKETS      200
+#define BENCHMARK_CPU_USEC     20
+#define BENCHMARK_BLOCK_USEC   100
+
+// A publisher that records what it was given and can be made slow or broken
+class RecordingPublisher : public Publisher {
+    public:
+        RecordingPublisher(uint32_t cpuUsec = 0, uint32_t blockUsec = 0, bool fail = false) {
+            m_iCpuUsec = cpuUsec;
+            m_iBlockUsec = blockUsec;
+            m_bFail = fail;
+            m_iBusy = 0;
+            m_bOverlap = false;
+        }
+
+        virtual bool publish(Packet *packet) {
+            if(__atomic_add_fetch(&m_iBusy, 1, __ATOMIC_SEQ_CST) > 1)
+                m_bOverlap = true;
+
+            if(m_iCpuUsec) {
+                struct timeval start, now;
+                gettimeofday(&start, NULL);
+                do {
+                    gettimeofday(&now, NULL);
+                } while((now.tv_sec - start.tv_sec) * 1000000 + now.tv_usec - start.tv_usec < m_iCpuUsec);
+            }
+
+            if(m_iBlockUsec) {
+                struct timespec ts = { 0, m_iBlockUsec * 1000 };
+                nanosleep(&ts, NULL);
+            }
+
+            m_oPackets.push_back(packet);
+            __atomic_sub_fetch(&m_iBusy, 1, __ATOMIC_SEQ_CST);
+
+            if(m_bFail)
+                throw PacketPublishFailure("recording publisher failed");
+
+            return true;
+        }
+
+        virtual bool compare(Publisher *rhs) { return rhs == this; }
+        virtual const PublisherType publisherType() { return PUBLISHER_UDP; }
+
+        vector<Packet *> m_oPackets;
+        bool m_bOverlap;
+
+    protected:
+        virtual bool handleInstrumentData(Packet *packet) { return true; }
+        virtual bool handleDriverData(Packet *packet) { return true; }
+        virtual bool handleCommand(Packet *packet) { return true; }
+        virtual bool handleStatus(Packet *packet) { return true; }
+        virtual bool handleFault(Packet *packet) { return true; }
+        virtual bool handleInstrumentCommand(Packet *packet) { return true; }
+        virtual bool handleHeartbeat(Packet *packet) { return true; }
+
+    private:
+        uint32_t m_iCpuUsec;
+        uint32_t m_iBlockUsec;
+        bool m_bFail;
+        uint32_t m_iBusy;
+};
+
+class PublisherPoolTest : public testing::Test {
+    protected:
+        virtual void SetUp() {
+            Logger::SetLogFile("/tmp/gtest.log");
+            Logger::SetLogLevel("DEBUG");
+
+            LOG(INFO) << "************************************************";
+            LOG(INFO) << "   PublisherPool Test Start Up";
+            LOG(INFO) << "************************************************";
+        }
+
+        double now() {
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            return tv.tv_sec + tv.tv_usec / 1000000.0;
+        }
+
+        // Packets per second publishing to count publishers on threads workers
+        double packetRate(uint32_t count, uint32_t threads, uint32_t cpuUsec, uint32_t blockUsec) {
+            Timestamp ts(1, 0x80000000);
+            PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "data", 4);
+            vector<RecordingPublisher *> owned;
+            vector<Publisher *> publishers;
+            PublisherPool pool;
+            string error;
+            double start;
+
+            for(uint32_t i = 0; i < count; i++) {
+                owned.push_back(new RecordingPublisher(cpuUsec, blockUsec));
+                publishers.push_back(owned.back());
+            }
+
+            EXPECT_TRUE(pool.start(threads));
+
+            start = now();
+            for(uint32_t p = 0; p < BENCHMARK_PACKETS; p++)
+                pool.publish(publishers, &packet, error);
+            double elapsed = now() - start;
+
+            EXPECT_EQ(error, "");
+            for(uint32_t i = 0; i < count; i++) {
+                EXPECT_EQ(owned[i]->m_oPackets.size(), BENCHMARK_PACKETS);
+                delete owned[i];
+            }
+
+            return BENCHMARK_PACKETS / elapsed;
+        }
+};
+
+// Records the CPUs and priority of the worker threads that publish to it
+class AffinityPublisher : public RecordingPublisher {
+    public:
+        AffinityPublisher(pid_t caller) : RecordingPublisher(0, 1000) { m_iCaller = caller; }
+
+        virtual bool publish(Packet *packet) {
+            if(ThreadTuning::ThreadId() != m_iCaller) {
+                string cpus = ThreadTuning::Affinity(pthread_self());
+                uint32_t priority = ThreadTuning::RealtimePriority(pthread_self());
+                pthread_mutex_lock(&s_oLock);
+                m_oAffinity.push_back(cpus);
+                m_oPriority.push_back(priority);
+                pthread_mutex_unlock(&s_oLock);
+            }
+            return RecordingPublisher::publish(packet);
+        }
+
+        static vector<string> m_oAffinity;
+        static vector<uint32_t> m_oPriority;
+        static pthread_mutex_t s_oLock;
+
+    private:
+        pid_t m_iCaller;
+};
+
+vector<string> AffinityPublisher::m_oAffinity;
+vector<uint32_t> AffinityPublisher::m_oPriority;
+pthread_mutex_t AffinityPublisher::s_oLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Test starting and stopping workers */
+TEST_F(PublisherPoolTest, StartStop) {
+    PublisherPool pool;
+
+    EXPECT_EQ(pool.threads(), 0);
+    EXPECT_TRUE(pool.start(4));
+    EXPECT_EQ(pool.threads(), 4);
+    EXPECT_TRUE(pool.start(2));
+    EXPECT_EQ(pool.threads(), 2);
+    EXPECT_FALSE(pool.start(PUBLISHER_POOL_MAX_THREADS + 1));
+    EXPECT_EQ(pool.threads(), 0);
+    EXPECT_TRUE(pool.start(0));
+    EXPECT_EQ(pool.threads(), 0);
+
+    PublisherList list;
+    EXPECT_TRUE(list.setThreads(3));
+    EXPECT_EQ(list.threads(), 3);
+}
+
+/* Workers stay on the CPUs they are given, including ones started later */
+TEST_F(PublisherPoolTest, Affinity) {
+    Timestamp ts(1, 0x80000000);
+    PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "data", 4);
+    vector<AffinityPublisher *> owned;
+    vector<Publisher *> publishers;
+    PublisherPool pool;
+    ostringstream cpu;
+    cpu_set_t allowed;
+    string error;
+
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for(int i = 0; i < CPU_SETSIZE; i++) {
+        if(CPU_ISSET(i, &allowed)) {
+            cpu << i;
+            break;
+        }
+    }
+
+    EXPECT_FALSE(pool.setAffinity("some"));
+    EXPECT_TRUE(pool.start(2));
+    EXPECT_TRUE(pool.setAffinity(cpu.str()));
+    EXPECT_TRUE(pool.start(3));
+
+    for(uint32_t i = 0; i < 6; i++) {
+        owned.push_back(new AffinityPublisher(ThreadTuning::ThreadId()));
+        publishers.push_back(owned.back());
+    }
+
+    for(uint32_t p = 0; p < 10; p++)
+        pool.publish(publishers, &packet, error);
+
+    EXPECT_EQ(error, "");
+    EXPECT_FALSE(AffinityPublisher::m_oAffinity.empty());
+    for(uint32_t i = 0; i < AffinityPublisher::m_oAffinity.size(); i++)
+        EXPECT_EQ(AffinityPublisher::m_oAffinity[i], cpu.str());
+
+    for(uint32_t i = 0; i < owned.size(); i++)
+        delete owned[i];
+}
+
+/* Workers run at the real time priority they are given, including ones
+ * started later */
+TEST_F(PublisherPoolTest, Realtime) {
+    Timestamp ts(1, 0x80000000);
+    PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "data", 4);
+    vector<AffinityPublisher *> owned;
+    vector<Publisher *> publishers;
+    PublisherPool pool;
+    string error;
+
+    EXPECT_FALSE(pool.setRealtime(THREAD_MAX_RT_PRIORITY + 1));
+    EXPECT_EQ(pool.realtimePriority(), 0);
+    EXPECT_TRUE(pool.start(2));
+
+    // Needs privileges we may not have
+    if(! pool.setRealtime(1)) {
+        pool.setRealtime(0);
+        return;
+    }
+
+    EXPECT_EQ(pool.realtimePriority(), 1);
+    EXPECT_TRUE(pool.start(3));
+
+    for(uint32_t i = 0; i < 6; i++) {
+        owned.push_back(new AffinityPublisher(ThreadTuning::ThreadId()));
+        publishers.push_back(owned.back());
+    }
+
+    AffinityPublisher::m_oPriority.clear();
+    for(uint32_t p = 0; p < 10; p++)
+        pool.publish(publishers, &packet, error);
+
+    EXPECT_EQ(error, "");
+    EXPECT_FALSE(AffinityPublisher::m_oPriority.empty());
+    for(uint32_t i = 0; i < AffinityPublisher::m_oPriority.size(); i++)
+        EXPECT_EQ(AffinityPublisher::m_oPriority[i], 1);
+
+    // Back to normal scheduling for the running workers
+    EXPECT_TRUE(pool.setRealtime(0));
+    AffinityPublisher::m_oPriority.clear();
+    for(uint32_t p = 0; p < 10; p++)
+        pool.publish(publishers, &packet, error);
+
+    EXPECT_FALSE(AffinityPublisher::m_oPriority.empty());
+    for(uint32_t i = 0; i < AffinityPublisher::m_oPriority.size(); i++)
+        EXPECT_EQ(AffinityPublisher::m_oPriority[i], 0);
+
+    for(uint32_t i = 0; i < owned.size(); i++)
+        delete owned[i];
+}
+
+/* Test every publisher sees every packet in order, one packet at a time */
+TEST_F(PublisherPoolTest, Ordering) {
+    Timestamp ts(1, 0x80000000);
+    vector<PortAgentPacket *> packets;
+    vector<RecordingPublisher *> owned;
+    vector<Publisher *> publishers;
+    PublisherPool pool;
+    string error;
+
+    for(int i = 0; i < 6; i++) {
+        owned.push_back(new RecordingPublisher(0, i % 2 ? 50 : 0));
+        publishers.push_back(owned.back());
+    }
+    for(int i = 0; i < 100; i++)
+        packets.push_back(new PortAgentPacket(DATA_FROM_INSTRUMENT, ts, "data", 4));
+
+    ASSERT_TRUE(pool.start(3));
+    for(int i = 0; i < 100; i++)
+        pool.publish(publishers, packets[i], error);
+    EXPECT_EQ(error, "");
+
+    for(int i = 0; i < 6; i++) {
+        ASSERT_EQ(owned[i]->m_oPackets.size(), 100);
+        for(int p = 0; p < 100; p++)
+            EXPECT_EQ(owned[i]->m_oPackets[p], packets[p]);
+        EXPECT_FALSE(owned[i]->m_bOverlap);
+        delete owned[i];
+    }
+
+    for(int i = 0; i < 100; i++)
+        delete packets[i];
+}
+
+/* Test a failing publisher is reported and doesn't stop the others */
+TEST_F(PublisherPoolTest, Errors) {
+    Timestamp ts(1, 0x80000000);
+    PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "data", 4);
+    RecordingPublisher good, bad(0, 0, true), other;
+    vector<Publisher *> publishers;
+    PublisherPool pool;
+    string error;
+
+    publishers.push_back(&good);
+    publishers.push_back(&bad);
+    publishers.push_back(&other);
+
+    ASSERT_TRUE(pool.start(2));
+    pool.publish(publishers, &packet, error);
+
+    EXPECT_NE(error.find("<Publish Type> error"), string::npos);
+    EXPECT_EQ(good.m_oPackets.size(), 1);
+    EXPECT_EQ(bad.m_oPackets.size(), 1);
+    EXPECT_EQ(other.m_oPackets.size(), 1);
+}
+
+/* Test idle threads take work queued for a busy one */
+TEST_F(PublisherPoolTest, WorkStealing) {
+    Timestamp ts(1, 0x80000000);
+    PortAgentPacket packet(DATA_FROM_INSTRUMENT, ts, "data", 4);
+    vector<RecordingPublisher *> owned;
+    vector<Publisher *> publishers;
+    PublisherPool pool;
+    string error;
+
+    for(int i = 0; i < 8; i++) {
+        owned.push_back(new RecordingPublisher(0, 500));
+        publishers.push_back(owned.back());
+    }
+
+    ASSERT_TRUE(pool.start(2));
+    for(int i = 0; i < 10; i++)
+        pool.publish(publishers, &packet, error);
+
+    EXPECT_EQ(error, "");
+    EXPECT_GT(pool.steals(), 0);
+
+    for(int i = 0; i < 8; i++) {
+        EXPECT_EQ(owned[i]->m_oPackets.size(), 10);
+        delete owned[i];
+    }
+}
+
+/* Packet rate against publisher count and thread count.  Publishers either
+ * burn CPU or block, like a write to a slow socket, for a fixed time. */
+TEST_F(PublisherPoolTest, Scaling) {
+    uint32_t counts[] = { 1, 2, 4, 8 };
+    uint32_t threads[] = { 0, 1, 2, 4 };
+
+    for(int mode = 0; mode < 2; mode++) {
+        uint32_t cpuUsec = mode ? 0 : BENCHMARK_CPU_USEC;
+        uint32_t blockUsec = mode ? BENCHMARK_BLOCK_USEC : 0;
+
+        for(int c = 0; c < 4; c++) {
+            ostringstream line;
+            line << (mode ? "blocking" : "cpu") << " publishers " << counts[c] << ", packets/s by threads";
+
+            for(int t = 0; t < 4; t++) {
+                double rate = packetRate(counts[c], threads[t], cpuUsec, blockUsec);
+                ostringstream name, value;
+
+                line << " " << threads[t] << ": " << (int)rate;
+
+                name << (mode ? "blocking" : "cpu") << "_p" << counts[c] << "_t" << threads[t];
+                value << (int)rate;
+                RecordProperty(name.str().c_str(), value.str().c_str());
+            }
+
+            LOG(INFO) << line.str();
+        }
+    }
+}
@@ -15,6 +15,13 @@
 #include "gtest/gtest.h"
 #include "common/util.h"
 
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fstream>
+
 using namespace logger;
 using namespace std;
 using namespace port_agent;
@@ -32,6 +39,13 @@ const char* FILE_LOG="/tmp/gtest.out";
 const char* SERVER_LOG="/tmp/gtest.srv";
 const char* PORT_AGENT_LOGBASE="/tmp/port_agent";
 
+// Longest we allow from launch to the first instrument byte reaching the
+// driver when starting from a saved config.
+#define WARM_START_LIMIT_MS 5000
+
+// How long we watch an idle port agent for wakeups
+#define IDLE_WATCH_SECONDS 3
+
 class PortAgentUnitTest : public testing::Test {
     protected:
         virtual void SetUp() {
@@ -47,6 +61,80 @@ class PortAgentUnitTest : public testing::Test {
             remove_file(FILE_LOG);
             
             stopPortAgent();
+            remove_file(portAgentConf().c_str());
+        }
+        
+        const string portAgentConf() {
+            stringstream filename;
+            filename << PORT_AGENT_LOGBASE << "_" << TEST_OB_CMD_PORT << ".conf";
+            return filename.str();
+        }
+        
+        int listenOn(uint16_t port) {
+            struct sockaddr_in addr;
+            int on = 1;
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            
+            if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 5)) {
+                close(fd);
+                return -1;
+            }
+            
+            return fd;
+        }
+        
+        int connectTo(uint16_t port) {
+            struct sockaddr_in addr;
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            
+            if(connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+                close(fd);
+                return -1;
+            }
+            
+            return fd;
+        }
+        
+        uint32_t elapsedMS(const struct timeval &start) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+        }
+        
+        const string portAgentPidFile() {
+            stringstream filename;
+            filename << PORT_AGENT_LOGBASE << "_" << TEST_OB_CMD_PORT << ".pid";
+            return filename.str();
+        }
+        
+        // Context switches the process has made.  A process blocked in
+        // select doesn't make any.
+        uint32_t contextSwitches(int pid) {
+            stringstream filename;
+            string line;
+            uint32_t total = 0;
+            
+            filename << "/proc/" << pid << "/status";
+            ifstream status(filename.str().c_str());
+            
+            while(getline(status, line)) {
+                if(line.find("ctxt_switches:") != string::npos)
+                    total += atoi(line.substr(line.find(':') + 1).c_str());
+            }
+            
+            return total;
         }
         
         const string portAgentLog() {
@@ -72,7 +160,7 @@ class PortAgentUnitTest : public testing::Test {
             }
         }
             
-        void startPortAgent() {
+        void startPortAgent(uint32_t settle = 1) {
             try {
                 stringstream cmd;
                 cmd << "../port_agent";
@@ -85,7 +173,7 @@ class PortAgentUnitTest : public testing::Test {
                 LOG(INFO) << "Start Port Agent: " << process.cmd_as_string();
 
                 process.run();
-                sleep(1);
+                sleep(settle);
             }
             catch(exception &e) {
                 string err = e.what();
@@ -340,6 +428,103 @@ TEST_F(PortAgentUnitTest, StartUp) {
     }
 }
 
+/* Test a restart with a saved config goes straight to moving data */
+TEST_F(PortAgentUnitTest, WarmStart) {
+    struct timeval start;
+    struct pollfd pfd;
+    char buffer[1024];
+    int instrumentListener, instrument = -1, driver = -1;
+    uint32_t connectMS = 0, firstDataMS = 0;
+    
+    instrumentListener = listenOn(atoi(TEST_IN_DATA_PORT));
+    ASSERT_GT(instrumentListener, 0);
+    
+    // The snapshot a previous run would have saved
+    writeConfig(portAgentConf());
+    
+    gettimeofday(&start, NULL);
+    startPortAgent(0);
+    
+    // Nobody configures it, it should connect to the instrument on its own
+    pfd.fd = instrumentListener;
+    pfd.events = POLLIN;
+    ASSERT_EQ(poll(&pfd, 1, WARM_START_LIMIT_MS), 1);
+    instrument = accept(instrumentListener, NULL, NULL);
+    ASSERT_GT(instrument, 0);
+    connectMS = elapsedMS(start);
+    
+    while(driver < 0 && elapsedMS(start) < WARM_START_LIMIT_MS) {
+        driver = connectTo(atoi(TEST_OB_DATA_PORT));
+        if(driver < 0) usleep(10000);
+    }
+    ASSERT_GT(driver, 0);
+    
+    // Keep the instrument talking until the driver hears it
+    pfd.fd = driver;
+    while(!firstDataMS && elapsedMS(start) < WARM_START_LIMIT_MS) {
+        ASSERT_GT(write(instrument, "warm\n", 5), 0);
+        
+        if(poll(&pfd, 1, 10) == 1 && read(driver, buffer, sizeof(buffer)) > 0)
+            firstDataMS = elapsedMS(start);
+    }
+    
+    LOG(INFO) << "warm start instrument connect ms: " << connectMS
+              << " first data ms: " << firstDataMS;
+    RecordProperty("instrument_connect_ms", connectMS);
+    RecordProperty("time_to_first_data_ms", firstDataMS);
+    
+    EXPECT_GT(firstDataMS, 0);
+    EXPECT_LT(firstDataMS, WARM_START_LIMIT_MS);
+    
+    close(driver);
+    close(instrument);
+    close(instrumentListener);
+    remove_file(portAgentConf().c_str());
+}
+
+/* Test a connected port agent with nothing to do doesn't wake up */
+TEST_F(PortAgentUnitTest, IdleWakeups) {
+    struct pollfd pfd;
+    int instrumentListener, instrument;
+    uint32_t before, after;
+    int pid;
+    
+    instrumentListener = listenOn(atoi(TEST_IN_DATA_PORT));
+    ASSERT_GT(instrumentListener, 0);
+    
+    writeConfig(portAgentConf());
+    startPortAgent(0);
+    
+    pfd.fd = instrumentListener;
+    pfd.events = POLLIN;
+    ASSERT_EQ(poll(&pfd, 1, WARM_START_LIMIT_MS), 1);
+    instrument = accept(instrumentListener, NULL, NULL);
+    ASSERT_GT(instrument, 0);
+    
+    // Let it finish connecting
+    sleep(1);
+    pid = atoi(read_file(portAgentPidFile().c_str()).c_str());
+    ASSERT_GT(pid, 0);
+    
+    before = contextSwitches(pid);
+    sleep(IDLE_WATCH_SECONDS);
+    after = contextSwitches(pid);
+    
+    LOG(INFO) << "idle wakeups in " << IDLE_WATCH_SECONDS << " seconds: " << after - before;
+    RecordProperty("idle_wakeups", after - before);
+    EXPECT_GT(before, 0);
+    EXPECT_EQ(after - before, 0);
+    
+    // Still awake for real work
+    ASSERT_EQ(write(instrument, "idle\n", 5), 5);
+    usleep(100000);
+    EXPECT_GT(contextSwitches(pid), after);
+    
+    close(instrument);
+    close(instrumentListener);
+    remove_file(portAgentConf().c_str());
+}
+
 /* Test startup sequence and failures */
 // Successful start should end in the unconfigured state
 
@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+#
+# Measure the round trip time of small messages through the port agent over
+# loopback.  This tool plays both ends: it listens on the instrument port
+# and echoes everything it reads, and it connects to the port agent data
+# port as the driver.  Each message goes driver -> agent -> instrument and
+# the echo comes back instrument -> agent -> driver as a port agent packet.
+#
+# Start the port agent with tools/test_tcp.cfg (add socket profile settings
+# to compare them) then run:
+#
+#   tcp_rtt_benchmark.py -i 9003 -d 9002 -n 1000
+#
+# Options:
+#
+#  -h, --help - Display the program help screen
+#  -i PORT, --instrument-port PORT - port the agent connects to, default 9003
+#  -d PORT, --data-port PORT - port agent data port, default 9002
+#  -n COUNT, --count COUNT - number of round trips, default 1000
+#  -s SIZE, --size SIZE - message size in bytes, default 16
+#  -t TIMEOUT, --timeout TIMEOUT - how long to wait for the agent, default 30
+#
+
+from __future__ import print_function
+
+import socket
+import struct
+import argparse
+import time
+
+HEADER_SIZE = 16
+SYNC = b'\xa3\x9d\x7a'
+
+def parseArgs():
+    parser = argparse.ArgumentParser(description="Port Agent RTT Benchmark")
+    parser.add_argument('-i', '--instrument-port', dest='instrument_port', type=int, default=9003,
+        help='port the port agent connects to as the instrument')
+    parser.add_argument('-d', '--data-port', dest='data_port', type=int, default=9002,
+        help='port agent data port')
+    parser.add_argument('-n', '--count', dest='count', type=int, default=1000,
+        help='number of round trips')
+    parser.add_argument('-s', '--size', dest='size', type=int, default=16,
+        help='message size in bytes')
+    parser.add_argument('-t', '--timeout', dest='timeout', type=int, default=30,
+        help='connection timeout')
+
+    return parser.parse_args()
+
+def nodelay(sock):
+    # Keep our own sockets out of the measurement
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+def read_exact(sock, size):
+    result = b''
+    while len(result) < size:
+        data = sock.recv(size - len(result))
+        if not data:
+            raise Exception("connection closed")
+        result += data
+    return result
+
+def read_instrument_data(sock, size):
+    # Pull port agent packets off the data port until we have size bytes of
+    # instrument data.  Anything else (heartbeats, echoed driver data) is
+    # skipped.
+    result = b''
+    while len(result) < size:
+        header = read_exact(sock, HEADER_SIZE)
+        if header[0:3] != SYNC:
+            raise Exception("lost packet sync")
+
+        packet_type = struct.unpack('B', header[3:4])[0]
+        packet_size = struct.unpack('>H', header[4:6])[0]
+        payload = read_exact(sock, packet_size - HEADER_SIZE)
+
+        if packet_type == 1:    # DATA_FROM_INSTRUMENT
+            result += payload
+    return result
+
+def echo(conn, size):
+    data = read_exact(conn, size)
+    conn.sendall(data)
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+opts = parseArgs()
+
+serv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+serv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+serv.bind(('', opts.instrument_port))
+serv.listen(1)
+serv.settimeout(opts.timeout)
+
+print("waiting for the port agent on port %d" % opts.instrument_port)
+instrument, addr = serv.accept()
+nodelay(instrument)
+
+driver = socket.create_connection(('localhost', opts.data_port), opts.timeout)
+nodelay(driver)
+print("connected to data port %d" % opts.data_port)
+
+message = b'x' * opts.size
+samples = []
+
+for i in range(opts.count):
+    start = time.time()
+    driver.sendall(message)
+    echo(instrument, opts.size)
+    read_instrument_data(driver, opts.size)
+    samples.append((time.time() - start) * 1000000)
+
+samples.sort()
+
+print("round trips: %d size: %d" % (opts.count, opts.size))
+print("rtt usec min: %.0f p50: %.0f p99: %.0f max: %.0f mean: %.0f" % (
+    samples[0], percentile(samples, 0.5), percentile(samples, 0.99),
+    samples[-1], sum(samples) / len(samples)))
+
+driver.close()
+instrument.close()
+serv.close()